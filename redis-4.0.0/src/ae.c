@@ -30,6 +30,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "fmacros.h"
 #include <stdio.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -49,13 +50,17 @@
 #ifdef HAVE_EVPORT
 #include "ae_evport.c"
 #else
-    #ifdef HAVE_EPOLL
-    #include "ae_epoll.c"
+    #ifdef HAVE_IO_URING
+    #include "ae_iouring.c"
     #else
-        #ifdef HAVE_KQUEUE
-        #include "ae_kqueue.c"
+        #ifdef HAVE_EPOLL
+        #include "ae_epoll.c"
         #else
-        #include "ae_select.c"
+            #ifdef HAVE_KQUEUE
+            #include "ae_kqueue.c"
+            #else
+            #include "ae_select.c"
+            #endif
         #endif
     #endif
 #endif
@@ -70,7 +75,12 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
     if (eventLoop->events == NULL || eventLoop->fired == NULL) goto err;
     eventLoop->setsize = setsize;
     eventLoop->lastTime = time(NULL);
-    eventLoop->timeEventHead = NULL;
+    eventLoop->timers = NULL;
+    eventLoop->timersCount = eventLoop->timersSize = 0;
+    eventLoop->timerIds = NULL;
+    eventLoop->timerIdsCount = eventLoop->timerIdsSize = 0;
+    eventLoop->timerIdsHoles = 0;
+    eventLoop->deletedTimers = NULL;
     eventLoop->timeEventNextId = 0;
     eventLoop->stop = 0;
     eventLoop->maxfd = -1;
@@ -123,9 +133,20 @@ int aeResizeSetSize(aeEventLoop *eventLoop, int setsize) {
 }
 
 void aeDeleteEventLoop(aeEventLoop *eventLoop) {
+    aeTimeEvent *te;
+    int j;
+
     aeApiFree(eventLoop);
     zfree(eventLoop->events);
     zfree(eventLoop->fired);
+    for (j = 0; j < eventLoop->timersCount; j++)
+        zfree(eventLoop->timers[j]);
+    while ((te = eventLoop->deletedTimers) != NULL) {
+        eventLoop->deletedTimers = te->next;
+        zfree(te);
+    }
+    zfree(eventLoop->timers);
+    zfree(eventLoop->timerIds);
     zfree(eventLoop);
 }
 
@@ -201,12 +222,117 @@ static void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms)
     *ms = when_ms;
 }
 
+/* Time events are kept in a binary min-heap ordered by time to fire, so
+ * that finding the nearest timer is O(1), and adding or removing a timer is
+ * O(log(N)). Deleting a timer by id needs to find it first: since ids are
+ * assigned in increasing order, the eventLoop->timerIds array is always
+ * sorted by id just appending new timers, and a binary search is used.
+ * Deleted timers leave a hole in the array, that is compacted when holes
+ * are the majority. */
+
+static int aeTimeEventBefore(aeTimeEvent *a, aeTimeEvent *b) {
+    return a->when_sec < b->when_sec ||
+           (a->when_sec == b->when_sec && a->when_ms < b->when_ms);
+}
+
+static void aeTimersSet(aeEventLoop *eventLoop, int idx, aeTimeEvent *te) {
+    eventLoop->timers[idx] = te;
+    te->heapIndex = idx;
+}
+
+static void aeTimersUp(aeEventLoop *eventLoop, int idx) {
+    aeTimeEvent *te = eventLoop->timers[idx];
+
+    while (idx > 0) {
+        int parent = (idx-1)/2;
+
+        if (!aeTimeEventBefore(te,eventLoop->timers[parent])) break;
+        aeTimersSet(eventLoop,idx,eventLoop->timers[parent]);
+        idx = parent;
+    }
+    aeTimersSet(eventLoop,idx,te);
+}
+
+static void aeTimersDown(aeEventLoop *eventLoop, int idx) {
+    aeTimeEvent *te = eventLoop->timers[idx];
+
+    while (1) {
+        int child = idx*2+1;
+
+        if (child >= eventLoop->timersCount) break;
+        if (child+1 < eventLoop->timersCount &&
+            aeTimeEventBefore(eventLoop->timers[child+1],
+                              eventLoop->timers[child])) child++;
+        if (!aeTimeEventBefore(eventLoop->timers[child],te)) break;
+        aeTimersSet(eventLoop,idx,eventLoop->timers[child]);
+        idx = child;
+    }
+    aeTimersSet(eventLoop,idx,te);
+}
+
+static void aeTimersInsert(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    if (eventLoop->timersCount == eventLoop->timersSize) {
+        eventLoop->timersSize = eventLoop->timersSize ?
+                                eventLoop->timersSize*2 : 16;
+        eventLoop->timers = zrealloc(eventLoop->timers,
+            sizeof(aeTimeEvent*)*eventLoop->timersSize);
+    }
+    aeTimersSet(eventLoop,eventLoop->timersCount++,te);
+    aeTimersUp(eventLoop,te->heapIndex);
+}
+
+static void aeTimersRemove(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    int idx = te->heapIndex;
+    aeTimeEvent *last = eventLoop->timers[--eventLoop->timersCount];
+
+    te->heapIndex = -1;
+    if (last == te) return;
+    aeTimersSet(eventLoop,idx,last);
+    aeTimersUp(eventLoop,idx);
+    aeTimersDown(eventLoop,last->heapIndex);
+}
+
+/* Return the position of the time event 'id' in eventLoop->timerIds,
+ * or -1 if there is no such event. */
+static int aeTimerIdSearch(aeEventLoop *eventLoop, long long id) {
+    int low = 0, high = eventLoop->timerIdsCount-1;
+
+    while (low <= high) {
+        int mid = low+(high-low)/2;
+        aeTimeEventRef *ref = eventLoop->timerIds+mid;
+
+        if (ref->id == id) return ref->te ? mid : -1;
+        if (ref->id < id) low = mid+1; else high = mid-1;
+    }
+    return -1;
+}
+
+static void aeTimerIdRemove(aeEventLoop *eventLoop, int pos) {
+    int j, k;
+
+    eventLoop->timerIds[pos].te = NULL;
+    if (++eventLoop->timerIdsHoles <= eventLoop->timerIdsCount/2) return;
+    for (j = 0, k = 0; j < eventLoop->timerIdsCount; j++) {
+        if (eventLoop->timerIds[j].te)
+            eventLoop->timerIds[k++] = eventLoop->timerIds[j];
+    }
+    eventLoop->timerIdsCount = k;
+    eventLoop->timerIdsHoles = 0;
+}
+
+static void aeFreeTimeEvent(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    if (te->finalizerProc)
+        te->finalizerProc(eventLoop, te->clientData);
+    zfree(te);
+}
+
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc)
 {
     long long id = eventLoop->timeEventNextId++;
     aeTimeEvent *te;
+    aeTimeEventRef *ref;
 
     te = zmalloc(sizeof(*te));
     if (te == NULL) return AE_ERR;
@@ -215,55 +341,76 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
     te->timeProc = proc;
     te->finalizerProc = finalizerProc;
     te->clientData = clientData;
-    te->next = eventLoop->timeEventHead;
-    eventLoop->timeEventHead = te;
+    te->next = NULL;
+    aeTimersInsert(eventLoop,te);
+
+    if (eventLoop->timerIdsCount == eventLoop->timerIdsSize) {
+        eventLoop->timerIdsSize = eventLoop->timerIdsSize ?
+                                  eventLoop->timerIdsSize*2 : 16;
+        eventLoop->timerIds = zrealloc(eventLoop->timerIds,
+            sizeof(aeTimeEventRef)*eventLoop->timerIdsSize);
+    }
+    ref = eventLoop->timerIds+eventLoop->timerIdsCount++;
+    ref->id = id;
+    ref->te = te;
     return id;
 }
 
+/* Delete the time event with the specified id. The finalizer, if any, is
+ * called the next time the time events are processed. */
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    while(te) {
-        if (te->id == id) {
-            te->id = AE_DELETED_EVENT_ID;
-            return AE_OK;
-        }
-        te = te->next;
+    int pos = aeTimerIdSearch(eventLoop,id);
+    aeTimeEvent *te;
+
+    if (pos == -1) return AE_ERR; /* NO event with the specified ID found */
+    te = eventLoop->timerIds[pos].te;
+    aeTimerIdRemove(eventLoop,pos);
+    te->id = AE_DELETED_EVENT_ID;
+    /* Events not in the heap are being processed by processTimeEvents(),
+     * that will take care of them. */
+    if (te->heapIndex != -1) {
+        aeTimersRemove(eventLoop,te);
+        te->next = eventLoop->deletedTimers;
+        eventLoop->deletedTimers = te;
     }
-    return AE_ERR; /* NO event with the specified ID found */
+    return AE_OK;
+}
+
+/* Return the time event with the specified id, or NULL if there is no
+ * such event, or if it is a deleted event. */
+aeTimeEvent *aeGetTimeEvent(aeEventLoop *eventLoop, long long id) {
+    int pos = aeTimerIdSearch(eventLoop,id);
+
+    return pos == -1 ? NULL : eventLoop->timerIds[pos].te;
+}
+
+/* Return the number of milliseconds before the time event fires, or zero
+ * if it is already due. */
+long long aeTimeEventRemaining(aeTimeEvent *te) {
+    long now_sec, now_ms;
+    long long ms;
+
+    aeGetTime(&now_sec, &now_ms);
+    ms = (te->when_sec - now_sec)*1000LL + te->when_ms - now_ms;
+    return ms > 0 ? ms : 0;
 }
 
 /* Search the first timer to fire.
  * This operation is useful to know how many time the select can be
  * put in sleep without to delay any event.
- * If there are no timers NULL is returned.
- *
- * Note that's O(N) since time events are unsorted.
- * Possible optimizations (not needed by Redis so far, but...):
- * 1) Insert the event in order, so that the nearest is just the head.
- *    Much better but still insertion or deletion of timers is O(N).
- * 2) Use a skiplist to have this operation as O(1) and insertion as O(log(N)).
- */
+ * If there are no timers NULL is returned. */
 static aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    aeTimeEvent *nearest = NULL;
-
-    while(te) {
-        if (!nearest || te->when_sec < nearest->when_sec ||
-                (te->when_sec == nearest->when_sec &&
-                 te->when_ms < nearest->when_ms))
-            nearest = te;
-        te = te->next;
-    }
-    return nearest;
+    return eventLoop->timersCount ? eventLoop->timers[0] : NULL;
 }
 
 /* Process time events */
 static int processTimeEvents(aeEventLoop *eventLoop) {
-    int processed = 0;
-    aeTimeEvent *te, *prev;
+    int processed = 0, j;
+    aeTimeEvent *te, *requeue = NULL;
     long long maxId;
+    long now_sec, now_ms;
     time_t now = time(NULL);
 
     /* If the system clock is moved to the future, and then set back to the
@@ -275,61 +422,63 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
      * processing events earlier is less dangerous than delaying them
      * indefinitely, and practice suggests it is. */
     if (now < eventLoop->lastTime) {
-        te = eventLoop->timeEventHead;
-        while(te) {
-            te->when_sec = 0;
-            te = te->next;
-        }
+        for (j = 0; j < eventLoop->timersCount; j++)
+            eventLoop->timers[j]->when_sec = 0;
+        /* Only the milliseconds now matter: rebuild the heap. */
+        for (j = eventLoop->timersCount/2-1; j >= 0; j--)
+            aeTimersDown(eventLoop,j);
     }
     eventLoop->lastTime = now;
 
-    prev = NULL;
-    te = eventLoop->timeEventHead;
+    /* Release events scheduled for deletion. */
+    while ((te = eventLoop->deletedTimers) != NULL) {
+        eventLoop->deletedTimers = te->next;
+        aeFreeTimeEvent(eventLoop,te);
+    }
+
+    /* Fire all the events that are due. Every event is removed from the
+     * heap while its callback runs, and put back only at the end, so that
+     * an event rescheduling itself with a zero period, or events created by
+     * other time events in this iteration, are not processed again until
+     * the next iteration. */
     maxId = eventLoop->timeEventNextId-1;
-    while(te) {
-        long now_sec, now_ms;
+    aeGetTime(&now_sec, &now_ms);
+    while (eventLoop->timersCount) {
         long long id;
+        int retval;
 
-        /* Remove events scheduled for deletion. */
-        if (te->id == AE_DELETED_EVENT_ID) {
-            aeTimeEvent *next = te->next;
-            if (prev == NULL)
-                eventLoop->timeEventHead = te->next;
-            else
-                prev->next = te->next;
-            if (te->finalizerProc)
-                te->finalizerProc(eventLoop, te->clientData);
-            zfree(te);
-            te = next;
-            continue;
-        }
-
-        /* Make sure we don't process time events created by time events in
-         * this iteration. Note that this check is currently useless: we always
-         * add new timers on the head, however if we change the implementation
-         * detail, this check may be useful again: we keep it here for future
-         * defense. */
+        te = eventLoop->timers[0];
+        if (now_sec < te->when_sec ||
+            (now_sec == te->when_sec && now_ms < te->when_ms)) break;
+        aeTimersRemove(eventLoop,te);
         if (te->id > maxId) {
-            te = te->next;
+            te->next = requeue;
+            requeue = te;
             continue;
         }
-        aeGetTime(&now_sec, &now_ms);
-        if (now_sec > te->when_sec ||
-            (now_sec == te->when_sec && now_ms >= te->when_ms))
-        {
-            int retval;
-
-            id = te->id;
-            retval = te->timeProc(eventLoop, id, te->clientData);
-            processed++;
-            if (retval != AE_NOMORE) {
-                aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
-            } else {
-                te->id = AE_DELETED_EVENT_ID;
-            }
+
+        id = te->id;
+        retval = te->timeProc(eventLoop, id, te->clientData);
+        processed++;
+        if (te->id == AE_DELETED_EVENT_ID) {
+            /* Deleted by its own callback. */
+            aeFreeTimeEvent(eventLoop,te);
+        } else if (retval == AE_NOMORE) {
+            aeTimerIdRemove(eventLoop,aeTimerIdSearch(eventLoop,id));
+            aeFreeTimeEvent(eventLoop,te);
+        } else {
+            aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
+            te->next = requeue;
+            requeue = te;
         }
-        prev = te;
-        te = te->next;
+    }
+
+    while ((te = requeue) != NULL) {
+        requeue = te->next;
+        if (te->id == AE_DELETED_EVENT_ID)
+            aeFreeTimeEvent(eventLoop,te);
+        else
+            aeTimersInsert(eventLoop,te);
     }
     return processed;
 }
@@ -476,3 +625,151 @@ void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep
 void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep) {
     eventLoop->aftersleep = aftersleep;
 }
+
+#ifdef REDIS_TEST
+#define UNUSED(x) (void)(x)
+
+typedef struct aeTestTimer {
+    long long when;     /* Scheduled time in milliseconds. */
+    long long delid;    /* Time event to delete when fired, or -1. */
+    int rearm;          /* Times to reschedule itself before AE_NOMORE. */
+    int fired;
+    int finalized;
+} aeTestTimer;
+
+static long long aeTestLastFired;
+static int aeTestCheckOrder;
+static int aeTestErrors;
+
+#define aeTestAssert(_e) do { \
+    if (!(_e)) { \
+        printf("Assertion failed: %s (ae.c:%d)\n", #_e, __LINE__); \
+        aeTestErrors++; \
+    } \
+} while(0)
+
+static int aeTestTimeProc(aeEventLoop *eventLoop, long long id, void *data) {
+    aeTestTimer *t = data;
+
+    /* Timers fire in the order they are scheduled. */
+    if (aeTestCheckOrder) aeTestAssert(t->when >= aeTestLastFired);
+    aeTestLastFired = t->when;
+    t->fired++;
+    if (t->delid != -1) {
+        aeTestAssert(aeDeleteTimeEvent(eventLoop,t->delid) == AE_OK);
+        if (t->delid == id) return 10; /* Must not be rescheduled. */
+        t->delid = -1;
+    }
+    if (t->rearm) {
+        t->rearm--;
+        return 1;
+    }
+    return AE_NOMORE;
+}
+
+static void aeTestFinalizer(aeEventLoop *eventLoop, void *data) {
+    UNUSED(eventLoop);
+    ((aeTestTimer*)data)->finalized++;
+}
+
+static long long aeTestCreateTimer(aeEventLoop *el, long long ms,
+                                   aeTestTimer *t)
+{
+    long long id = aeCreateTimeEvent(el,ms,aeTestTimeProc,t,aeTestFinalizer);
+    aeTimeEvent *te = aeGetTimeEvent(el,id);
+
+    t->when = te->when_sec*1000LL+te->when_ms;
+    t->delid = -1;
+    t->rearm = 0;
+    t->fired = 0;
+    t->finalized = 0;
+    return id;
+}
+
+/* Check the heap property and the position of every event. */
+static void aeTestCheckHeap(aeEventLoop *el) {
+    int j;
+
+    for (j = 0; j < el->timersCount; j++) {
+        aeTestAssert(el->timers[j]->heapIndex == j);
+        if (j) aeTestAssert(!aeTimeEventBefore(el->timers[j],
+                                               el->timers[(j-1)/2]));
+    }
+}
+
+#define AE_TEST_TIMERS 500
+
+int aeTest(int argc, char **argv) {
+    aeEventLoop *el = aeCreateEventLoop(64);
+    static aeTestTimer timers[AE_TEST_TIMERS], a, b, c, d;
+    long long ids[AE_TEST_TIMERS], ida, idc, idd;
+    int j, fired = 0;
+
+    UNUSED(argc);
+    UNUSED(argv);
+    srand(time(NULL));
+
+    /* Delete half of the timers in random order, checking the heap after
+     * every deletion. */
+    for (j = 0; j < AE_TEST_TIMERS; j++)
+        ids[j] = aeTestCreateTimer(el,rand()%50,timers+j);
+    aeTestCheckHeap(el);
+    for (j = AE_TEST_TIMERS-1; j > 0; j--) {
+        int k = rand()%(j+1);
+        long long id = ids[j];
+
+        ids[j] = ids[k];
+        ids[k] = id;
+    }
+    for (j = 0; j < AE_TEST_TIMERS/2; j++) {
+        aeTestAssert(aeDeleteTimeEvent(el,ids[j]) == AE_OK);
+        aeTestAssert(aeDeleteTimeEvent(el,ids[j]) == AE_ERR);
+        aeTestAssert(aeGetTimeEvent(el,ids[j]) == NULL);
+        aeTestCheckHeap(el);
+    }
+    for (; j < AE_TEST_TIMERS; j++)
+        aeTestAssert(aeGetTimeEvent(el,ids[j]) != NULL);
+    aeTestAssert(el->timersCount == AE_TEST_TIMERS/2);
+
+    /* The remaining ones fire once, in order, and the deleted ones never. */
+    aeTestLastFired = 0;
+    aeTestCheckOrder = 1;
+    while (el->timersCount) aeProcessEvents(el,AE_TIME_EVENTS);
+    for (j = 0; j < AE_TEST_TIMERS; j++) {
+        aeTestAssert(timers[j].fired <= 1);
+        aeTestAssert(timers[j].finalized == 1);
+        fired += timers[j].fired;
+    }
+    aeTestAssert(fired == AE_TEST_TIMERS/2);
+    printf("Out of order deletion of %d timers: %s\n", AE_TEST_TIMERS/2,
+        aeTestErrors ? "ERR" : "OK");
+
+    /* Re-arming: 'a' reschedules itself five times, 'b' deletes 'c' that
+     * is scheduled later, 'd' deletes itself and is not rescheduled even
+     * if its callback returns a period. */
+    aeTestCheckOrder = 0;
+    ida = aeTestCreateTimer(el,1,&a);
+    a.rearm = 5;
+    aeTestCreateTimer(el,2,&b);
+    idc = aeTestCreateTimer(el,20,&c);
+    b.delid = idc;
+    idd = aeTestCreateTimer(el,3,&d);
+    d.delid = idd;
+    while (el->timersCount) {
+        aeProcessEvents(el,AE_TIME_EVENTS);
+        aeTestCheckHeap(el);
+    }
+    aeProcessEvents(el,AE_TIME_EVENTS|AE_DONT_WAIT);
+    aeTestAssert(a.fired == 6 && a.finalized == 1);
+    aeTestAssert(aeGetTimeEvent(el,ida) == NULL);
+    aeTestAssert(b.fired == 1 && b.finalized == 1);
+    aeTestAssert(c.fired == 0 && c.finalized == 1);
+    aeTestAssert(d.fired == 1 && d.finalized == 1);
+    aeTestAssert(el->timerIdsCount-el->timerIdsHoles == 0);
+    printf("Re-arming and deletion from callbacks: %s\n",
+        aeTestErrors ? "ERR" : "OK");
+
+    aeDeleteEventLoop(el);
+    return aeTestErrors ? 1 : 0;
+}
+#endif
@@ -78,9 +78,16 @@ typedef struct aeTimeEvent {
     aeTimeProc *timeProc;
     aeEventFinalizerProc *finalizerProc;
     void *clientData;
-    struct aeTimeEvent *next;
+    int heapIndex; /* Position in the timers heap, -1 if not in the heap. */
+    struct aeTimeEvent *next; /* Used for events removed from the heap. */
 } aeTimeEvent;
 
+/* Entry of the index of time events by id. */
+typedef struct aeTimeEventRef {
+    long long id;
+    aeTimeEvent *te; /* NULL if the event was deleted. */
+} aeTimeEventRef;
+
 /* A fired event */
 typedef struct aeFiredEvent {
     int fd;
@@ -95,7 +102,11 @@ typedef struct aeEventLoop {
     time_t lastTime;     /* Used to detect system clock skew */
     aeFileEvent *events; /* Registered events */
     aeFiredEvent *fired; /* Fired events */
-    aeTimeEvent *timeEventHead;
+    aeTimeEvent **timers; /* Min-heap of time events, by time to fire */
+    int timersCount, timersSize;
+    aeTimeEventRef *timerIds; /* Time events sorted by id, for lookups */
+    int timerIdsCount, timerIdsSize, timerIdsHoles;
+    aeTimeEvent *deletedTimers; /* Deleted events to finalize. */
     int stop;
     void *apidata; /* This is used for polling API specific data */
     aeBeforeSleepProc *beforesleep;
@@ -114,6 +125,8 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc);
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id);
+aeTimeEvent *aeGetTimeEvent(aeEventLoop *eventLoop, long long id);
+long long aeTimeEventRemaining(aeTimeEvent *te);
 int aeProcessEvents(aeEventLoop *eventLoop, int flags);
 int aeWait(int fd, int mask, long long milliseconds);
 void aeMain(aeEventLoop *eventLoop);
@@ -123,4 +136,8 @@ void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep);
 int aeGetSetSize(aeEventLoop *eventLoop);
 int aeResizeSetSize(aeEventLoop *eventLoop, int setsize);
 
+#ifdef REDIS_TEST
+int aeTest(int argc, char **argv);
+#endif
+
 #endif
@@ -0,0 +1,443 @@
+/* Linux io_uring based ae.c module
+ *
+ * File events are implemented with IORING_OP_POLL_ADD requests. Polls are
+ * one shot: after a poll completes the fd is armed again before the next
+ * wait, and since a poll request checks the readiness of the file when it
+ * is armed, this gives the same level triggered semantics of the other
+ * backends. All the requests queued while processing events (arming and
+ * removing polls) are submitted in batch by the same io_uring_enter(2) call
+ * that waits for the next completions, so that registering and changing
+ * the interest for a file descriptor costs no syscall, compared to the
+ * epoll_ctl(2) call needed by the epoll backend.
+ *
+ * io_uring requires Linux 5.11 for the features used here: when it is not
+ * available at runtime the epoll backend is used instead.
+ *
+ * Copyright (c) 2017, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <endian.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/* The epoll backend is the fallback: include it with its functions renamed
+ * so that they don't clash with the ones of this file. */
+#define aeApiState aeEpollState
+#define aeApiCreate aeEpollCreate
+#define aeApiResize aeEpollResize
+#define aeApiFree aeEpollFree
+#define aeApiAddEvent aeEpollAddEvent
+#define aeApiDelEvent aeEpollDelEvent
+#define aeApiPoll aeEpollPoll
+#define aeApiName aeEpollName
+#include "ae_epoll.c"
+#undef aeApiState
+#undef aeApiCreate
+#undef aeApiResize
+#undef aeApiFree
+#undef aeApiAddEvent
+#undef aeApiDelEvent
+#undef aeApiPoll
+#undef aeApiName
+
+#define AE_URING_SQ_ENTRIES 4096
+#define AE_URING_CQ_MIN_ENTRIES 16384
+/* user_data of requests whose completion is not interesting. */
+#define AE_URING_IGNORE UINT64_MAX
+
+typedef struct aeApiState {
+    /* When io_uring can't be used the loop falls back to epoll: this
+     * structure is then passed as it is to the epoll functions, so the
+     * epoll state must be the first member. */
+    aeEpollState epoll;
+    int use_epoll;
+    int ringfd;
+    /* Submission queue. */
+    void *sqring;
+    size_t sqring_size;
+    unsigned *sqhead, *sqtail, *sqmask, *sqentries, *sqarray;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned sqpending;     /* Queued requests not yet submitted. */
+    /* Completion queue (may share the mapping with the submission one). */
+    void *cqring;
+    size_t cqring_size;
+    unsigned *cqhead, *cqtail, *cqmask;
+    struct io_uring_cqe *cqes;
+    /* Per fd state: the mask of the poll currently armed (if any), and
+     * the generation of the request, so that completions of polls that
+     * were removed or replaced can be recognized and ignored. */
+    unsigned char *armed;
+    uint32_t *gen;
+    int *rearm;             /* Fds that fired and should be armed again. */
+    int rearmcount;
+} aeApiState;
+
+/* Number of event loops using the epoll fallback, for aeApiName(). */
+static int aeEpollLoops = 0;
+
+static int aeUringSetup(unsigned entries, struct io_uring_params *p) {
+#ifdef __NR_io_uring_setup
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int aeUringEnter(int fd, unsigned submit, unsigned complete,
+                        unsigned flags, void *arg, size_t argsz)
+{
+#ifdef __NR_io_uring_enter
+    return (int) syscall(__NR_io_uring_enter, fd, submit, complete, flags,
+                         arg, argsz);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* Submit the queued requests without waiting for completions. */
+static void aeUringSubmit(aeApiState *state) {
+    while (state->sqpending) {
+        int ret = aeUringEnter(state->ringfd,state->sqpending,0,0,NULL,0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        state->sqpending -= ret;
+        if (ret == 0) break;
+    }
+}
+
+/* Return a free submission queue entry, submitting the queued ones to
+ * make room if the queue is full. */
+static struct io_uring_sqe *aeUringGetSqe(aeApiState *state) {
+    unsigned tail = *state->sqtail, head;
+    struct io_uring_sqe *sqe;
+
+    head = __atomic_load_n(state->sqhead,__ATOMIC_ACQUIRE);
+    if (tail-head >= *state->sqentries) {
+        aeUringSubmit(state);
+        head = __atomic_load_n(state->sqhead,__ATOMIC_ACQUIRE);
+        if (tail-head >= *state->sqentries) return NULL;
+    }
+    sqe = &state->sqes[tail & *state->sqmask];
+    memset(sqe,0,sizeof(*sqe));
+    state->sqarray[tail & *state->sqmask] = tail & *state->sqmask;
+    return sqe;
+}
+
+static void aeUringQueueSqe(aeApiState *state) {
+    __atomic_store_n(state->sqtail,*state->sqtail+1,__ATOMIC_RELEASE);
+    state->sqpending++;
+}
+
+static uint64_t aeUringUserData(aeApiState *state, int fd) {
+    return ((uint64_t)state->gen[fd] << 32) | (uint32_t)fd;
+}
+
+/* Arm a one shot poll for 'fd' with the specified AE mask. */
+static int aeUringArm(aeApiState *state, int fd, int mask) {
+    struct io_uring_sqe *sqe = aeUringGetSqe(state);
+    uint32_t events = 0;
+
+    if (sqe == NULL) return -1;
+    if (mask & AE_READABLE) events |= POLLIN;
+    if (mask & AE_WRITABLE) events |= POLLOUT;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    events = (events << 16) | (events >> 16);
+#endif
+    state->gen[fd]++;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = aeUringUserData(state,fd);
+    aeUringQueueSqe(state);
+    state->armed[fd] = mask;
+    return 0;
+}
+
+/* Remove the poll currently armed for 'fd'. */
+static void aeUringDisarm(aeApiState *state, int fd) {
+    struct io_uring_sqe *sqe;
+
+    if (state->armed[fd] == AE_NONE) return;
+    sqe = aeUringGetSqe(state);
+    /* If the queue is full and can't be flushed, just let the poll fire:
+     * bumping the generation makes sure the completion is ignored. */
+    if (sqe != NULL) {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->addr = aeUringUserData(state,fd);
+        sqe->user_data = AE_URING_IGNORE;
+        aeUringQueueSqe(state);
+    }
+    state->gen[fd]++;
+    state->armed[fd] = AE_NONE;
+}
+
+/* Release the ring and the per fd state, but not 'state' itself. */
+static void aeUringFreeRing(aeApiState *state) {
+    if (state->sqes) munmap(state->sqes,state->sqes_size);
+    if (state->cqring && state->cqring != state->sqring)
+        munmap(state->cqring,state->cqring_size);
+    if (state->sqring) munmap(state->sqring,state->sqring_size);
+    if (state->ringfd != -1) close(state->ringfd);
+    zfree(state->armed);
+    zfree(state->gen);
+    zfree(state->rearm);
+    memset(state,0,sizeof(*state));
+}
+
+static int aeApiCreate(aeEventLoop *eventLoop) {
+    aeApiState *state;
+    struct io_uring_params p;
+    unsigned cqentries = AE_URING_CQ_MIN_ENTRIES;
+
+    state = zcalloc(sizeof(*state));
+    state->ringfd = -1;
+    state->armed = zcalloc(eventLoop->setsize);
+    state->gen = zcalloc(sizeof(uint32_t)*eventLoop->setsize);
+    state->rearm = zmalloc(sizeof(int)*eventLoop->setsize);
+
+    /* Size the completion queue so that it can hold a completion for every
+     * fd (the kernel clamps it to its own limit): even if it overflows the
+     * kernel will not drop completions. */
+    while (cqentries < (unsigned)eventLoop->setsize) cqentries *= 2;
+    memset(&p,0,sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE|IORING_SETUP_CLAMP;
+    p.cq_entries = cqentries;
+    state->ringfd = aeUringSetup(AE_URING_SQ_ENTRIES,&p);
+    if (state->ringfd == -1 ||
+        !(p.features & IORING_FEAT_NODROP) ||
+        !(p.features & IORING_FEAT_EXT_ARG)) goto fallback;
+
+    state->sqring_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    state->cqring_size = p.cq_off.cqes +
+                         p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (state->cqring_size > state->sqring_size)
+            state->sqring_size = state->cqring_size;
+        state->cqring_size = state->sqring_size;
+    }
+    state->sqring = mmap(NULL,state->sqring_size,PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE,state->ringfd,IORING_OFF_SQ_RING);
+    if (state->sqring == MAP_FAILED) {
+        state->sqring = NULL;
+        goto fallback;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        state->cqring = state->sqring;
+    } else {
+        state->cqring = mmap(NULL,state->cqring_size,PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE,state->ringfd,IORING_OFF_CQ_RING);
+        if (state->cqring == MAP_FAILED) {
+            state->cqring = NULL;
+            goto fallback;
+        }
+    }
+    state->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    state->sqes = mmap(NULL,state->sqes_size,PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE,state->ringfd,IORING_OFF_SQES);
+    if (state->sqes == MAP_FAILED) {
+        state->sqes = NULL;
+        goto fallback;
+    }
+
+    state->sqhead = (unsigned*)((char*)state->sqring+p.sq_off.head);
+    state->sqtail = (unsigned*)((char*)state->sqring+p.sq_off.tail);
+    state->sqmask = (unsigned*)((char*)state->sqring+p.sq_off.ring_mask);
+    state->sqentries = (unsigned*)((char*)state->sqring+p.sq_off.ring_entries);
+    state->sqarray = (unsigned*)((char*)state->sqring+p.sq_off.array);
+    state->cqhead = (unsigned*)((char*)state->cqring+p.cq_off.head);
+    state->cqtail = (unsigned*)((char*)state->cqring+p.cq_off.tail);
+    state->cqmask = (unsigned*)((char*)state->cqring+p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe*)((char*)state->cqring+p.cq_off.cqes);
+    eventLoop->apidata = state;
+    return 0;
+
+fallback:
+    aeUringFreeRing(state);
+    if (aeEpollCreate(eventLoop) == -1) {
+        zfree(state);
+        return -1;
+    }
+    state->epoll = *(aeEpollState*)eventLoop->apidata;
+    zfree(eventLoop->apidata);
+    state->use_epoll = 1;
+    eventLoop->apidata = state;
+    __atomic_add_fetch(&aeEpollLoops,1,__ATOMIC_RELAXED);
+    return 0;
+}
+
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeApiState *state = eventLoop->apidata;
+
+    if (state->use_epoll) return aeEpollResize(eventLoop,setsize);
+    state->armed = zrealloc(state->armed,setsize);
+    state->gen = zrealloc(state->gen,sizeof(uint32_t)*setsize);
+    state->rearm = zrealloc(state->rearm,sizeof(int)*setsize);
+    if (setsize > eventLoop->setsize) {
+        int old = eventLoop->setsize;
+        memset(state->armed+old,0,setsize-old);
+        memset(state->gen+old,0,sizeof(uint32_t)*(setsize-old));
+    }
+    if (state->rearmcount > setsize) state->rearmcount = setsize;
+    return 0;
+}
+
+static void aeApiFree(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+
+    if (state->use_epoll) {
+        __atomic_sub_fetch(&aeEpollLoops,1,__ATOMIC_RELAXED);
+        aeEpollFree(eventLoop); /* Releases 'state' as well. */
+        return;
+    }
+    aeUringFreeRing(state);
+    zfree(state);
+}
+
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeApiState *state = eventLoop->apidata;
+
+    if (state->use_epoll) return aeEpollAddEvent(eventLoop,fd,mask);
+    mask |= eventLoop->events[fd].mask; /* Merge old events */
+
+    /* Nothing to do if the armed poll already covers the new mask, since
+     * spurious events are filtered by ae.c. Otherwise the poll is replaced
+     * by a new one with the merged mask. */
+    if ((state->armed[fd] & mask) == mask) return 0;
+    aeUringDisarm(state,fd);
+    return aeUringArm(state,fd,mask);
+}
+
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    aeApiState *state = eventLoop->apidata;
+    int mask = eventLoop->events[fd].mask & (~delmask);
+
+    if (state->use_epoll) {
+        aeEpollDelEvent(eventLoop,fd,delmask);
+        return;
+    }
+
+    /* When the fd is still monitored for some event we keep the armed poll
+     * instead of paying for replacing it: if it fires for an event we are
+     * no longer interested in, it is armed again with the new mask.
+     *
+     * A pending poll holds a reference to the file, so when the fd is no
+     * longer monitored the removal is submitted ASAP: the caller is usually
+     * about to close it, and the socket must really go away, like it
+     * happens with close() on an epoll monitored fd. */
+    if (mask == AE_NONE) {
+        aeUringDisarm(state,fd);
+        aeUringSubmit(state);
+    }
+}
+
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeApiState *state = eventLoop->apidata;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned head, tail, flags = IORING_ENTER_GETEVENTS;
+    int j, numevents = 0;
+
+    if (state->use_epoll) return aeEpollPoll(eventLoop,tvp);
+
+    /* Arm again the fds that fired in the previous iteration. */
+    for (j = 0; j < state->rearmcount; j++) {
+        int fd = state->rearm[j];
+        int mask = fd < eventLoop->setsize ? eventLoop->events[fd].mask : 0;
+
+        if (mask != AE_NONE && state->armed[fd] == AE_NONE)
+            aeUringArm(state,fd,mask);
+    }
+    state->rearmcount = 0;
+
+    /* Submit everything queued so far and wait for completions with a
+     * single syscall. */
+    memset(&arg,0,sizeof(arg));
+    if (tvp) {
+        ts.tv_sec = tvp->tv_sec;
+        ts.tv_nsec = tvp->tv_usec*1000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+    head = *state->cqhead;
+    tail = __atomic_load_n(state->cqtail,__ATOMIC_ACQUIRE);
+    if (head == tail && !(tvp && tvp->tv_sec == 0 && tvp->tv_usec == 0)) {
+        int ret = aeUringEnter(state->ringfd,state->sqpending,1,
+                               flags|IORING_ENTER_EXT_ARG,&arg,sizeof(arg));
+        if (ret > 0) state->sqpending -= ret;
+    } else if (state->sqpending) {
+        aeUringSubmit(state);
+    }
+
+    /* Reap the completions. */
+    head = *state->cqhead;
+    tail = __atomic_load_n(state->cqtail,__ATOMIC_ACQUIRE);
+    while (head != tail && numevents < eventLoop->setsize) {
+        struct io_uring_cqe *cqe = &state->cqes[head & *state->cqmask];
+        uint64_t ud = cqe->user_data;
+        int fd = (int)(ud & 0xffffffff), mask = 0;
+
+        head++;
+        if (ud == AE_URING_IGNORE || fd >= eventLoop->setsize ||
+            (uint32_t)(ud >> 32) != state->gen[fd]) continue;
+
+        state->armed[fd] = AE_NONE;
+        state->rearm[state->rearmcount++] = fd;
+        if (cqe->res < 0) {
+            /* The poll failed (for instance because it was canceled
+             * by the kernel): let the handlers find out. */
+            mask = AE_READABLE|AE_WRITABLE;
+        } else {
+            if (cqe->res & POLLIN) mask |= AE_READABLE;
+            if (cqe->res & POLLOUT) mask |= AE_WRITABLE;
+            if (cqe->res & POLLERR) mask |= AE_WRITABLE;
+            if (cqe->res & POLLHUP) mask |= AE_WRITABLE;
+        }
+        eventLoop->fired[numevents].fd = fd;
+        eventLoop->fired[numevents].mask = mask;
+        numevents++;
+    }
+    __atomic_store_n(state->cqhead,head,__ATOMIC_RELEASE);
+    return numevents;
+}
+
+/* The name is not per loop: epoll is reported if any loop fell back. */
+static char *aeApiName(void) {
+    return __atomic_load_n(&aeEpollLoops,__ATOMIC_RELAXED) ?
+           aeEpollName() : "io_uring";
+}
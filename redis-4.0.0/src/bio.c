@@ -85,8 +85,10 @@ struct bio_job {
 
 void *bioProcessBackgroundJobs(void *arg);
 void lazyfreeFreeObjectFromBioThread(robj *o);
-void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2);
-void lazyfreeFreeSlotsMapFromBioThread(zskiplist *sl);
+void lazyfreeFreeDatabaseFromBioThread(dict *ht);
+void lazyfreeFreeRadixTreeFromBioThread(rax *rt);
+void snapshotProcessJobFromBioThread(void *file, sds buf, int op);
+void replBacklogDiskProcessJobFromBioThread(void *file, void *block, int op);
 
 /* Make sure we have enough stack to perform all the things we do in the
  * main thread. */
@@ -191,14 +193,21 @@ void *bioProcessBackgroundJobs(void *arg) {
         } else if (type == BIO_LAZY_FREE) {
             /* What we free changes depending on what arguments are set:
              * arg1 -> free the object at pointer.
-             * arg2 & arg3 -> free two dictionaries (a Redis DB).
-             * only arg3 -> free the skiplist. */
+             * arg2 -> free the dictionary of a Redis DB.
+             * only arg3 -> free the radix tree (slots map or expires
+             *               index). */
             if (job->arg1)
                 lazyfreeFreeObjectFromBioThread(job->arg1);
-            else if (job->arg2 && job->arg3)
-                lazyfreeFreeDatabaseFromBioThread(job->arg2,job->arg3);
+            else if (job->arg2)
+                lazyfreeFreeDatabaseFromBioThread(job->arg2);
             else if (job->arg3)
-                lazyfreeFreeSlotsMapFromBioThread(job->arg3);
+                lazyfreeFreeRadixTreeFromBioThread(job->arg3);
+        } else if (type == BIO_SNAPSHOT_WRITE) {
+            snapshotProcessJobFromBioThread(job->arg1,job->arg2,
+                                            (long)job->arg3);
+        } else if (type == BIO_REPL_BACKLOG_WRITE) {
+            replBacklogDiskProcessJobFromBioThread(job->arg1,job->arg2,
+                                                   (long)job->arg3);
         } else {
             serverPanic("Wrong job type in bioProcessBackgroundJobs().");
         }
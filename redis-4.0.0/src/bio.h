@@ -39,4 +39,6 @@ void bioKillThreads(void);
 #define BIO_CLOSE_FILE    0 /* Deferred close(2) syscall. */
 #define BIO_AOF_FSYNC     1 /* Deferred AOF fsync. */
 #define BIO_LAZY_FREE     2 /* Deferred objects freeing. */
-#define BIO_NUM_OPS       3
+#define BIO_SNAPSHOT_WRITE 3 /* Forkless BGSAVE output, see snapshot.c. */
+#define BIO_REPL_BACKLOG_WRITE 4 /* Backlog segments, see replbacklog.c. */
+#define BIO_NUM_OPS       5
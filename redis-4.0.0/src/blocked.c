@@ -122,7 +122,9 @@ void processUnblockedClients(void) {
          * client is not blocked before to proceed, but things may change and
          * the code is conceptually more correct this way. */
         if (!(c->flags & CLIENT_BLOCKED)) {
-            if (c->querybuf && sdslen(c->querybuf) > 0) {
+            if ((c->querybuf && sdslen(c->querybuf) > 0) ||
+                c->flags & CLIENT_PENDING_COMMAND)
+            {
                 processInputBuffer(c);
             }
         }
@@ -138,6 +140,8 @@ void unblockClient(client *c) {
         unblockClientWaitingReplicas(c);
     } else if (c->btype == BLOCKED_MODULE) {
         unblockClientFromModule(c);
+    } else if (c->btype == BLOCKED_TIERED) {
+        tieredUnblockClient(c);
     } else {
         serverPanic("Unknown btype in unblockClient().");
     }
@@ -184,7 +188,9 @@ void disconnectAllBlockedClients(void) {
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
 
-        if (c->flags & CLIENT_BLOCKED) {
+        /* Clients waiting for spilled values are unblocked as soon as
+         * the reads complete, whatever the state of the instance. */
+        if (c->flags & CLIENT_BLOCKED && c->btype != BLOCKED_TIERED) {
             addReplySds(c,sdsnew(
                 "-UNBLOCKED force unblock from blocking operation, "
                 "instance state changed (master -> slave?)\r\n"));
@@ -74,6 +74,9 @@
 /* Test for polling API */
 #ifdef __linux__
 #define HAVE_EPOLL 1
+#ifdef USE_IO_URING
+#define HAVE_IO_URING 1
+#endif
 #endif
 
 #if (defined(__APPLE__) && defined(MAC_OS_X_VERSION_10_6)) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
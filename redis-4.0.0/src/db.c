@@ -43,9 +43,17 @@
  * lookupKeyWrite() and lookupKeyReadWithFlags(). */
 robj *lookupKey(redisDb *db, robj *key, int flags) {
     dictEntry *de = dictFind(db->dict,key->ptr);
+
+    /* The allkeys-tinylfu policy also counts lookups of missing keys. */
+    if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_TINYLFU &&
+        !(flags & LOOKUP_NOTOUCH)) tinylfuRecordAccess(key->ptr);
     if (de) {
         robj *val = dictGetVal(de);
 
+        /* Bring back the value if it was spilled to tiered storage. */
+        if (val->encoding == OBJ_ENCODING_SPILLED)
+            val = tieredLoadKey(db,de);
+
         /* Update the access time for the ageing algorithm.
          * Don't do it if we have a saving child, as this will trigger
          * a copy on write madness. */
@@ -138,6 +146,7 @@ robj *lookupKeyRead(redisDb *db, robj *key) {
  * does not exist in the specified DB. */
 robj *lookupKeyWrite(redisDb *db, robj *key) {
     expireIfNeeded(db,key);
+    snapshotBeforeKeyWrite(db,key);
     return lookupKey(db,key,LOOKUP_NONE);
 }
 
@@ -153,36 +162,93 @@ robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply) {
     return o;
 }
 
-/* Add the key to the DB. It's up to the caller to increment the reference
- * counter of the value if needed.
+/* Add the key to the DB. The caller reference to the value is moved to
+ * the DB, it's up to the caller to increment the reference counter of the
+ * value before calling the function if it's still needed.
+ *
+ * When possible the key is embedded in the value object (see
+ * objectEmbedKey()), so that the value object may be replaced by a new one:
+ * the object stored in the DB is returned, and the caller must use it in
+ * place of 'val' from now on.
  *
  * The program is aborted if the key already exists. */
-void dbAdd(redisDb *db, robj *key, robj *val) {
-    sds copy = sdsdup(key->ptr);
-    int retval = dictAdd(db->dict, copy, val);
+robj *dbAdd(redisDb *db, robj *key, robj *val) {
+    sds copy;
+    int retval;
+
+    snapshotBeforeKeyWrite(db,key);
+    val = objectEmbedKey(val,key->ptr,-1,&copy);
+    if (copy == NULL) copy = sdsdup(key->ptr);
+
+    /* Additions starting a resize of the table are the slow path of
+     * dictAdd(), reported as "dict-expand" latency events. */
+    if (dictWillExpand(db->dict)) {
+        mstime_t latency;
+
+        latencyStartMonitor(latency);
+        retval = dictAdd(db->dict, copy, val);
+        latencyEndMonitor(latency);
+        latencyAddSampleIfNeeded("dict-expand",latency);
+    } else {
+        retval = dictAdd(db->dict, copy, val);
+    }
 
     serverAssertWithInfo(NULL,key,retval == DICT_OK);
+    if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_TINYLFU)
+        tinylfuWindowAdd(db->id,key->ptr);
     if (val->type == OBJ_LIST) signalListAsReady(db, key);
     if (server.cluster_enabled) slotToKeyAdd(key);
- }
+    return val;
+}
+
+/* Return a copy of the key 'key' of the keyspace that is not embedded in a
+ * value object, preserving its expire. */
+static sds dbKeyDup(sds key) {
+    long long when = keyGetExpire(key);
+    sds copy;
+
+    if (when == -1) return sdsdup(key);
+    copy = sdsnewlenaux(key,sdslen(key));
+    *(long long*)sdsaux(copy) = when;
+    return copy;
+}
 
-/* Overwrite an existing key with a new value. Incrementing the reference
- * count of the new value is up to the caller.
+/* Overwrite an existing key with a new value. Like in dbAdd() the caller
+ * reference to the value is moved to the DB, and the object stored in
+ * the DB, that the caller must use in place of 'val', is returned.
  * This function does not modify the expire time of the existing key.
  *
  * The program is aborted if the key was not already present. */
-void dbOverwrite(redisDb *db, robj *key, robj *val) {
-    dictEntry *de = dictFind(db->dict,key->ptr);
+robj *dbOverwrite(redisDb *db, robj *key, robj *val) {
+    dictEntry *de;
 
+    snapshotBeforeKeyWrite(db,key);
+    de = dictFind(db->dict,key->ptr);
     serverAssertWithInfo(NULL,key,de != NULL);
-    if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
-        robj *old = dictGetVal(de);
-        int saved_lru = old->lru;
-        dictReplace(db->dict, key->ptr, val);
-        val->lru = saved_lru;
-    } else {
-        dictReplace(db->dict, key->ptr, val);
-    }
+    if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU)
+        val->lru = ((robj*)dictGetVal(de))->lru;
+    return dbSetValue(db,de,val);
+}
+
+/* Replace the value of the entry 'de' with 'val', releasing the old value.
+ * Like dbOverwrite() the new value may be a copy of 'val' with the key
+ * embedded, and is returned. Nothing else about the key changes: this is
+ * also used to swap values with their tiered storage stubs, see tiered.c. */
+robj *dbSetValue(redisDb *db, dictEntry *de, robj *val) {
+    robj *old = dictGetVal(de);
+    sds oldkey = dictGetKey(de), newkey;
+
+    /* The old key may be embedded in the old value: move it to the new
+     * value, or make it a standalone string, before releasing the old
+     * value. */
+    val = objectEmbedKey(val,oldkey,keyGetExpire(oldkey),&newkey);
+    if (newkey == NULL)
+        newkey = sdsembedded(oldkey) ? dbKeyDup(oldkey) : oldkey;
+    dictSetKey(db->dict,de,newkey);
+    dictSetVal(db->dict,de,val);
+    if (newkey != oldkey && !sdsembedded(oldkey)) sdsfree(oldkey);
+    decrRefCount(old);
+    return val;
 }
 
 /* High level Set operation. This function can be used in order to set
@@ -192,16 +258,20 @@ void dbOverwrite(redisDb *db, robj *key, robj *val) {
  * 2) clients WATCHing for the destination key notified.
  * 3) The expire time of the key is reset (the key is made persistent).
  *
+ * The object stored in the DB, that may be a copy of 'val' with the key
+ * embedded (see dbAdd()), is returned.
+ *
  * All the new keys in the database should be craeted via this interface. */
-void setKey(redisDb *db, robj *key, robj *val) {
+robj *setKey(redisDb *db, robj *key, robj *val) {
+    incrRefCount(val);
     if (lookupKeyWrite(db,key) == NULL) {
-        dbAdd(db,key,val);
+        val = dbAdd(db,key,val);
     } else {
-        dbOverwrite(db,key,val);
+        val = dbOverwrite(db,key,val);
     }
-    incrRefCount(val);
     removeExpire(db,key);
     signalModifiedKey(db,key);
+    return val;
 }
 
 int dbExists(redisDb *db, robj *key) {
@@ -224,7 +294,7 @@ robj *dbRandomKey(redisDb *db) {
 
         key = dictGetKey(de);
         keyobj = createStringObject(key,sdslen(key));
-        if (dictFind(db->expires,key)) {
+        if (keyGetExpire(key) != -1) {
             if (expireIfNeeded(db,keyobj)) {
                 decrRefCount(keyobj);
                 continue; /* search for another key. This expired. */
@@ -236,10 +306,17 @@ robj *dbRandomKey(redisDb *db) {
 
 /* Delete a key, value, and associated expiration entry if any, from the DB */
 int dbSyncDelete(redisDb *db, robj *key) {
-    /* Deleting an entry from the expires dict will not free the sds of
-     * the key, because it is shared with the main dictionary. */
-    if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
-    if (dictDelete(db->dict,key->ptr) == DICT_OK) {
+    dictEntry *de;
+
+    snapshotBeforeKeyWrite(db,key);
+    /* The expire is stored with the key, see setExpire(). */
+    de = dictUnlink(db->dict,key->ptr);
+    if (de) {
+        sds keysds = dictGetKey(de);
+        long long when = keyGetExpire(keysds);
+
+        if (when != -1) expireIndexUpdateKey(db,keysds,when,0);
+        dictFreeUnlinkedEntry(db->dict,de);
         if (server.cluster_enabled) slotToKeyDel(key);
         return 1;
     } else {
@@ -287,7 +364,7 @@ robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o) {
         robj *decoded = getDecodedObject(o);
         o = createRawStringObject(decoded->ptr, sdslen(decoded->ptr));
         decrRefCount(decoded);
-        dbOverwrite(db,key,o);
+        o = dbOverwrite(db,key,o);
     }
     return o;
 }
@@ -315,6 +392,9 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
         return -1;
     }
 
+    /* A BGSAVE without fork must save the keys before they go away. */
+    snapshotCompleteScan(dbnum);
+
     for (j = 0; j < server.dbnum; j++) {
         if (dbnum != -1 && dbnum != j) continue;
         removed += dictSize(server.db[j].dict);
@@ -322,8 +402,8 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
             emptyDbAsync(&server.db[j]);
         } else {
             dictEmpty(server.db[j].dict,callback);
-            dictEmpty(server.db[j].expires,callback);
         }
+        expireIndexFlush(&server.db[j],async);
     }
     if (server.cluster_enabled) {
         if (async) {
@@ -405,6 +485,9 @@ void flushallCommand(client *c) {
     int flags;
 
     if (getFlushCommandFlags(c,&flags) == C_ERR) return;
+    /* Like the saving child killed below, a BGSAVE without fork in
+     * progress is stopped, instead of saving the keys about to go away. */
+    snapshotAbort();
     signalFlushedDb(-1);
     server.dirty += emptyDb(-1,flags,NULL);
     addReply(c,shared.ok);
@@ -630,7 +713,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
 
     /* Step 2: Iterate the collection.
      *
-     * Note that if the object is encoded with a ziplist, intset, or any other
+     * Note that if the object is encoded with a listpack, intset, or any other
      * representation that is not a hash table, we are sure that it is also
      * composed of a small number of elements. So to avoid taking state we
      * just return everything inside the object in a single call, setting the
@@ -677,17 +760,17 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
             listAddNodeTail(keys,createStringObjectFromLongLong(ll));
         cursor = 0;
     } else if (o->type == OBJ_HASH || o->type == OBJ_ZSET) {
-        unsigned char *p = ziplistIndex(o->ptr,0);
+        unsigned char *p = lpSeek(o->ptr,0);
         unsigned char *vstr;
         unsigned int vlen;
         long long vll;
 
         while(p) {
-            ziplistGet(p,&vstr,&vlen,&vll);
+            vstr = lpGetValue(p,&vlen,&vll);
             listAddNodeTail(keys,
                 (vstr != NULL) ? createStringObject((char*)vstr,vlen) :
                                  createStringObjectFromLongLong(vll));
-            p = ziplistNext(o->ptr,p);
+            p = lpNext(o->ptr,p);
         }
         cursor = 0;
     } else {
@@ -853,9 +936,11 @@ void renameGenericCommand(client *c, int nx) {
          * with the same name. */
         dbDelete(c->db,c->argv[2]);
     }
+    /* Delete the old key first: this way the value is not shared and
+     * the new key can be embedded in it. */
+    dbDelete(c->db,c->argv[1]);
     dbAdd(c->db,c->argv[2],o);
     if (expire != -1) setExpire(c,c->db,c->argv[2],expire);
-    dbDelete(c->db,c->argv[1]);
     signalModifiedKey(c->db,c->argv[1]);
     signalModifiedKey(c->db,c->argv[2]);
     notifyKeyspaceEvent(NOTIFY_GENERIC,"rename_from",
@@ -919,12 +1004,12 @@ void moveCommand(client *c) {
         addReply(c,shared.czero);
         return;
     }
-    dbAdd(dst,c->argv[1],o);
-    if (expire != -1) setExpire(c,dst,c->argv[1],expire);
+    /* OK! free the entry in the source DB, and move the value to the
+     * target DB, where the key can be embedded in it. */
     incrRefCount(o);
-
-    /* OK! key moved, free the entry in the source DB */
     dbDelete(src,c->argv[1]);
+    dbAdd(dst,c->argv[1],o);
+    if (expire != -1) setExpire(c,dst,c->argv[1],expire);
     server.dirty++;
     addReply(c,shared.cone);
 }
@@ -957,6 +1042,7 @@ int dbSwapDatabases(int id1, int id2) {
     if (id1 < 0 || id1 >= server.dbnum ||
         id2 < 0 || id2 >= server.dbnum) return C_ERR;
     if (id1 == id2) return C_OK;
+    snapshotCompleteScan(id1 < id2 ? id2 : id1);
     redisDb aux = server.db[id1];
     redisDb *db1 = &server.db[id1], *db2 = &server.db[id2];
 
@@ -964,11 +1050,15 @@ int dbSwapDatabases(int id1, int id2) {
      * ready_keys and watched_keys, since we want clients to
      * remain in the same DB they were. */
     db1->dict = db2->dict;
-    db1->expires = db2->expires;
+    db1->expires_index = db2->expires_index;
+    db1->expired_until = db2->expired_until;
+    db1->expired_backlog = db2->expired_backlog;
     db1->avg_ttl = db2->avg_ttl;
 
     db2->dict = aux.dict;
-    db2->expires = aux.expires;
+    db2->expires_index = aux.expires_index;
+    db2->expired_until = aux.expired_until;
+    db2->expired_backlog = aux.expired_backlog;
     db2->avg_ttl = aux.avg_ttl;
 
     /* Now we need to handle clients blocked on lists: as an effect
@@ -1018,25 +1108,84 @@ void swapdbCommand(client *c) {
  * Expires API
  *----------------------------------------------------------------------------*/
 
+/* The expire of a key is not stored in a separated dictionary: the keyspace
+ * is a bucketed dictionary (see dict.c), so the entries of the keys with an
+ * expire are flagged with the bucket marks, that activeExpireCycle() and the
+ * eviction can sample without touching the other entries, and the unix time
+ * in milliseconds is stored in the auxiliary data of the key sds string
+ * (see sdsnewlenaux()). The key is reallocated with room for the expire the
+ * first time one is set, so the keys that never had an expire don't pay for
+ * it, and just one lookup is needed to get the value and its expire. */
+
+/* Return the expire stored in the key sds 'key' of the keyspace, or -1 if
+ * the key has no associated expire. */
+long long keyGetExpire(sds key) {
+    long long *when = sdsaux(key);
+
+    return when ? *when : -1;
+}
+
 int removeExpire(redisDb *db, robj *key) {
+    dictEntry *de;
+    long long *when;
+
     /* An expire may only be removed if there is a corresponding entry in the
      * main dict. Otherwise, the key will never be freed. */
-    serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
-    return dictDelete(db->expires,key->ptr) == DICT_OK;
+    snapshotBeforeKeyWrite(db,key);
+    de = dictSetMark(db->dict,key->ptr,0);
+    serverAssertWithInfo(NULL,key,de != NULL);
+    when = sdsaux(dictGetKey(de));
+    if (when == NULL || *when == -1) return 0;
+    expireIndexUpdateKey(db,dictGetKey(de),*when,0);
+    /* Keep the auxiliary data: the key will likely get a new expire. */
+    *when = -1;
+    return 1;
 }
 
 /* Set an expire to the specified key. If the expire is set in the context
  * of an user calling a command 'c' is the client, otherwise 'c' is set
  * to NULL. The 'when' parameter is the absolute unix time in milliseconds
- * after which the key will no longer be considered valid. */
+ * after which the key will no longer be considered valid.
+ *
+ * Note that when the key is embedded in the value object (see dbAdd()), the
+ * value object may be replaced: pointers to the value obtained before
+ * calling this function must be looked up again. */
 void setExpire(client *c, redisDb *db, robj *key, long long when) {
-    dictEntry *kde, *de;
+    dictEntry *de;
+    long long *aux, old = -1;
+    sds keysds;
 
-    /* Reuse the sds from the main dict in the expire dict */
-    kde = dictFind(db->dict,key->ptr);
-    serverAssertWithInfo(NULL,key,kde != NULL);
-    de = dictAddOrFind(db->expires,dictGetKey(kde));
-    dictSetSignedIntegerVal(de,when);
+    snapshotBeforeKeyWrite(db,key);
+    de = dictSetMark(db->dict,key->ptr,1);
+    serverAssertWithInfo(NULL,key,de != NULL);
+    keysds = dictGetKey(de);
+    if ((aux = sdsaux(keysds)) == NULL) {
+        /* First expire of this key: replace the key with a copy having
+         * room for it. The hash does not change, so the entry can stay
+         * in the same slot. A key embedded in the value is embedded again
+         * in a new value object, or made a standalone string if the value
+         * can't be replaced. */
+        sds newkey = NULL;
+
+        if (sdsembedded(keysds)) {
+            robj *val = objectEmbedKey(dictGetVal(de),keysds,when,&newkey);
+            dictSetVal(db->dict,de,val);
+        }
+        if (newkey == NULL) {
+            newkey = sdsnewlenaux(keysds,sdslen(keysds));
+            if (!sdsembedded(keysds)) sdsfree(keysds);
+        }
+        dictSetKey(db->dict,de,newkey);
+        aux = sdsaux(newkey);
+    } else {
+        old = *aux;
+    }
+    *aux = when;
+    if (old != when) {
+        keysds = dictGetKey(de);
+        if (old != -1) expireIndexUpdateKey(db,keysds,old,0);
+        expireIndexUpdateKey(db,keysds,when,1);
+    }
 
     int writable_slave = server.masterhost && server.repl_slave_ro == 0;
     if (c && writable_slave && !(c->flags & CLIENT_MASTER))
@@ -1049,13 +1198,10 @@ long long getExpire(redisDb *db, robj *key) {
     dictEntry *de;
 
     /* No expire? return ASAP */
-    if (dictSize(db->expires) == 0 ||
-       (de = dictFind(db->expires,key->ptr)) == NULL) return -1;
+    if (dictMarkedSize(db->dict) == 0 ||
+       (de = dictFind(db->dict,key->ptr)) == NULL) return -1;
 
-    /* The entry was found in the expire dict, this means it should also
-     * be present in the main dict (safety check). */
-    serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
-    return dictGetSignedIntegerVal(de);
+    return keyGetExpire(dictGetKey(de));
 }
 
 /* Propagate expires into slaves and the AOF file.
@@ -136,7 +136,7 @@ void computeDatasetDigest(unsigned char *final) {
         /* Iterate this DB writing every entry */
         while((de = dictNext(di)) != NULL) {
             sds key;
-            robj *keyobj, *o;
+            robj *keyobj, *o, *loaded = NULL;
             long long expiretime;
 
             memset(digest,0,20); /* This key-val digest */
@@ -146,6 +146,8 @@ void computeDatasetDigest(unsigned char *final) {
             mixDigest(digest,key,sdslen(key));
 
             o = dictGetVal(de);
+            if (o->encoding == OBJ_ENCODING_SPILLED)
+                o = loaded = tieredLoadValue(o);
 
             aux = htonl(o->type);
             mixDigest(digest,&aux,sizeof(aux));
@@ -174,7 +176,7 @@ void computeDatasetDigest(unsigned char *final) {
             } else if (o->type == OBJ_ZSET) {
                 unsigned char eledigest[20];
 
-                if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+                if (o->encoding == OBJ_ENCODING_LISTPACK) {
                     unsigned char *zl = o->ptr;
                     unsigned char *eptr, *sptr;
                     unsigned char *vstr;
@@ -182,13 +184,13 @@ void computeDatasetDigest(unsigned char *final) {
                     long long vll;
                     double score;
 
-                    eptr = ziplistIndex(zl,0);
+                    eptr = lpSeek(zl,0);
                     serverAssert(eptr != NULL);
-                    sptr = ziplistNext(zl,eptr);
+                    sptr = lpNext(zl,eptr);
                     serverAssert(sptr != NULL);
 
                     while (eptr != NULL) {
-                        serverAssert(ziplistGet(eptr,&vstr,&vlen,&vll));
+                        vstr = lpGetValue(eptr,&vlen,&vll);
                         score = zzlGetScore(sptr);
 
                         memset(eledigest,0,20);
@@ -256,6 +258,7 @@ void computeDatasetDigest(unsigned char *final) {
             /* We can finally xor the key-val digest to the final digest */
             xorDigest(final,digest,20);
             decrRefCount(keyobj);
+            if (loaded) decrRefCount(loaded);
         }
         dictReleaseIterator(di);
     }
@@ -291,7 +294,7 @@ void debugCommand(client *c) {
         blen++; addReplyStatus(c,
         "sdslen <key> -- Show low level SDS string info representing key and value.");
         blen++; addReplyStatus(c,
-        "ziplist <key> -- Show low level info about the ziplist encoding.");
+        "listpack <key> -- Show low level info about the listpack encoding.");
         blen++; addReplyStatus(c,
         "populate <count> [prefix] [size] -- Create <count> string keys named key:<num>. If a prefix is specified is used instead of the 'key' prefix.");
         blen++; addReplyStatus(c,
@@ -382,8 +385,8 @@ void debugCommand(client *c) {
             used = snprintf(nextra, remaining, " ql_avg_node:%.2f", avg);
             nextra += used;
             remaining -= used;
-            /* Add quicklist fill level / max ziplist size */
-            used = snprintf(nextra, remaining, " ql_ziplist_max:%d", ql->fill);
+            /* Add quicklist fill level / max listpack size */
+            used = snprintf(nextra, remaining, " ql_listpack_max:%d", ql->fill);
             nextra += used;
             remaining -= used;
             /* Add isCompressed? */
@@ -433,17 +436,17 @@ void debugCommand(client *c) {
                 (long long) sdsavail(val->ptr),
                 (long long) getStringObjectSdsUsedMemory(val));
         }
-    } else if (!strcasecmp(c->argv[1]->ptr,"ziplist") && c->argc == 3) {
+    } else if (!strcasecmp(c->argv[1]->ptr,"listpack") && c->argc == 3) {
         robj *o;
 
         if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nokeyerr))
                 == NULL) return;
 
-        if (o->encoding != OBJ_ENCODING_ZIPLIST) {
-            addReplyError(c,"Not an sds encoded string.");
+        if (o->encoding != OBJ_ENCODING_LISTPACK) {
+            addReplyError(c,"Not a listpack encoded object.");
         } else {
-            ziplistRepr(o->ptr);
-            addReplyStatus(c,"Ziplist structure printed on stdout");
+            lpRepr(o->ptr);
+            addReplyStatus(c,"Listpack structure printed on stdout");
         }
     } else if (!strcasecmp(c->argv[1]->ptr,"populate") &&
                c->argc >= 3 && c->argc <= 5) {
@@ -542,10 +545,6 @@ void debugCommand(client *c) {
         dictGetStats(buf,sizeof(buf),server.db[dbid].dict);
         stats = sdscat(stats,buf);
 
-        stats = sdscatprintf(stats,"[Expires HT]\n");
-        dictGetStats(buf,sizeof(buf),server.db[dbid].expires);
-        stats = sdscat(stats,buf);
-
         addReplyBulkSds(c,stats);
     } else {
         addReplyErrorFormat(c, "Unknown DEBUG subcommand or wrong number of arguments for '%s'",
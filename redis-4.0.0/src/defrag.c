@@ -125,7 +125,8 @@ robj *activeDefragStringOb(robj* ob, int *defragged) {
                 ret->ptr = (void*)((intptr_t)ret + ofs);
                 (*defragged)++;
             }
-        } else if (ob->encoding!=OBJ_ENCODING_INT) {
+        } else if (ob->encoding!=OBJ_ENCODING_INT &&
+                   ob->encoding!=OBJ_ENCODING_SPILLED) {
             serverPanic("Unknown string encoding");
         }
     }
@@ -140,6 +141,7 @@ int dictIterDefragEntry(dictIterator *iter) {
      * to use, and require no other chagnes in the dict. */
     int defragged = 0;
     dictht *ht;
+    dictEntry **bucket;
     /* Handle the next entry (if there is one), and update the pointer in the
      * current entry. */
     if (iter->nextEntry) {
@@ -152,38 +154,57 @@ int dictIterDefragEntry(dictIterator *iter) {
     }
     /* handle the case of the first entry in the hash bucket. */
     ht = &iter->d->ht[iter->table];
-    if (ht->table[iter->index] == iter->entry) {
+    bucket = dictGetBucketRef(ht,iter->index);
+    if (bucket && *bucket == iter->entry) {
         dictEntry *newde = activeDefragAlloc(iter->entry);
         if (newde) {
             iter->entry = newde;
-            ht->table[iter->index] = newde;
+            *bucket = newde;
             defragged++;
         }
     }
     return defragged;
 }
 
+/* Defrag helper for the buckets of a hash table: the table itself and, for
+ * big tables, the segments holding the buckets. Returns a stat of how many
+ * pointers were moved. */
+int dictDefragHt(dictht *ht) {
+    dictEntry **newtable;
+    int defragged = 0;
+
+    if (ht->table == NULL) return 0;
+    if (dictIsSegmented(ht)) {
+        unsigned long j;
+
+        for (j = 0; j < dictNumSegments(ht); j++) {
+            dictEntry **newseg;
+
+            if (dictSegments(ht)[j] == NULL) continue;
+            newseg = activeDefragAlloc(dictSegments(ht)[j]);
+            if (newseg)
+                defragged++, dictSegments(ht)[j] = newseg;
+        }
+    }
+    newtable = activeDefragAlloc(ht->table);
+    if (newtable)
+        defragged++, ht->table = newtable;
+    return defragged;
+}
+
 /* Defrag helper for dict main allocations (dict struct, and hash tables).
  * receives a pointer to the dict* and implicitly updates it when the dict
  * struct itself was moved. Returns a stat of how many pointers were moved. */
 int dictDefragTables(dict** dictRef) {
     dict *d = *dictRef;
-    dictEntry **newtable;
     int defragged = 0;
     /* handle the dict struct */
     dict *newd = activeDefragAlloc(d);
     if (newd)
         defragged++, *dictRef = d = newd;
-    /* handle the first hash table */
-    newtable = activeDefragAlloc(d->ht[0].table);
-    if (newtable)
-        defragged++, d->ht[0].table = newtable;
-    /* handle the second hash table */
-    if (d->ht[1].table) {
-        newtable = activeDefragAlloc(d->ht[1].table);
-        if (newtable)
-            defragged++, d->ht[1].table = newtable;
-    }
+    /* handle the two hash tables */
+    defragged += dictDefragHt(&d->ht[0]);
+    defragged += dictDefragHt(&d->ht[1]);
     return defragged;
 }
 
@@ -246,29 +267,6 @@ double *zslDefrag(zskiplist *zsl, double score, sds oldele, sds newele) {
     return NULL;
 }
 
-/* Utility function that replaces an old key pointer in the dictionary with a
- * new pointer. Additionally, we try to defrag the dictEntry in that dict.
- * Oldkey mey be a dead pointer and should not be accessed (we get a
- * pre-calculated hash value). Newkey may be null if the key pointer wasn't
- * moved. Return value is the the dictEntry if found, or NULL if not found.
- * NOTE: this is very ugly code, but it let's us avoid the complication of
- * doing a scan on another dict. */
-dictEntry* replaceSateliteDictKeyPtrAndOrDefragDictEntry(dict *d, sds oldkey, sds newkey, unsigned int hash, int *defragged) {
-    dictEntry **deref = dictFindEntryRefByPtrAndHash(d, oldkey, hash);
-    if (deref) {
-        dictEntry *de = *deref;
-        dictEntry *newde = activeDefragAlloc(de);
-        if (newde) {
-            de = *deref = newde;
-            (*defragged)++;
-        }
-        if (newkey)
-            de->key = newkey;
-        return de;
-    }
-    return NULL;
-}
-
 /* for each key we scan in the main dict, this function will attempt to defrag
  * all the various pointers it has. Returns a stat of how many pointers were
  * moved. */
@@ -280,27 +278,28 @@ int defragKey(redisDb *db, dictEntry *de) {
     dictIterator *di;
     int defragged = 0;
     sds newsds;
-
-    /* Try to defrag the key name. */
-    newsds = activeDefragSds(keysds);
-    if (newsds)
-        defragged++, de->key = newsds;
-    if (dictSize(db->expires)) {
-         /* Dirty code:
-          * I can't search in db->expires for that key after i already released
-          * the pointer it holds it won't be able to do the string compare */
-        unsigned int hash = dictGetHash(db->dict, de->key);
-        replaceSateliteDictKeyPtrAndOrDefragDictEntry(db->expires, keysds, newsds, hash, &defragged);
+    UNUSED(db);
+
+    /* Try to defrag the key name. The expire is stored with it. Keys
+     * embedded in the value object are moved together with it below. */
+    if (!sdsembedded(keysds)) {
+        newsds = activeDefragSds(keysds);
+        if (newsds)
+            defragged++, de->key = newsds;
     }
 
     /* Try to defrag robj and / or string value. */
     ob = dictGetVal(de);
     if ((newob = activeDefragStringOb(ob, &defragged))) {
+        if (sdsembedded(keysds))
+            de->key = (char*)newob + (keysds - (char*)ob);
         de->v.val = newob;
         ob = newob;
     }
 
-    if (ob->type == OBJ_STRING) {
+    if (ob->encoding == OBJ_ENCODING_SPILLED) {
+        /* Only the object is in memory, already handled above. */
+    } else if (ob->type == OBJ_STRING) {
         /* Already handled in activeDefragStringOb. */
     } else if (ob->type == OBJ_LIST) {
         if (ob->encoding == OBJ_ENCODING_QUICKLIST) {
@@ -352,7 +351,7 @@ int defragKey(redisDb *db, dictEntry *de) {
             serverPanic("Unknown set encoding");
         }
     } else if (ob->type == OBJ_ZSET) {
-        if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (ob->encoding == OBJ_ENCODING_LISTPACK) {
             if ((newzl = activeDefragAlloc(ob->ptr)))
                 defragged++, ob->ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_SKIPLIST) {
@@ -386,7 +385,7 @@ int defragKey(redisDb *db, dictEntry *de) {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (ob->type == OBJ_HASH) {
-        if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (ob->encoding == OBJ_ENCODING_LISTPACK) {
             if ((newzl = activeDefragAlloc(ob->ptr)))
                 defragged++, ob->ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_HT) {
@@ -426,14 +425,17 @@ void defragScanCallback(void *privdata, const dictEntry *de) {
 }
 
 /* Defrag scan callback for for each hash table bicket,
- * used in order to defrag the dictEntry allocations. */
+ * used in order to defrag the dictEntry allocations. The keyspace is a
+ * bucketed dict, so the callback gets a reference to every single entry,
+ * that has no 'next' field. */
 void defragDictBucketCallback(void *privdata, dictEntry **bucketref) {
-    UNUSED(privdata);
+    redisDb *db = privdata;
     while(*bucketref) {
         dictEntry *de = *bucketref, *newde;
         if ((newde = activeDefragAlloc(de))) {
             *bucketref = newde;
         }
+        if (dictIsBucketed(db->dict)) break;
         bucketref = &(*bucketref)->next;
     }
 }
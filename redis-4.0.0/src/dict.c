@@ -38,6 +38,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdarg.h>
 #include <limits.h>
@@ -68,6 +69,9 @@ static int _dictExpandIfNeeded(dict *ht);
 static unsigned long _dictNextPower(unsigned long size);
 static int _dictKeyIndex(dict *ht, const void *key, unsigned int hash, dictEntry **existing);
 static int _dictInit(dict *ht, dictType *type, void *privDataPtr);
+static void _dictReset(dictht *ht);
+static void _dictRehashStep(dict *d);
+long long dictFingerprint(dict *d);
 
 /* -------------------------- hash functions -------------------------------- */
 
@@ -95,6 +99,675 @@ uint64_t dictGenCaseHashFunction(const unsigned char *buf, int len) {
     return siphash_nocase(buf,len,dict_hash_function_seed);
 }
 
+/* ----------------------------- Tables ------------------------------------ */
+
+/* Allocate the buckets of a table of 'size' buckets. For segmented tables
+ * only the array of segment pointers is allocated here. */
+static dictEntry **_dictTableCreate(unsigned long size) {
+    if (size > DICT_SEGMENT_SIZE)
+        return zcalloc((size >> DICT_SEGMENT_BITS)*sizeof(dictEntry**));
+    return zcalloc(size*sizeof(dictEntry*));
+}
+
+/* Release the buckets of a table, not the entries. */
+static void _dictTableFree(dictht *ht) {
+    if (ht->table == NULL) return;
+    if (dictIsSegmented(ht)) {
+        unsigned long j;
+
+        for (j = 0; j < dictNumSegments(ht); j++)
+            zfree(dictSegments(ht)[j]);
+    }
+    zfree(ht->table);
+}
+
+/* Return the content of the bucket 'idx'. */
+static inline dictEntry *_dictChain(dictht *ht, unsigned long idx) {
+    if (dictIsSegmented(ht)) {
+        dictEntry **seg = dictSegments(ht)[idx >> DICT_SEGMENT_BITS];
+        return seg ? seg[idx & DICT_SEGMENT_MASK] : NULL;
+    }
+    return ht->table[idx];
+}
+
+/* Return a reference to the bucket 'idx', allocating the segment holding
+ * it if needed. This is the only place where segments are allocated. */
+static inline dictEntry **_dictChainRefCreate(dictht *ht, unsigned long idx) {
+    if (dictIsSegmented(ht)) {
+        dictEntry ***segs = dictSegments(ht);
+        unsigned long s = idx >> DICT_SEGMENT_BITS;
+
+        if (segs[s] == NULL)
+            segs[s] = zcalloc(DICT_SEGMENT_SIZE*sizeof(dictEntry*));
+        return segs[s]+(idx & DICT_SEGMENT_MASK);
+    }
+    return ht->table+idx;
+}
+
+/* Return a reference to the bucket 'idx', or NULL if the bucket is in a
+ * segment that was never allocated (so the bucket is empty). */
+dictEntry **dictGetBucketRef(dictht *ht, unsigned long idx) {
+    if (dictIsSegmented(ht)) {
+        dictEntry **seg = dictSegments(ht)[idx >> DICT_SEGMENT_BITS];
+        return seg ? seg+(idx & DICT_SEGMENT_MASK) : NULL;
+    }
+    return ht->table+idx;
+}
+
+/* ----------------------------- Bucketed tables ---------------------------- */
+
+/* Dicts whose type has 'bucketed' set, like the Redis keyspace, don't use
+ * chains of entries. Their table is an array of 64 bytes buckets, each one
+ * holding up to DICT_BUCKET_SLOTS entries and 8 bits of the hash of every
+ * entry (the tag). Lookups only compare the keys of the entries with a
+ * matching tag, so most misses are resolved reading a single bucket,
+ * without touching any dictEntry or key. A full bucket gets an overflow
+ * bucket chained to it. Since the entries are not chained, they are
+ * allocated without the 'next' field.
+ *
+ * An entry always lives in the bucket selected by the low bits of its hash,
+ * like the entries of a chain, so incremental rehashing and dictScan() work
+ * exactly like for chained tables, a bucket at a time.
+ *
+ * In the dictht of a bucketed table, 'size' is the number of entry slots, so
+ * that dictSlots() keeps its meaning, while 'sizemask' is the number of
+ * buckets minus one. Tables with more than DICT_BUCKET_SEGMENT_SIZE buckets
+ * are segmented, exactly like big chained tables.
+ *
+ * Overflow buckets are released by the rehashing, and when they become the
+ * empty tail of a chain after a deletion, so a chain without entries never
+ * has overflow buckets.
+ *
+ * Every slot also has a 'mark' bit that the user can set with dictSetMark()
+ * to flag a subset of the entries, like the keys with an expire in the
+ * Redis keyspace. The mark follows the entry when it is rehashed, and is
+ * cleared when it is deleted. dictGetSomeMarkedKeys() samples the marked
+ * entries reading just the buckets. */
+
+#define DICT_BUCKET_SLOTS 6
+#define DICT_BUCKET_FULL ((1<<DICT_BUCKET_SLOTS)-1)
+#define DICT_BUCKET_MAX_FILL 5  /* Grow at this many entries per bucket. */
+#define DICT_BUCKET_MIN_FILL 3  /* Size new tables for this many entries. */
+#define DICT_BUCKET_SEGMENT_BITS 10 /* 64k bytes segments. */
+#define DICT_BUCKET_SEGMENT_SIZE (1UL<<DICT_BUCKET_SEGMENT_BITS)
+#define DICT_BUCKET_SEGMENT_MASK (DICT_BUCKET_SEGMENT_SIZE-1)
+#define DICT_BUCKETED_ENTRY_SIZE offsetof(dictEntry,next)
+#define DICT_MARKED_SAMPLE_STEPS 100 /* Max buckets visited per marked key. */
+
+typedef struct dictBucket {
+    uint8_t presence;                   /* Bitmap of the used slots. */
+    uint8_t tags[DICT_BUCKET_SLOTS];    /* High 8 bits of each entry hash. */
+    uint8_t marks;                      /* Bitmap of the marked slots. */
+    dictEntry *entries[DICT_BUCKET_SLOTS];
+    struct dictBucket *next;            /* Overflow bucket or NULL. */
+} dictBucket;
+
+#define dictBucketTag(hash) ((uint8_t)((hash)>>56))
+
+/* Note that the first bucket of a chain may be empty while its overflow
+ * buckets are not. */
+#define dictBucketIsEmpty(b) ((b) == NULL || ((b)->presence == 0 && (b)->next == NULL))
+
+static inline unsigned long _dictBucketsNum(dictht *ht) {
+    return ht->size ? ht->sizemask+1 : 0;
+}
+
+static inline int _dictBucketsSegmented(dictht *ht) {
+    return _dictBucketsNum(ht) > DICT_BUCKET_SEGMENT_SIZE;
+}
+
+#define dictBucketSegments(ht) ((dictBucket**)(ht)->table)
+
+static dictEntry **_dictBucketsCreate(unsigned long nbuckets) {
+    if (nbuckets > DICT_BUCKET_SEGMENT_SIZE)
+        return zcalloc((nbuckets >> DICT_BUCKET_SEGMENT_BITS)*
+                       sizeof(dictBucket*));
+    return zcalloc(nbuckets*sizeof(dictBucket));
+}
+
+/* Release the buckets of a table, not the entries nor overflow buckets. */
+static void _dictBucketsFree(dictht *ht) {
+    if (ht->table == NULL) return;
+    if (_dictBucketsSegmented(ht)) {
+        unsigned long j;
+
+        for (j = 0; j < _dictBucketsNum(ht) >> DICT_BUCKET_SEGMENT_BITS; j++)
+            zfree(dictBucketSegments(ht)[j]);
+    }
+    zfree(ht->table);
+}
+
+/* Return the bucket 'idx', or NULL if its segment was never allocated. */
+static inline dictBucket *_dictBucketAt(dictht *ht, unsigned long idx) {
+    if (_dictBucketsSegmented(ht)) {
+        dictBucket *seg = dictBucketSegments(ht)[idx >> DICT_BUCKET_SEGMENT_BITS];
+        return seg ? seg+(idx & DICT_BUCKET_SEGMENT_MASK) : NULL;
+    }
+    return ((dictBucket*)ht->table)+idx;
+}
+
+/* Like _dictBucketAt() but allocates the segment if needed. */
+static inline dictBucket *_dictBucketAtCreate(dictht *ht, unsigned long idx) {
+    if (_dictBucketsSegmented(ht)) {
+        dictBucket **segs = dictBucketSegments(ht);
+        unsigned long s = idx >> DICT_BUCKET_SEGMENT_BITS;
+
+        if (segs[s] == NULL)
+            segs[s] = zcalloc(DICT_BUCKET_SEGMENT_SIZE*sizeof(dictBucket));
+        return segs[s]+(idx & DICT_BUCKET_SEGMENT_MASK);
+    }
+    return ((dictBucket*)ht->table)+idx;
+}
+
+/* Search 'key' in the table 'ht'. If found the entry is returned and, when
+ * 'bucketptr' is not NULL, its bucket and slot are stored by reference. */
+static dictEntry *_dictBucketsLookup(dict *d, dictht *ht, const void *key,
+                                     uint64_t hash, dictBucket **bucketptr,
+                                     int *slotptr)
+{
+    uint8_t tag = dictBucketTag(hash);
+    dictBucket *b;
+    int j;
+
+    if (ht->size == 0) return NULL;
+    for (b = _dictBucketAt(ht,hash & ht->sizemask); b; b = b->next) {
+        for (j = 0; j < DICT_BUCKET_SLOTS; j++) {
+            dictEntry *he;
+
+            if (!(b->presence & (1<<j)) || b->tags[j] != tag) continue;
+            he = b->entries[j];
+            if (key == he->key || dictCompareKeys(d, key, he->key)) {
+                if (bucketptr) {
+                    *bucketptr = b;
+                    *slotptr = j;
+                }
+                return he;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Return a reference to a free slot in the bucket 'idx' (or in one of its
+ * overflow buckets), marking it as used with the specified tag, and as
+ * marked if 'mark' is true. */
+static dictEntry **_dictBucketsFreeSlot(dictht *ht, unsigned long idx,
+                                        uint8_t tag, int mark)
+{
+    dictBucket *b = _dictBucketAtCreate(ht,idx);
+
+    while(b->presence == DICT_BUCKET_FULL) {
+        if (b->next == NULL) b->next = zcalloc(sizeof(dictBucket));
+        b = b->next;
+    }
+    for (idx = 0; b->presence & (1<<idx); idx++);
+    b->presence |= 1<<idx;
+    b->tags[idx] = tag;
+    if (mark) {
+        b->marks |= 1<<idx;
+        ht->marked++;
+    }
+    return b->entries+idx;
+}
+
+/* Clear the slot 'slot' of bucket 'b', the first bucket of its chain being
+ * 'head'. Overflow buckets left empty at the end of the chain are
+ * released, so that a deletion never changes the position of the other
+ * entries of the chain, which matters for safe iterators. */
+static void _dictBucketsClearSlot(dictht *ht, dictBucket *head, dictBucket *b,
+                                  int slot)
+{
+    if (b->marks & (1<<slot)) {
+        b->marks &= ~(1<<slot);
+        ht->marked--;
+    }
+    b->presence &= ~(1<<slot);
+    b->entries[slot] = NULL;
+    while(head->next) {
+        dictBucket *prev = head, *tail = head->next;
+
+        while(tail->next) {
+            prev = tail;
+            tail = tail->next;
+        }
+        if (tail->presence) break;
+        zfree(tail);
+        prev->next = NULL;
+    }
+}
+
+/* Union of the marks of the chain of buckets starting at 'b'. */
+static uint8_t _dictBucketsChainMarks(dictBucket *b) {
+    uint8_t marks = 0;
+
+    for (; b; b = b->next) marks |= b->marks;
+    return marks;
+}
+
+/* Number of entries in the chain of buckets starting at 'b'. */
+static unsigned long _dictBucketsChainLen(dictBucket *b) {
+    unsigned long count = 0;
+
+    for (; b; b = b->next) count += __builtin_popcount(b->presence);
+    return count;
+}
+
+static int _dictBucketsExpand(dict *d, unsigned long size) {
+    dictht n;
+    unsigned long nbuckets;
+
+    nbuckets = _dictNextPower((size+DICT_BUCKET_MIN_FILL-1)/
+                              DICT_BUCKET_MIN_FILL);
+    if (nbuckets == _dictBucketsNum(&d->ht[0])) return DICT_ERR;
+
+    n.size = nbuckets*DICT_BUCKET_SLOTS;
+    n.sizemask = nbuckets-1;
+    n.table = _dictBucketsCreate(nbuckets);
+    n.used = 0;
+    n.marked = 0;
+
+    if (d->ht[0].table == NULL) {
+        d->ht[0] = n;
+        return DICT_OK;
+    }
+    d->ht[1] = n;
+    d->rehashidx = 0;
+    return DICT_OK;
+}
+
+/* Like _dictRehashAdvance() for bucketed tables. */
+static void _dictBucketsRehashAdvance(dict *d) {
+    if (_dictBucketsSegmented(&d->ht[0])) {
+        dictBucket **segs = dictBucketSegments(&d->ht[0]);
+        unsigned long s = d->rehashidx >> DICT_BUCKET_SEGMENT_BITS;
+
+        if (segs[s] == NULL) {
+            d->rehashidx = (s+1) << DICT_BUCKET_SEGMENT_BITS;
+            return;
+        }
+        if (((d->rehashidx+1) & DICT_BUCKET_SEGMENT_MASK) == 0) {
+            zfree(segs[s]);
+            segs[s] = NULL;
+        }
+    }
+    d->rehashidx++;
+}
+
+static int _dictBucketsRehash(dict *d, int n) {
+    int empty_visits = n*10; /* Max number of empty buckets to visit. */
+
+    while(n-- && d->ht[0].used != 0) {
+        dictBucket *head, *b, *next;
+        int j;
+
+        assert(_dictBucketsNum(&d->ht[0]) > (unsigned long)d->rehashidx);
+        while(dictBucketIsEmpty(head = _dictBucketAt(&d->ht[0],d->rehashidx))) {
+            _dictBucketsRehashAdvance(d);
+            if (--empty_visits == 0) return 1;
+        }
+        /* Move all the entries of this bucket, and of its overflow
+         * buckets, to the new table. */
+        for (b = head; b; b = next) {
+            for (j = 0; j < DICT_BUCKET_SLOTS; j++) {
+                dictEntry *de;
+                uint64_t h;
+
+                if (!(b->presence & (1<<j))) continue;
+                de = b->entries[j];
+                h = dictHashKey(d, de->key);
+                *_dictBucketsFreeSlot(&d->ht[1],h & d->ht[1].sizemask,
+                                      b->tags[j],b->marks & (1<<j)) = de;
+                if (b->marks & (1<<j)) d->ht[0].marked--;
+                d->ht[0].used--;
+                d->ht[1].used++;
+            }
+            next = b->next;
+            if (b != head) zfree(b);
+        }
+        memset(head,0,sizeof(*head));
+        _dictBucketsRehashAdvance(d);
+    }
+
+    if (d->ht[0].used == 0) {
+        _dictBucketsFree(&d->ht[0]);
+        d->ht[0] = d->ht[1];
+        _dictReset(&d->ht[1]);
+        d->rehashidx = -1;
+        return 0;
+    }
+    return 1;
+}
+
+static dictEntry *_dictBucketsAddRaw(dict *d, void *key, dictEntry **existing) {
+    dictEntry *entry;
+    dictht *ht;
+    uint64_t h;
+    int table;
+
+    if (existing) *existing = NULL;
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    if (_dictExpandIfNeeded(d) == DICT_ERR) return NULL;
+
+    h = dictHashKey(d,key);
+    for (table = 0; table <= 1; table++) {
+        entry = _dictBucketsLookup(d,&d->ht[table],key,h,NULL,NULL);
+        if (entry) {
+            if (existing) *existing = entry;
+            return NULL;
+        }
+        if (!dictIsRehashing(d)) break;
+    }
+
+    ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
+    entry = zmalloc(DICT_BUCKETED_ENTRY_SIZE);
+    *_dictBucketsFreeSlot(ht,h & ht->sizemask,dictBucketTag(h),0) = entry;
+    ht->used++;
+    dictSetKey(d, entry, key);
+    return entry;
+}
+
+static dictEntry *_dictBucketsDelete(dict *d, const void *key, int nofree) {
+    uint64_t h;
+    int table;
+
+    if (dictSize(d) == 0) return NULL;
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    h = dictHashKey(d, key);
+
+    for (table = 0; table <= 1; table++) {
+        dictht *ht = &d->ht[table];
+        dictBucket *b;
+        dictEntry *he;
+        int slot;
+
+        he = _dictBucketsLookup(d,ht,key,h,&b,&slot);
+        if (he) {
+            _dictBucketsClearSlot(ht,_dictBucketAt(ht,h & ht->sizemask),b,slot);
+            if (!nofree) {
+                dictFreeKey(d, he);
+                dictFreeVal(d, he);
+                zfree(he);
+            }
+            ht->used--;
+            return he;
+        }
+        if (!dictIsRehashing(d)) break;
+    }
+    return NULL;
+}
+
+static dictEntry *_dictBucketsFind(dict *d, const void *key) {
+    dictEntry *he;
+    uint64_t h;
+    int table;
+
+    if (dictSize(d) == 0) return NULL;
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    h = dictHashKey(d, key);
+    for (table = 0; table <= 1; table++) {
+        he = _dictBucketsLookup(d,&d->ht[table],key,h,NULL,NULL);
+        if (he || !dictIsRehashing(d)) return he;
+    }
+    return NULL;
+}
+
+static dictEntry *_dictBucketsSetMark(dict *d, const void *key, int mark) {
+    uint64_t h;
+    int table;
+
+    if (dictSize(d) == 0) return NULL;
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    h = dictHashKey(d, key);
+    for (table = 0; table <= 1; table++) {
+        dictht *ht = &d->ht[table];
+        dictBucket *b;
+        dictEntry *he;
+        int slot;
+
+        he = _dictBucketsLookup(d,ht,key,h,&b,&slot);
+        if (he) {
+            if (mark && !(b->marks & (1<<slot))) {
+                b->marks |= 1<<slot;
+                ht->marked++;
+            } else if (!mark && (b->marks & (1<<slot))) {
+                b->marks &= ~(1<<slot);
+                ht->marked--;
+            }
+            return he;
+        }
+        if (!dictIsRehashing(d)) break;
+    }
+    return NULL;
+}
+
+static void _dictBucketsClear(dict *d, dictht *ht, void(callback)(void *)) {
+    unsigned long i;
+
+    for (i = 0; i < _dictBucketsNum(ht) && ht->used > 0; i++) {
+        dictBucket *head, *b, *next;
+        int j;
+
+        if (callback && (i & 65535) == 0) callback(d->privdata);
+
+        if ((head = _dictBucketAt(ht,i)) == NULL) {
+            i |= DICT_BUCKET_SEGMENT_MASK; /* Skip the whole segment. */
+            continue;
+        }
+        for (b = head; b; b = next) {
+            for (j = 0; j < DICT_BUCKET_SLOTS; j++) {
+                dictEntry *he = b->entries[j];
+
+                if (!(b->presence & (1<<j))) continue;
+                dictFreeKey(d, he);
+                dictFreeVal(d, he);
+                zfree(he);
+                ht->used--;
+            }
+            next = b->next;
+            if (b != head) zfree(b);
+        }
+    }
+    _dictBucketsFree(ht);
+    _dictReset(ht);
+}
+
+static dictEntry *_dictBucketsNext(dictIterator *iter) {
+    dict *d = iter->d;
+
+    if (iter->index == -1 && iter->table == 0) {
+        if (iter->safe)
+            d->iterators++;
+        else
+            iter->fingerprint = dictFingerprint(d);
+        iter->index = 0;
+        iter->pos = 0;
+    }
+
+    while(1) {
+        dictht *ht = &d->ht[iter->table];
+        dictBucket *b;
+        long pos = 0;
+
+        if ((unsigned long)iter->index >= _dictBucketsNum(ht)) {
+            if (dictIsRehashing(d) && iter->table == 0) {
+                iter->table++;
+                iter->index = 0;
+                iter->pos = 0;
+                continue;
+            }
+            iter->entry = NULL;
+            return NULL;
+        }
+        if ((b = _dictBucketAt(ht,iter->index)) == NULL) {
+            iter->index = (iter->index | DICT_BUCKET_SEGMENT_MASK)+1;
+            iter->pos = 0;
+            continue;
+        }
+        /* Return the first entry at or after the saved position. Since
+         * deletions never move entries, the position is still valid even
+         * if the dict was modified via a safe iterator. */
+        for (; b; b = b->next, pos += DICT_BUCKET_SLOTS) {
+            int j;
+
+            if (pos+DICT_BUCKET_SLOTS <= iter->pos) continue;
+            for (j = 0; j < DICT_BUCKET_SLOTS; j++) {
+                if (pos+j < iter->pos || !(b->presence & (1<<j))) continue;
+                iter->pos = pos+j+1;
+                iter->entry = b->entries[j];
+                return iter->entry;
+            }
+        }
+        iter->index++;
+        iter->pos = 0;
+    }
+}
+
+static dictEntry *_dictBucketsGetRandomKey(dict *d) {
+    dictBucket *b;
+    unsigned long h, count;
+
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    do {
+        if (dictIsRehashing(d)) {
+            unsigned long n0 = _dictBucketsNum(&d->ht[0]);
+
+            /* No elements in the buckets from 0 to rehashidx-1. */
+            h = d->rehashidx + (random() % (n0 +
+                                _dictBucketsNum(&d->ht[1]) -
+                                d->rehashidx));
+            b = (h >= n0) ? _dictBucketAt(&d->ht[1],h-n0) :
+                            _dictBucketAt(&d->ht[0],h);
+        } else {
+            h = random() & d->ht[0].sizemask;
+            b = _dictBucketAt(&d->ht[0],h);
+        }
+        count = _dictBucketsChainLen(b);
+    } while(count == 0);
+
+    /* Pick a random entry of the chain of buckets. */
+    count = random() % count;
+    for (; b; b = b->next) {
+        int j;
+
+        for (j = 0; j < DICT_BUCKET_SLOTS; j++) {
+            if (!(b->presence & (1<<j))) continue;
+            if (count-- == 0) return b->entries[j];
+        }
+    }
+    return NULL; /* Not reached. */
+}
+
+/* See dictGetSomeKeys(), this is the same algorithm walking buckets. If
+ * 'marked' is true only the marked entries are returned: in this case the
+ * buckets are visited in sequence from a random one, without jumping
+ * elsewhere after a run of buckets without marked entries, and at most
+ * once, so the returned entries are never duplicated. */
+static unsigned int _dictBucketsGetSomeKeys(dict *d, dictEntry **des,
+                                            unsigned int count, int marked)
+{
+    unsigned long j, tables, stored = 0, maxsizemask, maxsteps;
+    unsigned long i, emptylen = 0;
+    unsigned long size = marked ? dictMarkedSize(d) : dictSize(d);
+
+    /* When sampling marked entries the steps depend on the requested count
+     * and not on the number of marked entries: when they are a few the
+     * buckets to visit to find them are more, not less. */
+    if (marked) maxsteps = count*DICT_MARKED_SAMPLE_STEPS;
+    if (size < count) count = size;
+    if (!marked) maxsteps = count*10;
+
+    for (j = 0; j < count; j++) {
+        if (dictIsRehashing(d))
+            _dictRehashStep(d);
+        else
+            break;
+    }
+
+    tables = dictIsRehashing(d) ? 2 : 1;
+    maxsizemask = d->ht[0].sizemask;
+    if (tables > 1 && maxsizemask < d->ht[1].sizemask)
+        maxsizemask = d->ht[1].sizemask;
+    if (marked && maxsteps > maxsizemask) maxsteps = maxsizemask+1;
+
+    i = random() & maxsizemask;
+    while(stored < count && maxsteps--) {
+        for (j = 0; j < tables; j++) {
+            dictBucket *b;
+
+            if (tables == 2 && j == 0 && i < (unsigned long) d->rehashidx) {
+                if (!marked && i >= _dictBucketsNum(&d->ht[1]))
+                    i = d->rehashidx;
+                continue;
+            }
+            if (i >= _dictBucketsNum(&d->ht[j])) continue;
+            b = _dictBucketAt(&d->ht[j],i);
+            if (dictBucketIsEmpty(b) ||
+                (marked && _dictBucketsChainMarks(b) == 0))
+            {
+                emptylen++;
+                if (!marked && emptylen >= 5 && emptylen > count) {
+                    i = random() & maxsizemask;
+                    emptylen = 0;
+                }
+                continue;
+            }
+            emptylen = 0;
+            for (; b; b = b->next) {
+                uint8_t used = marked ? b->marks : b->presence;
+                int k;
+
+                for (k = 0; k < DICT_BUCKET_SLOTS; k++) {
+                    if (!(used & (1<<k))) continue;
+                    *des++ = b->entries[k];
+                    if (++stored == count) return stored;
+                }
+            }
+        }
+        i = (i+1) & maxsizemask;
+    }
+    return stored;
+}
+
+/* Emit the entries of bucket 'idx' for dictScan(). */
+static void _dictBucketsScanBucket(dictht *ht, unsigned long idx,
+                                   dictScanFunction *fn,
+                                   dictScanBucketFunction *bucketfn,
+                                   void *privdata)
+{
+    dictBucket *head = _dictBucketAt(ht,idx), *b;
+    int j;
+
+    if (bucketfn) {
+        for (b = head; b; b = b->next)
+            for (j = 0; j < DICT_BUCKET_SLOTS; j++)
+                if (b->presence & (1<<j)) bucketfn(privdata,b->entries+j);
+    }
+    for (b = head; b; b = b->next)
+        for (j = 0; j < DICT_BUCKET_SLOTS; j++)
+            if (b->presence & (1<<j)) fn(privdata,b->entries[j]);
+}
+
+static dictEntry **_dictBucketsFindRefByPtr(dict *d, const void *oldptr,
+                                            unsigned int hash)
+{
+    int table, j;
+
+    for (table = 0; table <= 1; table++) {
+        dictht *ht = &d->ht[table];
+        dictBucket *b;
+
+        if (ht->size == 0) continue;
+        for (b = _dictBucketAt(ht,hash & ht->sizemask); b; b = b->next) {
+            for (j = 0; j < DICT_BUCKET_SLOTS; j++) {
+                if ((b->presence & (1<<j)) && b->entries[j]->key == oldptr)
+                    return b->entries+j;
+            }
+        }
+        if (!dictIsRehashing(d)) break;
+    }
+    return NULL;
+}
+
 /* ----------------------------- API implementation ------------------------- */
 
 /* Reset a hash table already initialized with ht_init().
@@ -105,6 +778,7 @@ static void _dictReset(dictht *ht)
     ht->size = 0;
     ht->sizemask = 0;
     ht->used = 0;
+    ht->marked = 0;
 }
 
 /* Create a new hash table */
@@ -153,6 +827,7 @@ int dictExpand(dict *d, unsigned long size)
      * elements already inside the hash table */
     if (dictIsRehashing(d) || d->ht[0].used > size)
         return DICT_ERR;
+    if (dictIsBucketed(d)) return _dictBucketsExpand(d,size);
 
     /* Rehashing to the same table size is not useful. */
     if (realsize == d->ht[0].size) return DICT_ERR;
@@ -160,8 +835,9 @@ int dictExpand(dict *d, unsigned long size)
     /* Allocate the new hash table and initialize all pointers to NULL */
     n.size = realsize;
     n.sizemask = realsize-1;
-    n.table = zcalloc(realsize*sizeof(dictEntry*));
+    n.table = _dictTableCreate(realsize);
     n.used = 0;
+    n.marked = 0;
 
     /* Is this the first initialization? If so it's not really a rehashing
      * we just set the first hash table so that it can accept keys. */
@@ -176,6 +852,27 @@ int dictExpand(dict *d, unsigned long size)
     return DICT_OK;
 }
 
+/* Move the rehashing index to the next bucket of the old table. With a
+ * segmented old table, a segment that was never allocated is skipped at
+ * once, and a segment is released as soon as the rehashing is done with it,
+ * so that the old and the new table don't use twice the memory. */
+static void _dictRehashAdvance(dict *d) {
+    if (dictIsSegmented(&d->ht[0])) {
+        dictEntry ***segs = dictSegments(&d->ht[0]);
+        unsigned long s = d->rehashidx >> DICT_SEGMENT_BITS;
+
+        if (segs[s] == NULL) {
+            d->rehashidx = (s+1) << DICT_SEGMENT_BITS;
+            return;
+        }
+        if (((d->rehashidx+1) & DICT_SEGMENT_MASK) == 0) {
+            zfree(segs[s]);
+            segs[s] = NULL;
+        }
+    }
+    d->rehashidx++;
+}
+
 /* Performs N steps of incremental rehashing. Returns 1 if there are still
  * keys to move from the old to the new hash table, otherwise 0 is returned.
  *
@@ -188,6 +885,7 @@ int dictExpand(dict *d, unsigned long size)
 int dictRehash(dict *d, int n) {
     int empty_visits = n*10; /* Max number of empty buckets to visit. */
     if (!dictIsRehashing(d)) return 0;
+    if (dictIsBucketed(d)) return _dictBucketsRehash(d,n);
 
     while(n-- && d->ht[0].used != 0) {
         dictEntry *de, *nextde;
@@ -195,31 +893,32 @@ int dictRehash(dict *d, int n) {
         /* Note that rehashidx can't overflow as we are sure there are more
          * elements because ht[0].used != 0 */
         assert(d->ht[0].size > (unsigned long)d->rehashidx);
-        while(d->ht[0].table[d->rehashidx] == NULL) {
-            d->rehashidx++;
+        while((de = _dictChain(&d->ht[0],d->rehashidx)) == NULL) {
+            _dictRehashAdvance(d);
             if (--empty_visits == 0) return 1;
         }
-        de = d->ht[0].table[d->rehashidx];
         /* Move all the keys in this bucket from the old to the new hash HT */
         while(de) {
             unsigned int h;
+            dictEntry **bucket;
 
             nextde = de->next;
             /* Get the index in the new hash table */
             h = dictHashKey(d, de->key) & d->ht[1].sizemask;
-            de->next = d->ht[1].table[h];
-            d->ht[1].table[h] = de;
+            bucket = _dictChainRefCreate(&d->ht[1],h);
+            de->next = *bucket;
+            *bucket = de;
             d->ht[0].used--;
             d->ht[1].used++;
             de = nextde;
         }
-        d->ht[0].table[d->rehashidx] = NULL;
-        d->rehashidx++;
+        *dictGetBucketRef(&d->ht[0],d->rehashidx) = NULL;
+        _dictRehashAdvance(d);
     }
 
     /* Check if we already rehashed the whole table... */
     if (d->ht[0].used == 0) {
-        zfree(d->ht[0].table);
+        _dictTableFree(&d->ht[0]);
         d->ht[0] = d->ht[1];
         _dictReset(&d->ht[1]);
         d->rehashidx = -1;
@@ -292,9 +991,10 @@ int dictAdd(dict *d, void *key, void *val)
 dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing)
 {
     int index;
-    dictEntry *entry;
+    dictEntry *entry, **bucket;
     dictht *ht;
 
+    if (dictIsBucketed(d)) return _dictBucketsAddRaw(d,key,existing);
     if (dictIsRehashing(d)) _dictRehashStep(d);
 
     /* Get the index of the new element, or -1 if
@@ -307,9 +1007,10 @@ dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing)
      * system it is more likely that recently added entries are accessed
      * more frequently. */
     ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
+    bucket = _dictChainRefCreate(ht,index);
     entry = zmalloc(sizeof(*entry));
-    entry->next = ht->table[index];
-    ht->table[index] = entry;
+    entry->next = *bucket;
+    *bucket = entry;
     ht->used++;
 
     /* Set the hash entry fields. */
@@ -339,7 +1040,7 @@ int dictReplace(dict *d, void *key, void *val)
      * as the previous one. In this context, think to reference counting,
      * you want to increment (set), and then decrement (free), and not the
      * reverse. */
-    auxentry = *existing;
+    auxentry.v = existing->v; /* Bucketed entries have no 'next' field. */
     dictSetVal(d, existing, val);
     dictFreeVal(d, &auxentry);
     return 0;
@@ -367,13 +1068,14 @@ static dictEntry *dictGenericDelete(dict *d, const void *key, int nofree) {
     int table;
 
     if (d->ht[0].used == 0 && d->ht[1].used == 0) return NULL;
+    if (dictIsBucketed(d)) return _dictBucketsDelete(d,key,nofree);
 
     if (dictIsRehashing(d)) _dictRehashStep(d);
     h = dictHashKey(d, key);
 
     for (table = 0; table <= 1; table++) {
         idx = h & d->ht[table].sizemask;
-        he = d->ht[table].table[idx];
+        he = _dictChain(&d->ht[table],idx);
         prevHe = NULL;
         while(he) {
             if (key==he->key || dictCompareKeys(d, key, he->key)) {
@@ -381,7 +1083,7 @@ static dictEntry *dictGenericDelete(dict *d, const void *key, int nofree) {
                 if (prevHe)
                     prevHe->next = he->next;
                 else
-                    d->ht[table].table[idx] = he->next;
+                    *dictGetBucketRef(&d->ht[table],idx) = he->next;
                 if (!nofree) {
                     dictFreeKey(d, he);
                     dictFreeVal(d, he);
@@ -442,13 +1144,25 @@ void dictFreeUnlinkedEntry(dict *d, dictEntry *he) {
 int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
     unsigned long i;
 
+    if (dictIsBucketed(d)) {
+        _dictBucketsClear(d,ht,callback);
+        return DICT_OK;
+    }
+
     /* Free all the elements */
     for (i = 0; i < ht->size && ht->used > 0; i++) {
         dictEntry *he, *nextHe;
 
         if (callback && (i & 65535) == 0) callback(d->privdata);
 
-        if ((he = ht->table[i]) == NULL) continue;
+        /* Skip segments that were never allocated. */
+        if (dictIsSegmented(ht) &&
+            dictSegments(ht)[i >> DICT_SEGMENT_BITS] == NULL)
+        {
+            i |= DICT_SEGMENT_MASK;
+            continue;
+        }
+        if ((he = _dictChain(ht,i)) == NULL) continue;
         while(he) {
             nextHe = he->next;
             dictFreeKey(d, he);
@@ -459,7 +1173,7 @@ int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
         }
     }
     /* Free the table and the allocated cache structure */
-    zfree(ht->table);
+    _dictTableFree(ht);
     /* Re-initialize the table */
     _dictReset(ht);
     return DICT_OK; /* never fails */
@@ -473,17 +1187,26 @@ void dictRelease(dict *d)
     zfree(d);
 }
 
+/* Set ('mark' is non zero) or clear the mark of the entry of 'key' in a
+ * bucketed dictionary. The entry is returned, or NULL if the key does not
+ * exist. The number of marked entries is reported by dictMarkedSize(). */
+dictEntry *dictSetMark(dict *d, const void *key, int mark) {
+    assert(dictIsBucketed(d));
+    return _dictBucketsSetMark(d,key,mark);
+}
+
 dictEntry *dictFind(dict *d, const void *key)
 {
     dictEntry *he;
     unsigned int h, idx, table;
 
     if (d->ht[0].used + d->ht[1].used == 0) return NULL; /* dict is empty */
+    if (dictIsBucketed(d)) return _dictBucketsFind(d,key);
     if (dictIsRehashing(d)) _dictRehashStep(d);
     h = dictHashKey(d, key);
     for (table = 0; table <= 1; table++) {
         idx = h & d->ht[table].sizemask;
-        he = d->ht[table].table[idx];
+        he = _dictChain(&d->ht[table],idx);
         while(he) {
             if (key==he->key || dictCompareKeys(d, key, he->key))
                 return he;
@@ -561,6 +1284,7 @@ dictIterator *dictGetSafeIterator(dict *d) {
 
 dictEntry *dictNext(dictIterator *iter)
 {
+    if (dictIsBucketed(iter->d)) return _dictBucketsNext(iter);
     while (1) {
         if (iter->entry == NULL) {
             dictht *ht = &iter->d->ht[iter->table];
@@ -580,7 +1304,7 @@ dictEntry *dictNext(dictIterator *iter)
                     break;
                 }
             }
-            iter->entry = ht->table[iter->index];
+            iter->entry = _dictChain(ht,iter->index);
         } else {
             iter->entry = iter->nextEntry;
         }
@@ -614,6 +1338,7 @@ dictEntry *dictGetRandomKey(dict *d)
     int listlen, listele;
 
     if (dictSize(d) == 0) return NULL;
+    if (dictIsBucketed(d)) return _dictBucketsGetRandomKey(d);
     if (dictIsRehashing(d)) _dictRehashStep(d);
     if (dictIsRehashing(d)) {
         do {
@@ -622,13 +1347,14 @@ dictEntry *dictGetRandomKey(dict *d)
             h = d->rehashidx + (random() % (d->ht[0].size +
                                             d->ht[1].size -
                                             d->rehashidx));
-            he = (h >= d->ht[0].size) ? d->ht[1].table[h - d->ht[0].size] :
-                                      d->ht[0].table[h];
+            he = (h >= d->ht[0].size) ?
+                 _dictChain(&d->ht[1],h - d->ht[0].size) :
+                 _dictChain(&d->ht[0],h);
         } while(he == NULL);
     } else {
         do {
             h = random() & d->ht[0].sizemask;
-            he = d->ht[0].table[h];
+            he = _dictChain(&d->ht[0],h);
         } while(he == NULL);
     }
 
@@ -676,6 +1402,7 @@ unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
     unsigned long stored = 0, maxsizemask;
     unsigned long maxsteps;
 
+    if (dictIsBucketed(d)) return _dictBucketsGetSomeKeys(d,des,count,0);
     if (dictSize(d) < count) count = dictSize(d);
     maxsteps = count*10;
 
@@ -709,7 +1436,7 @@ unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
                 continue;
             }
             if (i >= d->ht[j].size) continue; /* Out of range for this table. */
-            dictEntry *he = d->ht[j].table[i];
+            dictEntry *he = _dictChain(&d->ht[j],i);
 
             /* Count contiguous empty buckets, and jump to other
              * locations if they reach 'count' (with a minimum of 5). */
@@ -737,6 +1464,18 @@ unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
     return stored;
 }
 
+/* Like dictGetSomeKeys() but only the entries marked with dictSetMark()
+ * are returned. Unlike dictGetSomeKeys() the returned entries are never
+ * duplicated, so the caller is free to delete them one after the other.
+ * Only bucketed dictionaries support marks, for the other dictionaries
+ * this always returns zero. */
+unsigned int dictGetSomeMarkedKeys(dict *d, dictEntry **des,
+                                   unsigned int count)
+{
+    if (!dictIsBucketed(d)) return 0;
+    return _dictBucketsGetSomeKeys(d,des,count,1);
+}
+
 /* Function to reverse bits. Algorithm from:
  * http://graphics.stanford.edu/~seander/bithacks.html#ReverseParallel */
 static unsigned long rev(unsigned long v) {
@@ -749,6 +1488,29 @@ static unsigned long rev(unsigned long v) {
     return v;
 }
 
+/* Emit the entries of the bucket 'idx' of the table 'ht' for dictScan(). */
+static void _dictScanBucket(dict *d, dictht *ht, unsigned long idx,
+                            dictScanFunction *fn,
+                            dictScanBucketFunction *bucketfn,
+                            void *privdata)
+{
+    const dictEntry *de, *next;
+    dictEntry **bucket;
+
+    if (dictIsBucketed(d)) {
+        _dictBucketsScanBucket(ht,idx,fn,bucketfn,privdata);
+        return;
+    }
+    if (bucketfn && (bucket = dictGetBucketRef(ht,idx)) != NULL)
+        bucketfn(privdata, bucket);
+    de = _dictChain(ht,idx);
+    while (de) {
+        next = de->next;
+        fn(privdata, de);
+        de = next;
+    }
+}
+
 /* dictScan() is used to iterate over the elements of a dictionary.
  *
  * Iterating works the following way:
@@ -840,7 +1602,6 @@ unsigned long dictScan(dict *d,
                        void *privdata)
 {
     dictht *t0, *t1;
-    const dictEntry *de, *next;
     unsigned long m0, m1;
 
     if (dictSize(d) == 0) return 0;
@@ -850,13 +1611,7 @@ unsigned long dictScan(dict *d,
         m0 = t0->sizemask;
 
         /* Emit entries at cursor */
-        if (bucketfn) bucketfn(privdata, &t0->table[v & m0]);
-        de = t0->table[v & m0];
-        while (de) {
-            next = de->next;
-            fn(privdata, de);
-            de = next;
-        }
+        _dictScanBucket(d,t0,v & m0,fn,bucketfn,privdata);
 
     } else {
         t0 = &d->ht[0];
@@ -872,25 +1627,13 @@ unsigned long dictScan(dict *d,
         m1 = t1->sizemask;
 
         /* Emit entries at cursor */
-        if (bucketfn) bucketfn(privdata, &t0->table[v & m0]);
-        de = t0->table[v & m0];
-        while (de) {
-            next = de->next;
-            fn(privdata, de);
-            de = next;
-        }
+        _dictScanBucket(d,t0,v & m0,fn,bucketfn,privdata);
 
         /* Iterate over indices in larger table that are the expansion
          * of the index pointed to by the cursor in the smaller table */
         do {
             /* Emit entries at cursor */
-            if (bucketfn) bucketfn(privdata, &t1->table[v & m1]);
-            de = t1->table[v & m1];
-            while (de) {
-                next = de->next;
-                fn(privdata, de);
-                de = next;
-            }
+            _dictScanBucket(d,t1,v & m1,fn,bucketfn,privdata);
 
             /* Increment bits not covered by the smaller mask */
             v = (((v | m0) + 1) & ~m0) | (v & m0);
@@ -911,6 +1654,25 @@ unsigned long dictScan(dict *d,
     return v;
 }
 
+/* Return true if the dictScan() calls that returned the cursor 'v' already
+ * visited the bucket of 'key', that is, if an element with this key, added
+ * to the dictionary after the scan passed the bucket, would not be returned
+ * by the next calls. Since a cursor of 0 is both the start and the end of a
+ * scan, it is considered as the start here.
+ *
+ * This holds as long as the dictionary is not shrunk while scanning: when
+ * the table grows, the buckets already visited only expand into buckets
+ * the cursor will not visit again (see the dictScan() comment), and the
+ * comparison of the reversed bucket index with the reversed cursor gives
+ * the same result with the mask of the larger table. */
+int dictScanCursorPassed(dict *d, unsigned long v, const void *key) {
+    unsigned long m0 = d->ht[0].sizemask;
+
+    /* dictScan() advances the cursor using the smaller table. */
+    if (dictIsRehashing(d) && d->ht[1].sizemask < m0) m0 = d->ht[1].sizemask;
+    return rev(dictHashKey(d,key) & m0) < rev(v & m0);
+}
+
 /* ------------------------- private functions ------------------------------ */
 
 /* Expand the hash table if needed */
@@ -922,19 +1684,53 @@ static int _dictExpandIfNeeded(dict *d)
     /* If the hash table is empty expand it to the initial size. */
     if (d->ht[0].size == 0) return dictExpand(d, DICT_HT_INITIAL_SIZE);
 
-    /* If we reached the 1:1 ratio, and we are allowed to resize the hash
-     * table (global setting) or we should avoid it but the ratio between
-     * elements/buckets is over the "safe" threshold, we resize doubling
-     * the number of buckets. */
-    if (d->ht[0].used >= d->ht[0].size &&
-        (dict_can_resize ||
-         d->ht[0].used/d->ht[0].size > dict_force_resize_ratio))
-    {
-        return dictExpand(d, d->ht[0].used*2);
-    }
+    /* Chained tables are doubled in size, bucketed tables are sized by
+     * dictExpand() itself so that the buckets are about half full. */
+    if (dictWillExpand(d))
+        return dictExpand(d, dictIsBucketed(d) ? d->ht[0].used+1 :
+                                                 d->ht[0].used*2);
     return DICT_OK;
 }
 
+/* Return true if adding an element to the dictionary is going to start
+ * a rehashing, so that callers can track the latency of table expansions.
+ *
+ * This happens if we reached the 1:1 ratio (DICT_BUCKET_MAX_FILL entries
+ * per bucket for bucketed tables), and we are allowed to resize the hash
+ * table (global setting) or we should avoid it but the ratio between
+ * elements/buckets is over the "safe" threshold. */
+int dictWillExpand(dict *d) {
+    unsigned long capacity;
+
+    if (dictIsRehashing(d)) return 0;
+    if (d->ht[0].size == 0) return 1;
+    capacity = dictIsBucketed(d) ?
+               _dictBucketsNum(&d->ht[0])*DICT_BUCKET_MAX_FILL :
+               d->ht[0].size;
+    return d->ht[0].used >= capacity &&
+           (dict_can_resize || d->ht[0].used/capacity > dict_force_resize_ratio);
+}
+
+/* Return the memory used by the tables of the dictionary, and by the
+ * entries themselves, not counting keys and values, nor the overflow buckets
+ * of bucketed tables, that are rare. */
+size_t dictMemUsage(dict *d) {
+    size_t mem = sizeof(*d);
+    int table;
+
+    for (table = 0; table <= 1; table++) {
+        dictht *ht = &d->ht[table];
+
+        if (dictIsBucketed(d)) {
+            mem += _dictBucketsNum(ht)*sizeof(dictBucket)+
+                   ht->used*DICT_BUCKETED_ENTRY_SIZE;
+        } else {
+            mem += ht->size*sizeof(dictEntry*)+ht->used*sizeof(dictEntry);
+        }
+    }
+    return mem;
+}
+
 /* Our hash table capability is a power of two */
 static unsigned long _dictNextPower(unsigned long size)
 {
@@ -967,7 +1763,7 @@ static int _dictKeyIndex(dict *d, const void *key, unsigned int hash, dictEntry
     for (table = 0; table <= 1; table++) {
         idx = hash & d->ht[table].sizemask;
         /* Search if this slot does not already contain the given key */
-        he = d->ht[table].table[idx];
+        he = _dictChain(&d->ht[table],idx);
         while(he) {
             if (key==he->key || dictCompareKeys(d, key, he->key)) {
                 if (existing) *existing = he;
@@ -1009,9 +1805,14 @@ dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, unsigned i
     unsigned int idx, table;
 
     if (d->ht[0].used + d->ht[1].used == 0) return NULL; /* dict is empty */
+    if (dictIsBucketed(d)) return _dictBucketsFindRefByPtr(d,oldptr,hash);
     for (table = 0; table <= 1; table++) {
         idx = hash & d->ht[table].sizemask;
-        heref = &d->ht[table].table[idx];
+        heref = dictGetBucketRef(&d->ht[table],idx);
+        if (heref == NULL) {
+            if (!dictIsRehashing(d)) return NULL;
+            continue;
+        }
         he = *heref;
         while(he) {
             if (oldptr==he->key)
@@ -1027,8 +1828,13 @@ dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, unsigned i
 /* ------------------------------- Debugging ---------------------------------*/
 
 #define DICT_STATS_VECTLEN 50
-size_t _dictGetStatsHt(char *buf, size_t bufsize, dictht *ht, int tableid) {
+size_t _dictGetStatsHt(char *buf, size_t bufsize, dictht *ht, int tableid,
+                       int bucketed)
+{
     unsigned long i, slots = 0, chainlen, maxchainlen = 0;
+    unsigned long buckets = bucketed ? _dictBucketsNum(ht) : ht->size;
+    unsigned long segbits = bucketed ? DICT_BUCKET_SEGMENT_BITS :
+                                       DICT_SEGMENT_BITS;
     unsigned long totchainlen = 0;
     unsigned long clvector[DICT_STATS_VECTLEN];
     size_t l = 0;
@@ -1040,20 +1846,30 @@ size_t _dictGetStatsHt(char *buf, size_t bufsize, dictht *ht, int tableid) {
 
     /* Compute stats. */
     for (i = 0; i < DICT_STATS_VECTLEN; i++) clvector[i] = 0;
-    for (i = 0; i < ht->size; i++) {
+    for (i = 0; i < buckets; i++) {
         dictEntry *he;
 
-        if (ht->table[i] == NULL) {
-            clvector[0]++;
-            continue;
-        }
-        slots++;
-        /* For each hash entry on this slot... */
-        chainlen = 0;
-        he = ht->table[i];
-        while(he) {
-            chainlen++;
-            he = he->next;
+        if (bucketed) {
+            /* For bucketed tables the chain is the bucket with its
+             * overflow buckets. */
+            chainlen = _dictBucketsChainLen(_dictBucketAt(ht,i));
+            if (chainlen == 0) {
+                clvector[0]++;
+                continue;
+            }
+            slots++;
+        } else {
+            if ((he = _dictChain(ht,i)) == NULL) {
+                clvector[0]++;
+                continue;
+            }
+            slots++;
+            /* For each hash entry on this slot... */
+            chainlen = 0;
+            while(he) {
+                chainlen++;
+                he = he->next;
+            }
         }
         clvector[(chainlen < DICT_STATS_VECTLEN) ? chainlen : (DICT_STATS_VECTLEN-1)]++;
         if (chainlen > maxchainlen) maxchainlen = chainlen;
@@ -1074,13 +1890,29 @@ size_t _dictGetStatsHt(char *buf, size_t bufsize, dictht *ht, int tableid) {
         ht->size, ht->used, slots, maxchainlen,
         (float)totchainlen/slots, (float)ht->used/slots);
 
+    if (buckets > (1UL<<segbits) && l < bufsize) {
+        unsigned long segments = 0;
+
+        /* Chained and bucketed tables both store the segment pointers
+         * in 'table'. */
+        for (i = 0; i < buckets >> segbits; i++)
+            if (((void**)ht->table)[i]) segments++;
+        l += snprintf(buf+l,bufsize-l,
+            " allocated segments: %ld of %ld\n",
+            segments, buckets >> segbits);
+    }
+    if (bucketed && l < bufsize) {
+        l += snprintf(buf+l,bufsize-l,
+            " marked elements: %ld\n", ht->marked);
+    }
+
     for (i = 0; i < DICT_STATS_VECTLEN-1; i++) {
         if (clvector[i] == 0) continue;
         if (l >= bufsize) break;
         l += snprintf(buf+l,bufsize-l,
             "   %s%ld: %ld (%.02f%%)\n",
             (i == DICT_STATS_VECTLEN-1)?">= ":"",
-            i, clvector[i], ((float)clvector[i]/ht->size)*100);
+            i, clvector[i], ((float)clvector[i]/buckets)*100);
     }
 
     /* Unlike snprintf(), teturn the number of characters actually written. */
@@ -1093,11 +1925,11 @@ void dictGetStats(char *buf, size_t bufsize, dict *d) {
     char *orig_buf = buf;
     size_t orig_bufsize = bufsize;
 
-    l = _dictGetStatsHt(buf,bufsize,&d->ht[0],0);
+    l = _dictGetStatsHt(buf,bufsize,&d->ht[0],0,dictIsBucketed(d));
     buf += l;
     bufsize -= l;
     if (dictIsRehashing(d) && bufsize > 0) {
-        _dictGetStatsHt(buf,bufsize,&d->ht[1],1);
+        _dictGetStatsHt(buf,bufsize,&d->ht[1],1,dictIsBucketed(d));
     }
     /* Make sure there is a NULL term at the end. */
     if (orig_bufsize) orig_buf[orig_bufsize-1] = '\0';
@@ -1135,40 +1967,70 @@ dictType BenchmarkDictType = {
     NULL,
     compareCallback,
     freeCallback,
-    NULL
+    NULL,
+    0
 };
 
+dictType BenchmarkBucketedDictType = {
+    hashCallback,
+    NULL,
+    NULL,
+    compareCallback,
+    freeCallback,
+    NULL,
+    1
+};
+
+static long long timeInMicroseconds(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
 #define start_benchmark() start = timeInMilliseconds()
 #define end_benchmark(msg) do { \
     elapsed = timeInMilliseconds()-start; \
     printf(msg ": %ld items in %lld ms\n", count, elapsed); \
 } while(0);
 
-/* dict-benchmark [count] */
+/* dict-benchmark [count] [bucketed] */
 int main(int argc, char **argv) {
     long j;
-    long long start, elapsed;
-    dict *dict = dictCreate(&BenchmarkDictType,NULL);
+    long long start, elapsed, worst = 0;
+    dict *dict;
     long count = 0;
 
-    if (argc == 2) {
+    if (argc >= 2) {
         count = strtol(argv[1],NULL,10);
     } else {
         count = 5000000;
     }
+    if (argc >= 3 && !strcmp(argv[2],"bucketed")) {
+        dict = dictCreate(&BenchmarkBucketedDictType,NULL);
+    } else {
+        dict = dictCreate(&BenchmarkDictType,NULL);
+    }
 
     start_benchmark();
     for (j = 0; j < count; j++) {
-        int retval = dictAdd(dict,sdsfromlonglong(j),(void*)j);
+        sds key = sdsfromlonglong(j);
+        long long t = timeInMicroseconds();
+        int retval = dictAdd(dict,key,(void*)j);
+        t = timeInMicroseconds()-t;
+        if (t > worst) worst = t;
         assert(retval == DICT_OK);
     }
     end_benchmark("Inserting");
+    printf("Worst case single insertion: %lld us\n", worst);
     assert((long)dictSize(dict) == count);
 
     /* Wait for rehashing. */
     while (dictIsRehashing(dict)) {
         dictRehashMilliseconds(dict,100);
     }
+    printf("Table and entries memory: %.2f bytes per key\n",
+        (double)dictMemUsage(dict)/count);
 
     start_benchmark();
     for (j = 0; j < count; j++) {
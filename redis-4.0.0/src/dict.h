@@ -52,7 +52,7 @@ typedef struct dictEntry {
         int64_t s64;
         double d;
     } v;
-    struct dictEntry *next;
+    struct dictEntry *next; /* Not allocated for bucketed dicts. */
 } dictEntry;
 
 typedef struct dictType {
@@ -62,15 +62,25 @@ typedef struct dictType {
     int (*keyCompare)(void *privdata, const void *key1, const void *key2);
     void (*keyDestructor)(void *privdata, void *key);
     void (*valDestructor)(void *privdata, void *obj);
+    int bucketed; /* Use cache line buckets instead of chains, see dict.c. */
 } dictType;
 
 /* This is our hash table structure. Every dictionary has two of this as we
- * implement incremental rehashing, for the old to the new table. */
+ * implement incremental rehashing, for the old to the new table.
+ *
+ * Chained tables with more than DICT_SEGMENT_SIZE buckets are not allocated as a
+ * single array: in that case 'table' is actually an array of pointers to
+ * segments of DICT_SEGMENT_SIZE buckets (see dictSegments()), and every
+ * segment is allocated only when one of its buckets is populated for the
+ * first time. This way growing a huge table never allocates and zeroes
+ * gigabytes of memory at once, and the new table is populated a segment at
+ * a time while the incremental rehashing frees the old table segments. */
 typedef struct dictht {
     dictEntry **table;
     unsigned long size;
     unsigned long sizemask;
     unsigned long used;
+    unsigned long marked; /* Marked entries, see dictSetMark(). */
 } dictht;
 
 typedef struct dict {
@@ -90,16 +100,24 @@ typedef struct dictIterator {
     long index;
     int table, safe;
     dictEntry *entry, *nextEntry;
+    long pos; /* Position inside the bucket, for bucketed dicts. */
     /* unsafe iterator fingerprint for misuse detection. */
     long long fingerprint;
 } dictIterator;
 
 typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
+/* For bucketed dicts the bucket function is called with a reference to
+ * every single entry, and the 'next' field must not be followed. */
 typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
 
 /* This is the initial size of every hash table */
 #define DICT_HT_INITIAL_SIZE     4
 
+/* Buckets per segment of big tables, 64k bytes with 64 bit pointers. */
+#define DICT_SEGMENT_BITS 13
+#define DICT_SEGMENT_SIZE (1UL<<DICT_SEGMENT_BITS)
+#define DICT_SEGMENT_MASK (DICT_SEGMENT_SIZE-1)
+
 /* ------------------------------- Macros ------------------------------------*/
 #define dictFreeVal(d, entry) \
     if ((d)->type->valDestructor) \
@@ -145,7 +163,12 @@ typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
 #define dictGetDoubleVal(he) ((he)->v.d)
 #define dictSlots(d) ((d)->ht[0].size+(d)->ht[1].size)
 #define dictSize(d) ((d)->ht[0].used+(d)->ht[1].used)
+#define dictMarkedSize(d) ((d)->ht[0].marked+(d)->ht[1].marked)
 #define dictIsRehashing(d) ((d)->rehashidx != -1)
+#define dictIsBucketed(d) ((d)->type->bucketed)
+#define dictIsSegmented(ht) ((ht)->size > DICT_SEGMENT_SIZE)
+#define dictSegments(ht) ((dictEntry***)(ht)->table)
+#define dictNumSegments(ht) ((ht)->size >> DICT_SEGMENT_BITS)
 
 /* API */
 dict *dictCreate(dictType *type, void *privDataPtr);
@@ -160,13 +183,17 @@ void dictFreeUnlinkedEntry(dict *d, dictEntry *he);
 void dictRelease(dict *d);
 dictEntry * dictFind(dict *d, const void *key);
 void *dictFetchValue(dict *d, const void *key);
+dictEntry *dictSetMark(dict *d, const void *key, int mark);
 int dictResize(dict *d);
+int dictWillExpand(dict *d);
+size_t dictMemUsage(dict *d);
 dictIterator *dictGetIterator(dict *d);
 dictIterator *dictGetSafeIterator(dict *d);
 dictEntry *dictNext(dictIterator *iter);
 void dictReleaseIterator(dictIterator *iter);
 dictEntry *dictGetRandomKey(dict *d);
 unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count);
+unsigned int dictGetSomeMarkedKeys(dict *d, dictEntry **des, unsigned int count);
 void dictGetStats(char *buf, size_t bufsize, dict *d);
 uint64_t dictGenHashFunction(const void *key, int len);
 uint64_t dictGenCaseHashFunction(const unsigned char *buf, int len);
@@ -178,8 +205,10 @@ int dictRehashMilliseconds(dict *d, int ms);
 void dictSetHashFunctionSeed(uint8_t *seed);
 uint8_t *dictGetHashFunctionSeed(void);
 unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn, dictScanBucketFunction *bucketfn, void *privdata);
+int dictScanCursorPassed(dict *d, unsigned long v, const void *key);
 unsigned int dictGetHash(dict *d, const void *key);
 dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, unsigned int hash);
+dictEntry **dictGetBucketRef(dictht *ht, unsigned long idx);
 
 /* Hash table types */
 extern dictType dictTypeHeapStringCopyKey;
@@ -115,6 +115,11 @@ unsigned long long estimateObjectIdleTime(robj *o) {
  * should block the execution of commands that will result in more memory
  * used by the server.
  *
+ * If maxmemory-eviction-time-limit is set the function stops evicting after
+ * the configured amount of microseconds, returning C_ERR as well. The
+ * memory still to free (the eviction debt) is evicted by a time event, in
+ * steps with the same time limit, so that clients are served meanwhile.
+ *
  * ------------------------------------------------------------------------
  *
  * LRU approximation algorithm
@@ -161,11 +166,17 @@ void evictionPoolAlloc(void) {
  * idle time are on the left, and keys with the higher idle time on the
  * right. */
 
-void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evictionPoolEntry *pool) {
+void evictionPoolPopulate(int dbid, dict *keydict, struct evictionPoolEntry *pool) {
     int j, k, count;
     dictEntry *samples[server.maxmemory_samples];
 
-    count = dictGetSomeKeys(sampledict,samples,server.maxmemory_samples);
+    /* The volatile policies only sample the keys with an expire, that are
+     * marked in the keyspace dictionary. */
+    if (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS)
+        count = dictGetSomeKeys(keydict,samples,server.maxmemory_samples);
+    else
+        count = dictGetSomeMarkedKeys(keydict,samples,
+                                      server.maxmemory_samples);
     for (j = 0; j < count; j++) {
         unsigned long long idle;
         sds key;
@@ -174,14 +185,7 @@ void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evic
 
         de = samples[j];
         key = dictGetKey(de);
-
-        /* If the dictionary we are sampling from is not the main
-         * dictionary (but the expires one) we need to lookup the key
-         * again in the key dictionary to obtain the value object. */
-        if (server.maxmemory_policy != MAXMEMORY_VOLATILE_TTL) {
-            if (sampledict != keydict) de = dictFind(keydict, key);
-            o = dictGetVal(de);
-        }
+        o = dictGetVal(de);
 
         /* Calculate the idle time according to the policy. This is called
          * idle just because the code initially handled LRU, but is in fact
@@ -199,7 +203,7 @@ void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evic
             idle = 255-LFUDecrAndReturn(o);
         } else if (server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL) {
             /* In this case the sooner the expire the better. */
-            idle = ULLONG_MAX - (long)dictGetVal(de);
+            idle = ULLONG_MAX - keyGetExpire(key);
         } else {
             serverPanic("Unknown eviction policy in evictionPoolPopulate()");
         }
@@ -346,14 +350,215 @@ unsigned long LFUDecrAndReturn(robj *o) {
     return counter;
 }
 
+/* ----------------------------------------------------------------------------
+ * W-TinyLFU admission, used by the allkeys-tinylfu policy.
+ *
+ * With the LFU policy a scan of keys accessed just once may evict keys that
+ * are popular but whose counter is decaying. The allkeys-tinylfu policy
+ * uses the LFU counters and the eviction pool exactly like allkeys-lfu, but
+ * also remembers the keys created recently in a small FIFO, the window,
+ * sized 1% of the keys. When the window is full and a key must be evicted,
+ * the oldest key of the window competes with the victim selected by the
+ * pool: the one with the lower access frequency is evicted. So keys
+ * accessed just once are evicted soon after leaving the window, without
+ * displacing the keys of the main space.
+ *
+ * Frequencies are estimated with a count-min sketch of 4 rows of 4 bit
+ * counters, with at least as many counters per row as keys in the dataset,
+ * recording every key lookup, hit or miss. To forget old accesses, all the
+ * counters are halved every TINYLFU_SAMPLE_FACTOR lookups per counter.
+ * --------------------------------------------------------------------------*/
+
+#define TINYLFU_DEPTH 4
+#define TINYLFU_MIN_WIDTH 1024
+#define TINYLFU_SAMPLE_FACTOR 10
+#define TINYLFU_WINDOW_PERC 1
+#define TINYLFU_WINDOW_MIN 16
+#define TINYLFU_RESIZE_PERIOD 1024 /* Lookups between checks of the size. */
+
+struct tinylfuWindowEntry {
+    sds key;
+    int dbid;
+};
+
+static struct {
+    uint8_t *sketch;            /* TINYLFU_DEPTH rows of 'width' counters. */
+    unsigned long width;        /* Counters per row, power of two. */
+    unsigned long long additions; /* Lookups since the last halving. */
+    unsigned long long lookups; /* Lookups since the last size check. */
+    size_t keys;                /* Keys in all the DBs at the last check. */
+    struct tinylfuWindowEntry *window; /* Circular buffer. */
+    size_t window_size, window_head, window_len;
+} tinylfu;
+
+/* Return the counter 'idx' of the sketch. */
+static unsigned int tinylfuGetCounter(unsigned long idx) {
+    return (tinylfu.sketch[idx>>1] >> ((idx&1)<<2)) & 15;
+}
+
+/* Return the index of the counter of row 'row' for the hash 'hash'. */
+static unsigned long tinylfuIndex(uint64_t hash, int row) {
+    uint32_t h1 = hash, h2 = (hash >> 32) | 1;
+    return row*tinylfu.width + ((h1 + (uint64_t)row*h2) & (tinylfu.width-1));
+}
+
+/* Release the sketch and the window: called when the policy is changed. */
+void tinylfuReset(void) {
+    while(tinylfu.window_len) {
+        sdsfree(tinylfu.window[tinylfu.window_head].key);
+        tinylfu.window_head = (tinylfu.window_head+1) % tinylfu.window_size;
+        tinylfu.window_len--;
+    }
+    zfree(tinylfu.window);
+    zfree(tinylfu.sketch);
+    memset(&tinylfu,0,sizeof(tinylfu));
+}
+
+/* Create the sketch again, empty, if it has less counters per row than
+ * the number of keys. */
+static void tinylfuResizeIfNeeded(void) {
+    unsigned long width = tinylfu.width ? tinylfu.width : TINYLFU_MIN_WIDTH;
+    int j;
+
+    tinylfu.keys = 0;
+    for (j = 0; j < server.dbnum; j++)
+        tinylfu.keys += dictSize(server.db[j].dict);
+    while (width < tinylfu.keys) width <<= 1;
+    if (tinylfu.sketch && width == tinylfu.width) return;
+    zfree(tinylfu.sketch);
+    tinylfu.width = width;
+    tinylfu.sketch = zcalloc(TINYLFU_DEPTH*width/2);
+    tinylfu.additions = 0;
+}
+
+/* Record an access to 'key' in the frequency sketch. */
+void tinylfuRecordAccess(sds key) {
+    uint64_t hash = dictGenHashFunction(key,sdslen(key));
+    int j;
+
+    if (tinylfu.sketch == NULL ||
+        ++tinylfu.lookups % TINYLFU_RESIZE_PERIOD == 0)
+    {
+        tinylfuResizeIfNeeded();
+    }
+    for (j = 0; j < TINYLFU_DEPTH; j++) {
+        unsigned long idx = tinylfuIndex(hash,j);
+
+        if (tinylfuGetCounter(idx) < 15)
+            tinylfu.sketch[idx>>1] += 1 << ((idx&1)<<2);
+    }
+
+    /* Halve all the counters from time to time, so that the estimation
+     * reflects the recent accesses. */
+    if (++tinylfu.additions >= TINYLFU_SAMPLE_FACTOR*tinylfu.width) {
+        size_t bytes = TINYLFU_DEPTH*tinylfu.width/2, i;
+
+        for (i = 0; i < bytes; i++)
+            tinylfu.sketch[i] = (tinylfu.sketch[i] >> 1) & 0x77;
+        tinylfu.additions /= 2;
+    }
+}
+
+/* Return the estimated access frequency of 'key', from 0 to 15. */
+unsigned int tinylfuEstimate(sds key) {
+    uint64_t hash = dictGenHashFunction(key,sdslen(key));
+    unsigned int min = 15;
+    int j;
+
+    if (tinylfu.sketch == NULL) return 0;
+    for (j = 0; j < TINYLFU_DEPTH; j++) {
+        unsigned int c = tinylfuGetCounter(tinylfuIndex(hash,j));
+        if (c < min) min = c;
+    }
+    return min;
+}
+
+/* Return the number of keys the window should hold. */
+static size_t tinylfuWindowMaxLen(void) {
+    size_t max = tinylfu.keys*TINYLFU_WINDOW_PERC/100;
+    return max < TINYLFU_WINDOW_MIN ? TINYLFU_WINDOW_MIN : max;
+}
+
+/* Remove the oldest key from the window, storing it in '*key' and '*dbid'.
+ * The caller should free the key. Returns 0 if the window is empty. */
+static int tinylfuWindowPop(sds *key, int *dbid) {
+    struct tinylfuWindowEntry *e;
+
+    if (tinylfu.window_len == 0) return 0;
+    e = tinylfu.window+tinylfu.window_head;
+    *key = e->key;
+    *dbid = e->dbid;
+    tinylfu.window_head = (tinylfu.window_head+1) % tinylfu.window_size;
+    tinylfu.window_len--;
+    return 1;
+}
+
+/* Add a key just created to the window. Keys are removed by eviction, see
+ * tinylfuAdmit(), but when no eviction is needed the window is still kept
+ * within twice its size, the oldest keys just leaving it. */
+void tinylfuWindowAdd(int dbid, sds key) {
+    struct tinylfuWindowEntry *e;
+    size_t maxlen = tinylfuWindowMaxLen()*2;
+    sds oldkey;
+    int olddbid;
+
+    while (tinylfu.window_len >= maxlen && tinylfuWindowPop(&oldkey,&olddbid))
+        sdsfree(oldkey);
+    if (tinylfu.window_len == tinylfu.window_size) {
+        /* Grow the circular buffer, moving the entries at its start. */
+        size_t size = tinylfu.window_size ? tinylfu.window_size*2 :
+                                            TINYLFU_WINDOW_MIN;
+        struct tinylfuWindowEntry *window = zmalloc(sizeof(*window)*size);
+        size_t j;
+
+        for (j = 0; j < tinylfu.window_len; j++) {
+            window[j] = tinylfu.window[(tinylfu.window_head+j) %
+                                       tinylfu.window_size];
+        }
+        zfree(tinylfu.window);
+        tinylfu.window = window;
+        tinylfu.window_size = size;
+        tinylfu.window_head = 0;
+    }
+    e = tinylfu.window+((tinylfu.window_head+tinylfu.window_len) %
+                        tinylfu.window_size);
+    e->key = sdsdup(key);
+    e->dbid = dbid;
+    tinylfu.window_len++;
+}
+
+/* Given the victim 'victim' of DB 'dbid' selected by the eviction pool,
+ * if the window is full let its oldest key compete with it: if the key
+ * leaving the window is not accessed more often than the victim, it is
+ * the one to evict. In that case '*victim' and '*dbid' are updated. Keys
+ * of the window that no longer exist are skipped. */
+static void tinylfuAdmit(sds *victim, int *dbid) {
+    size_t maxlen = tinylfuWindowMaxLen();
+    sds candidate;
+    int cdbid;
+
+    while (tinylfu.window_len > maxlen &&
+           tinylfuWindowPop(&candidate,&cdbid))
+    {
+        dictEntry *de = dictFind(server.db[cdbid].dict,candidate);
+
+        if (de && tinylfuEstimate(candidate) <= tinylfuEstimate(*victim)) {
+            *victim = dictGetKey(de);
+            *dbid = cdbid;
+        }
+        sdsfree(candidate);
+        if (de) break; /* Admitted or evicted, in both cases we are done. */
+    }
+}
+
 /* ----------------------------------------------------------------------------
  * The external API for eviction: freeMemroyIfNeeded() is called by the
  * server when there is data to add in order to make space if needed.
  * --------------------------------------------------------------------------*/
 
-/* We don't want to count AOF buffers and slaves output buffers as
- * used memory: the eviction should use mostly data size. This function
- * returns the sum of AOF and slaves buffer. */
+/* We don't want to count AOF buffers, slaves output buffers and the output
+ * of a BGSAVE without fork as used memory: the eviction should use mostly
+ * data size. This function returns the sum of these buffers. */
 size_t freeMemoryGetNotCountedMemory(void) {
     size_t overhead = 0;
     int slaves = listLength(server.slaves);
@@ -365,19 +570,70 @@ size_t freeMemoryGetNotCountedMemory(void) {
         listRewind(server.slaves,&li);
         while((ln = listNext(&li))) {
             client *slave = listNodeValue(ln);
-            overhead += getClientOutputBufferMemoryUsage(slave);
+            overhead += getClientReplyMemoryUsage(slave);
         }
+
+        /* The slaves share the replication buffer with the backlog: only
+         * what exceeds the backlog size is the memory used by the slaves. */
+        if ((long long)server.repl_buffer_mem > server.repl_backlog_size)
+            overhead += server.repl_buffer_mem - server.repl_backlog_size;
     }
     if (server.aof_state != AOF_OFF) {
         overhead += sdslen(server.aof_buf)+aofRewriteBufferSize();
     }
+    overhead += snapshotBufferedBytes();
     return overhead;
 }
 
+static int eviction_timer_active = 0; /* Is evictionTimeProc() scheduled? */
+
+/* Continue the eviction stopped by freeMemoryIfNeeded() because of the
+ * time limit, as soon as possible, until the debt is paid. */
+static int evictionTimeProc(struct aeEventLoop *eventLoop, long long id,
+                            void *clientData)
+{
+    UNUSED(eventLoop);
+    UNUSED(id);
+    UNUSED(clientData);
+
+    if (clientsArePaused()) return 100; /* Try again later. */
+    if (server.maxmemory == 0) {
+        evictionSetDebt(0);
+    } else {
+        freeMemoryIfNeeded();
+    }
+    if (server.eviction_debt) return 0;
+    eviction_timer_active = 0;
+    return AE_NOMORE;
+}
+
+/* Set the number of bytes still to evict after freeMemoryIfNeeded() reached
+ * the eviction time limit, starting the time event evicting them if needed,
+ * or zero when there is nothing left to evict. When the debt is paid the
+ * time it took is reported as the "eviction-debt" latency event.
+ *
+ * Without an event loop, as in redis-evict-sim, the caller is in charge of
+ * calling freeMemoryIfNeeded() again while server.eviction_debt is set. */
+void evictionSetDebt(size_t debt) {
+    if (debt && !server.eviction_debt) {
+        server.eviction_debt_start = mstime();
+        if (!eviction_timer_active && server.el &&
+            aeCreateTimeEvent(server.el,0,evictionTimeProc,NULL,NULL) != AE_ERR)
+        {
+            eviction_timer_active = 1;
+        }
+    } else if (!debt && server.eviction_debt) {
+        latencyAddSampleIfNeeded("eviction-debt",
+            mstime()-server.eviction_debt_start);
+    }
+    server.eviction_debt = debt;
+}
+
 int freeMemoryIfNeeded(void) {
     size_t mem_reported, mem_used, mem_tofree, mem_freed;
     mstime_t latency, eviction_latency;
-    long long delta;
+    long long delta, start;
+    long long evicted = 0;
     int slaves = listLength(server.slaves);
 
     /* When clients are paused the dataset should be static not just from the
@@ -388,7 +644,10 @@ int freeMemoryIfNeeded(void) {
     /* Check if we are over the memory usage limit. If we are not, no need
      * to subtract the slaves output buffers. We can just return ASAP. */
     mem_reported = zmalloc_used_memory();
-    if (mem_reported <= server.maxmemory) return C_OK;
+    if (mem_reported <= server.maxmemory) {
+        if (server.eviction_debt) evictionSetDebt(0);
+        return C_OK;
+    }
 
     /* Remove the size of slaves output buffers and AOF buffer from the
      * count of used memory. */
@@ -397,7 +656,10 @@ int freeMemoryIfNeeded(void) {
     mem_used = (mem_used > overhead) ? mem_used-overhead : 0;
 
     /* Check if we are still over the memory limit. */
-    if (mem_used <= server.maxmemory) return C_OK;
+    if (mem_used <= server.maxmemory) {
+        if (server.eviction_debt) evictionSetDebt(0);
+        return C_OK;
+    }
 
     /* Compute how much memory we need to free. */
     mem_tofree = mem_used - server.maxmemory;
@@ -406,6 +668,7 @@ int freeMemoryIfNeeded(void) {
     if (server.maxmemory_policy == MAXMEMORY_NO_EVICTION)
         goto cant_free; /* We need to free memory, but policy forbids. */
 
+    start = server.maxmemory_eviction_time_limit ? ustime() : 0;
     latencyStartMonitor(latency);
     while (mem_freed < mem_tofree) {
         int j, k, i, keys_freed = 0;
@@ -413,7 +676,6 @@ int freeMemoryIfNeeded(void) {
         sds bestkey = NULL;
         int bestdbid;
         redisDb *db;
-        dict *dict;
         dictEntry *de;
 
         if (server.maxmemory_policy & (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU) ||
@@ -429,10 +691,10 @@ int freeMemoryIfNeeded(void) {
                  * every DB. */
                 for (i = 0; i < server.dbnum; i++) {
                     db = server.db+i;
-                    dict = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
-                            db->dict : db->expires;
-                    if ((keys = dictSize(dict)) != 0) {
-                        evictionPoolPopulate(i, dict, db->dict, pool);
+                    keys = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
+                            dictSize(db->dict) : dictMarkedSize(db->dict);
+                    if (keys != 0) {
+                        evictionPoolPopulate(i, db->dict, pool);
                         total_keys += keys;
                     }
                 }
@@ -443,13 +705,12 @@ int freeMemoryIfNeeded(void) {
                     if (pool[k].key == NULL) continue;
                     bestdbid = pool[k].dbid;
 
-                    if (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) {
-                        de = dictFind(server.db[pool[k].dbid].dict,
-                            pool[k].key);
-                    } else {
-                        de = dictFind(server.db[pool[k].dbid].expires,
-                            pool[k].key);
-                    }
+                    de = dictFind(server.db[pool[k].dbid].dict,
+                        pool[k].key);
+                    /* With a volatile policy the key must still have an
+                     * expire to be evicted. */
+                    if (de && !(server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS)
+                        && keyGetExpire(dictGetKey(de)) == -1) de = NULL;
 
                     /* Remove the entry from the pool. */
                     if (pool[k].key != pool[k].cached)
@@ -467,6 +728,11 @@ int freeMemoryIfNeeded(void) {
                     }
                 }
             }
+            if (bestkey &&
+                server.maxmemory_policy == MAXMEMORY_ALLKEYS_TINYLFU)
+            {
+                tinylfuAdmit(&bestkey,&bestdbid);
+            }
         }
 
         /* volatile-random and allkeys-random policy */
@@ -479,10 +745,12 @@ int freeMemoryIfNeeded(void) {
             for (i = 0; i < server.dbnum; i++) {
                 j = (++next_db) % server.dbnum;
                 db = server.db+j;
-                dict = (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM) ?
-                        db->dict : db->expires;
-                if (dictSize(dict) != 0) {
-                    de = dictGetRandomKey(dict);
+                if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM) {
+                    de = dictSize(db->dict) ? dictGetRandomKey(db->dict) : NULL;
+                } else if (dictGetSomeMarkedKeys(db->dict,&de,1) == 0) {
+                    de = NULL;
+                }
+                if (de) {
                     bestkey = dictGetKey(de);
                     bestdbid = j;
                     break;
@@ -519,6 +787,7 @@ int freeMemoryIfNeeded(void) {
                 keyobj, db->id);
             decrRefCount(keyobj);
             keys_freed++;
+            evicted++;
 
             /* When the memory to free starts to be big enough, we may
              * start spending so much time here that is impossible to
@@ -533,7 +802,7 @@ int freeMemoryIfNeeded(void) {
              * memory, since the "mem_freed" amount is computed only
              * across the dbAsyncDelete() call, while the thread can
              * release the memory all the time. */
-            if (server.lazyfree_lazy_eviction && !(keys_freed % 16)) {
+            if (server.lazyfree_lazy_eviction && !(evicted % 16)) {
                 overhead = freeMemoryGetNotCountedMemory();
                 mem_used = zmalloc_used_memory();
                 mem_used = (mem_used > overhead) ? mem_used-overhead : 0;
@@ -548,12 +817,26 @@ int freeMemoryIfNeeded(void) {
             latencyAddSampleIfNeeded("eviction-cycle",latency);
             goto cant_free; /* nothing to free... */
         }
+
+        /* Stop when the time limit is reached: the rest is evicted in
+         * background, see evictionSetDebt(). */
+        if (start && mem_freed < mem_tofree && !(evicted % 16) &&
+            ustime()-start > server.maxmemory_eviction_time_limit)
+        {
+            latencyEndMonitor(latency);
+            latencyAddSampleIfNeeded("eviction-cycle",latency);
+            evictionSetDebt(mem_tofree-mem_freed);
+            return C_ERR;
+        }
     }
     latencyEndMonitor(latency);
     latencyAddSampleIfNeeded("eviction-cycle",latency);
+    if (server.eviction_debt) evictionSetDebt(0);
     return C_OK;
 
 cant_free:
+    if (server.eviction_debt) evictionSetDebt(0);
+
     /* We are here if we are not able to reclaim memory. There is only one
      * last thing we can try: check if the lazyfree thread has jobs in queue
      * and wait... */
@@ -42,7 +42,8 @@
 
 /* Helper function for the activeExpireCycle() function.
  * This function will try to expire the key that is stored in the hash table
- * entry 'de' of the 'expires' hash table of a Redis database.
+ * entry 'de' of the keyspace of a Redis database, that must be a key with
+ * an expire set.
  *
  * If the key is found to be expired, it is removed from the database and
  * 1 is returned. Otherwise no operation is performed and 0 is returned.
@@ -52,9 +53,9 @@
  * The parameter 'now' is the current time in milliseconds as is passed
  * to the function to avoid too many gettimeofday() syscalls. */
 int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
-    long long t = dictGetSignedIntegerVal(de);
+    sds key = dictGetKey(de);
+    long long t = keyGetExpire(key);
     if (now > t) {
-        sds key = dictGetKey(de);
         robj *keyobj = createStringObject(key,sdslen(key));
 
         propagateExpire(db,keyobj,server.lazyfree_lazy_expire);
@@ -72,6 +73,244 @@ int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
     }
 }
 
+/*-----------------------------------------------------------------------------
+ * Expires index
+ *
+ * When active-expire-index is enabled every DB has a radix tree with an
+ * element for every key with an expire set. Elements are the unix time in
+ * milliseconds of the expire, as a 64 bit big endian integer with the sign
+ * bit flipped, followed by the key name: iterating the tree returns the
+ * keys in the order they expire, so the active expire cycle can reclaim
+ * the expired keys directly instead of looking for them by sampling.
+ *
+ * The number of indexed keys expiring before 'expired_until' is kept in
+ * 'expired_backlog', updated when keys are added or removed: moving
+ * 'expired_until' forward only visits the keys expiring meanwhile.
+ *----------------------------------------------------------------------------*/
+
+#define EXPIRE_INDEX_TIME_LEN 8
+
+static void expireIndexEncodeTime(unsigned char *buf, long long when) {
+    uint64_t t = (uint64_t)when ^ (1ULL<<63);
+    int j;
+
+    for (j = EXPIRE_INDEX_TIME_LEN-1; j >= 0; j--) {
+        buf[j] = t & 0xff;
+        t >>= 8;
+    }
+}
+
+static long long expireIndexDecodeTime(unsigned char *buf) {
+    uint64_t t = 0;
+    int j;
+
+    for (j = 0; j < EXPIRE_INDEX_TIME_LEN; j++) t = (t<<8) | buf[j];
+    return (long long)(t ^ (1ULL<<63));
+}
+
+/* Add or remove the element of the key 'key' expiring at 'when' to or from
+ * the expires index of 'db'. Nothing is done if the index is disabled. */
+void expireIndexUpdateKey(redisDb *db, sds key, long long when, int add) {
+    size_t keylen = sdslen(key);
+    unsigned char buf[64];
+    unsigned char *indexed = buf;
+
+    if (db->expires_index == NULL) return;
+    if (keylen+EXPIRE_INDEX_TIME_LEN > sizeof(buf))
+        indexed = zmalloc(keylen+EXPIRE_INDEX_TIME_LEN);
+    expireIndexEncodeTime(indexed,when);
+    memcpy(indexed+EXPIRE_INDEX_TIME_LEN,key,keylen);
+    if (add) {
+        if (raxInsert(db->expires_index,indexed,keylen+EXPIRE_INDEX_TIME_LEN,
+                      NULL,NULL) && when < db->expired_until)
+            db->expired_backlog++;
+    } else {
+        if (raxRemove(db->expires_index,indexed,keylen+EXPIRE_INDEX_TIME_LEN,
+                      NULL) && when < db->expired_until)
+            db->expired_backlog--;
+    }
+    if (indexed != buf) zfree(indexed);
+}
+
+/* Empty the expires index of 'db', if enabled. With 'async' the old index
+ * is released by the lazyfree thread. */
+void expireIndexFlush(redisDb *db, int async) {
+    rax *old = db->expires_index;
+
+    if (old == NULL) return;
+    db->expires_index = raxNew();
+    db->expired_until = LLONG_MIN;
+    db->expired_backlog = 0;
+    if (async) {
+        expireIndexFreeAsync(old);
+    } else {
+        raxFree(old);
+    }
+}
+
+/* Create or release the expires index of every DB. The index is created
+ * scanning the whole keyspace, so enabling it at runtime blocks the server
+ * for a time proportional to the number of keys. */
+void expireIndexToggle(int enable) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+
+        if (enable && db->expires_index == NULL) {
+            dictIterator *di = dictGetIterator(db->dict);
+            dictEntry *de;
+
+            db->expires_index = raxNew();
+            db->expired_until = LLONG_MIN;
+            db->expired_backlog = 0;
+            while((de = dictNext(di)) != NULL) {
+                sds key = dictGetKey(de);
+                long long when = keyGetExpire(key);
+
+                if (when != -1) expireIndexUpdateKey(db,key,when,1);
+            }
+            dictReleaseIterator(di);
+        } else if (!enable && db->expires_index != NULL) {
+            raxFree(db->expires_index);
+            db->expires_index = NULL;
+        }
+    }
+}
+
+/* Reclaim up to 'count' keys of 'db' already expired at time 'now', in the
+ * order they expired, using the expires index. Returns the number of keys
+ * reclaimed: if it is 'count' there may be more expired keys. */
+static int activeExpireCycleFromIndex(redisDb *db, long long now, int count) {
+    sds keys[ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP];
+    long long when[ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP];
+    int num = 0, expired = 0, j;
+    raxIterator ri;
+
+    if (count > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP)
+        count = ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP;
+
+    /* Collect the names first: deleting the keys modifies the tree. */
+    raxStart(&ri,db->expires_index);
+    raxSeek(&ri,"^",NULL,0);
+    while(num < count && raxNext(&ri)) {
+        when[num] = expireIndexDecodeTime(ri.key);
+        if (when[num] >= now) break;
+        keys[num] = sdsnewlen(ri.key+EXPIRE_INDEX_TIME_LEN,
+                              ri.key_len-EXPIRE_INDEX_TIME_LEN);
+        num++;
+    }
+    raxStop(&ri);
+
+    for (j = 0; j < num; j++) {
+        dictEntry *de = dictFind(db->dict,keys[j]);
+
+        if (de && activeExpireCycleTryExpire(db,de,now)) {
+            expired++;
+        } else {
+            /* Never expected: just drop the stale element. */
+            expireIndexUpdateKey(db,keys[j],when[j],0);
+        }
+        sdsfree(keys[j]);
+    }
+    return expired;
+}
+
+/* Return the number of keys of 'db' that already expired at time 'now' but
+ * were not reclaimed yet. With the expires index the count is exact, and
+ * only the keys that expired since the previous call are visited: this
+ * matters for slaves, that never reclaim expired keys by themselves.
+ * Otherwise the count is estimated sampling the keys with an expire. */
+unsigned long long expiredKeysBacklog(redisDb *db, long long now) {
+    unsigned long long backlog = 0;
+
+    if (db->expires_index) {
+        if (now > db->expired_until) {
+            unsigned char start[EXPIRE_INDEX_TIME_LEN];
+            raxIterator ri;
+
+            expireIndexEncodeTime(start,db->expired_until);
+            raxStart(&ri,db->expires_index);
+            raxSeek(&ri,">=",start,EXPIRE_INDEX_TIME_LEN);
+            while(raxNext(&ri) && expireIndexDecodeTime(ri.key) < now)
+                db->expired_backlog++;
+            raxStop(&ri);
+            db->expired_until = now;
+        }
+        backlog = db->expired_backlog;
+    } else if (dictMarkedSize(db->dict)) {
+        dictEntry *samples[ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP];
+        unsigned long num, k;
+
+        num = dictGetSomeMarkedKeys(db->dict,samples,
+                                    ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP);
+        for (k = 0; k < num; k++) {
+            if (keyGetExpire(dictGetKey(samples[k])) < now) backlog++;
+        }
+        if (num) backlog = backlog*dictMarkedSize(db->dict)/num;
+    }
+    return backlog;
+}
+
+/* A single loop of the active expire cycle in the specified DB, using 'now'
+ * as the current time: return the number of keys expired.
+ *
+ * The keys with an expire are marked in the buckets of the keyspace, so
+ * random keys among them are sampled, checking for expired ones, without
+ * accessing the other entries. The sampled entries are never duplicated, so
+ * they can be deleted one after the other.
+ *
+ * With the expires index there is no need to sample: the expired keys are
+ * reclaimed directly in the order they expired. In this case the average
+ * TTL is not updated. */
+int activeExpireCycleTryExpireSome(redisDb *db, long long now) {
+    dictEntry *samples[ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP];
+    unsigned long num, k;
+    long long ttl_sum = 0;
+    int ttl_samples = 0, expired = 0;
+
+    if (db->expires_index)
+        return activeExpireCycleFromIndex(db,now,
+                                    ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP);
+
+    num = dictGetSomeMarkedKeys(db->dict,samples,
+                                ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP);
+    for (k = 0; k < num; k++) {
+        dictEntry *de = samples[k];
+        long long ttl;
+
+        ttl = keyGetExpire(dictGetKey(de))-now;
+        if (activeExpireCycleTryExpire(db,de,now)) expired++;
+        if (ttl > 0) {
+            /* We want the average TTL of keys yet not expired. */
+            ttl_sum += ttl;
+            ttl_samples++;
+        }
+    }
+
+    /* Update the average TTL stats for this database. */
+    if (ttl_samples) {
+        long long avg_ttl = ttl_sum/ttl_samples;
+
+        /* Do a simple running average with a few samples.
+         * We just use the current estimate with a weight of 2%
+         * and the previous estimate with a weight of 98%. */
+        if (db->avg_ttl == 0) db->avg_ttl = avg_ttl;
+        db->avg_ttl = (db->avg_ttl/50)*49 + (avg_ttl/50);
+    }
+    return expired;
+}
+
+/* Return true if the active expire cycle should run another loop in the
+ * DB, after a loop that expired 'expired' keys: we don't repeat the cycle
+ * if there are less than 25% of keys found expired in the current DB, or,
+ * using the index, if there are no more expired keys. */
+int activeExpireCycleShouldRepeat(redisDb *db, int expired) {
+    return db->expires_index ?
+           expired == ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP :
+           expired > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP/4;
+}
+
 /* Try to expire a few timed out keys. The algorithm used is adaptive and
  * will use few CPU cycles if there are few expiring keys, otherwise
  * it will get more aggressive to avoid that too much memory is used by
@@ -152,57 +391,12 @@ void activeExpireCycle(int type) {
         /* Continue to expire if at the end of the cycle more than 25%
          * of the keys were expired. */
         do {
-            unsigned long num, slots;
-            long long now, ttl_sum;
-            int ttl_samples;
-
             /* If there is nothing to expire try next DB ASAP. */
-            if ((num = dictSize(db->expires)) == 0) {
+            if (dictMarkedSize(db->dict) == 0) {
                 db->avg_ttl = 0;
                 break;
             }
-            slots = dictSlots(db->expires);
-            now = mstime();
-
-            /* When there are less than 1% filled slots getting random
-             * keys is expensive, so stop here waiting for better times...
-             * The dictionary will be resized asap. */
-            if (num && slots > DICT_HT_INITIAL_SIZE &&
-                (num*100/slots < 1)) break;
-
-            /* The main collection cycle. Sample random keys among keys
-             * with an expire set, checking for expired ones. */
-            expired = 0;
-            ttl_sum = 0;
-            ttl_samples = 0;
-
-            if (num > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP)
-                num = ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP;
-
-            while (num--) {
-                dictEntry *de;
-                long long ttl;
-
-                if ((de = dictGetRandomKey(db->expires)) == NULL) break;
-                ttl = dictGetSignedIntegerVal(de)-now;
-                if (activeExpireCycleTryExpire(db,de,now)) expired++;
-                if (ttl > 0) {
-                    /* We want the average TTL of keys yet not expired. */
-                    ttl_sum += ttl;
-                    ttl_samples++;
-                }
-            }
-
-            /* Update the average TTL stats for this database. */
-            if (ttl_samples) {
-                long long avg_ttl = ttl_sum/ttl_samples;
-
-                /* Do a simple running average with a few samples.
-                 * We just use the current estimate with a weight of 2%
-                 * and the previous estimate with a weight of 98%. */
-                if (db->avg_ttl == 0) db->avg_ttl = avg_ttl;
-                db->avg_ttl = (db->avg_ttl/50)*49 + (avg_ttl/50);
-            }
+            expired = activeExpireCycleTryExpireSome(db,mstime());
 
             /* We can't block forever here even if there are many keys to
              * expire. So after a given amount of milliseconds return to the
@@ -215,9 +409,7 @@ void activeExpireCycle(int type) {
                 if (elapsed > timelimit) timelimit_exit = 1;
             }
             if (timelimit_exit) return;
-            /* We don't repeat the cycle if there are less than 25% of keys
-             * found expired in the current DB. */
-        } while (expired > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP/4);
+        } while (activeExpireCycleShouldRepeat(db,expired));
     }
 }
 
@@ -278,9 +470,12 @@ void expireSlaveKeys(void) {
         while(dbids && dbid < server.dbnum) {
             if ((dbids & 1) != 0) {
                 redisDb *db = server.db+dbid;
-                dictEntry *expire = dictFind(db->expires,keyname);
+                dictEntry *expire = dictFind(db->dict,keyname);
                 int expired = 0;
 
+                if (expire && keyGetExpire(dictGetKey(expire)) == -1)
+                    expire = NULL;
+
                 if (expire &&
                     activeExpireCycleTryExpire(server.db+dbid,expire,start))
                 {
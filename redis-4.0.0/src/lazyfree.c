@@ -4,7 +4,6 @@
 #include "cluster.h"
 
 static size_t lazyfree_objects = 0;
-pthread_mutex_t lazyfree_objects_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* Return the number of currently pending objects to free. */
 size_t lazyfreeGetPendingObjectsCount(void) {
@@ -29,7 +28,9 @@ size_t lazyfreeGetPendingObjectsCount(void) {
  * For lists the funciton returns the number of elements in the quicklist
  * representing the list. */
 size_t lazyfreeGetFreeEffort(robj *obj) {
-    if (obj->type == OBJ_LIST) {
+    if (obj->encoding == OBJ_ENCODING_SPILLED) {
+        return 1; /* Just the stub, the value is on disk. */
+    } else if (obj->type == OBJ_LIST) {
         quicklist *ql = obj->ptr;
         return ql->len;
     } else if (obj->type == OBJ_SET && obj->encoding == OBJ_ENCODING_HT) {
@@ -52,31 +53,40 @@ size_t lazyfreeGetFreeEffort(robj *obj) {
  * will be reclaimed in a different bio.c thread. */
 #define LAZYFREE_THRESHOLD 64
 int dbAsyncDelete(redisDb *db, robj *key) {
-    /* Deleting an entry from the expires dict will not free the sds of
-     * the key, because it is shared with the main dictionary. */
-    if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
-
     /* If the value is composed of a few allocations, to free in a lazy way
      * is actually just slower... So under a certain limit we just free
      * the object synchronously. */
-    dictEntry *de = dictUnlink(db->dict,key->ptr);
+    dictEntry *de;
+    robj *lazyval = NULL;
+
+    snapshotBeforeKeyWrite(db,key);
+    de = dictUnlink(db->dict,key->ptr);
     if (de) {
         robj *val = dictGetVal(de);
         size_t free_effort = lazyfreeGetFreeEffort(val);
+        long long when = keyGetExpire(dictGetKey(de));
+
+        if (when != -1) expireIndexUpdateKey(db,dictGetKey(de),when,0);
 
         /* If releasing the object is too much work, let's put it into the
-         * lazy free list. */
-        if (free_effort > LAZYFREE_THRESHOLD) {
-            atomicIncr(lazyfree_objects,1);
-            bioCreateBackgroundJob(BIO_LAZY_FREE,val,NULL,NULL);
+         * lazy free list. Objects referenced elsewhere, like the value of
+         * a key being renamed, can't be released by another thread. */
+        if (free_effort > LAZYFREE_THRESHOLD && val->refcount == 1) {
+            lazyval = val;
             dictSetVal(db->dict,de,NULL);
         }
     }
 
     /* Release the key-val pair, or just the key if we set the val
-     * field to NULL in order to lazy free it later. */
+     * field to NULL in order to lazy free it later. The value is passed
+     * to the lazy free thread only after the key is released, since the
+     * key may be embedded in the value. */
     if (de) {
         dictFreeUnlinkedEntry(db->dict,de);
+        if (lazyval) {
+            atomicIncr(lazyfree_objects,1);
+            bioCreateBackgroundJob(BIO_LAZY_FREE,lazyval,NULL,NULL);
+        }
         if (server.cluster_enabled) slotToKeyDel(key);
         return 1;
     } else {
@@ -85,14 +95,14 @@ int dbAsyncDelete(redisDb *db, robj *key) {
 }
 
 /* Empty a Redis DB asynchronously. What the function does actually is to
- * create a new empty set of hash tables and scheduling the old ones for
- * lazy freeing. */
+ * create a new empty hash table and scheduling the old one for lazy
+ * freeing. */
 void emptyDbAsync(redisDb *db) {
-    dict *oldht1 = db->dict, *oldht2 = db->expires;
+    dict *oldht = db->dict;
+    copyClientsReplyObjects(); /* Clients may reference values in replies. */
     db->dict = dictCreate(&dbDictType,NULL);
-    db->expires = dictCreate(&keyptrDictType,NULL);
-    atomicIncr(lazyfree_objects,dictSize(oldht1));
-    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,oldht1,oldht2);
+    atomicIncr(lazyfree_objects,dictSize(oldht));
+    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,oldht,NULL);
 }
 
 /* Empty the slots-keys map of Redis CLuster by creating a new empty one
@@ -107,6 +117,13 @@ void slotToKeyFlushAsync(void) {
     bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,NULL,old);
 }
 
+/* Release in the lazyfree thread the expires index of a DB, that the caller
+ * already substituted with a fresh one. */
+void expireIndexFreeAsync(rax *index) {
+    atomicIncr(lazyfree_objects,index->numele);
+    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,NULL,index);
+}
+
 /* Release objects from the lazyfree thread. It's just decrRefCount()
  * updating the count of objects to release. */
 void lazyfreeFreeObjectFromBioThread(robj *o) {
@@ -114,21 +131,18 @@ void lazyfreeFreeObjectFromBioThread(robj *o) {
     atomicDecr(lazyfree_objects,1);
 }
 
-/* Release a database from the lazyfree thread. The 'db' pointer is the
- * database which was substitutied with a fresh one in the main thread
- * when the database was logically deleted. 'sl' is a skiplist used by
- * Redis Cluster in order to take the hash slots -> keys mapping. This
- * may be NULL if Redis Cluster is disabled. */
-void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2) {
-    size_t numkeys = dictSize(ht1);
-    dictRelease(ht1);
-    dictRelease(ht2);
+/* Release a database from the lazyfree thread. The 'ht' pointer is the
+ * keyspace of the database which was substitutied with a fresh one in the
+ * main thread when the database was logically deleted. */
+void lazyfreeFreeDatabaseFromBioThread(dict *ht) {
+    size_t numkeys = dictSize(ht);
+    dictRelease(ht);
     atomicDecr(lazyfree_objects,numkeys);
 }
 
-/* Release the skiplist mapping Redis Cluster keys to slots in the
- * lazyfree thread. */
-void lazyfreeFreeSlotsMapFromBioThread(rax *rt) {
+/* Release a radix tree in the lazyfree thread: the map of Redis Cluster
+ * keys to slots, or the expires index of a DB. */
+void lazyfreeFreeRadixTreeFromBioThread(rax *rt) {
     size_t len = rt->numele;
     raxFree(rt);
     atomicDecr(lazyfree_objects,len);
@@ -0,0 +1,1315 @@
+/* Listpack -- A lists of strings serialization format
+ *
+ * The listpack is a compact, contiguous representation of a list of strings
+ * and integers, used by Redis to encode small hashes, small sorted sets and
+ * the nodes of the quicklist. It replaces the ziplist with a simpler layout
+ * that removes a pathological case of the latter.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * LISTPACK OVERALL LAYOUT
+ * =======================
+ *
+ * <tot-bytes> <num-elements> <element-1> ... <element-N> <listpack-end-byte>
+ *
+ * <uint32_t tot-bytes> is the total number of bytes of the listpack, header
+ * and terminator included, so that it can be resized without a traversal.
+ *
+ * <uint16_t num-elements> is the number of elements, or 65535 if there are
+ * more than 65534 elements: in that case a full scan is needed to count
+ * them (and the field is updated again if the count drops below the limit).
+ *
+ * <uint8_t listpack-end-byte> is always 255. No element starts with 255.
+ *
+ * All the header fields are stored in little endian.
+ *
+ * LISTPACK ELEMENTS
+ * =================
+ *
+ * Every element is made of three parts:
+ *
+ * <encoding-type><element-data><element-tot-len>
+ *
+ * The encoding type specifies if the element is an integer or a string, and
+ * in the case of strings, its length. The following encodings are used,
+ * selected looking at the first byte:
+ *
+ * 0|xxxxxxx                       7 bit unsigned integer (0-127).
+ * 10|xxxxxx <string>              String of up to 63 bytes.
+ * 110|xxxxx yyyyyyyy              13 bit signed integer.
+ * 1110|xxxx yyyyyyyy <string>     String of up to 4095 bytes.
+ * 11110000 <4 bytes len> <string> String of up to 2^32-1 bytes.
+ * 11110001 <2 bytes>              16 bit signed integer.
+ * 11110010 <3 bytes>              24 bit signed integer.
+ * 11110011 <4 bytes>              32 bit signed integer.
+ * 11110100 <8 bytes>              64 bit signed integer.
+ * 11111111                        End of listpack.
+ *
+ * Strings that are valid integers in the canonical form are always stored
+ * as integers, using the smallest encoding able to represent them. Negative
+ * integers are stored in two's complement with the width of the encoding.
+ *
+ * <element-tot-len> is the number of bytes of <encoding-type> plus
+ * <element-data>, stored in a variable length encoding that can be parsed
+ * from right to left: every byte holds 7 bits of the length, the least
+ * significant bits being in the rightmost byte, and the most significant
+ * bit of a byte is set if more bytes follow on its left. This is what
+ * allows to traverse the listpack backward.
+ *
+ * Since every element only stores information about itself, inserting or
+ * deleting an element never changes the other elements: unlike the ziplist,
+ * where each entry encodes the length of the previous one with a 1 or 5
+ * bytes field, there is no cascading update that has to rewrite and move
+ * the whole blob once an entry grows past 253 bytes.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2017, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include "zmalloc.h"
+#include "util.h"
+#include "listpack.h"
+#include "redisassert.h"
+
+#define LP_HDR_SIZE 6       /* 32 bit total len + 16 bit number of elements. */
+#define LP_HDR_NUMELE_UNKNOWN UINT16_MAX
+#define LP_MAX_INT_ENCODING_LEN 9
+#define LP_MAX_BACKLEN_SIZE 5
+#define LP_ENCODING_INT 0
+#define LP_ENCODING_STRING 1
+
+#define LP_ENCODING_7BIT_UINT 0
+#define LP_ENCODING_7BIT_UINT_MASK 0x80
+#define LP_ENCODING_IS_7BIT_UINT(byte) (((byte)&LP_ENCODING_7BIT_UINT_MASK)==LP_ENCODING_7BIT_UINT)
+
+#define LP_ENCODING_6BIT_STR 0x80
+#define LP_ENCODING_6BIT_STR_MASK 0xC0
+#define LP_ENCODING_IS_6BIT_STR(byte) (((byte)&LP_ENCODING_6BIT_STR_MASK)==LP_ENCODING_6BIT_STR)
+
+#define LP_ENCODING_13BIT_INT 0xC0
+#define LP_ENCODING_13BIT_INT_MASK 0xE0
+#define LP_ENCODING_IS_13BIT_INT(byte) (((byte)&LP_ENCODING_13BIT_INT_MASK)==LP_ENCODING_13BIT_INT)
+
+#define LP_ENCODING_12BIT_STR 0xE0
+#define LP_ENCODING_12BIT_STR_MASK 0xF0
+#define LP_ENCODING_IS_12BIT_STR(byte) (((byte)&LP_ENCODING_12BIT_STR_MASK)==LP_ENCODING_12BIT_STR)
+
+#define LP_ENCODING_16BIT_INT 0xF1
+#define LP_ENCODING_24BIT_INT 0xF2
+#define LP_ENCODING_32BIT_INT 0xF3
+#define LP_ENCODING_64BIT_INT 0xF4
+#define LP_ENCODING_32BIT_STR 0xF0
+
+#define LP_EOF 0xFF
+
+#define LP_ENCODING_6BIT_STR_LEN(p) ((p)[0] & 0x3F)
+#define LP_ENCODING_12BIT_STR_LEN(p) ((((p)[0] & 0xF) << 8) | (p)[1])
+#define LP_ENCODING_32BIT_STR_LEN(p) (((uint32_t)(p)[1]<<0) | \
+                                      ((uint32_t)(p)[2]<<8) | \
+                                      ((uint32_t)(p)[3]<<16) | \
+                                      ((uint32_t)(p)[4]<<24))
+
+#define lpGetTotalBytes(p)     (((uint32_t)(p)[0]<<0) | \
+                                ((uint32_t)(p)[1]<<8) | \
+                                ((uint32_t)(p)[2]<<16) | \
+                                ((uint32_t)(p)[3]<<24))
+
+#define lpGetNumElements(p)    (((uint32_t)(p)[4]<<0) | \
+                                ((uint32_t)(p)[5]<<8))
+#define lpSetTotalBytes(p,v) do { \
+    (p)[0] = (v)&0xff; \
+    (p)[1] = ((v)>>8)&0xff; \
+    (p)[2] = ((v)>>16)&0xff; \
+    (p)[3] = ((v)>>24)&0xff; \
+} while(0)
+
+#define lpSetNumElements(p,v) do { \
+    (p)[4] = (v)&0xff; \
+    (p)[5] = ((v)>>8)&0xff; \
+} while(0)
+
+/* Create a new, empty listpack. */
+unsigned char *lpNew(void) {
+    unsigned char *lp = zmalloc(LP_HDR_SIZE+1);
+    lpSetTotalBytes(lp,LP_HDR_SIZE+1);
+    lpSetNumElements(lp,0);
+    lp[LP_HDR_SIZE] = LP_EOF;
+    return lp;
+}
+
+/* Free the specified listpack. */
+void lpFree(unsigned char *lp) {
+    zfree(lp);
+}
+
+/* Store in 'intenc' the smallest integer encoding able to represent 'v',
+ * and its length (encoding byte included) in 'enclen'. */
+static void lpEncodeIntegerGetType(int64_t v, unsigned char *intenc, uint64_t *enclen) {
+    if (v >= 0 && v <= 127) {
+        intenc[0] = v;
+        *enclen = 1;
+    } else if (v >= -4096 && v <= 4095) {
+        if (v < 0) v = ((int64_t)1<<13)+v;
+        intenc[0] = (v>>8)|LP_ENCODING_13BIT_INT;
+        intenc[1] = v&0xff;
+        *enclen = 2;
+    } else if (v >= -32768 && v <= 32767) {
+        if (v < 0) v = ((int64_t)1<<16)+v;
+        intenc[0] = LP_ENCODING_16BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = v>>8;
+        *enclen = 3;
+    } else if (v >= -8388608 && v <= 8388607) {
+        if (v < 0) v = ((int64_t)1<<24)+v;
+        intenc[0] = LP_ENCODING_24BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = (v>>8)&0xff;
+        intenc[3] = v>>16;
+        *enclen = 4;
+    } else if (v >= -2147483648LL && v <= 2147483647LL) {
+        if (v < 0) v = ((int64_t)1<<32)+v;
+        intenc[0] = LP_ENCODING_32BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = (v>>8)&0xff;
+        intenc[3] = (v>>16)&0xff;
+        intenc[4] = v>>24;
+        *enclen = 5;
+    } else {
+        uint64_t uv = v;
+        intenc[0] = LP_ENCODING_64BIT_INT;
+        intenc[1] = uv&0xff;
+        intenc[2] = (uv>>8)&0xff;
+        intenc[3] = (uv>>16)&0xff;
+        intenc[4] = (uv>>24)&0xff;
+        intenc[5] = (uv>>32)&0xff;
+        intenc[6] = (uv>>40)&0xff;
+        intenc[7] = (uv>>48)&0xff;
+        intenc[8] = uv>>56;
+        *enclen = 9;
+    }
+}
+
+/* Return LP_ENCODING_INT if the element 'ele' of 'size' bytes can be encoded
+ * as an integer, filling 'intenc' with the encoded integer, or
+ * LP_ENCODING_STRING otherwise. In both cases 'enclen' is set to the number
+ * of bytes of the encoded element, excluding the backlen field. */
+static int lpEncodeGetType(unsigned char *ele, uint32_t size, unsigned char *intenc, uint64_t *enclen) {
+    long long v;
+
+    if (size <= 20 && string2ll((char*)ele,size,&v)) {
+        lpEncodeIntegerGetType(v,intenc,enclen);
+        return LP_ENCODING_INT;
+    } else {
+        if (size < 64) *enclen = 1+size;
+        else if (size < 4096) *enclen = 2+size;
+        else *enclen = 5+(uint64_t)size;
+        return LP_ENCODING_STRING;
+    }
+}
+
+/* Store the reverse-encoded length 'l' in 'buf', returning the number of
+ * bytes needed. If 'buf' is NULL just the number of bytes is returned. */
+static unsigned long lpEncodeBacklen(unsigned char *buf, uint64_t l) {
+    if (l <= 127) {
+        if (buf) buf[0] = l;
+        return 1;
+    } else if (l < 16383) {
+        if (buf) {
+            buf[0] = l>>7;
+            buf[1] = (l&127)|128;
+        }
+        return 2;
+    } else if (l < 2097151) {
+        if (buf) {
+            buf[0] = l>>14;
+            buf[1] = ((l>>7)&127)|128;
+            buf[2] = (l&127)|128;
+        }
+        return 3;
+    } else if (l < 268435455) {
+        if (buf) {
+            buf[0] = l>>21;
+            buf[1] = ((l>>14)&127)|128;
+            buf[2] = ((l>>7)&127)|128;
+            buf[3] = (l&127)|128;
+        }
+        return 4;
+    } else {
+        if (buf) {
+            buf[0] = l>>28;
+            buf[1] = ((l>>21)&127)|128;
+            buf[2] = ((l>>14)&127)|128;
+            buf[3] = ((l>>7)&127)|128;
+            buf[4] = (l&127)|128;
+        }
+        return 5;
+    }
+}
+
+/* Decode the backlen field whose last byte is pointed by 'p', returning
+ * the length of the element it belongs to. */
+static uint64_t lpDecodeBacklen(unsigned char *p) {
+    uint64_t val = 0;
+    uint64_t shift = 0;
+    do {
+        val |= (uint64_t)(p[0] & 127) << shift;
+        if (!(p[0] & 128)) break;
+        shift += 7;
+        p--;
+    } while (shift < 35);
+    return val;
+}
+
+/* Encode the string 's' of 'len' bytes in 'buf', which must be large
+ * enough, as returned by lpEncodeGetType(). */
+static void lpEncodeString(unsigned char *buf, unsigned char *s, uint32_t len) {
+    if (len < 64) {
+        buf[0] = len | LP_ENCODING_6BIT_STR;
+        memcpy(buf+1,s,len);
+    } else if (len < 4096) {
+        buf[0] = (len >> 8) | LP_ENCODING_12BIT_STR;
+        buf[1] = len & 0xff;
+        memcpy(buf+2,s,len);
+    } else {
+        buf[0] = LP_ENCODING_32BIT_STR;
+        buf[1] = len & 0xff;
+        buf[2] = (len >> 8) & 0xff;
+        buf[3] = (len >> 16) & 0xff;
+        buf[4] = (len >> 24) & 0xff;
+        memcpy(buf+5,s,len);
+    }
+}
+
+/* Return the number of bytes of the encoding type and data of the element
+ * pointed by 'p', that is, the element length without the backlen field.
+ * Zero is returned for an invalid encoding byte. */
+static uint32_t lpCurrentEncodedSize(unsigned char *p) {
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) return 1;
+    if (LP_ENCODING_IS_6BIT_STR(p[0])) return 1+LP_ENCODING_6BIT_STR_LEN(p);
+    if (LP_ENCODING_IS_13BIT_INT(p[0])) return 2;
+    if (LP_ENCODING_IS_12BIT_STR(p[0])) return 2+LP_ENCODING_12BIT_STR_LEN(p);
+    switch(p[0]) {
+    case LP_ENCODING_16BIT_INT: return 3;
+    case LP_ENCODING_24BIT_INT: return 4;
+    case LP_ENCODING_32BIT_INT: return 5;
+    case LP_ENCODING_64BIT_INT: return 9;
+    case LP_ENCODING_32BIT_STR: return 5+LP_ENCODING_32BIT_STR_LEN(p);
+    case LP_EOF: return 1;
+    default: return 0;
+    }
+}
+
+/* Return the number of bytes needed to read the full encoding type of the
+ * element starting with the 'encoding' byte: that's more than one only for
+ * strings, that store their length after the first byte. */
+static uint32_t lpEncodingTypeSize(unsigned char encoding) {
+    if (LP_ENCODING_IS_12BIT_STR(encoding)) return 2;
+    if (encoding == LP_ENCODING_32BIT_STR) return 5;
+    return 1;
+}
+
+/* Skip the element pointed by 'p', returning the address of the next one
+ * (which may be the terminator). */
+static unsigned char *lpSkip(unsigned char *p) {
+    unsigned long entrylen = lpCurrentEncodedSize(p);
+    entrylen += lpEncodeBacklen(NULL,entrylen);
+    return p+entrylen;
+}
+
+/* Return the element after 'p', or NULL if 'p' is the last one. */
+unsigned char *lpNext(unsigned char *lp, unsigned char *p) {
+    ((void) lp);
+    p = lpSkip(p);
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+/* Return the element before 'p', or NULL if 'p' is the first one. 'p' may
+ * also point to the terminator, in which case the last element is returned. */
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p) {
+    uint64_t prevlen;
+
+    if (p-lp == LP_HDR_SIZE) return NULL;
+    p--; /* Seek the last byte of the previous element's backlen. */
+    prevlen = lpDecodeBacklen(p);
+    prevlen += lpEncodeBacklen(NULL,prevlen);
+    return p-prevlen+1;
+}
+
+/* Return the first element of the listpack, or NULL if it is empty. */
+unsigned char *lpFirst(unsigned char *lp) {
+    unsigned char *p = lp+LP_HDR_SIZE;
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+/* Return the last element of the listpack, or NULL if it is empty. */
+unsigned char *lpLast(unsigned char *lp) {
+    unsigned char *p = lp+lpGetTotalBytes(lp)-1; /* Seek EOF element. */
+    return lpPrev(lp,p);
+}
+
+/* Return the number of elements of the listpack. When the header can't
+ * hold the count a full scan is performed, and the header is updated if
+ * the count turns out to fit again. */
+unsigned long lpLength(unsigned char *lp) {
+    uint32_t numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN) return numele;
+
+    uint32_t count = 0;
+    unsigned char *p = lpFirst(lp);
+    while(p) {
+        count++;
+        p = lpNext(lp,p);
+    }
+    if (count < LP_HDR_NUMELE_UNKNOWN) lpSetNumElements(lp,count);
+    return count;
+}
+
+/* Return the element pointed by 'p'.
+ *
+ * If it is a string, a pointer to the string is returned and 'count' is
+ * set to its length. If it is an integer and 'intbuf' is not NULL, the
+ * integer is converted to a string stored in 'intbuf' (at least
+ * LP_INTBUF_SIZE bytes), that is returned, with its length in 'count'.
+ * Otherwise NULL is returned and 'count' is set to the integer value. */
+unsigned char *lpGet(unsigned char *p, int64_t *count, unsigned char *intbuf) {
+    int64_t val;
+    uint64_t uval, negstart, negmax;
+
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) {
+        negstart = UINT64_MAX; /* 7 bit ints are always positive. */
+        negmax = 0;
+        uval = p[0] & 0x7f;
+    } else if (LP_ENCODING_IS_6BIT_STR(p[0])) {
+        *count = LP_ENCODING_6BIT_STR_LEN(p);
+        return p+1;
+    } else if (LP_ENCODING_IS_13BIT_INT(p[0])) {
+        uval = ((uint64_t)(p[0]&0x1f)<<8) | p[1];
+        negstart = (uint64_t)1<<12;
+        negmax = 8191;
+    } else if (LP_ENCODING_IS_12BIT_STR(p[0])) {
+        *count = LP_ENCODING_12BIT_STR_LEN(p);
+        return p+2;
+    } else if (p[0] == LP_ENCODING_16BIT_INT) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8;
+        negstart = (uint64_t)1<<15;
+        negmax = UINT16_MAX;
+    } else if (p[0] == LP_ENCODING_24BIT_INT) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16;
+        negstart = (uint64_t)1<<23;
+        negmax = UINT32_MAX>>8;
+    } else if (p[0] == LP_ENCODING_32BIT_INT) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16 |
+               (uint64_t)p[4]<<24;
+        negstart = (uint64_t)1<<31;
+        negmax = UINT32_MAX;
+    } else if (p[0] == LP_ENCODING_64BIT_INT) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16 |
+               (uint64_t)p[4]<<24 |
+               (uint64_t)p[5]<<32 |
+               (uint64_t)p[6]<<40 |
+               (uint64_t)p[7]<<48 |
+               (uint64_t)p[8]<<56;
+        negstart = (uint64_t)1<<63;
+        negmax = UINT64_MAX;
+    } else if (p[0] == LP_ENCODING_32BIT_STR) {
+        *count = LP_ENCODING_32BIT_STR_LEN(p);
+        return p+5;
+    } else {
+        assert(NULL); /* Invalid encoding or EOF. */
+        return NULL;
+    }
+
+    /* Convert the unsigned value to the signed one using two's complement
+     * for the width of the encoding. */
+    if (uval >= negstart) {
+        uval = negmax-uval;
+        val = uval;
+        val = -val-1;
+    } else {
+        val = uval;
+    }
+
+    if (intbuf) {
+        *count = ll2string((char*)intbuf,LP_INTBUF_SIZE,(long long)val);
+        return intbuf;
+    } else {
+        *count = val;
+        return NULL;
+    }
+}
+
+/* Like lpGet() but with the same arguments of ziplistGet(): if the element
+ * is a string it is returned and its length is stored in 'slen', otherwise
+ * NULL is returned and the integer is stored in 'lval'. */
+unsigned char *lpGetValue(unsigned char *p, unsigned int *slen, long long *lval) {
+    unsigned char *vstr;
+    int64_t ele_len;
+
+    vstr = lpGet(p,&ele_len,NULL);
+    if (vstr) {
+        *slen = ele_len;
+    } else {
+        *lval = ele_len;
+    }
+    return vstr;
+}
+
+/* Insert, delete or replace the element 'ele' of length 'size' at the
+ * element pointed by 'p'. 'where' is LP_BEFORE, LP_AFTER or LP_REPLACE.
+ * If 'ele' is NULL the element pointed by 'p' is deleted.
+ *
+ * If 'newp' is not NULL, on return it points to the element just added,
+ * or, on deletion, to the element that followed the deleted one (NULL if
+ * the deleted element was the last one).
+ *
+ * The listpack, which may have been reallocated, is returned, or NULL if
+ * it would exceed the 32 bit length limit. */
+unsigned char *lpInsert(unsigned char *lp, unsigned char *ele, uint32_t size, unsigned char *p, int where, unsigned char **newp) {
+    unsigned char intenc[LP_MAX_INT_ENCODING_LEN];
+    unsigned char backlen[LP_MAX_BACKLEN_SIZE];
+    uint64_t enclen = 0;
+    int enctype = LP_ENCODING_STRING;
+
+    if (ele == NULL) where = LP_REPLACE;
+
+    /* Inserting after an element is inserting before the next one. */
+    if (where == LP_AFTER) {
+        p = lpSkip(p);
+        where = LP_BEFORE;
+    }
+
+    /* Store the offset of 'p': the listpack may be reallocated. */
+    unsigned long poff = p-lp;
+
+    if (ele) enctype = lpEncodeGetType(ele,size,intenc,&enclen);
+    unsigned long backlen_size = ele ? lpEncodeBacklen(backlen,enclen) : 0;
+    uint64_t old_listpack_bytes = lpGetTotalBytes(lp);
+    uint32_t replaced_len = 0;
+    if (where == LP_REPLACE) {
+        replaced_len = lpCurrentEncodedSize(p);
+        replaced_len += lpEncodeBacklen(NULL,replaced_len);
+    }
+
+    uint64_t new_listpack_bytes = old_listpack_bytes + enclen + backlen_size
+                                  - replaced_len;
+    if (new_listpack_bytes > UINT32_MAX) return NULL;
+
+    /* Make room for the new element, or remove the space of the old one,
+     * moving the tail of the listpack. Only the tail after 'p' is moved:
+     * the other elements are not touched. */
+    unsigned char *dst = lp + poff;
+    if (new_listpack_bytes > old_listpack_bytes) {
+        lp = zrealloc(lp,new_listpack_bytes);
+        dst = lp + poff;
+    }
+    if (where == LP_BEFORE) {
+        memmove(dst+enclen+backlen_size,dst,old_listpack_bytes-poff);
+    } else { /* LP_REPLACE. */
+        memmove(dst+enclen+backlen_size,
+                dst+replaced_len,
+                old_listpack_bytes-poff-replaced_len);
+    }
+    if (new_listpack_bytes < old_listpack_bytes) {
+        lp = zrealloc(lp,new_listpack_bytes);
+        dst = lp + poff;
+    }
+
+    if (newp) {
+        *newp = dst;
+        /* After a deletion 'dst' points to the next element, if any. */
+        if (!ele && dst[0] == LP_EOF) *newp = NULL;
+    }
+    if (ele) {
+        if (enctype == LP_ENCODING_INT) {
+            memcpy(dst,intenc,enclen);
+        } else {
+            lpEncodeString(dst,ele,size);
+        }
+        dst += enclen;
+        memcpy(dst,backlen,backlen_size);
+    }
+
+    /* Update the header. */
+    if (where != LP_REPLACE || ele == NULL) {
+        uint32_t num_elements = lpGetNumElements(lp);
+        if (num_elements != LP_HDR_NUMELE_UNKNOWN) {
+            if (ele)
+                lpSetNumElements(lp,num_elements+1);
+            else
+                lpSetNumElements(lp,num_elements-1);
+        }
+    }
+    lpSetTotalBytes(lp,new_listpack_bytes);
+    return lp;
+}
+
+/* Append the element 'ele' of 'size' bytes at the end of the listpack. */
+unsigned char *lpAppend(unsigned char *lp, unsigned char *ele, uint32_t size) {
+    uint64_t listpack_bytes = lpGetTotalBytes(lp);
+    unsigned char *eofptr = lp + listpack_bytes - 1;
+    return lpInsert(lp,ele,size,eofptr,LP_BEFORE,NULL);
+}
+
+/* Add the element 'ele' of 'size' bytes at the head of the listpack. */
+unsigned char *lpPrepend(unsigned char *lp, unsigned char *ele, uint32_t size) {
+    return lpInsert(lp,ele,size,lp+LP_HDR_SIZE,LP_BEFORE,NULL);
+}
+
+/* Append the integer 'lval' at the end of the listpack. */
+unsigned char *lpAppendInteger(unsigned char *lp, long long lval) {
+    char buf[LP_INTBUF_SIZE];
+    int len = ll2string(buf,sizeof(buf),lval);
+    return lpAppend(lp,(unsigned char*)buf,len);
+}
+
+/* Replace the element pointed by '*p' with 'ele' of 'size' bytes. On return
+ * '*p' points to the new element. */
+unsigned char *lpReplace(unsigned char *lp, unsigned char **p, unsigned char *ele, uint32_t size) {
+    return lpInsert(lp,ele,size,*p,LP_REPLACE,p);
+}
+
+/* Delete the element pointed by 'p'. If 'newp' is not NULL it is set to the
+ * next element, or NULL if the deleted element was the last one. */
+unsigned char *lpDelete(unsigned char *lp, unsigned char *p, unsigned char **newp) {
+    return lpInsert(lp,NULL,0,p,LP_REPLACE,newp);
+}
+
+/* Delete 'num' consecutive elements starting at the one pointed by '*p'
+ * (or less if the end of the listpack is reached) with a single memmove().
+ * On return '*p' points to the element that followed the deleted ones, or
+ * is NULL if there is none. */
+unsigned char *lpDeleteRangeWithEntry(unsigned char *lp, unsigned char **p, unsigned long num) {
+    size_t bytes = lpBytes(lp);
+    unsigned long deleted = 0;
+    unsigned char *eofptr = lp + bytes - 1;
+    unsigned char *first, *tail;
+    uint32_t numele;
+    size_t poff;
+
+    first = tail = *p;
+    if (num == 0) return lp;
+
+    while (num--) {
+        deleted++;
+        tail = lpSkip(tail);
+        if (tail[0] == LP_EOF) break;
+    }
+
+    poff = first-lp;
+    memmove(first,tail,eofptr-tail+1);
+    lpSetTotalBytes(lp,bytes-(tail-first));
+    numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN)
+        lpSetNumElements(lp,numele-deleted);
+    lp = zrealloc(lp,bytes-(tail-first));
+
+    *p = lp+poff;
+    if ((*p)[0] == LP_EOF) *p = NULL;
+    return lp;
+}
+
+/* Delete 'num' consecutive elements starting at 'index'. Negative indexes
+ * count from the tail, -1 being the last element. */
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num) {
+    unsigned char *p = lpSeek(lp,index);
+
+    if (p == NULL || num == 0) return lp;
+    return lpDeleteRangeWithEntry(lp,&p,num);
+}
+
+/* Merge listpacks 'first' and 'second' by appending 'second' to 'first'.
+ *
+ * The largest of the two is reallocated to hold both of them, so that the
+ * smallest one is copied, and the other one is freed. On return the
+ * pointer to the freed listpack is set to NULL and the other one to the
+ * merged listpack, that is also returned. NULL is returned if the two
+ * listpacks can't be merged. */
+unsigned char *lpMerge(unsigned char **first, unsigned char **second) {
+    if (first == NULL || *first == NULL || second == NULL || *second == NULL)
+        return NULL;
+    if (*first == *second) return NULL;
+
+    size_t first_bytes = lpBytes(*first);
+    unsigned long first_len = lpGetNumElements(*first);
+    size_t second_bytes = lpBytes(*second);
+    unsigned long second_len = lpGetNumElements(*second);
+
+    int append;
+    unsigned char *source, *target;
+    size_t target_bytes, source_bytes;
+    if (first_bytes >= second_bytes) {
+        target = *first;
+        target_bytes = first_bytes;
+        source = *second;
+        source_bytes = second_bytes;
+        append = 1;
+    } else {
+        target = *second;
+        target_bytes = second_bytes;
+        source = *first;
+        source_bytes = first_bytes;
+        append = 0;
+    }
+
+    /* Just one header and one terminator in the merged listpack. */
+    unsigned long long lpbytes = (unsigned long long)first_bytes +
+                                 second_bytes - LP_HDR_SIZE - 1;
+    if (lpbytes > UINT32_MAX) return NULL;
+    unsigned long lplength = first_len + second_len;
+    if (first_len == LP_HDR_NUMELE_UNKNOWN ||
+        second_len == LP_HDR_NUMELE_UNKNOWN ||
+        lplength > LP_HDR_NUMELE_UNKNOWN)
+    {
+        lplength = LP_HDR_NUMELE_UNKNOWN;
+    }
+
+    target = zrealloc(target,lpbytes);
+    if (append) {
+        /* Copy the source elements and terminator over the target's one. */
+        memcpy(target+target_bytes-1,
+               source+LP_HDR_SIZE,
+               source_bytes-LP_HDR_SIZE);
+    } else {
+        /* Move the target elements after the source ones. */
+        memmove(target+source_bytes-1,
+                target+LP_HDR_SIZE,
+                target_bytes-LP_HDR_SIZE);
+        memcpy(target+LP_HDR_SIZE,
+               source+LP_HDR_SIZE,
+               source_bytes-LP_HDR_SIZE-1);
+    }
+    lpSetNumElements(target,lplength);
+    lpSetTotalBytes(target,lpbytes);
+
+    if (append) {
+        zfree(*second);
+        *second = NULL;
+        *first = target;
+    } else {
+        zfree(*first);
+        *first = NULL;
+        *second = target;
+    }
+    return target;
+}
+
+/* Return the total number of bytes the listpack is composed of. */
+size_t lpBytes(unsigned char *lp) {
+    return lpGetTotalBytes(lp);
+}
+
+/* Return the number of bytes a string element of 'slen' bytes uses in a
+ * listpack, backlen included. Strings that are valid integers are encoded
+ * in fewer bytes, so this is an upper bound for any element of that size. */
+size_t lpEntrySizeString(size_t slen) {
+    size_t enclen;
+
+    if (slen < 64) enclen = 1+slen;
+    else if (slen < 4096) enclen = 2+slen;
+    else enclen = 5+slen;
+    return enclen+lpEncodeBacklen(NULL,enclen);
+}
+
+/* Return the element at the specified index, or NULL if out of range.
+ * Negative indexes count from the tail, -1 being the last element. When
+ * the number of elements is known the nearest side is used to seek. */
+unsigned char *lpSeek(unsigned char *lp, long index) {
+    int forward = 1;
+    uint32_t numele = lpGetNumElements(lp);
+
+    if (numele != LP_HDR_NUMELE_UNKNOWN) {
+        if (index < 0) index = (long)numele+index;
+        if (index < 0) return NULL;
+        if (index >= (long)numele) return NULL;
+        if (index > (long)numele/2) {
+            forward = 0;
+            /* Turn it into a negative index to seek from the tail. */
+            index -= numele;
+        }
+    } else {
+        if (index < 0) forward = 0;
+    }
+
+    if (forward) {
+        unsigned char *ele = lpFirst(lp);
+        while (index > 0 && ele) {
+            ele = lpNext(lp,ele);
+            index--;
+        }
+        return ele;
+    } else {
+        unsigned char *ele = lpLast(lp);
+        while (index < -1 && ele) {
+            ele = lpPrev(lp,ele);
+            index++;
+        }
+        return ele;
+    }
+}
+
+/* Return 1 if the element pointed by 'p' is equal to the string 's' of
+ * 'slen' bytes, 0 otherwise. */
+int lpCompare(unsigned char *p, unsigned char *s, uint32_t slen) {
+    unsigned char *value;
+    int64_t sz;
+    long long sval;
+
+    value = lpGet(p,&sz,NULL);
+    if (value) return slen == sz && memcmp(value,s,slen) == 0;
+    /* Integers are always stored in their canonical form, so the string
+     * can only be equal if it is an integer as well. */
+    return slen <= 20 && string2ll((char*)s,slen,&sval) && sval == sz;
+}
+
+/* Find the element equal to 's' of 'slen' bytes, starting the search at
+ * 'p' and comparing one element every 'skip'+1 (so 1 to only look at the
+ * keys of a listpack of key/value pairs). Return NULL if not found. */
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *s, uint32_t slen, unsigned int skip) {
+    unsigned int skipcnt = 0;
+    int vencoding = 0; /* 0: not converted yet, 1: integer, -1: string. */
+    long long vll = 0;
+
+    while (p) {
+        if (skipcnt == 0) {
+            unsigned char *value;
+            int64_t count;
+
+            value = lpGet(p,&count,NULL);
+            if (value) {
+                if (count == slen && memcmp(value,s,slen) == 0) return p;
+            } else {
+                /* Convert 's' to an integer just the first time an integer
+                 * element is found. */
+                if (vencoding == 0) {
+                    vencoding = (slen <= 20 &&
+                                 string2ll((char*)s,slen,&vll)) ? 1 : -1;
+                }
+                if (vencoding == 1 && count == vll) return p;
+            }
+            skipcnt = skip;
+        } else {
+            skipcnt--;
+        }
+        p = lpNext(lp,p);
+    }
+    return NULL;
+}
+
+/* Validate the listpack 'lp' of 'size' bytes, as loaded from an untrusted
+ * source such as an RDB file. The header and terminator are always checked.
+ * If 'deep' is true every element is also checked to be well formed and
+ * within bounds, and the elements count to match the header.
+ * Return 1 if the listpack is valid, 0 otherwise. */
+int lpValidateIntegrity(unsigned char *lp, size_t size, int deep) {
+    unsigned char *p, *eof;
+    uint32_t numele, count = 0;
+
+    if (size < LP_HDR_SIZE+1) return 0;
+    if (lpGetTotalBytes(lp) != size) return 0;
+    if (lp[size-1] != LP_EOF) return 0;
+    if (!deep) return 1;
+
+    numele = lpGetNumElements(lp);
+    p = lp+LP_HDR_SIZE;
+    eof = lp+size-1;
+    while (p < eof) {
+        uint64_t entrylen, backlen_size;
+
+        if (p[0] == LP_EOF) return 0;
+        /* Make sure the string length is within bounds before reading it. */
+        if ((size_t)(eof-p) < lpEncodingTypeSize(p[0])) return 0;
+        entrylen = lpCurrentEncodedSize(p);
+        if (entrylen == 0) return 0;
+        backlen_size = lpEncodeBacklen(NULL,entrylen);
+        if ((uint64_t)(eof-p) < entrylen+backlen_size) return 0;
+        if (lpDecodeBacklen(p+entrylen+backlen_size-1) != entrylen) return 0;
+        p += entrylen+backlen_size;
+        count++;
+    }
+    if (numele != LP_HDR_NUMELE_UNKNOWN && numele != count) return 0;
+    return 1;
+}
+
+/* Print the listpack layout on stdout, for debugging purposes. */
+void lpRepr(unsigned char *lp) {
+    unsigned char *p, *vstr;
+    int64_t vlen;
+    int index = 0;
+
+    printf(
+        "{total bytes %zu} "
+        "{num entries %lu}\n",
+        lpBytes(lp),
+        lpLength(lp));
+    p = lpFirst(lp);
+    while(p) {
+        uint32_t encoded_size = lpCurrentEncodedSize(p);
+        unsigned long back_len = lpEncodeBacklen(NULL,encoded_size);
+        printf(
+            "{\n"
+                "\taddr 0x%08lx,\n"
+                "\tindex %2d,\n"
+                "\toffset %5lu,\n"
+                "\thdr+entry len: %5u,\n"
+                "\thdr len%2u,\n"
+                "\tbacklen: %2lu,\n",
+            (long unsigned)p,
+            index,
+            (unsigned long) (p-lp),
+            encoded_size,
+            lpEncodingTypeSize(p[0]),
+            back_len);
+        printf("\tbytes: ");
+        for (unsigned int i = 0; i < encoded_size+back_len; i++) {
+            printf("%02x|",p[i]);
+        }
+        printf("\n");
+        vstr = lpGet(p,&vlen,NULL);
+        if (vstr) {
+            printf("\t[str]");
+            if (vlen > 40) {
+                if (fwrite(vstr,40,1,stdout) == 0) perror("fwrite");
+                printf("...");
+            } else {
+                if (vlen && fwrite(vstr,vlen,1,stdout) == 0) perror("fwrite");
+            }
+        } else {
+            printf("\t[int]%lld", (long long) vlen);
+        }
+        printf("\n}\n");
+        p = lpNext(lp,p);
+        index++;
+    }
+    printf("{end}\n\n");
+}
+
+#ifdef REDIS_TEST
+#include <sys/time.h>
+#include "ziplist.h"
+
+static long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+static void verifyEntry(unsigned char *p, char *s, size_t slen) {
+    assert(lpCompare(p,(unsigned char*)s,slen));
+}
+
+static int randstring(char *target, unsigned int min, unsigned int max) {
+    int p = 0;
+    int len = min+rand()%(max-min+1);
+    int minval, maxval;
+    switch(rand() % 3) {
+    case 0:
+        minval = 0;
+        maxval = 255;
+    break;
+    case 1:
+        minval = 48;
+        maxval = 122;
+    break;
+    case 2:
+        minval = 48;
+        maxval = 52;
+    break;
+    default:
+        assert(NULL);
+    }
+
+    while(p < len)
+        target[p++] = minval+rand()%(maxval-minval+1);
+    return len;
+}
+
+/* Fill a ziplist and a listpack with 'count' elements of 'size' bytes. */
+static void benchFill(unsigned char **zl, unsigned char **lp, int count, int size) {
+    char buf[4096];
+
+    memset(buf,'x',size);
+    *zl = ziplistNew();
+    *lp = lpNew();
+    for (int j = 0; j < count; j++) {
+        *zl = ziplistPush(*zl,(unsigned char*)buf,size,ZIPLIST_TAIL);
+        *lp = lpAppend(*lp,(unsigned char*)buf,size);
+    }
+}
+
+/* Insert and delete 'ops' elements of 'size' bytes at random positions of
+ * a ziplist and a listpack of 'count' elements of 'fillsize' bytes, and
+ * print the time spent by each. */
+static void benchInsertDelete(char *name, int count, int fillsize, int size, int ops) {
+    unsigned char *zl, *lp, *p;
+    char buf[4096];
+    long long start, zltime, lptime;
+    int j;
+
+    memset(buf,'y',size);
+    benchFill(&zl,&lp,count,fillsize);
+
+    srand(1234);
+    start = usec();
+    for (j = 0; j < ops; j++) {
+        int idx = rand() % count;
+        p = ziplistIndex(zl,idx);
+        zl = ziplistInsert(zl,p,(unsigned char*)buf,size);
+        p = ziplistIndex(zl,(idx+count/2) % (count+1));
+        zl = ziplistDelete(zl,&p);
+    }
+    zltime = usec()-start;
+
+    srand(1234);
+    start = usec();
+    for (j = 0; j < ops; j++) {
+        int idx = rand() % count;
+        p = lpSeek(lp,idx);
+        lp = lpInsert(lp,(unsigned char*)buf,size,p,LP_BEFORE,NULL);
+        p = lpSeek(lp,(idx+count/2) % (count+1));
+        lp = lpDelete(lp,p,NULL);
+    }
+    lptime = usec()-start;
+
+    assert(ziplistLen(zl) == (unsigned)count && lpLength(lp) == (unsigned)count);
+    printf("%-24s %d entries, %5dx insert+delete: "
+           "ziplist %7lld usec, listpack %7lld usec\n",
+           name, count, ops, zltime, lptime);
+    zfree(zl);
+    lpFree(lp);
+}
+
+/* Insert an element of 300 bytes at the head of copies of a ziplist and a
+ * listpack of 'count' elements of 250 bytes. In the ziplist every entry
+ * grows past 253 bytes when its prevlen field is enlarged to hold the
+ * length of the entry before it, so the insertion cascades to all the
+ * entries, each one requiring a memmove() of the rest of the blob. The
+ * cascade only happens once per blob, so a fresh copy is used every time:
+ * the copy costs the same for both. */
+static void benchCascade(int count, int ops) {
+    unsigned char *zl, *lp, *copy;
+    char buf[300];
+    long long start, zltime, lptime;
+    int j;
+
+    memset(buf,'y',sizeof(buf));
+    benchFill(&zl,&lp,count,250);
+
+    start = usec();
+    for (j = 0; j < ops; j++) {
+        copy = zmalloc(ziplistBlobLen(zl));
+        memcpy(copy,zl,ziplistBlobLen(zl));
+        copy = ziplistPush(copy,(unsigned char*)buf,sizeof(buf),ZIPLIST_HEAD);
+        zfree(copy);
+    }
+    zltime = usec()-start;
+
+    start = usec();
+    for (j = 0; j < ops; j++) {
+        copy = zmalloc(lpBytes(lp));
+        memcpy(copy,lp,lpBytes(lp));
+        copy = lpPrepend(copy,(unsigned char*)buf,sizeof(buf));
+        zfree(copy);
+    }
+    lptime = usec()-start;
+
+    printf("%-24s %d entries, %5dx insert at head: "
+           "ziplist %7lld usec, listpack %7lld usec\n",
+           "Cascade update", count, ops, zltime, lptime);
+    zfree(zl);
+    lpFree(lp);
+}
+
+/* Iterate a ziplist and a listpack of 'count' elements from tail to head,
+ * as done by reverse range commands such as ZREVRANGE and LRANGE with
+ * negative indexes. */
+static void benchReverseIteration(int count, int size, int loops) {
+    unsigned char *zl, *lp, *p, *vstr;
+    unsigned int vlen;
+    long long vll, start, zltime, lptime, sum = 0;
+    int64_t lplen;
+
+    benchFill(&zl,&lp,count,size);
+    start = usec();
+    for (int j = 0; j < loops; j++) {
+        p = ziplistIndex(zl,-1);
+        while (p) {
+            ziplistGet(p,&vstr,&vlen,&vll);
+            sum += vlen;
+            p = ziplistPrev(zl,p);
+        }
+    }
+    zltime = usec()-start;
+
+    start = usec();
+    for (int j = 0; j < loops; j++) {
+        p = lpLast(lp);
+        while (p) {
+            lpGet(p,&lplen,NULL);
+            sum -= lplen;
+            p = lpPrev(lp,p);
+        }
+    }
+    lptime = usec()-start;
+
+    assert(sum == 0);
+    printf("%-24s %d entries, %5dx iteration:     "
+           "ziplist %7lld usec, listpack %7lld usec\n",
+           "Reverse iteration", count, loops, zltime, lptime);
+    zfree(zl);
+    lpFree(lp);
+}
+
+int listpackTest(int argc, char *argv[]) {
+    unsigned char *lp, *p;
+    unsigned char buf[LP_INTBUF_SIZE];
+    int64_t len;
+    char *mixlist[] = {"hello", "foo", "quux", "1024"};
+    int j;
+
+    ((void) argc);
+    ((void) argv);
+
+    printf("Create, append and prepend:\n");
+    {
+        lp = lpNew();
+        lp = lpAppend(lp,(unsigned char*)mixlist[1],strlen(mixlist[1]));
+        lp = lpAppend(lp,(unsigned char*)mixlist[2],strlen(mixlist[2]));
+        lp = lpPrepend(lp,(unsigned char*)mixlist[0],strlen(mixlist[0]));
+        lp = lpAppend(lp,(unsigned char*)mixlist[3],strlen(mixlist[3]));
+        assert(lpLength(lp) == 4);
+        for (j = 0; j < 4; j++)
+            verifyEntry(lpSeek(lp,j),mixlist[j],strlen(mixlist[j]));
+        p = lpSeek(lp,3);
+        assert(lpGet(p,&len,NULL) == NULL && len == 1024);
+        lpRepr(lp);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Seek, next and prev:\n");
+    {
+        assert(lpSeek(lp,4) == NULL && lpSeek(lp,-5) == NULL);
+        verifyEntry(lpSeek(lp,-1),"1024",4);
+        verifyEntry(lpSeek(lp,-4),"hello",5);
+        p = lpLast(lp);
+        for (j = 3; j >= 0; j--) {
+            verifyEntry(p,mixlist[j],strlen(mixlist[j]));
+            p = lpPrev(lp,p);
+        }
+        assert(p == NULL);
+        p = lpFirst(lp);
+        for (j = 0; j < 4; j++) {
+            verifyEntry(p,mixlist[j],strlen(mixlist[j]));
+            p = lpNext(lp,p);
+        }
+        assert(p == NULL);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Find, replace and delete:\n");
+    {
+        p = lpFind(lp,lpFirst(lp),(unsigned char*)"1024",4,0);
+        assert(p == lpSeek(lp,3));
+        assert(lpFind(lp,lpFirst(lp),(unsigned char*)"foo",3,1) == NULL);
+        p = lpFind(lp,lpFirst(lp),(unsigned char*)"quux",4,1);
+        assert(p == lpSeek(lp,2));
+        lp = lpReplace(lp,&p,(unsigned char*)"a much longer quux",18);
+        verifyEntry(p,"a much longer quux",18);
+        verifyEntry(lpNext(lp,p),"1024",4);
+        lp = lpDelete(lp,lpSeek(lp,1),&p);
+        verifyEntry(p,"a much longer quux",18);
+        lp = lpDelete(lp,lpLast(lp),&p);
+        assert(p == NULL && lpLength(lp) == 2);
+        lp = lpDeleteRange(lp,0,10);
+        assert(lpLength(lp) == 0 && lpFirst(lp) == NULL && lpLast(lp) == NULL);
+        assert(lpBytes(lp) == LP_HDR_SIZE+1);
+        lpFree(lp);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Integer encodings:\n");
+    {
+        long long values[] = {0, 127, 128, -1, 4095, -4096, 4096, -4097,
+            32767, -32768, 32768, 8388607, -8388608, 8388608,
+            2147483647LL, -2147483648LL, 2147483648LL,
+            LLONG_MAX, LLONG_MIN};
+        int count = sizeof(values)/sizeof(values[0]);
+
+        lp = lpNew();
+        for (j = 0; j < count; j++) lp = lpAppendInteger(lp,values[j]);
+        p = lpFirst(lp);
+        for (j = 0; j < count; j++) {
+            assert(lpGet(p,&len,NULL) == NULL && len == values[j]);
+            lpGet(p,&len,buf);
+            assert(len == ll2string((char*)buf,sizeof(buf),values[j]));
+            p = lpNext(lp,p);
+        }
+        /* Not canonical integers are strings. */
+        lp = lpAppend(lp,(unsigned char*)"0123",4);
+        assert(lpGet(lpLast(lp),&len,NULL) != NULL && len == 4);
+        assert(lpValidateIntegrity(lp,lpBytes(lp),1));
+        lpFree(lp);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Big strings and the elements count limit:\n");
+    {
+        char *big = zmalloc(70000);
+        memset(big,'a',70000);
+        lp = lpNew();
+        lp = lpAppend(lp,(unsigned char*)big,100);
+        lp = lpAppend(lp,(unsigned char*)big,5000);
+        lp = lpAppend(lp,(unsigned char*)big,70000);
+        lp = lpAppend(lp,(unsigned char*)"tail",4);
+        assert(lpGet(lpSeek(lp,2),&len,NULL) && len == 70000);
+        verifyEntry(lpPrev(lp,lpLast(lp)),big,70000);
+        verifyEntry(lpSeek(lp,-3),big,5000);
+        assert(lpValidateIntegrity(lp,lpBytes(lp),1));
+        lpFree(lp);
+        zfree(big);
+
+        lp = lpNew();
+        for (j = 0; j < 70000; j++) lp = lpAppendInteger(lp,j);
+        assert(lpLength(lp) == 70000);
+        p = lpSeek(lp,-1);
+        assert(lpGet(p,&len,NULL) == NULL && len == 69999);
+        lp = lpDeleteRange(lp,0,10000);
+        assert(lpLength(lp) == 60000);
+        assert(lpGet(lpSeek(lp,59999),&len,NULL) == NULL && len == 69999);
+        assert(lpValidateIntegrity(lp,lpBytes(lp),1));
+        lpFree(lp);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Merge:\n");
+    {
+        unsigned char *lp1 = lpNew(), *lp2 = lpNew();
+        for (j = 0; j < 10; j++) lp1 = lpAppendInteger(lp1,j);
+        for (j = 10; j < 15; j++) lp2 = lpAppendInteger(lp2,j);
+        lp = lpMerge(&lp1,&lp2);
+        assert(lp == lp1 && lp2 == NULL && lpLength(lp) == 15);
+        lp2 = lpNew();
+        lp2 = lpAppendInteger(lp2,-1);
+        lp = lpMerge(&lp2,&lp1);
+        assert(lp == lp1 && lp2 == NULL && lpLength(lp) == 16);
+        p = lpFirst(lp);
+        for (j = -1; j < 15; j++) {
+            assert(lpGet(p,&len,NULL) == NULL && len == j);
+            p = lpNext(lp,p);
+        }
+        assert(lpValidateIntegrity(lp,lpBytes(lp),1));
+        lpFree(lp);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Stress with random payloads, compared with a ziplist:\n");
+    {
+        char s[1024];
+        unsigned int slen;
+        unsigned char *zl, *zp, *zstr;
+        unsigned int zlen;
+        long long zll;
+
+        for (int iter = 0; iter < 2000; iter++) {
+            zl = ziplistNew();
+            lp = lpNew();
+            int ops = rand() % 200;
+            for (j = 0; j < ops; j++) {
+                int len = lpLength(lp);
+                int where = len ? rand() % len : 0;
+                if (len && rand() % 3 == 0) {
+                    zp = ziplistIndex(zl,where);
+                    zl = ziplistDelete(zl,&zp);
+                    lp = lpDelete(lp,lpSeek(lp,where),NULL);
+                    continue;
+                }
+                if (rand() % 2) {
+                    slen = randstring(s,1,rand() % 2 ? 20 : 600);
+                } else {
+                    slen = sprintf(s,"%lld",
+                        ((long long)rand() << 32 | rand()) >> (rand() % 64));
+                }
+                if (len == 0) {
+                    zl = ziplistPush(zl,(unsigned char*)s,slen,ZIPLIST_TAIL);
+                    lp = lpAppend(lp,(unsigned char*)s,slen);
+                } else {
+                    zp = ziplistIndex(zl,where);
+                    zl = ziplistInsert(zl,zp,(unsigned char*)s,slen);
+                    lp = lpInsert(lp,(unsigned char*)s,slen,lpSeek(lp,where),
+                                  LP_BEFORE,NULL);
+                }
+            }
+            assert(ziplistLen(zl) == lpLength(lp));
+            assert(lpValidateIntegrity(lp,lpBytes(lp),1));
+            zp = ziplistIndex(zl,-1);
+            p = lpLast(lp);
+            while (zp) {
+                assert(p != NULL);
+                ziplistGet(zp,&zstr,&zlen,&zll);
+                if (zstr) {
+                    assert(lpCompare(p,zstr,zlen));
+                } else {
+                    assert(lpGet(p,&len,NULL) == NULL && len == zll);
+                }
+                zp = ziplistPrev(zl,zp);
+                p = lpPrev(lp,p);
+            }
+            assert(p == NULL);
+            zfree(zl);
+            lpFree(lp);
+        }
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Benchmark insert/delete heavy workloads on 512 entries:\n");
+    {
+        benchInsertDelete("Small entries",512,16,16,20000);
+        benchInsertDelete("Medium entries",512,100,100,20000);
+        benchInsertDelete("Large entries",512,250,300,20000);
+        benchCascade(512,200);
+        benchReverseIteration(512,16,20000);
+        printf("\n");
+    }
+
+    return 0;
+}
+#endif
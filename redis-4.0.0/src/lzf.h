@@ -96,5 +96,26 @@ unsigned int
 lzf_decompress (const void *const in_data,  unsigned int in_len,
                 void             *out_data, unsigned int out_len);
 
+/*
+ * Variants used to compress a stream in chunks: the dict_len bytes
+ * preceding the data (the end of the previous chunks, up to 8192 bytes
+ * are useful) can be referenced by the compressed data.
+ *
+ * lzf_compress_dict compresses the in_len bytes at in_data + dict_len,
+ * in_data pointing to the dictionary. lzf_decompress_dict writes the
+ * data at out_data + dict_len, out_data pointing to the same dictionary,
+ * up to a maximum of out_len characters. The return values are the ones
+ * of lzf_compress and lzf_decompress.
+ */
+unsigned int
+lzf_compress_dict (const void *const in_data, unsigned int dict_len,
+                   unsigned int in_len,
+                   void *out_data, unsigned int out_len);
+
+unsigned int
+lzf_decompress_dict (const void *const in_data,  unsigned int in_len,
+                     void *out_data, unsigned int dict_len,
+                     unsigned int out_len);
+
 #endif
 
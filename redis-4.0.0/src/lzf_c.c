@@ -96,8 +96,9 @@
  */
 
 unsigned int
-lzf_compress (const void *const in_data, unsigned int in_len,
-	      void *out_data, unsigned int out_len
+lzf_compress_dict (const void *const in_data, unsigned int dict_len,
+                   unsigned int in_len,
+                   void *out_data, unsigned int out_len
 #if LZF_STATE_ARG
               , LZF_STATE htab
 #endif
@@ -108,7 +109,7 @@ lzf_compress (const void *const in_data, unsigned int in_len,
 #endif
   const u8 *ip = (const u8 *)in_data;
         u8 *op = (u8 *)out_data;
-  const u8 *in_end  = ip + in_len;
+  const u8 *in_end  = ip + dict_len + in_len;
         u8 *out_end = op + out_len;
   const u8 *ref;
 
@@ -137,6 +138,16 @@ lzf_compress (const void *const in_data, unsigned int in_len,
   lit = 0; op++; /* start run */
 
   hval = FRST (ip);
+
+  /* Index the dictionary, so that the data can reference it. */
+  while (ip < (const u8 *)in_data + dict_len && ip < in_end - 2)
+    {
+      hval = NEXT (hval, ip);
+      htab[IDX (hval)] = ip - LZF_HSLOT_BIAS;
+      ip++;
+    }
+  ip = (const u8 *)in_data + dict_len;
+
   while (ip < in_end - 2)
     {
       LZF_HSLOT *hslot;
@@ -289,3 +300,17 @@ lzf_compress (const void *const in_data, unsigned int in_len,
   return op - (u8 *)out_data;
 }
 
+unsigned int
+lzf_compress (const void *const in_data, unsigned int in_len,
+	      void *out_data, unsigned int out_len
+#if LZF_STATE_ARG
+              , LZF_STATE htab
+#endif
+              )
+{
+  return lzf_compress_dict (in_data, 0, in_len, out_data, out_len
+#if LZF_STATE_ARG
+                            , htab
+#endif
+                            );
+}
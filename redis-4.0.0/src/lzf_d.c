@@ -53,11 +53,12 @@
 #endif
 
 unsigned int
-lzf_decompress (const void *const in_data,  unsigned int in_len,
-                void             *out_data, unsigned int out_len)
+lzf_decompress_dict (const void *const in_data,  unsigned int in_len,
+                     void *out_data, unsigned int dict_len,
+                     unsigned int out_len)
 {
   u8 const *ip = (const u8 *)in_data;
-  u8       *op = (u8 *)out_data;
+  u8       *op = (u8 *)out_data + dict_len;
   u8 const *const in_end  = ip + in_len;
   u8       *const out_end = op + out_len;
 
@@ -180,6 +181,13 @@ lzf_decompress (const void *const in_data,  unsigned int in_len,
     }
   while (ip < in_end);
 
-  return op - (u8 *)out_data;
+  return op - ((u8 *)out_data + dict_len);
+}
+
+unsigned int
+lzf_decompress (const void *const in_data,  unsigned int in_len,
+                void             *out_data, unsigned int out_len)
+{
+  return lzf_decompress_dict (in_data, in_len, out_data, 0, out_len);
 }
 
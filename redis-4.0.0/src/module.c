@@ -119,6 +119,7 @@ struct RedisModuleCtx {
     struct RedisModulePoolAllocBlock *pa_head;
 };
 typedef struct RedisModuleCtx RedisModuleCtx;
+typedef void (*RedisModuleTimerProc)(RedisModuleCtx *ctx, void *data);
 
 #define REDISMODULE_CTX_INIT {(void*)(unsigned long)&RM_GetApi, NULL, NULL, NULL, NULL, 0, 0, 0, NULL, 0, NULL, NULL, 0, NULL}
 #define REDISMODULE_CTX_MULTI_EMITTED (1<<0)
@@ -353,15 +354,14 @@ int moduleCreateEmptyKey(RedisModuleKey *key, int type) {
                             server.list_compress_depth);
         break;
     case REDISMODULE_KEYTYPE_ZSET:
-        obj = createZsetZiplistObject();
+        obj = createZsetListpackObject();
         break;
     case REDISMODULE_KEYTYPE_HASH:
         obj = createHashObject();
         break;
     default: return REDISMODULE_ERR;
     }
-    dbAdd(key->db,key->key,obj);
-    key->value = obj;
+    key->value = dbAdd(key->db,key->key,obj);
     return REDISMODULE_OK;
 }
 
@@ -1401,6 +1401,8 @@ int RM_SetExpire(RedisModuleKey *key, mstime_t expire) {
     if (expire != REDISMODULE_NO_EXPIRE) {
         expire += mstime();
         setExpire(key->ctx->client,key->db,key->key,expire);
+        /* The value object may be replaced, see setExpire(). */
+        key->value = dictFetchValue(key->db->dict,key->key->ptr);
     } else {
         removeExpire(key->db,key->key);
     }
@@ -1418,8 +1420,7 @@ int RM_SetExpire(RedisModuleKey *key, mstime_t expire) {
 int RM_StringSet(RedisModuleKey *key, RedisModuleString *str) {
     if (!(key->mode & REDISMODULE_WRITE) || key->iter) return REDISMODULE_ERR;
     RM_DeleteKey(key);
-    setKey(key->db,key->key,str);
-    key->value = str;
+    key->value = setKey(key->db,key->key,str);
     return REDISMODULE_OK;
 }
 
@@ -1498,8 +1499,7 @@ int RM_StringTruncate(RedisModuleKey *key, size_t newlen) {
     if (key->value == NULL) {
         /* Empty key: create it with the new size. */
         robj *o = createObject(OBJ_STRING,sdsnewlen(NULL, newlen));
-        setKey(key->db,key->key,o);
-        key->value = o;
+        key->value = setKey(key->db,key->key,o);
         decrRefCount(o);
     } else {
         /* Unshare and resize. */
@@ -1742,7 +1742,7 @@ int zsetInitScoreRange(RedisModuleKey *key, double min, double max, int minex, i
     zrs->minex = minex;
     zrs->maxex = maxex;
 
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         key->zcurrent = first ? zzlFirstInRange(key->value->ptr,zrs) :
                                 zzlLastInRange(key->value->ptr,zrs);
     } else if (key->value->encoding == OBJ_ENCODING_SKIPLIST) {
@@ -1806,7 +1806,7 @@ int zsetInitLexRange(RedisModuleKey *key, RedisModuleString *min, RedisModuleStr
      * otherwise we don't want the zlexrangespec to be freed. */
     key->ztype = REDISMODULE_ZSET_RANGE_LEX;
 
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         key->zcurrent = first ? zzlFirstInLexRange(key->value->ptr,zlrs) :
                                 zzlLastInLexRange(key->value->ptr,zlrs);
     } else if (key->value->encoding == OBJ_ENCODING_SKIPLIST) {
@@ -1851,12 +1851,12 @@ RedisModuleString *RM_ZsetRangeCurrentElement(RedisModuleKey *key, double *score
     RedisModuleString *str;
 
     if (key->zcurrent == NULL) return NULL;
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *eptr, *sptr;
         eptr = key->zcurrent;
-        sds ele = ziplistGetObject(eptr);
+        sds ele = lpGetObject(eptr);
         if (score) {
-            sptr = ziplistNext(key->value->ptr,eptr);
+            sptr = lpNext(key->value->ptr,eptr);
             *score = zzlGetScore(sptr);
         }
         str = createObject(OBJ_STRING,ele);
@@ -1877,12 +1877,12 @@ RedisModuleString *RM_ZsetRangeCurrentElement(RedisModuleKey *key, double *score
 int RM_ZsetRangeNext(RedisModuleKey *key) {
     if (!key->ztype || !key->zcurrent) return 0; /* No active iterator. */
 
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = key->value->ptr;
         unsigned char *eptr = key->zcurrent;
         unsigned char *next;
-        next = ziplistNext(zl,eptr); /* Skip element. */
-        if (next) next = ziplistNext(zl,next); /* Skip score. */
+        next = lpNext(zl,eptr); /* Skip element. */
+        if (next) next = lpNext(zl,next); /* Skip score. */
         if (next == NULL) {
             key->zer = 1;
             return 0;
@@ -1892,7 +1892,7 @@ int RM_ZsetRangeNext(RedisModuleKey *key) {
                 /* Fetch the next element score for the
                  * range check. */
                 unsigned char *saved_next = next;
-                next = ziplistNext(zl,next); /* Skip next element. */
+                next = lpNext(zl,next); /* Skip next element. */
                 double score = zzlGetScore(next); /* Obtain the next score. */
                 if (!zslValueLteMax(score,&key->zrs)) {
                     key->zer = 1;
@@ -1940,12 +1940,12 @@ int RM_ZsetRangeNext(RedisModuleKey *key) {
 int RM_ZsetRangePrev(RedisModuleKey *key) {
     if (!key->ztype || !key->zcurrent) return 0; /* No active iterator. */
 
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = key->value->ptr;
         unsigned char *eptr = key->zcurrent;
         unsigned char *prev;
-        prev = ziplistPrev(zl,eptr); /* Go back to previous score. */
-        if (prev) prev = ziplistPrev(zl,prev); /* Back to previous ele. */
+        prev = lpPrev(zl,eptr); /* Go back to previous score. */
+        if (prev) prev = lpPrev(zl,prev); /* Back to previous ele. */
         if (prev == NULL) {
             key->zer = 1;
             return 0;
@@ -1955,7 +1955,7 @@ int RM_ZsetRangePrev(RedisModuleKey *key) {
                 /* Fetch the previous element score for the
                  * range check. */
                 unsigned char *saved_prev = prev;
-                prev = ziplistNext(zl,prev); /* Skip element to get the score.*/
+                prev = lpNext(zl,prev); /* Skip element to get the score.*/
                 double score = zzlGetScore(prev); /* Obtain the prev score. */
                 if (!zslValueGteMin(score,&key->zrs)) {
                     key->zer = 1;
@@ -2520,6 +2520,7 @@ RedisModuleCallReply *RM_Call(RedisModuleCtx *ctx, const char *cmdname, const ch
     c->flags |= CLIENT_MODULE;
     c->db = ctx->client->db;
     c->argv = argv;
+    c->argv_len = argc;
     c->argc = argc;
     c->cmd = c->lastcmd = cmd;
     /* We handle the above format error only when the client is setup so that
@@ -2831,9 +2832,8 @@ int RM_ModuleTypeSetValue(RedisModuleKey *key, moduleType *mt, void *value) {
     if (!(key->mode & REDISMODULE_WRITE) || key->iter) return REDISMODULE_ERR;
     RM_DeleteKey(key);
     robj *o = createModuleObject(mt,value);
-    setKey(key->db,key->key,o);
+    key->value = setKey(key->db,key->key,o);
     decrRefCount(o);
-    key->value = o;
     return REDISMODULE_OK;
 }
 
@@ -3558,6 +3558,127 @@ void moduleReleaseGIL(void) {
     pthread_mutex_unlock(&moduleGIL);
 }
 
+/* --------------------------------------------------------------------------
+ * Module Timers API
+ *
+ * Module timers are an high precision "green timers" abstraction where
+ * every module can register even millions of timers without problems,
+ * since they are stored in the event loop timers heap, so creating,
+ * stopping and firing a timer is O(log(N)).
+ * -------------------------------------------------------------------------- */
+
+typedef struct RedisModuleTimer {
+    RedisModule *module;                /* Module reference. */
+    RedisModuleTimerProc callback;      /* The callback to invoke on expire. */
+    void *data;                         /* Private data for the callback. */
+    int dbid;                           /* Database number selected by the
+                                           original client. */
+} RedisModuleTimer;
+
+/* Client used as the context of the timers callbacks. */
+static client *moduleTimerClient = NULL;
+
+/* This is the timer handler that is called by the main event loop. */
+int moduleTimerHandler(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    RedisModuleTimer *timer = clientData;
+    RedisModuleCtx ctx = REDISMODULE_CTX_INIT;
+    UNUSED(eventLoop);
+    UNUSED(id);
+
+    if (moduleTimerClient == NULL) moduleTimerClient = createClient(-1);
+    ctx.module = timer->module;
+    ctx.client = moduleTimerClient;
+    selectDb(ctx.client,timer->dbid);
+    timer->callback(&ctx,timer->data);
+    moduleFreeContext(&ctx);
+    return AE_NOMORE;
+}
+
+/* Release the timer structure once the event loop is done with it. */
+void moduleTimerFinalizer(struct aeEventLoop *eventLoop, void *clientData) {
+    UNUSED(eventLoop);
+    zfree(clientData);
+}
+
+/* Return the module timer with the specified ID, if it belongs to the
+ * module of the context, otherwise NULL. */
+static RedisModuleTimer *moduleGetTimer(RedisModuleCtx *ctx, RedisModuleTimerID id) {
+    aeTimeEvent *te = aeGetTimeEvent(server.el,(long long)id);
+    RedisModuleTimer *timer;
+
+    if (te == NULL || te->timeProc != moduleTimerHandler) return NULL;
+    timer = te->clientData;
+    return timer->module == ctx->module ? timer : NULL;
+}
+
+/* Create a new timer that will fire after `period` milliseconds, and will call
+ * the specified function using `data` as argument. The returned timer ID can be
+ * used to get information from the timer or to stop it before it fires.
+ *
+ * The callback is called with a context having the same database selected
+ * as the context used to create the timer. Timers fire just once. */
+RedisModuleTimerID RM_CreateTimer(RedisModuleCtx *ctx, mstime_t period, RedisModuleTimerProc callback, void *data) {
+    RedisModuleTimer *timer = zmalloc(sizeof(*timer));
+    long long id;
+
+    timer->module = ctx->module;
+    timer->callback = callback;
+    timer->data = data;
+    timer->dbid = ctx->client ? ctx->client->db->id : 0;
+    if (period < 0) period = 0;
+    id = aeCreateTimeEvent(server.el,period,moduleTimerHandler,timer,
+                           moduleTimerFinalizer);
+    return (RedisModuleTimerID)id;
+}
+
+/* Stop a timer, returns REDISMODULE_OK if the timer was found, belonged to the
+ * calling module, and was stopped, otherwise REDISMODULE_ERR is returned.
+ * If not NULL, the data pointer is set to the value of the data argument when
+ * the timer was created. */
+int RM_StopTimer(RedisModuleCtx *ctx, RedisModuleTimerID id, void **data) {
+    RedisModuleTimer *timer = moduleGetTimer(ctx,id);
+
+    if (timer == NULL) return REDISMODULE_ERR;
+    if (data) *data = timer->data;
+    aeDeleteTimeEvent(server.el,(long long)id);
+    return REDISMODULE_OK;
+}
+
+/* Obtain information about a timer: its remaining time before firing
+ * (in milliseconds), and the private data pointer associated with the timer.
+ * If the timer specified does not exist or belongs to a different module
+ * no information is returned and the function returns REDISMODULE_ERR, otherwise
+ * REDISMODULE_OK is returned. The arguments remaining or data can be NULL if
+ * the caller does not need certain information. */
+int RM_GetTimerInfo(RedisModuleCtx *ctx, RedisModuleTimerID id, uint64_t *remaining, void **data) {
+    RedisModuleTimer *timer = moduleGetTimer(ctx,id);
+
+    if (timer == NULL) return REDISMODULE_ERR;
+    if (remaining)
+        *remaining = aeTimeEventRemaining(aeGetTimeEvent(server.el,(long long)id));
+    if (data) *data = timer->data;
+    return REDISMODULE_OK;
+}
+
+/* Stop all the timers of a module that is going to be unloaded. */
+void moduleStopTimers(RedisModule *module) {
+    long long *ids = NULL;
+    int j, count = 0;
+
+    for (j = 0; j < server.el->timersCount; j++) {
+        aeTimeEvent *te = server.el->timers[j];
+        RedisModuleTimer *timer = te->clientData;
+
+        if (te->timeProc != moduleTimerHandler || timer->module != module)
+            continue;
+        ids = zrealloc(ids,sizeof(long long)*(count+1));
+        ids[count++] = te->id;
+    }
+    /* Deleting events changes the heap: delete them only after the scan. */
+    for (j = 0; j < count; j++) aeDeleteTimeEvent(server.el,ids[j]);
+    zfree(ids);
+}
+
 /* --------------------------------------------------------------------------
  * Modules API internals
  * -------------------------------------------------------------------------- */
@@ -3724,6 +3845,9 @@ int moduleUnload(sds name) {
 
     /* Unregister all the hooks. TODO: Yet no hooks support here. */
 
+    /* Timers would call the unloaded code: stop them. */
+    moduleStopTimers(module);
+
     /* Unload the dynamic library. */
     if (dlclose(module->handle) == -1) {
         char *error = dlerror();
@@ -3916,4 +4040,7 @@ void moduleRegisterCoreAPI(void) {
     REGISTER_API(DigestAddStringBuffer);
     REGISTER_API(DigestAddLongLong);
     REGISTER_API(DigestEndSequence);
+    REGISTER_API(CreateTimer);
+    REGISTER_API(StopTimer);
+    REGISTER_API(GetTimerInfo);
 }
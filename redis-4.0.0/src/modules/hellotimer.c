@@ -0,0 +1,101 @@
+/* Hellotimer module -- An example of the module timers API.
+ *
+ * -----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2017, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../redismodule.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Timer callback: log the string passed as private data and free it. */
+void timerHandler(RedisModuleCtx *ctx, void *data) {
+    RedisModule_Log(ctx,"notice","Fired %s!",(char *)data);
+    RedisModule_Free(data);
+}
+
+/* HELLOTIMER.TIMER <count> -- Create <count> timers firing randomly
+ * in the next 5 seconds. Replies with the IDs of the timers. */
+int TimerCommand_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    long long count, j;
+
+    if (argc != 2) return RedisModule_WrongArity(ctx);
+    if (RedisModule_StringToLongLong(argv[1],&count) != REDISMODULE_OK ||
+        count < 0)
+        return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+
+    RedisModule_ReplyWithArray(ctx,count);
+    for (j = 0; j < count; j++) {
+        int delay = rand() % 5000;
+        char *buf = RedisModule_Alloc(256);
+        snprintf(buf,256,"After %d",delay);
+        RedisModuleTimerID id =
+            RedisModule_CreateTimer(ctx,delay,timerHandler,buf);
+        RedisModule_ReplyWithLongLong(ctx,id);
+    }
+    return REDISMODULE_OK;
+}
+
+/* HELLOTIMER.STOP <id> -- Stop a timer created by this module, replying
+ * with the number of milliseconds that were remaining before it fired. */
+int StopCommand_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    long long id;
+    uint64_t remaining;
+    void *data;
+
+    if (argc != 2) return RedisModule_WrongArity(ctx);
+    if (RedisModule_StringToLongLong(argv[1],&id) != REDISMODULE_OK)
+        return RedisModule_ReplyWithError(ctx,"ERR invalid timer id");
+    if (RedisModule_GetTimerInfo(ctx,id,&remaining,NULL) != REDISMODULE_OK ||
+        RedisModule_StopTimer(ctx,id,&data) != REDISMODULE_OK)
+        return RedisModule_ReplyWithError(ctx,"ERR no such timer");
+    RedisModule_Free(data);
+    return RedisModule_ReplyWithLongLong(ctx,remaining);
+}
+
+/* This function must be present on each Redis module. It is used in order to
+ * register the commands into the Redis server. */
+int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    REDISMODULE_NOT_USED(argv);
+    REDISMODULE_NOT_USED(argc);
+
+    if (RedisModule_Init(ctx,"hellotimer",1,REDISMODULE_APIVER_1)
+        == REDISMODULE_ERR) return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"hellotimer.timer",
+        TimerCommand_RedisCommand,"readonly",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"hellotimer.stop",
+        StopCommand_RedisCommand,"readonly",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    return REDISMODULE_OK;
+}
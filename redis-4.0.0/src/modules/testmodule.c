@@ -121,6 +121,59 @@ int TestStringPrintf(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 }
 
 
+/* Counters incremented by the two timers of TEST.TIMER.START. */
+static int TestTimerFired[2];
+static RedisModuleTimerID TestTimerID[2];
+
+void TestTimerHandler(RedisModuleCtx *ctx, void *data) {
+    REDISMODULE_NOT_USED(ctx);
+    (*(int*)data)++;
+}
+
+/* TEST.TIMER.START -- Create two timers firing in 10 milliseconds, and stop
+ * the second one, that must return its private data and no longer exist. */
+int TestTimerStart(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    REDISMODULE_NOT_USED(argv);
+    REDISMODULE_NOT_USED(argc);
+    uint64_t remaining;
+    void *data;
+    int j;
+
+    for (j = 0; j < 2; j++) {
+        TestTimerFired[j] = 0;
+        TestTimerID[j] = RedisModule_CreateTimer(ctx,10,TestTimerHandler,
+                                                 TestTimerFired+j);
+    }
+    if (RedisModule_GetTimerInfo(ctx,TestTimerID[1],&remaining,&data) !=
+        REDISMODULE_OK || remaining > 10 || data != TestTimerFired+1)
+        return RedisModule_ReplyWithError(ctx,"ERR wrong timer info");
+    if (RedisModule_StopTimer(ctx,TestTimerID[1],&data) != REDISMODULE_OK ||
+        data != TestTimerFired+1)
+        return RedisModule_ReplyWithError(ctx,"ERR can't stop the timer");
+    if (RedisModule_GetTimerInfo(ctx,TestTimerID[1],NULL,NULL) !=
+        REDISMODULE_ERR ||
+        RedisModule_StopTimer(ctx,TestTimerID[1],NULL) != REDISMODULE_ERR)
+        return RedisModule_ReplyWithError(ctx,"ERR stopped timer still exists");
+    return RedisModule_ReplyWithSimpleString(ctx,"OK");
+}
+
+/* TEST.TIMER.FIRED -- Reply with the number of times the two timers of
+ * TEST.TIMER.START fired, and with 1 for every timer still existing. */
+int TestTimerFiredCount(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    REDISMODULE_NOT_USED(argv);
+    REDISMODULE_NOT_USED(argc);
+    int j;
+
+    RedisModule_ReplyWithArray(ctx,4);
+    for (j = 0; j < 2; j++)
+        RedisModule_ReplyWithLongLong(ctx,TestTimerFired[j]);
+    for (j = 0; j < 2; j++)
+        RedisModule_ReplyWithLongLong(ctx,
+            RedisModule_GetTimerInfo(ctx,TestTimerID[j],NULL,NULL) ==
+            REDISMODULE_OK);
+    return REDISMODULE_OK;
+}
+
 /* ----------------------------- Test framework ----------------------------- */
 
 /* Return 1 if the reply matches the specified string, otherwise log errors
@@ -229,6 +282,14 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
         TestStringPrintf,"write deny-oom",1,1,1) == REDISMODULE_ERR)
         return REDISMODULE_ERR;
 
+    if (RedisModule_CreateCommand(ctx,"test.timer.start",
+        TestTimerStart,"readonly",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"test.timer.fired",
+        TestTimerFiredCount,"readonly",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
     if (RedisModule_CreateCommand(ctx,"test.it",
         TestIt,"readonly",1,1,1) == REDISMODULE_ERR)
         return REDISMODULE_ERR;
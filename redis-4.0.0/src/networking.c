@@ -54,13 +54,34 @@ size_t getStringObjectSdsUsedMemory(robj *o) {
     }
 }
 
+/* The client reply list is a list of sds chunks, however large string
+ * objects are not copied into it: the list node holds a reference to the
+ * object itself, see _addReplyObjectToList(). The two kinds of nodes are
+ * told apart by the pointer alignment: sds strings always start after an
+ * odd sized header (1, 3, 5, 9 or 17 bytes) at the start of an aligned
+ * allocation, so their pointer is odd, while robj pointers are returned by
+ * zmalloc() and are always even. */
+#define replyNodeIsObject(v) ((v) != NULL && (((uintptr_t)(v)) & 1) == 0)
+
+/* Return the buffer holding the protocol of the reply list node 'v'. */
+static inline sds replyNodeBuffer(void *v) {
+    return replyNodeIsObject(v) ? ((robj*)v)->ptr : v;
+}
+
 /* Client.reply list dup and free methods. */
 void *dupClientReplyValue(void *o) {
+    if (replyNodeIsObject(o)) {
+        incrRefCount(o);
+        return o;
+    }
     return sdsdup(o);
 }
 
 void freeClientReplyValue(void *o) {
-    sdsfree(o);
+    if (replyNodeIsObject(o))
+        decrRefCount(o);
+    else
+        sdsfree(o);
 }
 
 int listMatchObjects(void *a, void *b) {
@@ -96,11 +117,13 @@ client *createClient(int fd) {
     c->name = NULL;
     c->bufpos = 0;
     c->querybuf = sdsempty();
+    c->qb_pos = 0;
     c->pending_querybuf = sdsempty();
     c->querybuf_peak = 0;
     c->reqtype = 0;
     c->argc = 0;
     c->argv = NULL;
+    c->argv_len = 0;
     c->cmd = c->lastcmd = NULL;
     c->multibulklen = 0;
     c->bulklen = -1;
@@ -117,6 +140,11 @@ client *createClient(int fd) {
     c->slave_listening_port = 0;
     c->slave_ip[0] = '\0';
     c->slave_capa = SLAVE_CAPA_NONE;
+    c->ref_repl_buf_node = NULL;
+    c->ref_block_pos = 0;
+    c->repl_comp = NULL;
+    c->repl_comp_buf = NULL;
+    c->repl_disk_offset = 0;
     c->reply = listCreate();
     c->reply_bytes = 0;
     c->obuf_soft_limit_reached_time = 0;
@@ -125,6 +153,7 @@ client *createClient(int fd) {
     c->btype = BLOCKED_NONE;
     c->bpop.timeout = 0;
     c->bpop.keys = dictCreate(&objectKeyPointerValueDictType,NULL);
+    c->bpop.tiered_jobs = listCreate();
     c->bpop.target = NULL;
     c->bpop.numreplicas = 0;
     c->bpop.reploffset = 0;
@@ -140,6 +169,29 @@ client *createClient(int fd) {
     return c;
 }
 
+/* Put the client in the list of clients that have something to write to
+ * the socket, so that before re-entering the event loop we can try to
+ * directly write to the client socket, see handleClientsWithPendingWrites().
+ * Slaves are only scheduled when they can actually receive writes. */
+void clientInstallWriteHandler(client *c) {
+    /* Schedule the client to write the output buffers to the socket only
+     * if not already done and, for slaves, if the slave can actually receive
+     * writes at this stage. */
+    if (!(c->flags & CLIENT_PENDING_WRITE) &&
+        (c->replstate == REPL_STATE_NONE ||
+         (c->replstate == SLAVE_STATE_ONLINE && !c->repl_put_online_on_ack)))
+    {
+        /* Here instead of installing the write handler, we just flag the
+         * client and put it into a list of clients that have something
+         * to write to the socket. This way before re-entering the event
+         * loop, we can try to directly write to the client sockets avoiding
+         * a system call. We'll only really install the write handler if
+         * we'll not be able to write the whole reply at once. */
+        c->flags |= CLIENT_PENDING_WRITE;
+        listAddNodeHead(server.clients_pending_write,c);
+    }
+}
+
 /* This function is called every time we are going to transmit new data
  * to the client. The behavior is the following:
  *
@@ -177,24 +229,12 @@ int prepareClientToWrite(client *c) {
 
     if (c->fd <= 0) return C_ERR; /* Fake client for AOF loading. */
 
-    /* Schedule the client to write the output buffers to the socket only
-     * if not already done (there were no pending writes already and the client
-     * was yet not flagged), and, for slaves, if the slave can actually
-     * receive writes at this stage. */
-    if (!clientHasPendingReplies(c) &&
-        !(c->flags & CLIENT_PENDING_WRITE) &&
-        (c->replstate == REPL_STATE_NONE ||
-         (c->replstate == SLAVE_STATE_ONLINE && !c->repl_put_online_on_ack)))
-    {
-        /* Here instead of installing the write handler, we just flag the
-         * client and put it into a list of clients that have something
-         * to write to the socket. This way before re-entering the event
-         * loop, we can try to directly write to the client sockets avoiding
-         * a system call. We'll only really install the write handler if
-         * we'll not be able to write the whole reply at once. */
-        c->flags |= CLIENT_PENDING_WRITE;
-        listAddNodeHead(server.clients_pending_write,c);
-    }
+    /* Schedule the client to write the output buffers to the socket, unless
+     * there were already pending writes. Clients handled by an I/O thread
+     * (CLIENT_PENDING_READ) can't touch the global list: the main thread
+     * will schedule them once the thread returns the client. */
+    if (!clientHasPendingReplies(c) && !(c->flags & CLIENT_PENDING_READ))
+        clientInstallWriteHandler(c);
 
     /* Authorize the caller to queue in the output buffer of this client. */
     return C_OK;
@@ -224,7 +264,23 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
 void _addReplyObjectToList(client *c, robj *o) {
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
 
-    if (listLength(c->reply) == 0) {
+    /* Large strings are not copied: we just take a reference to the object
+     * and write the reply straight from it. The object can't change while
+     * the reply is pending, since commands modifying strings in place call
+     * dbUnshareStringValue() first, that copies objects with refcount > 1.
+     * Clients without a socket are excluded since their reply list is
+     * consumed as a list of sds strings by scripting and modules.
+     *
+     * Note that the referenced bytes are still accounted in reply_bytes,
+     * so that the output buffer limits work exactly as before: the object
+     * may be deleted from the dataset while the reply is pending. */
+    if (o->encoding == OBJ_ENCODING_RAW && c->fd != -1 &&
+        sdslen(o->ptr) >= PROTO_REPLY_MIN_REF_BYTES)
+    {
+        incrRefCount(o);
+        listAddNodeTail(c->reply,o);
+        c->reply_bytes += sdslen(o->ptr);
+    } else if (listLength(c->reply) == 0) {
         sds s = sdsdup(o->ptr);
         listAddNodeTail(c->reply,s);
         c->reply_bytes += sdslen(s);
@@ -234,7 +290,9 @@ void _addReplyObjectToList(client *c, robj *o) {
 
         /* Append to this object when possible. If tail == NULL it was
          * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+sdslen(o->ptr) <= PROTO_REPLY_CHUNK_BYTES) {
+        if (tail && !replyNodeIsObject(tail) &&
+            sdslen(tail)+sdslen(o->ptr) <= PROTO_REPLY_CHUNK_BYTES)
+        {
             tail = sdscatsds(tail,o->ptr);
             listNodeValue(ln) = tail;
             c->reply_bytes += sdslen(o->ptr);
@@ -264,7 +322,9 @@ void _addReplySdsToList(client *c, sds s) {
 
         /* Append to this object when possible. If tail == NULL it was
          * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+sdslen(s) <= PROTO_REPLY_CHUNK_BYTES) {
+        if (tail && !replyNodeIsObject(tail) &&
+            sdslen(tail)+sdslen(s) <= PROTO_REPLY_CHUNK_BYTES)
+        {
             tail = sdscatsds(tail,s);
             listNodeValue(ln) = tail;
             c->reply_bytes += sdslen(s);
@@ -290,7 +350,9 @@ void _addReplyStringToList(client *c, const char *s, size_t len) {
 
         /* Append to this object when possible. If tail == NULL it was
          * set via addDeferredMultiBulkLength(). */
-        if (tail && sdslen(tail)+len <= PROTO_REPLY_CHUNK_BYTES) {
+        if (tail && !replyNodeIsObject(tail) &&
+            sdslen(tail)+len <= PROTO_REPLY_CHUNK_BYTES)
+        {
             tail = sdscatlen(tail,s,len);
             listNodeValue(ln) = tail;
             c->reply_bytes += len;
@@ -443,8 +505,9 @@ void setDeferredMultiBulkLength(client *c, void *node, long length) {
     if (ln->next != NULL) {
         next = listNodeValue(ln->next);
 
-        /* Only glue when the next node is non-NULL (an sds in this case) */
-        if (next != NULL) {
+        /* Only glue when the next node is an sds (not NULL and not a
+         * referenced object). */
+        if (next != NULL && !replyNodeIsObject(next)) {
             len = sdscatsds(len,next);
             listDelNode(c->reply,ln->next);
             listNodeValue(ln) = len;
@@ -586,19 +649,46 @@ void addReplyBulkLongLong(client *c, long long ll) {
 
 /* Copy 'src' client output buffers into 'dst' client output buffers.
  * The function takes care of freeing the old output buffers of the
- * destination client. */
+ * destination client. For slaves the position in the shared replication
+ * buffer is copied as well. */
 void copyClientOutputBuffer(client *dst, client *src) {
     listRelease(dst->reply);
     dst->reply = listDup(src->reply);
     memcpy(dst->buf,src->buf,src->bufpos);
     dst->bufpos = src->bufpos;
     dst->reply_bytes = src->reply_bytes;
+    copySlaveReplBufferCursor(dst,src);
+}
+
+/* Replace the referenced objects in the reply list of every client with a
+ * private copy of their content. This is needed before handing whole
+ * databases to the lazyfree thread, that would otherwise release objects
+ * whose refcount is shared with the main thread. */
+void copyClientsReplyObjects(void) {
+    listIter li, ri;
+    listNode *ln, *rn;
+
+    listRewind(server.clients,&li);
+    while((ln = listNext(&li)) != NULL) {
+        client *c = listNodeValue(ln);
+
+        listRewind(c->reply,&ri);
+        while((rn = listNext(&ri)) != NULL) {
+            robj *o = listNodeValue(rn);
+
+            if (!replyNodeIsObject(o)) continue;
+            listNodeValue(rn) = sdsdup(o->ptr);
+            decrRefCount(o);
+        }
+    }
 }
 
 /* Return true if the specified client has pending reply buffers to write to
  * the socket. */
 int clientHasPendingReplies(client *c) {
-    return c->bufpos || listLength(c->reply);
+    return c->bufpos || listLength(c->reply) || slaveHasPendingReplBuffer(c) ||
+           (c->repl_comp_buf && sdslen(c->repl_comp_buf)) ||
+           c->repl_disk_offset;
 }
 
 #define MAX_ACCEPTS_PER_CALL 1000
@@ -762,6 +852,14 @@ void unlinkClient(client *c) {
         c->flags &= ~CLIENT_PENDING_WRITE;
     }
 
+    /* Remove from the list of pending reads if needed. */
+    if (c->flags & CLIENT_PENDING_READ) {
+        ln = listSearchKey(server.clients_pending_read,c);
+        serverAssert(ln != NULL);
+        listDelNode(server.clients_pending_read,ln);
+        c->flags &= ~CLIENT_PENDING_READ;
+    }
+
     /* When client was just unblocked because of a blocking operation,
      * remove it from the list of unblocked clients. */
     if (c->flags & CLIENT_UNBLOCKED) {
@@ -806,6 +904,7 @@ void freeClient(client *c) {
     /* Deallocate structures used to block on blocking ops. */
     if (c->flags & CLIENT_BLOCKED) unblockClient(c);
     dictRelease(c->bpop.keys);
+    listRelease(c->bpop.tiered_jobs);
 
     /* UNWATCH all the keys */
     unwatchAllKeys(c);
@@ -833,6 +932,11 @@ void freeClient(client *c) {
             if (c->repldbfd != -1) close(c->repldbfd);
             if (c->replpreamble) sdsfree(c->replpreamble);
         }
+        releaseSlaveReplBufferCursor(c);
+        if (c->repl_comp) {
+            replCompressorRelease(c->repl_comp);
+            sdsfree(c->repl_comp_buf);
+        }
         list *l = (c->flags & CLIENT_MONITOR) ? server.monitors : server.slaves;
         ln = listSearchKey(l,c);
         serverAssert(ln != NULL);
@@ -887,51 +991,281 @@ void freeClientsInAsyncFreeQueue(void) {
     }
 }
 
+/* I/O threads operation currently in progress, see the threaded I/O
+ * section at the end of this file. */
+#define IO_THREADS_OP_IDLE 0
+#define IO_THREADS_OP_READ 1
+#define IO_THREADS_OP_WRITE 2
+static int io_threads_op = IO_THREADS_OP_IDLE;
+
+/* Free the client from the read / write paths. While the I/O threads are
+ * processing a batch of clients we can't free anything (nor touch the global
+ * client lists), so the client is just flagged and the main thread will free
+ * it once all the threads are done. */
+static void freeClientFromIOPath(client *c) {
+    if (io_threads_op == IO_THREADS_OP_IDLE)
+        freeClient(c);
+    else
+        c->flags |= CLIENT_CLOSE_AFTER_IO;
+}
+
+/* Remove the fully written node of 'objlen' bytes at the head of the client
+ * reply list. */
+static void delReplyListHead(client *c, size_t objlen) {
+    listDelNode(c->reply,listFirst(c->reply));
+    c->sentlen = 0;
+    c->reply_bytes -= objlen;
+    /* If there are no longer objects in the list, we expect
+     * the count of reply bytes to be exactly zero. */
+    if (listLength(c->reply) == 0)
+        serverAssert(c->reply_bytes == 0);
+}
+
+/* Called by the main thread after the I/O threads wrote the replies:
+ * release the referenced object left at the head of the reply list by
+ * writeToClient() if it was fully written. */
+static void releaseWrittenReplyObject(client *c) {
+    void *o;
+
+    if (c->bufpos || listLength(c->reply) == 0) return;
+    o = listNodeValue(listFirst(c->reply));
+    if (replyNodeIsObject(o) && c->sentlen == sdslen(((robj*)o)->ptr))
+        delReplyListHead(c,c->sentlen);
+}
+
+/* Write to the socket, with a single writev() call, the static buffer
+ * and as many reply list nodes as allowed by NET_MAX_WRITEV_IOV and
+ * NET_MAX_WRITES_PER_EVENT, then remove from the output buffers what was
+ * written. Pipelined clients usually have many small reply chunks queued,
+ * so this saves a lot of syscalls compared to writing a node at a time.
+ *
+ * Returns the writev() return value, or 0 if nothing was written without
+ * calling writev() at all. */
+static ssize_t writevToClient(int fd, client *c) {
+    struct iovec iov[NET_MAX_WRITEV_IOV];
+    int iovcnt = 0, threaded = io_threads_op != IO_THREADS_OP_IDLE;
+    size_t iovbytes = 0, offset = c->sentlen, remaining;
+    ssize_t nwritten = 0;
+    listIter li;
+    listNode *ln;
+
+    if (c->bufpos > 0) {
+        iov[iovcnt].iov_base = c->buf+offset;
+        iov[iovcnt].iov_len = c->bufpos-offset;
+        iovbytes += iov[iovcnt++].iov_len;
+        offset = 0;
+    }
+
+    /* Referenced objects may be shared with clients served by other I/O
+     * threads, so their refcount is only touched by the main thread (see
+     * releaseWrittenReplyObject()): when called from the I/O threads we
+     * stop at the first object, that is left at the head of the list once
+     * written. */
+    listRewind(c->reply,&li);
+    while(iovcnt < NET_MAX_WRITEV_IOV && iovbytes < NET_MAX_WRITES_PER_EVENT &&
+          (ln = listNext(&li)) != NULL)
+    {
+        void *o = listNodeValue(ln);
+        sds buf = replyNodeBuffer(o);
+
+        if (offset == sdslen(buf)) {
+            if (threaded && replyNodeIsObject(o)) return 0;
+            continue; /* Empty nodes are removed below. */
+        }
+        iov[iovcnt].iov_base = buf+offset;
+        iov[iovcnt].iov_len = sdslen(buf)-offset;
+        iovbytes += iov[iovcnt++].iov_len;
+        offset = 0;
+        if (threaded && replyNodeIsObject(o)) break;
+    }
+
+    if (iovcnt) {
+        nwritten = writev(fd,iov,iovcnt);
+        if (nwritten <= 0) return nwritten;
+    }
+
+    /* Consume the static buffer first, then the list nodes. */
+    remaining = nwritten;
+    if (c->bufpos > 0) {
+        if (remaining < c->bufpos-c->sentlen) {
+            c->sentlen += remaining;
+            return nwritten;
+        }
+        remaining -= c->bufpos-c->sentlen;
+        c->bufpos = 0;
+        c->sentlen = 0;
+    }
+    while(listLength(c->reply)) {
+        void *o = listNodeValue(listFirst(c->reply));
+        size_t objlen = sdslen(replyNodeBuffer(o));
+
+        if (objlen-c->sentlen > remaining) {
+            c->sentlen += remaining;
+            break;
+        }
+        remaining -= objlen-c->sentlen;
+        if (threaded && replyNodeIsObject(o)) {
+            c->sentlen = objlen;
+            break;
+        }
+        delReplyListHead(c,objlen);
+    }
+    return nwritten;
+}
+
+/* Write to the socket of a slave the shared replication buffer, starting
+ * from the position of the slave. Like writevToClient() up to
+ * NET_MAX_WRITEV_IOV blocks are written with a single writev() call, but
+ * from the I/O threads we stop at the end of the current block: moving the
+ * slave to the next block changes the refcount of blocks shared with other
+ * slaves, so it is left to the main thread (advanceSlaveReplBufferCursor()).
+ *
+ * Returns the writev() return value, or 0 if nothing was written. */
+static ssize_t writevReplBufferToSlave(int fd, client *c) {
+    struct iovec iov[NET_MAX_WRITEV_IOV];
+    int iovcnt = 0, threaded = io_threads_op != IO_THREADS_OP_IDLE;
+    size_t iovbytes = 0, pos = c->ref_block_pos;
+    listNode *ln = c->ref_repl_buf_node;
+    ssize_t nwritten;
+
+    while(ln && iovcnt < NET_MAX_WRITEV_IOV &&
+          iovbytes < NET_MAX_WRITES_PER_EVENT)
+    {
+        replBufBlock *o = listNodeValue(ln);
+
+        if (o->used > pos) {
+            iov[iovcnt].iov_base = o->buf+pos;
+            iov[iovcnt].iov_len = o->used-pos;
+            iovbytes += iov[iovcnt++].iov_len;
+        }
+        if (threaded) break;
+        pos = 0;
+        ln = listNextNode(ln);
+    }
+    if (iovcnt == 0) return 0;
+
+    nwritten = writev(fd,iov,iovcnt);
+    if (nwritten <= 0) return nwritten;
+    c->ref_block_pos += nwritten;
+    if (!threaded) advanceSlaveReplBufferCursor(c);
+    return nwritten;
+}
+
+/* Read the next chunk of the disk backlog for a slave reading from disk.
+ * Returns the number of bytes read, or -1 on error. */
+static ssize_t readBacklogDiskForSlave(client *c, void *buf, size_t len) {
+    ssize_t nread = replBacklogDiskRead(c->repl_disk_offset,buf,len);
+
+    if (nread == -1) {
+        int err = errno;
+
+        serverLog(LL_WARNING,"Error reading the replication backlog from "
+            "disk for slave %s: %s", replicationGetSlaveName(c),
+            strerror(err));
+        errno = err;
+    }
+    return nread;
+}
+
+/* Write to the socket of a slave the replication backlog from its disk
+ * tier (see replbacklog.c), starting from the offset of the slave. The data
+ * is read in chunks of PROTO_IOBUF_LEN bytes.
+ *
+ * Always called by the main thread, see writeToClient(). Returns the
+ * write() return value, or -1 if reading from disk failed. */
+static ssize_t writeBacklogDiskToSlave(int fd, client *c) {
+    char buf[PROTO_IOBUF_LEN];
+    ssize_t nread, nwritten;
+
+    nread = readBacklogDiskForSlave(c,buf,sizeof(buf));
+    if (nread == -1) return -1;
+    nwritten = write(fd,buf,nread);
+    if (nwritten <= 0) return nwritten;
+    replBacklogDiskAdvance(c,nwritten);
+    return nwritten;
+}
+
+/* Write to the socket of a slave with a compressed link (see
+ * replcompress.c). The data is compressed in the order it would be sent
+ * otherwise, private output buffers first, a buffer or replication block
+ * at a time, and removed from the output buffers once compressed, so what
+ * the slave still has to receive is the compressed data not yet written
+ * plus the usual buffers.
+ *
+ * Always called by the main thread, see writeToClient(). Returns the
+ * write() return value, or 0 if there was nothing to write. */
+static ssize_t writeCompressedToSlave(int fd, client *c) {
+    ssize_t nwritten;
+
+    while(sdslen(c->repl_comp_buf) == 0) {
+        if (c->bufpos) {
+            c->repl_comp_buf = replCompress(c->repl_comp,c->repl_comp_buf,
+                c->buf+c->sentlen,c->bufpos-c->sentlen);
+            c->bufpos = 0;
+            c->sentlen = 0;
+        } else if (listLength(c->reply)) {
+            sds buf = replyNodeBuffer(listNodeValue(listFirst(c->reply)));
+
+            c->repl_comp_buf = replCompress(c->repl_comp,c->repl_comp_buf,
+                buf+c->sentlen,sdslen(buf)-c->sentlen);
+            delReplyListHead(c,sdslen(buf));
+        } else if (c->repl_disk_offset) {
+            char buf[PROTO_IOBUF_LEN];
+            ssize_t nread = readBacklogDiskForSlave(c,buf,sizeof(buf));
+
+            if (nread == -1) return -1;
+            c->repl_comp_buf = replCompress(c->repl_comp,c->repl_comp_buf,
+                buf,nread);
+            replBacklogDiskAdvance(c,nread);
+        } else if (slaveHasPendingReplBuffer(c)) {
+            replBufBlock *o = listNodeValue(c->ref_repl_buf_node);
+
+            c->repl_comp_buf = replCompress(c->repl_comp,c->repl_comp_buf,
+                o->buf+c->ref_block_pos,o->used-c->ref_block_pos);
+            c->ref_block_pos = o->used;
+            advanceSlaveReplBufferCursor(c);
+        } else {
+            return 0;
+        }
+    }
+
+    nwritten = write(fd,c->repl_comp_buf,sdslen(c->repl_comp_buf));
+    if (nwritten <= 0) return nwritten;
+    sdsrange(c->repl_comp_buf,nwritten,-1);
+    return nwritten;
+}
+
 /* Write data in output buffers to client. Return C_OK if the client
- * is still valid after the call, C_ERR if it was freed. */
+ * is still valid after the call, C_ERR if it was freed (or, when called
+ * from an I/O thread, flagged to be freed by the main thread). */
 int writeToClient(int fd, client *c, int handler_installed) {
     ssize_t nwritten = 0, totwritten = 0;
-    size_t objlen;
-    sds o;
+    long long calls = 0;
 
-    while(clientHasPendingReplies(c)) {
-        if (c->bufpos > 0) {
-            nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
-            if (nwritten <= 0) break;
-            c->sentlen += nwritten;
-            totwritten += nwritten;
-
-            /* If the buffer was sent, set bufpos to zero to continue with
-             * the remainder of the reply. */
-            if ((int)c->sentlen == c->bufpos) {
-                c->bufpos = 0;
-                c->sentlen = 0;
-            }
-        } else {
-            o = listNodeValue(listFirst(c->reply));
-            objlen = sdslen(o);
+    /* Compression uses the state of the client compressor, and consumes
+     * the shared replication buffer as it goes, and the disk backlog is
+     * shared with the bio thread writing it: leave them to the main thread,
+     * that will install the write handler. */
+    if ((c->repl_comp || c->repl_disk_offset) &&
+        io_threads_op != IO_THREADS_OP_IDLE) return C_OK;
 
-            if (objlen == 0) {
-                listDelNode(c->reply,listFirst(c->reply));
-                continue;
-            }
+    while(clientHasPendingReplies(c)) {
+        /* Slaves send their private output buffers first, then the
+         * replication stream from the disk backlog if they are reading it,
+         * and from the shared replication buffer. */
+        if (c->repl_comp)
+            nwritten = writeCompressedToSlave(fd,c);
+        else if (c->bufpos || listLength(c->reply))
+            nwritten = writevToClient(fd,c);
+        else if (c->repl_disk_offset)
+            nwritten = writeBacklogDiskToSlave(fd,c);
+        else
+            nwritten = writevReplBufferToSlave(fd,c);
+        if (nwritten == 0) break;
+        calls++;
+        if (nwritten < 0) break;
+        totwritten += nwritten;
 
-            nwritten = write(fd, o + c->sentlen, objlen - c->sentlen);
-            if (nwritten <= 0) break;
-            c->sentlen += nwritten;
-            totwritten += nwritten;
-
-            /* If we fully sent the object on head go to the next one */
-            if (c->sentlen == objlen) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->sentlen = 0;
-                c->reply_bytes -= objlen;
-                /* If there are no longer objects in the list, we expect
-                 * the count of reply bytes to be exactly zero. */
-                if (listLength(c->reply) == 0)
-                    serverAssert(c->reply_bytes == 0);
-            }
-        }
         /* Note that we avoid to send more than NET_MAX_WRITES_PER_EVENT
          * bytes, in a single threaded server it's a good idea to serve
          * other clients as well, even if a very large request comes from
@@ -944,14 +1278,15 @@ int writeToClient(int fd, client *c, int handler_installed) {
             (server.maxmemory == 0 ||
              zmalloc_used_memory() < server.maxmemory)) break;
     }
-    server.stat_net_output_bytes += totwritten;
+    atomicIncr(server.stat_net_output_bytes,totwritten);
+    atomicIncr(server.stat_net_write_calls,calls);
     if (nwritten == -1) {
         if (errno == EAGAIN) {
             nwritten = 0;
         } else {
             serverLog(LL_VERBOSE,
                 "Error writing to client: %s", strerror(errno));
-            freeClient(c);
+            freeClientFromIOPath(c);
             return C_ERR;
         }
     }
@@ -968,7 +1303,7 @@ int writeToClient(int fd, client *c, int handler_installed) {
 
         /* Close connection after entire reply has been sent. */
         if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
-            freeClient(c);
+            freeClientFromIOPath(c);
             return C_ERR;
         }
     }
@@ -1036,6 +1371,15 @@ void resetClient(client *c) {
     }
 }
 
+/* Return a pointer to the first '\r' of the query buffer, starting at the
+ * current position c->qb_pos, or NULL if there is none. The search is
+ * bounded by the buffer length: unlike strchr() it does not need to check
+ * every byte for the null terminator, and memchr() is vectorized by the
+ * C library (SSE2 / AVX2 where available). */
+static inline char *protoFindCR(client *c) {
+    return memchr(c->querybuf+c->qb_pos,'\r',sdslen(c->querybuf)-c->qb_pos);
+}
+
 /* Like processMultibulkBuffer(), but for the inline protocol instead of RESP,
  * this function consumes the client query buffer and creates a command ready
  * to be executed inside the client structure. Returns C_OK if the command
@@ -1049,12 +1393,14 @@ int processInlineBuffer(client *c) {
     sds *argv, aux;
     size_t querylen;
 
+    char *querybuf = c->querybuf+c->qb_pos;
+
     /* Search for end of line */
-    newline = strchr(c->querybuf,'\n');
+    newline = memchr(querybuf,'\n',sdslen(c->querybuf)-c->qb_pos);
 
     /* Nothing to do without a \r\n */
     if (newline == NULL) {
-        if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+        if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
             addReplyError(c,"Protocol error: too big inline request");
             setProtocolError("too big inline request",c,0);
         }
@@ -1062,12 +1408,12 @@ int processInlineBuffer(client *c) {
     }
 
     /* Handle the \r\n case. */
-    if (newline && newline != c->querybuf && *(newline-1) == '\r')
+    if (newline && newline != querybuf && *(newline-1) == '\r')
         newline--;
 
     /* Split the input buffer up to the \r\n */
-    querylen = newline-(c->querybuf);
-    aux = sdsnewlen(c->querybuf,querylen);
+    querylen = newline-querybuf;
+    aux = sdsnewlen(querybuf,querylen);
     argv = sdssplitargs(aux,&argc);
     sdsfree(aux);
     if (argv == NULL) {
@@ -1083,12 +1429,14 @@ int processInlineBuffer(client *c) {
         c->repl_ack_time = server.unixtime;
 
     /* Leave data after the first line of the query in the buffer */
-    sdsrange(c->querybuf,querylen+2,-1);
+    c->qb_pos += querylen+2;
+    if (c->qb_pos > sdslen(c->querybuf)) c->qb_pos = sdslen(c->querybuf);
 
     /* Setup argv array on client structure */
-    if (argc) {
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj*)*argc);
+    if (c->argv_len < argc) {
+        zfree(c->argv);
+        c->argv_len = argc;
+        c->argv = zmalloc(sizeof(robj*)*c->argv_len);
     }
 
     /* Create redis objects for all arguments. */
@@ -1105,7 +1453,8 @@ int processInlineBuffer(client *c) {
 }
 
 /* Helper function. Trims query buffer to make the function that processes
- * multi bulk requests idempotent. */
+ * multi bulk requests idempotent. The 'pos' offset is relative to the
+ * current query buffer position c->qb_pos. */
 #define PROTO_DUMP_LEN 128
 static void setProtocolError(const char *errstr, client *c, int pos) {
     if (server.verbosity <= LL_VERBOSE) {
@@ -1132,7 +1481,8 @@ static void setProtocolError(const char *errstr, client *c, int pos) {
         sdsfree(client);
     }
     c->flags |= CLIENT_CLOSE_AFTER_REPLY;
-    sdsrange(c->querybuf,pos,-1);
+    sdsrange(c->querybuf,c->qb_pos+pos,-1);
+    c->qb_pos = 0;
 }
 
 /* Process the query buffer for client 'c', setting up the client argument
@@ -1148,7 +1498,7 @@ static void setProtocolError(const char *errstr, client *c, int pos) {
  * to be '*'. Otherwise for inline commands processInlineBuffer() is called. */
 int processMultibulkBuffer(client *c) {
     char *newline = NULL;
-    int pos = 0, ok;
+    int ok;
     long long ll;
 
     if (c->multibulklen == 0) {
@@ -1156,9 +1506,9 @@ int processMultibulkBuffer(client *c) {
         serverAssertWithInfo(c,NULL,c->argc == 0);
 
         /* Multi bulk length cannot be read without a \r\n */
-        newline = strchr(c->querybuf,'\r');
+        newline = protoFindCR(c);
         if (newline == NULL) {
-            if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+            if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
                 addReplyError(c,"Protocol error: too big mbulk count string");
                 setProtocolError("too big mbulk count string",c,0);
             }
@@ -1171,34 +1521,36 @@ int processMultibulkBuffer(client *c) {
 
         /* We know for sure there is a whole line since newline != NULL,
          * so go ahead and find out the multi bulk length. */
-        serverAssertWithInfo(c,NULL,c->querybuf[0] == '*');
-        ok = string2ll(c->querybuf+1,newline-(c->querybuf+1),&ll);
+        serverAssertWithInfo(c,NULL,c->querybuf[c->qb_pos] == '*');
+        ok = string2ll(c->querybuf+c->qb_pos+1,
+                       newline-(c->querybuf+c->qb_pos+1),&ll);
         if (!ok || ll > 1024*1024) {
             addReplyError(c,"Protocol error: invalid multibulk length");
-            setProtocolError("invalid mbulk count",c,pos);
+            setProtocolError("invalid mbulk count",c,0);
             return C_ERR;
         }
 
-        pos = (newline-c->querybuf)+2;
-        if (ll <= 0) {
-            sdsrange(c->querybuf,pos,-1);
-            return C_OK;
-        }
+        c->qb_pos = (newline-c->querybuf)+2;
+        if (ll <= 0) return C_OK;
 
         c->multibulklen = ll;
 
-        /* Setup argv array on client structure */
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj*)*c->multibulklen);
+        /* Setup argv array on client structure, reusing the one of the
+         * previous command if it is big enough. */
+        if (c->argv_len < c->multibulklen) {
+            zfree(c->argv);
+            c->argv_len = c->multibulklen;
+            c->argv = zmalloc(sizeof(robj*)*c->argv_len);
+        }
     }
 
     serverAssertWithInfo(c,NULL,c->multibulklen > 0);
     while(c->multibulklen) {
         /* Read bulk length if unknown */
         if (c->bulklen == -1) {
-            newline = strchr(c->querybuf+pos,'\r');
+            newline = protoFindCR(c);
             if (newline == NULL) {
-                if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+                if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
                     addReplyError(c,
                         "Protocol error: too big bulk count string");
                     setProtocolError("too big bulk count string",c,0);
@@ -1211,22 +1563,23 @@ int processMultibulkBuffer(client *c) {
             if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
                 break;
 
-            if (c->querybuf[pos] != '$') {
+            if (c->querybuf[c->qb_pos] != '$') {
                 addReplyErrorFormat(c,
                     "Protocol error: expected '$', got '%c'",
-                    c->querybuf[pos]);
-                setProtocolError("expected $ but got something else",c,pos);
+                    c->querybuf[c->qb_pos]);
+                setProtocolError("expected $ but got something else",c,0);
                 return C_ERR;
             }
 
-            ok = string2ll(c->querybuf+pos+1,newline-(c->querybuf+pos+1),&ll);
+            ok = string2ll(c->querybuf+c->qb_pos+1,
+                           newline-(c->querybuf+c->qb_pos+1),&ll);
             if (!ok || ll < 0 || ll > 512*1024*1024) {
                 addReplyError(c,"Protocol error: invalid bulk length");
-                setProtocolError("invalid bulk length",c,pos);
+                setProtocolError("invalid bulk length",c,0);
                 return C_ERR;
             }
 
-            pos += newline-(c->querybuf+pos)+2;
+            c->qb_pos = newline-c->querybuf+2;
             if (ll >= PROTO_MBULK_BIG_ARG) {
                 size_t qblen;
 
@@ -1234,8 +1587,8 @@ int processMultibulkBuffer(client *c) {
                  * try to make it likely that it will start at c->querybuf
                  * boundary so that we can optimize object creation
                  * avoiding a large copy of data. */
-                sdsrange(c->querybuf,pos,-1);
-                pos = 0;
+                sdsrange(c->querybuf,c->qb_pos,-1);
+                c->qb_pos = 0;
                 qblen = sdslen(c->querybuf);
                 /* Hint the sds library about the amount of bytes this string is
                  * going to contain. */
@@ -1246,14 +1599,14 @@ int processMultibulkBuffer(client *c) {
         }
 
         /* Read bulk argument */
-        if (sdslen(c->querybuf)-pos < (unsigned)(c->bulklen+2)) {
+        if (sdslen(c->querybuf)-c->qb_pos < (size_t)(c->bulklen+2)) {
             /* Not enough data (+2 == trailing \r\n) */
             break;
         } else {
             /* Optimization: if the buffer contains JUST our bulk element
              * instead of creating a new object by *copying* the sds we
              * just use the current sds string. */
-            if (pos == 0 &&
+            if (c->qb_pos == 0 &&
                 c->bulklen >= PROTO_MBULK_BIG_ARG &&
                 (signed) sdslen(c->querybuf) == c->bulklen+2)
             {
@@ -1263,20 +1616,16 @@ int processMultibulkBuffer(client *c) {
                  * likely... */
                 c->querybuf = sdsnewlen(NULL,c->bulklen+2);
                 sdsclear(c->querybuf);
-                pos = 0;
             } else {
                 c->argv[c->argc++] =
-                    createStringObject(c->querybuf+pos,c->bulklen);
-                pos += c->bulklen+2;
+                    createStringObject(c->querybuf+c->qb_pos,c->bulklen);
+                c->qb_pos += c->bulklen+2;
             }
             c->bulklen = -1;
             c->multibulklen--;
         }
     }
 
-    /* Trim to pos */
-    if (pos) sdsrange(c->querybuf,pos,-1);
-
     /* We're done when c->multibulk == 0 */
     if (c->multibulklen == 0) return C_OK;
 
@@ -1284,16 +1633,55 @@ int processMultibulkBuffer(client *c) {
     return C_ERR;
 }
 
+/* Execute the command the client has in its argument vector, then reset
+ * the client if the command was actually executed. Returns C_ERR if the
+ * client was freed as a side effect of executing the command, otherwise
+ * C_OK is returned. */
+int processCommandAndResetClient(client *c) {
+    int deadclient = 0;
+    server.current_client = c;
+    /* Only reset the client when the command was executed. */
+    if (processCommand(c) == C_OK) {
+        if (c->flags & CLIENT_MASTER && !(c->flags & CLIENT_MULTI)) {
+            /* Update the applied replication offset of our master. */
+            c->reploff = c->read_reploff - sdslen(c->querybuf) + c->qb_pos;
+        }
+
+        /* Don't reset the client structure for clients blocked in a
+         * module blocking command, so that the reply callback will
+         * still be able to access the client argv and argc field.
+         * The client will be reset in unblockClientFromModule().
+         * Clients blocked reading spilled values will execute the
+         * same command again once unblocked. */
+        if (!(c->flags & CLIENT_BLOCKED) ||
+            (c->btype != BLOCKED_MODULE && c->btype != BLOCKED_TIERED))
+            resetClient(c);
+    }
+    /* freeMemoryIfNeeded may flush slave output buffers. This may
+     * result into a slave, that may be the active client, to be
+     * freed. */
+    if (server.current_client == NULL) deadclient = 1;
+    server.current_client = NULL;
+    return deadclient ? C_ERR : C_OK;
+}
+
 /* This function is called every time, in the client structure 'c', there is
  * more query buffer to process, because we read more data from the socket
  * or because a client was blocked and later reactivated, so there could be
- * pending query buffer, already representing a full command, to process. */
+ * pending query buffer, already representing a full command, to process.
+ *
+ * When called from an I/O thread (the client is flagged CLIENT_PENDING_READ)
+ * the function only parses the next command: execution is left to the main
+ * thread, see handleClientsWithPendingReadsUsingThreads(). */
 void processInputBuffer(client *c) {
-    server.current_client = c;
-    /* Keep processing while there is something in the input buffer */
-    while(sdslen(c->querybuf)) {
+    /* Keep processing while there is something in the input buffer, or
+     * a command already parsed by an I/O thread waiting to be executed. */
+    while(c->qb_pos < sdslen(c->querybuf) ||
+          c->flags & CLIENT_PENDING_COMMAND)
+    {
         /* Return if clients are paused. */
-        if (!(c->flags & CLIENT_SLAVE) && clientsArePaused()) break;
+        if (!(c->flags & CLIENT_SLAVE) &&
+            !(c->flags & CLIENT_PENDING_READ) && clientsArePaused()) break;
 
         /* Immediately abort if the client is in the middle of something. */
         if (c->flags & CLIENT_BLOCKED) break;
@@ -1305,57 +1693,67 @@ void processInputBuffer(client *c) {
          * The same applies for clients we want to terminate ASAP. */
         if (c->flags & (CLIENT_CLOSE_AFTER_REPLY|CLIENT_CLOSE_ASAP)) break;
 
-        /* Determine request type when unknown. */
-        if (!c->reqtype) {
-            if (c->querybuf[0] == '*') {
-                c->reqtype = PROTO_REQ_MULTIBULK;
-            } else {
-                c->reqtype = PROTO_REQ_INLINE;
+        if (c->flags & CLIENT_PENDING_COMMAND) {
+            /* The argument vector was already populated by an I/O thread:
+             * only the main thread gets here, so execute it. */
+            c->flags &= ~CLIENT_PENDING_COMMAND;
+        } else {
+            /* Determine request type when unknown. */
+            if (!c->reqtype) {
+                if (c->querybuf[c->qb_pos] == '*') {
+                    c->reqtype = PROTO_REQ_MULTIBULK;
+                } else {
+                    c->reqtype = PROTO_REQ_INLINE;
+                }
             }
-        }
 
-        if (c->reqtype == PROTO_REQ_INLINE) {
-            if (processInlineBuffer(c) != C_OK) break;
-        } else if (c->reqtype == PROTO_REQ_MULTIBULK) {
-            if (processMultibulkBuffer(c) != C_OK) break;
-        } else {
-            serverPanic("Unknown request type");
+            if (c->reqtype == PROTO_REQ_INLINE) {
+                if (processInlineBuffer(c) != C_OK) break;
+            } else if (c->reqtype == PROTO_REQ_MULTIBULK) {
+                if (processMultibulkBuffer(c) != C_OK) break;
+            } else {
+                serverPanic("Unknown request type");
+            }
         }
 
         /* Multibulk processing could see a <= 0 length. */
         if (c->argc == 0) {
             resetClient(c);
         } else {
-            /* Only reset the client when the command was executed. */
-            if (processCommand(c) == C_OK) {
-                if (c->flags & CLIENT_MASTER && !(c->flags & CLIENT_MULTI)) {
-                    /* Update the applied replication offset of our master. */
-                    c->reploff = c->read_reploff - sdslen(c->querybuf);
-                }
-
-                /* Don't reset the client structure for clients blocked in a
-                 * module blocking command, so that the reply callback will
-                 * still be able to access the client argv and argc field.
-                 * The client will be reset in unblockClientFromModule(). */
-                if (!(c->flags & CLIENT_BLOCKED) || c->btype != BLOCKED_MODULE)
-                    resetClient(c);
+            /* If we are in the context of an I/O thread we can't really
+             * execute the command here. All we can do is to flag the client
+             * as one that needs to process the command. */
+            if (c->flags & CLIENT_PENDING_READ) {
+                c->flags |= CLIENT_PENDING_COMMAND;
+                break;
             }
-            /* freeMemoryIfNeeded may flush slave output buffers. This may
-             * result into a slave, that may be the active client, to be
-             * freed. */
-            if (server.current_client == NULL) break;
+            /* The client may have been freed as a side effect of
+             * executing the command: return ASAP without touching it. */
+            if (processCommandAndResetClient(c) == C_ERR) return;
         }
     }
-    server.current_client = NULL;
+
+    /* Trim the processed part of the query buffer. This is done once for
+     * all the commands parsed in a single call, instead of moving the rest
+     * of the buffer after every command of a pipeline. */
+    if (c->qb_pos) {
+        sdsrange(c->querybuf,c->qb_pos,-1);
+        c->qb_pos = 0;
+    }
 }
 
 void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     client *c = (client*) privdata;
     int nread, readlen;
     size_t qblen;
+    replDecompressor *decomp;
     UNUSED(el);
     UNUSED(mask);
 
+    /* Check if we want to read from the client later when exiting from
+     * the event loop. This is the case if threaded I/O is enabled. */
+    if (postponeClientRead(c)) return;
+
     readlen = PROTO_IOBUF_LEN;
     /* If this is a multi bulk request, and we are processing a bulk reply
      * that is large enough, try to maximize the probability that the query
@@ -1371,21 +1769,33 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         if (remaining < readlen) readlen = remaining;
     }
 
+    /* With a compressed link the master data that was decompressed must be
+     * consumed at once: it is no longer in the socket, so no readable event
+     * would tell us about it later. */
+    decomp = (c->flags & CLIENT_MASTER) ? server.repl_master_decomp : NULL;
+    if (decomp) {
+        nread = replDecompressorFill(decomp,fd);
+        if (nread > 0) readlen = nread;
+    }
+
     qblen = sdslen(c->querybuf);
     if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
     c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
-    nread = read(fd, c->querybuf+qblen, readlen);
+    if (decomp == NULL)
+        nread = read(fd, c->querybuf+qblen, readlen);
+    else if (nread > 0)
+        nread = replDecompressorRead(decomp, fd, c->querybuf+qblen, readlen);
     if (nread == -1) {
         if (errno == EAGAIN) {
             return;
         } else {
             serverLog(LL_VERBOSE, "Reading from client: %s",strerror(errno));
-            freeClient(c);
+            freeClientFromIOPath(c);
             return;
         }
     } else if (nread == 0) {
         serverLog(LL_VERBOSE, "Client closed connection");
-        freeClient(c);
+        freeClientFromIOPath(c);
         return;
     } else if (c->flags & CLIENT_MASTER) {
         /* Append the query buffer to the pending (not applied) buffer
@@ -1398,7 +1808,7 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     sdsIncrLen(c->querybuf,nread);
     c->lastinteraction = server.unixtime;
     if (c->flags & CLIENT_MASTER) c->read_reploff += nread;
-    server.stat_net_input_bytes += nread;
+    atomicIncr(server.stat_net_input_bytes,nread);
     if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
         sds ci = catClientInfoString(sdsempty(),c), bytes = sdsempty();
 
@@ -1406,7 +1816,7 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         serverLog(LL_WARNING,"Closing client that reached max query buffer length: %s (qbuf initial bytes: %s)", ci, bytes);
         sdsfree(ci);
         sdsfree(bytes);
-        freeClient(c);
+        freeClientFromIOPath(c);
         return;
     }
 
@@ -1527,7 +1937,7 @@ sds catClientInfoString(sds s, client *client) {
         (int) dictSize(client->pubsub_channels),
         (int) listLength(client->pubsub_patterns),
         (client->flags & CLIENT_MULTI) ? client->mstate.count : -1,
-        (unsigned long long) sdslen(client->querybuf),
+        (unsigned long long) sdslen(client->querybuf)-client->qb_pos,
         (unsigned long long) sdsavail(client->querybuf),
         (unsigned long long) client->bufpos,
         (unsigned long long) listLength(client->reply),
@@ -1750,6 +2160,7 @@ void rewriteClientCommandVector(client *c, int argc, ...) {
     zfree(c->argv);
     /* Replace argv and argc with our new versions. */
     c->argv = argv;
+    c->argv_len = argc;
     c->argc = argc;
     c->cmd = lookupCommandOrOriginal(c->argv[0]->ptr);
     serverAssertWithInfo(c,NULL,c->cmd != NULL);
@@ -1761,6 +2172,7 @@ void replaceClientCommandVector(client *c, int argc, robj **argv) {
     freeClientArgv(c);
     zfree(c->argv);
     c->argv = argv;
+    c->argv_len = argc;
     c->argc = argc;
     c->cmd = lookupCommandOrOriginal(c->argv[0]->ptr);
     serverAssertWithInfo(c,NULL,c->cmd != NULL);
@@ -1780,8 +2192,11 @@ void replaceClientCommandVector(client *c, int argc, robj **argv) {
 void rewriteClientCommandArgument(client *c, int i, robj *newval) {
     robj *oldval;
 
-    if (i >= c->argc) {
+    if (i >= c->argv_len) {
         c->argv = zrealloc(c->argv,sizeof(robj*)*(i+1));
+        c->argv_len = i+1;
+    }
+    if (i >= c->argc) {
         c->argc = i+1;
         c->argv[i] = NULL;
     }
@@ -1805,17 +2220,26 @@ void rewriteClientCommandArgument(client *c, int i, robj *newval) {
  * The function returns the total sum of the length of all the objects
  * stored in the output list, plus the memory used to allocate every
  * list node. The static reply buffer is not taken into account since it
- * is allocated anyway.
+ * is allocated anyway. For slaves the part of the shared replication buffer
+ * the slave still has to send is counted as well.
  *
  * Note: this function is very fast so can be called as many time as
  * the caller wishes. The main usage of this function currently is
  * enforcing the client output length limits. */
 unsigned long getClientOutputBufferMemoryUsage(client *c) {
+    return getClientReplyMemoryUsage(c) + getSlaveReplBufferMemoryUsage(c);
+}
+
+/* Like getClientOutputBufferMemoryUsage(), but only the memory of the
+ * private output buffers of the client is returned, without the part of
+ * the replication buffer referenced by slaves, that is shared. */
+unsigned long getClientReplyMemoryUsage(client *c) {
     unsigned long list_item_size = sizeof(listNode)+5;
     /* The +5 above means we assume an sds16 hdr, may not be true
      * but is not going to be a problem. */
 
-    return c->reply_bytes + (list_item_size*listLength(c->reply));
+    return c->reply_bytes + (list_item_size*listLength(c->reply)) +
+           (c->repl_comp_buf ? sdsalloc(c->repl_comp_buf) : 0);
 }
 
 /* Get the class of a client, used in order to enforce limits to different
@@ -1906,7 +2330,8 @@ int checkClientOutputBufferLimits(client *c) {
  * lower level functions pushing data inside the client output buffers. */
 void asyncCloseClientOnOutputBufferLimitReached(client *c) {
     serverAssert(c->reply_bytes < SIZE_MAX-(1024*64));
-    if (c->reply_bytes == 0 || c->flags & CLIENT_CLOSE_ASAP) return;
+    if ((c->reply_bytes == 0 && c->ref_repl_buf_node == NULL) ||
+        c->flags & CLIENT_CLOSE_ASAP) return;
     if (checkClientOutputBufferLimits(c)) {
         sds client = catClientInfoString(sdsempty(),c);
 
@@ -2020,3 +2445,304 @@ int processEventsWhileBlocked(void) {
     }
     return count;
 }
+
+/* ==========================================================================
+ * Threaded I/O
+ * ========================================================================== */
+
+/* How many times an idle I/O thread polls its pending counter before
+ * blocking on its mutex, giving the main thread a chance to stop it. */
+#define IO_THREADS_SPIN_LOOPS 1000000
+
+pthread_t io_threads[IO_THREADS_MAX_NUM];
+pthread_mutex_t io_threads_mutex[IO_THREADS_MAX_NUM];
+unsigned long io_threads_pending[IO_THREADS_MAX_NUM];
+list *io_threads_list[IO_THREADS_MAX_NUM];
+
+static unsigned long getIOPendingCount(int i) {
+    unsigned long count = 0;
+    atomicGetWithSync(io_threads_pending[i],count);
+    return count;
+}
+
+static void setIOPendingCount(int i, unsigned long count) {
+    atomicSetWithSync(io_threads_pending[i],count);
+}
+
+/* Process the clients assigned to the I/O thread 'id' (id 0 is the main
+ * thread itself) for the operation currently in io_threads_op. */
+static void processIOThreadList(int id) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(io_threads_list[id],&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        if (io_threads_op == IO_THREADS_OP_WRITE) {
+            writeToClient(c->fd,c,0);
+        } else if (io_threads_op == IO_THREADS_OP_READ) {
+            readQueryFromClient(server.el,c->fd,c,0);
+        } else {
+            serverPanic("io_threads_op value is unknown");
+        }
+    }
+    listEmpty(io_threads_list[id]);
+}
+
+void *IOThreadMain(void *myid) {
+    /* The ID is the thread number (from 0 to server.io_threads_num-1), and is
+     * used by the thread to just manipulate a single sub-array of clients. */
+    long id = (unsigned long)myid;
+    int j;
+
+    while(1) {
+        /* Wait for start */
+        for (j = 0; j < IO_THREADS_SPIN_LOOPS; j++) {
+            if (getIOPendingCount(id) != 0) break;
+        }
+
+        /* Give the main thread a chance to stop this thread. */
+        if (getIOPendingCount(id) == 0) {
+            pthread_mutex_lock(&io_threads_mutex[id]);
+            pthread_mutex_unlock(&io_threads_mutex[id]);
+            continue;
+        }
+
+        /* Process: note that the main thread will never touch our list
+         * before we drop the pending count to 0. */
+        processIOThreadList(id);
+        setIOPendingCount(id,0);
+    }
+    return NULL;
+}
+
+/* Initialize the data structures needed for threaded I/O. */
+void initThreadedIO(void) {
+    pthread_t tid;
+    int j;
+
+    server.io_threads_active = 0; /* We start with threads not active. */
+
+    /* Don't spawn any thread if the user selected a single thread:
+     * we'll handle I/O directly from the main thread. */
+    if (server.io_threads_num == 1) return;
+
+    /* Spawn and initialize the I/O threads. Thread 0 is the main thread,
+     * that just needs its list of clients. */
+    io_threads_list[0] = listCreate();
+    for (j = 1; j < server.io_threads_num; j++) {
+        io_threads_list[j] = listCreate();
+        pthread_mutex_init(&io_threads_mutex[j],NULL);
+        setIOPendingCount(j,0);
+        pthread_mutex_lock(&io_threads_mutex[j]); /* Thread will be stopped. */
+        if (pthread_create(&tid,NULL,IOThreadMain,(void*)(long)j) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize I/O threads.");
+            exit(1);
+        }
+        io_threads[j] = tid;
+    }
+}
+
+static void startThreadedIO(void) {
+    int j;
+
+    serverAssert(server.io_threads_active == 0);
+    for (j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_unlock(&io_threads_mutex[j]);
+    server.io_threads_active = 1;
+}
+
+static void stopThreadedIO(void) {
+    int j;
+
+    /* We may have still clients with pending reads when this function
+     * is called: handle them before stopping the threads. */
+    handleClientsWithPendingReadsUsingThreads();
+    serverAssert(server.io_threads_active == 1);
+    for (j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_lock(&io_threads_mutex[j]);
+    server.io_threads_active = 0;
+}
+
+/* This function checks if there are not enough pending clients to justify
+ * taking the I/O threads active: in that case I/O threads are stopped if
+ * currently active. We track the pending writes as a measure of clients
+ * we need to handle in parallel, however the I/O threading is disabled
+ * globally for reads as well if we have too little pending clients.
+ *
+ * The function returns 0 if the I/O threading should be used because there
+ * are enough active threads, otherwise 1 is returned and the I/O threads
+ * could be possibly stopped (if already active) as a side effect. */
+int stopThreadedIOIfNeeded(void) {
+    int pending = listLength(server.clients_pending_write);
+
+    /* Return ASAP if I/O threads are disabled (single threaded mode). */
+    if (server.io_threads_num == 1) return 1;
+
+    if (pending < (server.io_threads_num*2)) {
+        if (server.io_threads_active) stopThreadedIO();
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* Assign the clients in 'l' to the I/O threads in a round robin fashion,
+ * run the operation 'op' in parallel (the main thread handles its own share
+ * as well), and wait for all the threads to be done. */
+static void runIOThreadsOperation(list *l, int op) {
+    listIter li;
+    listNode *ln;
+    int j, item_id = 0;
+
+    listRewind(l,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        int target_id = item_id % server.io_threads_num;
+        listAddNodeTail(io_threads_list[target_id],c);
+        item_id++;
+    }
+
+    /* Give the start condition to the waiting threads, by setting the
+     * start condition atomic var. */
+    io_threads_op = op;
+    for (j = 1; j < server.io_threads_num; j++)
+        setIOPendingCount(j,listLength(io_threads_list[j]));
+
+    /* Also use the main thread to process a slice of clients. */
+    processIOThreadList(0);
+
+    /* Wait for all the other threads to end their work. */
+    while(1) {
+        unsigned long pending = 0;
+        for (j = 1; j < server.io_threads_num; j++)
+            pending += getIOPendingCount(j);
+        if (pending == 0) break;
+    }
+    io_threads_op = IO_THREADS_OP_IDLE;
+}
+
+/* Like handleClientsWithPendingWrites(), but the socket writes are
+ * distributed among the I/O threads. When threaded I/O is disabled, or
+ * there are too few clients to serve to justify it, the work is done by
+ * the main thread alone. */
+int handleClientsWithPendingWritesUsingThreads(void) {
+    listIter li;
+    listNode *ln;
+    int processed = listLength(server.clients_pending_write);
+    if (processed == 0) return 0; /* Return ASAP if there are no clients. */
+
+    /* If I/O threads are disabled or we have few clients to serve, don't
+     * use I/O threads, but the boring synchronous code. */
+    if (server.io_threads_num == 1 || stopThreadedIOIfNeeded())
+        return handleClientsWithPendingWrites();
+
+    /* Start threads if needed. */
+    if (!server.io_threads_active) startThreadedIO();
+
+    /* The I/O threads can't touch the global pending writes list, so the
+     * flag is cleared here, before handing out the clients. */
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_WRITE;
+    }
+    runIOThreadsOperation(server.clients_pending_write,IO_THREADS_OP_WRITE);
+
+    /* Run the list of clients again to free the ones the threads flagged,
+     * and to install the write handler if there are still clients with
+     * data not yet written to the socket. */
+    while(listLength(server.clients_pending_write)) {
+        ln = listFirst(server.clients_pending_write);
+        client *c = listNodeValue(ln);
+        listDelNode(server.clients_pending_write,ln);
+
+        if (c->flags & CLIENT_CLOSE_AFTER_IO) {
+            c->flags &= ~CLIENT_CLOSE_AFTER_IO;
+            freeClient(c);
+            continue;
+        }
+        releaseWrittenReplyObject(c);
+        advanceSlaveReplBufferCursor(c);
+        if (!clientHasPendingReplies(c) &&
+            c->flags & CLIENT_CLOSE_AFTER_REPLY)
+        {
+            freeClient(c);
+            continue;
+        }
+        if (clientHasPendingReplies(c) &&
+            aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+                sendReplyToClient, c) == AE_ERR)
+        {
+            freeClientAsync(c);
+        }
+    }
+    server.stat_io_writes_processed += processed;
+    return processed;
+}
+
+/* Return 1 if we want to handle the client read later using threaded I/O.
+ * This is called by the readable handler of the event loop.
+ * As a side effect of calling this function the client is put in the
+ * pending read clients and flagged as such.
+ *
+ * Masters and slaves are always served synchronously, and so are all the
+ * clients while we are processing events from within a blocking operation
+ * (loading, busy scripts), since in that case beforeSleep() is not called
+ * and nobody would process the postponed reads. */
+int postponeClientRead(client *c) {
+    if (server.io_threads_active &&
+        server.io_threads_do_reads &&
+        !server.loading &&
+        !server.lua_timedout &&
+        io_threads_op == IO_THREADS_OP_IDLE &&
+        !(c->flags & (CLIENT_MASTER|CLIENT_SLAVE|CLIENT_PENDING_READ)))
+    {
+        c->flags |= CLIENT_PENDING_READ;
+        listAddNodeHead(server.clients_pending_read,c);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* When threaded I/O is also enabled for the reading + parsing side, the
+ * readable handler will just put normal clients into a queue of clients to
+ * process (instead of serving them synchronously). This function runs
+ * the queue using the I/O threads, and process them in order to accumulate
+ * the reads in the buffers, and also parse the first command available
+ * rendering it in the client structures. The commands are then executed
+ * by the main thread, in the order the clients were queued. */
+int handleClientsWithPendingReadsUsingThreads(void) {
+    int processed = listLength(server.clients_pending_read);
+
+    if (!server.io_threads_active || !server.io_threads_do_reads) return 0;
+    if (processed == 0) return 0;
+
+    runIOThreadsOperation(server.clients_pending_read,IO_THREADS_OP_READ);
+
+    /* Run the list of clients again to process the new buffers. */
+    while(listLength(server.clients_pending_read)) {
+        listNode *ln = listFirst(server.clients_pending_read);
+        client *c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_READ;
+        listDelNode(server.clients_pending_read,ln);
+
+        if (c->flags & CLIENT_CLOSE_AFTER_IO) {
+            c->flags &= ~CLIENT_CLOSE_AFTER_IO;
+            freeClient(c);
+            continue;
+        }
+
+        /* We may have pending replies if a thread readQueryFromClient()
+         * produced replies and did not install a write handler (it can't). */
+        if (!(c->flags & CLIENT_PENDING_WRITE) && clientHasPendingReplies(c))
+            clientInstallWriteHandler(c);
+
+        /* Execute the command parsed by the thread, if any, and the ones
+         * that may follow in the query buffer. */
+        processInputBuffer(c);
+    }
+    server.stat_io_reads_processed += processed;
+    return processed;
+}
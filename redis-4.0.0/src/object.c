@@ -107,6 +107,75 @@ robj *createEmbeddedStringObject(const char *ptr, size_t len) {
     return o;
 }
 
+/* Return an object with the same value of 'o' and a copy of the key 'key'
+ * embedded in the same allocation, so that a key of the keyspace and its
+ * value cost a single allocation (see dbAdd()). The embedded key is stored
+ * as an sds string flagged SDS_EMBEDDED right after the object header. If
+ * 'expire' is not -1 the key has auxiliary data holding it, as expected by
+ * keyGetExpire():
+ *
+ * +------+-------------------+---------+-----+----------------------+
+ * | robj | expire (optional) | sdshdr8 | key | EMBSTR value, if any |
+ * +------+-------------------+---------+-----+----------------------+
+ *
+ * The embedded key is stored by reference in '*keyptr'. One reference of
+ * 'o' is released: the caller must use the returned object in its place.
+ *
+ * Small strings (INT and EMBSTR encoded) are copied. The other objects are
+ * moved into the new allocation, so the key is only embedded if 'o' is not
+ * shared with anybody else. If the key can't be embedded, 'o' is returned
+ * and '*keyptr' is set to NULL. */
+robj *objectEmbedKey(robj *o, sds key, long long expire, sds *keyptr) {
+    size_t keylen = sdslen(key), vallen = 0, size;
+    int embstr = o->type == OBJ_STRING && o->encoding == OBJ_ENCODING_EMBSTR;
+    int copy = embstr || (o->type == OBJ_STRING &&
+                          o->encoding == OBJ_ENCODING_INT);
+    int auxlen = (expire != -1) ? SDS_AUX_SIZE : 0;
+    struct sdshdr8 *sh;
+    robj *n;
+
+    *keyptr = NULL;
+    if (o->refcount == OBJ_SHARED_REFCOUNT || keylen >= 1<<8 ||
+        (!copy && o->refcount != 1)) return o;
+
+    size = sizeof(robj)+auxlen+sizeof(struct sdshdr8)+keylen+1;
+    if (embstr) {
+        vallen = sdslen(o->ptr);
+        size += sizeof(struct sdshdr8)+vallen+1;
+    }
+    n = zmalloc(size);
+    n->type = o->type;
+    n->encoding = o->encoding;
+    n->lru = o->lru;
+    n->refcount = 1;
+
+    if (auxlen) memcpy(n+1,&expire,auxlen);
+    sh = (void*)((char*)(n+1)+auxlen);
+    sh->len = keylen;
+    sh->alloc = keylen;
+    sh->flags = SDS_TYPE_8|SDS_EMBEDDED|(auxlen ? SDS_AUX : 0);
+    memcpy(sh->buf,key,keylen+1);
+    *keyptr = sh->buf;
+
+    if (embstr) {
+        sh = (void*)(sh->buf+keylen+1);
+        sh->len = vallen;
+        sh->alloc = vallen;
+        sh->flags = SDS_TYPE_8;
+        memcpy(sh->buf,o->ptr,vallen+1);
+        n->ptr = sh->buf;
+    } else {
+        n->ptr = o->ptr;
+    }
+
+    if (copy) {
+        decrRefCount(o);
+    } else {
+        zfree(o); /* The value is now owned by the new object. */
+    }
+    return n;
+}
+
 /* Create a string object with EMBSTR encoding if it is smaller than
  * OBJ_ENCODING_EMBSTR_SIZE_LIMIT, otherwise the RAW encoding is
  * used.
@@ -208,9 +277,9 @@ robj *createIntsetObject(void) {
 }
 
 robj *createHashObject(void) {
-    unsigned char *zl = ziplistNew();
+    unsigned char *zl = lpNew();
     robj *o = createObject(OBJ_HASH, zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
@@ -225,10 +294,10 @@ robj *createZsetObject(void) {
     return o;
 }
 
-robj *createZsetZiplistObject(void) {
-    unsigned char *zl = ziplistNew();
+robj *createZsetListpackObject(void) {
+    unsigned char *zl = lpNew();
     robj *o = createObject(OBJ_ZSET,zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
@@ -275,8 +344,8 @@ void freeZsetObject(robj *o) {
         zslFree(zs->zsl);
         zfree(zs);
         break;
-    case OBJ_ENCODING_ZIPLIST:
-        zfree(o->ptr);
+    case OBJ_ENCODING_LISTPACK:
+        lpFree(o->ptr);
         break;
     default:
         serverPanic("Unknown sorted set encoding");
@@ -288,8 +357,8 @@ void freeHashObject(robj *o) {
     case OBJ_ENCODING_HT:
         dictRelease((dict*) o->ptr);
         break;
-    case OBJ_ENCODING_ZIPLIST:
-        zfree(o->ptr);
+    case OBJ_ENCODING_LISTPACK:
+        lpFree(o->ptr);
         break;
     default:
         serverPanic("Unknown hash encoding type");
@@ -309,6 +378,11 @@ void incrRefCount(robj *o) {
 
 void decrRefCount(robj *o) {
     if (o->refcount == 1) {
+        if (o->encoding == OBJ_ENCODING_SPILLED) {
+            tieredFreeValue(o);
+            zfree(o);
+            return;
+        }
         switch(o->type) {
         case OBJ_STRING: freeStringObject(o); break;
         case OBJ_LIST: freeListObject(o); break;
@@ -683,9 +757,11 @@ char *strEncoding(int encoding) {
     case OBJ_ENCODING_HT: return "hashtable";
     case OBJ_ENCODING_QUICKLIST: return "quicklist";
     case OBJ_ENCODING_ZIPLIST: return "ziplist";
+    case OBJ_ENCODING_LISTPACK: return "listpack";
     case OBJ_ENCODING_INTSET: return "intset";
     case OBJ_ENCODING_SKIPLIST: return "skiplist";
     case OBJ_ENCODING_EMBSTR: return "embstr";
+    case OBJ_ENCODING_SPILLED: return "spilled";
     default: return "unknown";
     }
 }
@@ -704,7 +780,9 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
     struct dictEntry *de;
     size_t asize = 0, elesize = 0, samples = 0;
 
-    if (o->type == OBJ_STRING) {
+    if (o->encoding == OBJ_ENCODING_SPILLED) {
+        asize = sizeof(*o)+tieredValueMemory(o);
+    } else if (o->type == OBJ_STRING) {
         if(o->encoding == OBJ_ENCODING_INT) {
             asize = sizeof(*o);
         } else if(o->encoding == OBJ_ENCODING_RAW) {
@@ -720,7 +798,7 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
             quicklistNode *node = ql->head;
             asize = sizeof(*o)+sizeof(quicklist);
             do {
-                elesize += sizeof(quicklistNode)+ziplistBlobLen(node->zl);
+                elesize += sizeof(quicklistNode)+lpBytes(node->zl);
                 samples++;
             } while ((node = node->next) && samples < sample_size);
             asize += (double)elesize/samples*listTypeLength(o);
@@ -748,8 +826,8 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
             serverPanic("Unknown set encoding");
         }
     } else if (o->type == OBJ_ZSET) {
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            asize = sizeof(*o)+(ziplistBlobLen(o->ptr));
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes(o->ptr));
         } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
             d = ((zset*)o->ptr)->dict;
             zskiplist *zsl = ((zset*)o->ptr)->zsl;
@@ -766,8 +844,8 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (o->type == OBJ_HASH) {
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            asize = sizeof(*o)+(ziplistBlobLen(o->ptr));
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes(o->ptr));
         } else if (o->encoding == OBJ_ENCODING_HT) {
             d = o->ptr;
             di = dictGetIterator(d);
@@ -821,9 +899,17 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
         zmalloc_get_fragmentation_ratio(server.resident_set_size);
     mem_total += server.initial_memory_usage;
 
+    /* The backlog and the slaves share the replication buffer: what exceeds
+     * the backlog size is accounted to the slaves. */
     mem = 0;
-    if (server.repl_backlog)
-        mem += zmalloc_size(server.repl_backlog);
+    if (server.repl_backlog) {
+        mem += sizeof(replBacklog) + server.repl_buffer_mem;
+        if (listLength(server.slaves) &&
+            (long long)server.repl_buffer_mem > server.repl_backlog_size)
+        {
+            mem -= server.repl_buffer_mem - server.repl_backlog_size;
+        }
+    }
     mh->repl_backlog = mem;
     mem_total += mem;
 
@@ -832,10 +918,12 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
         listIter li;
         listNode *ln;
 
+        if ((long long)server.repl_buffer_mem > server.repl_backlog_size)
+            mem += server.repl_buffer_mem - server.repl_backlog_size;
         listRewind(server.slaves,&li);
         while((ln = listNext(&li))) {
             client *c = listNodeValue(ln);
-            mem += getClientOutputBufferMemoryUsage(c);
+            mem += getClientReplyMemoryUsage(c);
             mem += sdsAllocSize(c->querybuf);
             mem += sizeof(client);
         }
@@ -878,14 +966,13 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
         mh->db = zrealloc(mh->db,sizeof(mh->db[0])*(mh->num_dbs+1));
         mh->db[mh->num_dbs].dbid = j;
 
-        mem = dictSize(db->dict) * sizeof(dictEntry) +
-              dictSlots(db->dict) * sizeof(dictEntry*) +
+        mem = dictMemUsage(db->dict) +
               dictSize(db->dict) * sizeof(robj);
         mh->db[mh->num_dbs].overhead_ht_main = mem;
         mem_total+=mem;
 
-        mem = dictSize(db->expires) * sizeof(dictEntry) +
-              dictSlots(db->expires) * sizeof(dictEntry*);
+        /* The expires are stored with the keys of the main dictionary. */
+        mem = dictMarkedSize(db->dict) * SDS_AUX_SIZE;
         mh->db[mh->num_dbs].overhead_ht_expires = mem;
         mem_total+=mem;
 
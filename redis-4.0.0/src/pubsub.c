@@ -47,6 +47,41 @@ int listMatchPubsubPattern(void *a, void *b) {
            (equalStringObjects(pa->pattern,pb->pattern));
 }
 
+/* Pattern subscriptions are indexed in server.pubsub_patterns, a radix tree
+ * mapping the literal prefix of the patterns (the part before the first
+ * glob special character) to the list of the subscriptions having such
+ * prefix. A channel can only match patterns whose literal prefix is a
+ * prefix of the channel name, so PUBLISH only needs to follow the path of
+ * the channel in the tree, and to try the patterns of the lists found on
+ * the way. Patterns starting with a special character, like "*", are all
+ * stored under the empty prefix. */
+static size_t pubsubPatternPrefixLen(sds pattern) {
+    size_t j, len = sdslen(pattern);
+
+    for (j = 0; j < len; j++) {
+        char c = pattern[j];
+        if (c == '*' || c == '?' || c == '[' || c == '\\') break;
+    }
+    return j;
+}
+
+/* Return the list of subscriptions with the same prefix of 'pattern',
+ * creating it if 'create' is true, otherwise NULL is returned if there
+ * are no such subscriptions. */
+static list *pubsubPatternList(sds pattern, int create) {
+    size_t prefixlen = pubsubPatternPrefixLen(pattern);
+    list *l = raxFind(server.pubsub_patterns,(unsigned char*)pattern,
+                      prefixlen);
+
+    if (l != raxNotFound) return l;
+    if (!create) return NULL;
+    l = listCreate();
+    listSetFreeMethod(l,freePubsubPattern);
+    listSetMatchMethod(l,listMatchPubsubPattern);
+    raxInsert(server.pubsub_patterns,(unsigned char*)pattern,prefixlen,l,NULL);
+    return l;
+}
+
 /* Return the number of channels + patterns a client is subscribed to. */
 int clientSubscriptionsCount(client *c) {
     return dictSize(c->pubsub_channels)+
@@ -135,7 +170,8 @@ int pubsubSubscribePattern(client *c, robj *pattern) {
         pat = zmalloc(sizeof(*pat));
         pat->pattern = getDecodedObject(pattern);
         pat->client = c;
-        listAddNodeTail(server.pubsub_patterns,pat);
+        listAddNodeTail(pubsubPatternList(pat->pattern->ptr,1),pat);
+        server.pubsub_patterns_num++;
     }
     /* Notify the client */
     addReply(c,shared.mbulkhdr[3]);
@@ -150,6 +186,7 @@ int pubsubSubscribePattern(client *c, robj *pattern) {
 int pubsubUnsubscribePattern(client *c, robj *pattern, int notify) {
     listNode *ln;
     pubsubPattern pat;
+    list *patterns;
     int retval = 0;
 
     incrRefCount(pattern); /* Protect the object. May be the same we remove */
@@ -157,9 +194,21 @@ int pubsubUnsubscribePattern(client *c, robj *pattern, int notify) {
         retval = 1;
         listDelNode(c->pubsub_patterns,ln);
         pat.client = c;
-        pat.pattern = pattern;
-        ln = listSearchKey(server.pubsub_patterns,&pat);
-        listDelNode(server.pubsub_patterns,ln);
+        pat.pattern = getDecodedObject(pattern);
+        patterns = pubsubPatternList(pat.pattern->ptr,0);
+        serverAssertWithInfo(c,NULL,patterns != NULL);
+        ln = listSearchKey(patterns,&pat);
+        serverAssertWithInfo(c,NULL,ln != NULL);
+        listDelNode(patterns,ln);
+        server.pubsub_patterns_num--;
+        if (listLength(patterns) == 0) {
+            /* Like for channels, don't leak prefixes when the last
+             * subscription is gone. */
+            raxRemove(server.pubsub_patterns,(unsigned char*)pat.pattern->ptr,
+                      pubsubPatternPrefixLen(pat.pattern->ptr),NULL);
+            listRelease(patterns);
+        }
+        decrRefCount(pat.pattern);
     }
     /* Notify the client */
     if (notify) {
@@ -221,12 +270,44 @@ int pubsubUnsubscribeAllPatterns(client *c, int notify) {
     return count;
 }
 
+/* State of pubsubPublishMessage() passed to pubsubPublishToPatterns(). */
+typedef struct pubsubPublishState {
+    robj *channel;  /* Decoded channel name. */
+    robj *message;
+    int receivers;
+} pubsubPublishState;
+
+/* Called for every list of subscriptions whose prefix is a prefix of the
+ * channel name, in order to send the message to the matching patterns. */
+static void pubsubPublishToPatterns(void *data, void *privdata) {
+    pubsubPublishState *st = privdata;
+    list *patterns = data;
+    robj *channel = st->channel;
+    listNode *ln;
+    listIter li;
+
+    listRewind(patterns,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        pubsubPattern *pat = ln->value;
+
+        if (stringmatchlen((char*)pat->pattern->ptr,
+                            sdslen(pat->pattern->ptr),
+                            (char*)channel->ptr,
+                            sdslen(channel->ptr),0)) {
+            addReply(pat->client,shared.mbulkhdr[4]);
+            addReply(pat->client,shared.pmessagebulk);
+            addReplyBulk(pat->client,pat->pattern);
+            addReplyBulk(pat->client,channel);
+            addReplyBulk(pat->client,st->message);
+            st->receivers++;
+        }
+    }
+}
+
 /* Publish a message */
 int pubsubPublishMessage(robj *channel, robj *message) {
     int receivers = 0;
     dictEntry *de;
-    listNode *ln;
-    listIter li;
 
     /* Send to clients listening for that channel */
     de = dictFind(server.pubsub_channels,channel);
@@ -247,25 +328,18 @@ int pubsubPublishMessage(robj *channel, robj *message) {
         }
     }
     /* Send to clients listening to matching channels */
-    if (listLength(server.pubsub_patterns)) {
-        listRewind(server.pubsub_patterns,&li);
-        channel = getDecodedObject(channel);
-        while ((ln = listNext(&li)) != NULL) {
-            pubsubPattern *pat = ln->value;
-
-            if (stringmatchlen((char*)pat->pattern->ptr,
-                                sdslen(pat->pattern->ptr),
-                                (char*)channel->ptr,
-                                sdslen(channel->ptr),0)) {
-                addReply(pat->client,shared.mbulkhdr[4]);
-                addReply(pat->client,shared.pmessagebulk);
-                addReplyBulk(pat->client,pat->pattern);
-                addReplyBulk(pat->client,channel);
-                addReplyBulk(pat->client,message);
-                receivers++;
-            }
-        }
-        decrRefCount(channel);
+    if (server.pubsub_patterns_num) {
+        pubsubPublishState st;
+
+        st.channel = getDecodedObject(channel);
+        st.message = message;
+        st.receivers = 0;
+        raxWalkPrefixes(server.pubsub_patterns,
+                        (unsigned char*)st.channel->ptr,
+                        sdslen(st.channel->ptr),
+                        pubsubPublishToPatterns,&st);
+        receivers += st.receivers;
+        decrRefCount(st.channel);
     }
     return receivers;
 }
@@ -362,7 +436,7 @@ void pubsubCommand(client *c) {
         }
     } else if (!strcasecmp(c->argv[1]->ptr,"numpat") && c->argc == 2) {
         /* PUBSUB NUMPAT */
-        addReplyLongLong(c,listLength(server.pubsub_patterns));
+        addReplyLongLong(c,server.pubsub_patterns_num);
     } else {
         addReplyErrorFormat(c,
             "Unknown PUBSUB subcommand or wrong number of arguments for '%s'",
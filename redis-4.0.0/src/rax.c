@@ -805,6 +805,47 @@ void *raxFind(rax *rax, unsigned char *s, size_t len) {
     return raxGetData(h);
 }
 
+/* Call 'fn' with the associated data of every element of the radix tree
+ * that is a prefix of the string 's' (including 's' itself), in order of
+ * increasing length. The number of elements found is returned.
+ *
+ * This only follows the path of 's' in the tree, so the cost is O(len)
+ * regardless of the number of elements stored. 'fn' must not modify
+ * the radix tree. */
+size_t raxWalkPrefixes(rax *rax, unsigned char *s, size_t len,
+                       void (*fn)(void *data, void *privdata), void *privdata)
+{
+    raxNode *h = rax->head;
+    size_t i = 0, found = 0;
+
+    while(1) {
+        unsigned char *v = h->data;
+        size_t j;
+
+        /* A node is a key if the string walked so far is an element. */
+        if (h->iskey) {
+            fn(raxGetData(h),privdata);
+            found++;
+        }
+        if (h->size == 0 || i == len) break;
+
+        raxNode **children = raxNodeFirstChildPtr(h);
+        if (h->iscompr) {
+            if (len-i < h->size || memcmp(v,s+i,h->size) != 0) break;
+            i += h->size;
+            j = 0;
+        } else {
+            for (j = 0; j < h->size; j++) {
+                if (v[j] == s[i]) break;
+            }
+            if (j == h->size) break;
+            i++;
+        }
+        memcpy(&h,children+j,sizeof(h));
+    }
+    return found;
+}
+
 /* Return the memory address where the 'parent' node stores the specified
  * 'child' pointer, so that the caller can update the pointer with another
  * one if needed. The function assumes it will find a match, otherwise the
@@ -870,8 +911,11 @@ raxNode *raxRemoveChild(raxNode *parent, raxNode *child) {
      * before now. */
     memmove(((char*)cp)-1,cp,(parent->size-taillen-1)*sizeof(raxNode**));
 
-    /* Move the remaining "tail" pointer at the right position as well. */
-    memmove(((char*)c)-1,c+1,taillen*sizeof(raxNode**)+parent->iskey*sizeof(void*));
+    /* Move the remaining "tail" pointer at the right position as well,
+     * together with the value pointer, that is only present if the node
+     * is a key with a non NULL value. */
+    size_t valuelen = (parent->iskey && !parent->isnull) ? sizeof(void*) : 0;
+    memmove(((char*)c)-1,c+1,taillen*sizeof(raxNode**)+valuelen);
 
     /* 4. Update size. */
     parent->size--;
@@ -147,6 +147,7 @@ rax *raxNew(void);
 int raxInsert(rax *rax, unsigned char *s, size_t len, void *data, void **old);
 int raxRemove(rax *rax, unsigned char *s, size_t len, void **old);
 void *raxFind(rax *rax, unsigned char *s, size_t len);
+size_t raxWalkPrefixes(rax *rax, unsigned char *s, size_t len, void (*fn)(void *data, void *privdata), void *privdata);
 void raxFree(rax *rax);
 void raxStart(raxIterator *it, rax *rt);
 int raxSeek(raxIterator *it, const char *op, unsigned char *ele, size_t len);
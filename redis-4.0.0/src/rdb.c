@@ -593,12 +593,14 @@ int rdbLoadBinaryFloatValue(rio *rdb, float *val) {
 
 /* Save the object type of object "o". */
 int rdbSaveObjectType(rio *rdb, robj *o) {
+    if (o->encoding == OBJ_ENCODING_SPILLED)
+        return rdbSaveType(rdb,tieredObjectRdbType(o));
     switch (o->type) {
     case OBJ_STRING:
         return rdbSaveType(rdb,RDB_TYPE_STRING);
     case OBJ_LIST:
         if (o->encoding == OBJ_ENCODING_QUICKLIST)
-            return rdbSaveType(rdb,RDB_TYPE_LIST_QUICKLIST);
+            return rdbSaveType(rdb,RDB_TYPE_LIST_QUICKLIST_2);
         else
             serverPanic("Unknown list encoding");
     case OBJ_SET:
@@ -609,15 +611,15 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
         else
             serverPanic("Unknown set encoding");
     case OBJ_ZSET:
-        if (o->encoding == OBJ_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,RDB_TYPE_ZSET_ZIPLIST);
+        if (o->encoding == OBJ_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,RDB_TYPE_ZSET_LISTPACK);
         else if (o->encoding == OBJ_ENCODING_SKIPLIST)
             return rdbSaveType(rdb,RDB_TYPE_ZSET_2);
         else
             serverPanic("Unknown sorted set encoding");
     case OBJ_HASH:
-        if (o->encoding == OBJ_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,RDB_TYPE_HASH_ZIPLIST);
+        if (o->encoding == OBJ_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,RDB_TYPE_HASH_LISTPACK);
         else if (o->encoding == OBJ_ENCODING_HT)
             return rdbSaveType(rdb,RDB_TYPE_HASH);
         else
@@ -643,7 +645,10 @@ int rdbLoadObjectType(rio *rdb) {
 ssize_t rdbSaveObject(rio *rdb, robj *o) {
     ssize_t n = 0, nwritten = 0;
 
-    if (o->type == OBJ_STRING) {
+    if (o->encoding == OBJ_ENCODING_SPILLED) {
+        /* Spilled values are already serialized in the RDB format. */
+        return tieredSaveObject(rdb,o);
+    } else if (o->type == OBJ_STRING) {
         /* Save a string value */
         if ((n = rdbSaveStringObject(rdb,o)) == -1) return -1;
         nwritten += n;
@@ -657,6 +662,11 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
             nwritten += n;
 
             do {
+                /* Our nodes are always listpacks, but Redis 7 also saves
+                 * plain nodes, so the container is part of the format. */
+                if ((n = rdbSaveLen(rdb,QUICKLIST_NODE_CONTAINER_PACKED)) == -1)
+                    return -1;
+                nwritten += n;
                 if (quicklistNodeIsCompressed(node)) {
                     void *data;
                     size_t compress_len = quicklistGetLzf(node, &data);
@@ -697,8 +707,8 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
         }
     } else if (o->type == OBJ_ZSET) {
         /* Save a sorted set value */
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            size_t l = lpBytes((unsigned char*)o->ptr);
 
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
@@ -733,8 +743,8 @@ ssize_t rdbSaveObject(rio *rdb, robj *o) {
         }
     } else if (o->type == OBJ_HASH) {
         /* Save a hash value */
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            size_t l = lpBytes((unsigned char*)o->ptr);
 
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
@@ -913,8 +923,8 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
         db_size = (dictSize(db->dict) <= UINT32_MAX) ?
                                 dictSize(db->dict) :
                                 UINT32_MAX;
-        expires_size = (dictSize(db->expires) <= UINT32_MAX) ?
-                                dictSize(db->expires) :
+        expires_size = (dictMarkedSize(db->dict) <= UINT32_MAX) ?
+                                dictMarkedSize(db->dict) :
                                 UINT32_MAX;
         if (rdbSaveType(rdb,RDB_OPCODE_RESIZEDB) == -1) goto werr;
         if (rdbSaveLen(rdb,db_size) == -1) goto werr;
@@ -1050,10 +1060,12 @@ int rdbSaveBackground(char *filename, rdbSaveInfo *rsi) {
     pid_t childpid;
     long long start;
 
-    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
+    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1 ||
+        server.rdb_forkless_in_progress) return C_ERR;
 
     server.dirty_before_bgsave = server.dirty;
     server.lastbgsave_try = time(NULL);
+    if (server.rdb_forkless) return snapshotStart(filename,rsi);
     openChildInfoPipe();
 
     start = ustime();
@@ -1145,6 +1157,26 @@ robj *rdbLoadCheckModuleValue(rio *rdb, char *modulename) {
     return createStringObject("module-dummy-value",18);
 }
 
+/* Convert the ziplist 'zl', as found in RDB files older than version 9,
+ * into a listpack with the same elements. The ziplist is freed. */
+static unsigned char *rdbZiplistToListpack(unsigned char *zl) {
+    unsigned char *lp = lpNew();
+    unsigned char *p = ziplistIndex(zl,0);
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vlong;
+
+    while (ziplistGet(p,&vstr,&vlen,&vlong)) {
+        if (vstr)
+            lp = lpAppend(lp,vstr,vlen);
+        else
+            lp = lpAppendInteger(lp,vlong);
+        p = ziplistNext(zl,p);
+    }
+    zfree(zl);
+    return lp;
+}
+
 /* Load a Redis object of the specified type from the specified file.
  * On success a newly allocated object is returned, otherwise NULL. */
 robj *rdbLoadObject(int rdbtype, rio *rdb) {
@@ -1249,7 +1281,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         /* Convert *after* loading, since sorted sets are not stored ordered. */
         if (zsetLength(o) <= server.zset_max_ziplist_entries &&
             maxelelen <= server.zset_max_ziplist_value)
-                zsetConvert(o,OBJ_ENCODING_ZIPLIST);
+                zsetConvert(o,OBJ_ENCODING_LISTPACK);
     } else if (rdbtype == RDB_TYPE_HASH) {
         uint64_t len;
         int ret;
@@ -1264,8 +1296,8 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         if (len > server.hash_max_ziplist_entries)
             hashTypeConvert(o, OBJ_ENCODING_HT);
 
-        /* Load every field and value into the ziplist */
-        while (o->encoding == OBJ_ENCODING_ZIPLIST && len > 0) {
+        /* Load every field and value into the listpack */
+        while (o->encoding == OBJ_ENCODING_LISTPACK && len > 0) {
             len--;
             /* Load raw strings */
             if ((field = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
@@ -1273,11 +1305,9 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
             if ((value = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
                 == NULL) return NULL;
 
-            /* Add pair to ziplist */
-            o->ptr = ziplistPush(o->ptr, (unsigned char*)field,
-                    sdslen(field), ZIPLIST_TAIL);
-            o->ptr = ziplistPush(o->ptr, (unsigned char*)value,
-                    sdslen(value), ZIPLIST_TAIL);
+            /* Add pair to listpack */
+            o->ptr = lpAppend(o->ptr, (unsigned char*)field, sdslen(field));
+            o->ptr = lpAppend(o->ptr, (unsigned char*)value, sdslen(value));
 
             /* Convert to hash table if size threshold is exceeded */
             if (sdslen(field) > server.hash_max_ziplist_value ||
@@ -1310,26 +1340,63 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 
         /* All pairs should be read by now */
         serverAssert(len == 0);
-    } else if (rdbtype == RDB_TYPE_LIST_QUICKLIST) {
+    } else if (rdbtype == RDB_TYPE_LIST_QUICKLIST ||
+               rdbtype == RDB_TYPE_LIST_QUICKLIST_2)
+    {
         if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
         o = createQuicklistObject();
         quicklistSetOptions(o->ptr, server.list_max_ziplist_size,
                             server.list_compress_depth);
 
         while (len--) {
+            uint64_t container = QUICKLIST_NODE_CONTAINER_PACKED;
+            size_t zlen;
+
+            if (rdbtype == RDB_TYPE_LIST_QUICKLIST_2) {
+                if ((container = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
+                    return NULL;
+                if (container != QUICKLIST_NODE_CONTAINER_NONE &&
+                    container != QUICKLIST_NODE_CONTAINER_PACKED)
+                {
+                    rdbExitReportCorruptRDB("Quicklist unknown container "
+                                            "format %llu.",
+                                            (unsigned long long)container);
+                }
+            }
             unsigned char *zl =
-                rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,NULL);
+                rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&zlen);
             if (zl == NULL) return NULL;
-            quicklistAppendZiplist(o->ptr, zl);
+            if (container == QUICKLIST_NODE_CONTAINER_NONE) {
+                /* A single element too big for a listpack, as saved by
+                 * Redis 7: add it to a node of its own. */
+                quicklistPushTail(o->ptr,zl,zlen);
+                zfree(zl);
+                continue;
+            }
+            if (rdbtype == RDB_TYPE_LIST_QUICKLIST) {
+                /* Old ziplist node: re-add its elements one by one. */
+                quicklistAppendValuesFromZiplist(o->ptr, zl);
+                continue;
+            }
+            if (!lpValidateIntegrity(zl,zlen,1))
+                rdbExitReportCorruptRDB("Listpack integrity check failed.");
+            if (lpLength(zl) == 0) {
+                lpFree(zl);
+                continue;
+            }
+            quicklistAppendListpack(o->ptr, zl);
         }
     } else if (rdbtype == RDB_TYPE_HASH_ZIPMAP  ||
                rdbtype == RDB_TYPE_LIST_ZIPLIST ||
                rdbtype == RDB_TYPE_SET_INTSET   ||
                rdbtype == RDB_TYPE_ZSET_ZIPLIST ||
-               rdbtype == RDB_TYPE_HASH_ZIPLIST)
+               rdbtype == RDB_TYPE_HASH_ZIPLIST ||
+               rdbtype == RDB_TYPE_ZSET_LISTPACK ||
+               rdbtype == RDB_TYPE_HASH_LISTPACK)
     {
+        size_t encoded_len;
         unsigned char *encoded =
-            rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,NULL);
+            rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&encoded_len);
         if (encoded == NULL) return NULL;
         o = createObject(OBJ_STRING,encoded); /* Obj type fixed below. */
 
@@ -1341,10 +1408,10 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
          * converted. */
         switch(rdbtype) {
             case RDB_TYPE_HASH_ZIPMAP:
-                /* Convert to ziplist encoded hash. This must be deprecated
+                /* Convert to listpack encoded hash. This must be deprecated
                  * when loading dumps created by Redis 2.4 gets deprecated. */
                 {
-                    unsigned char *zl = ziplistNew();
+                    unsigned char *zl = lpNew();
                     unsigned char *zi = zipmapRewind(o->ptr);
                     unsigned char *fstr, *vstr;
                     unsigned int flen, vlen;
@@ -1353,14 +1420,14 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                     while ((zi = zipmapNext(zi, &fstr, &flen, &vstr, &vlen)) != NULL) {
                         if (flen > maxlen) maxlen = flen;
                         if (vlen > maxlen) maxlen = vlen;
-                        zl = ziplistPush(zl, fstr, flen, ZIPLIST_TAIL);
-                        zl = ziplistPush(zl, vstr, vlen, ZIPLIST_TAIL);
+                        zl = lpAppend(zl, fstr, flen);
+                        zl = lpAppend(zl, vstr, vlen);
                     }
 
                     zfree(o->ptr);
                     o->ptr = zl;
                     o->type = OBJ_HASH;
-                    o->encoding = OBJ_ENCODING_ZIPLIST;
+                    o->encoding = OBJ_ENCODING_LISTPACK;
 
                     if (hashTypeLength(o) > server.hash_max_ziplist_entries ||
                         maxlen > server.hash_max_ziplist_value)
@@ -1381,14 +1448,34 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                     setTypeConvert(o,OBJ_ENCODING_HT);
                 break;
             case RDB_TYPE_ZSET_ZIPLIST:
+            case RDB_TYPE_ZSET_LISTPACK:
+                if (rdbtype == RDB_TYPE_ZSET_ZIPLIST) {
+                    o->ptr = rdbZiplistToListpack(o->ptr);
+                } else if (!lpValidateIntegrity(o->ptr,encoded_len,1)) {
+                    rdbExitReportCorruptRDB("Listpack integrity check failed.");
+                }
+                /* Members and scores are stored in pairs. */
+                if (lpLength(o->ptr) % 2)
+                    rdbExitReportCorruptRDB("Sorted set listpack with an odd "
+                                            "number of entries.");
                 o->type = OBJ_ZSET;
-                o->encoding = OBJ_ENCODING_ZIPLIST;
+                o->encoding = OBJ_ENCODING_LISTPACK;
                 if (zsetLength(o) > server.zset_max_ziplist_entries)
                     zsetConvert(o,OBJ_ENCODING_SKIPLIST);
                 break;
             case RDB_TYPE_HASH_ZIPLIST:
+            case RDB_TYPE_HASH_LISTPACK:
+                if (rdbtype == RDB_TYPE_HASH_ZIPLIST) {
+                    o->ptr = rdbZiplistToListpack(o->ptr);
+                } else if (!lpValidateIntegrity(o->ptr,encoded_len,1)) {
+                    rdbExitReportCorruptRDB("Listpack integrity check failed.");
+                }
+                /* Fields and values are stored in pairs. */
+                if (lpLength(o->ptr) % 2)
+                    rdbExitReportCorruptRDB("Hash listpack with an odd number "
+                                            "of entries.");
                 o->type = OBJ_HASH;
-                o->encoding = OBJ_ENCODING_ZIPLIST;
+                o->encoding = OBJ_ENCODING_LISTPACK;
                 if (hashTypeLength(o) > server.hash_max_ziplist_entries)
                     hashTypeConvert(o, OBJ_ENCODING_HT);
                 break;
@@ -1446,17 +1533,22 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 void startLoading(FILE *fp) {
     struct stat sb;
 
-    /* Load the DB */
-    server.loading = 1;
-    server.loading_start_time = time(NULL);
-    server.loading_loaded_bytes = 0;
     if (fstat(fileno(fp), &sb) == -1) {
-        server.loading_total_bytes = 0;
+        startLoadingSize(0);
     } else {
-        server.loading_total_bytes = sb.st_size;
+        startLoadingSize(sb.st_size);
     }
 }
 
+/* Like startLoading() but for a stream of 'size' bytes, or of unknown
+ * size if 'size' is zero. */
+void startLoadingSize(off_t size) {
+    server.loading = 1;
+    server.loading_start_time = time(NULL);
+    server.loading_loaded_bytes = 0;
+    server.loading_total_bytes = size;
+}
+
 /* Refresh the loading progress info */
 void loadingProgress(off_t pos) {
     server.loading_loaded_bytes = pos;
@@ -1488,14 +1580,407 @@ void rdbLoadProgressCallback(rio *r, const void *buf, size_t len) {
     }
 }
 
+/* -----------------------------------------------------------------------------
+ * Parallel loading
+ *
+ * When rdb-load-threads is greater than zero, rdbLoadRio() no longer decodes
+ * the values itself. The main thread keeps reading the stream (so that the
+ * checksum and the loading progress are computed exactly as before) but,
+ * for every key, it just copies the serialized value into a buffer, walking
+ * only the framing (lengths and string headers) of the encoding. Values are
+ * grouped in batches that a pool of threads decodes with rdbLoadObject(),
+ * which is where the time goes: LZF decompression, listpack / intset
+ * conversions, dict and skiplist creation. Decoded batches are added to the
+ * keyspace by the main thread in the same order they were read.
+ *
+ * Module values are always decoded by the main thread, since modules
+ * rdb_load() callbacks are not required to be thread safe.
+ * -------------------------------------------------------------------------- */
+
+#define RDB_LOAD_BATCH_KEYS 128             /* Max keys per batch. */
+#define RDB_LOAD_BATCH_BYTES (1024*1024)    /* Max payload bytes per batch. */
+#define RDB_LOAD_BATCHES_PER_THREAD 4       /* Max batches in flight. */
+
+typedef struct rdbLoadJob {
+    redisDb *db;            /* Target DB. */
+    robj *key;              /* Key, already loaded by the main thread. */
+    long long expiretime;   /* Expire or -1. */
+    int type;               /* RDB object type. */
+    sds payload;            /* Serialized value, freed once decoded. */
+    robj *val;              /* Decoded value, NULL on error. */
+} rdbLoadJob;
+
+typedef struct rdbLoadBatch {
+    rdbLoadJob jobs[RDB_LOAD_BATCH_KEYS];
+    int numjobs;
+    size_t bytes;
+    int done;               /* Set when every value was decoded. */
+} rdbLoadBatch;
+
+typedef struct rdbLoader {
+    int numthreads;
+    pthread_t *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t todo_cond;   /* Signaled when a batch is queued. */
+    pthread_cond_t done_cond;   /* Signaled when a batch was decoded. */
+    list *todo;                 /* Batches not yet picked by any thread. */
+    list *inflight;             /* All the batches not yet added, in order. */
+    rdbLoadBatch *current;      /* Batch we are filling. */
+    int stop;                   /* Tell the threads to exit. */
+} rdbLoader;
+
+/* Read 'len' bytes from the stream, appending them to the sds '*dst'. */
+static int rdbCopyBytes(rio *rdb, sds *dst, size_t len) {
+    size_t oldlen = sdslen(*dst);
+
+    if (len == 0) return 0;
+    *dst = sdsMakeRoomFor(*dst,len);
+    if (rioRead(rdb,*dst+oldlen,len) == 0) return -1;
+    sdsIncrLen(*dst,len);
+    return 0;
+}
+
+/* Like rdbLoadLenByRef() but the raw bytes are also appended to '*dst'. */
+static int rdbCopyLen(rio *rdb, sds *dst, int *isencoded, uint64_t *lenptr) {
+    unsigned char *p;
+    int type;
+
+    *isencoded = 0;
+    if (rdbCopyBytes(rdb,dst,1) == -1) return -1;
+    p = (unsigned char*)*dst+sdslen(*dst)-1;
+    type = (p[0]&0xC0)>>6;
+    if (type == RDB_ENCVAL) {
+        *isencoded = 1;
+        *lenptr = p[0]&0x3F;
+    } else if (type == RDB_6BITLEN) {
+        *lenptr = p[0]&0x3F;
+    } else if (type == RDB_14BITLEN) {
+        uint64_t hi = p[0]&0x3F;
+        if (rdbCopyBytes(rdb,dst,1) == -1) return -1;
+        p = (unsigned char*)*dst+sdslen(*dst)-1;
+        *lenptr = (hi<<8)|p[0];
+    } else if (p[0] == RDB_32BITLEN) {
+        uint32_t len;
+        if (rdbCopyBytes(rdb,dst,4) == -1) return -1;
+        memcpy(&len,*dst+sdslen(*dst)-4,4);
+        *lenptr = ntohl(len);
+    } else if (p[0] == RDB_64BITLEN) {
+        uint64_t len;
+        if (rdbCopyBytes(rdb,dst,8) == -1) return -1;
+        memcpy(&len,*dst+sdslen(*dst)-8,8);
+        *lenptr = ntohu64(len);
+    } else {
+        rdbExitReportCorruptRDB(
+            "Unknown length encoding %d in rdbLoadLen()",type);
+        return -1; /* Never reached. */
+    }
+    return 0;
+}
+
+/* Copy a string object, see rdbGenericLoadStringObject(). */
+static int rdbCopyString(rio *rdb, sds *dst) {
+    int isencoded;
+    uint64_t len, clen;
+
+    if (rdbCopyLen(rdb,dst,&isencoded,&len) == -1) return -1;
+    if (!isencoded) return rdbCopyBytes(rdb,dst,len);
+    switch(len) {
+    case RDB_ENC_INT8: return rdbCopyBytes(rdb,dst,1);
+    case RDB_ENC_INT16: return rdbCopyBytes(rdb,dst,2);
+    case RDB_ENC_INT32: return rdbCopyBytes(rdb,dst,4);
+    case RDB_ENC_LZF:
+        if (rdbCopyLen(rdb,dst,&isencoded,&clen) == -1) return -1;
+        if (rdbCopyLen(rdb,dst,&isencoded,&len) == -1) return -1;
+        return rdbCopyBytes(rdb,dst,clen);
+    default:
+        rdbExitReportCorruptRDB("Unknown RDB string encoding type %d",len);
+        return -1; /* Never reached. */
+    }
+}
+
+/* Copy a double in the old string format, see rdbLoadDoubleValue(). */
+static int rdbCopyDouble(rio *rdb, sds *dst) {
+    unsigned char len;
+
+    if (rdbCopyBytes(rdb,dst,1) == -1) return -1;
+    len = (*dst)[sdslen(*dst)-1];
+    if (len >= 253) return 0; /* NaN, +inf, -inf. */
+    return rdbCopyBytes(rdb,dst,len);
+}
+
+/* Copy the serialized value of type 'rdbtype' into '*dst' without decoding
+ * it. Module types are not handled since they can't be parsed without the
+ * help of the module. Returns -1 on short read. */
+static int rdbCopyObject(int rdbtype, rio *rdb, sds *dst) {
+    uint64_t len, j;
+    int isencoded;
+
+    switch(rdbtype) {
+    case RDB_TYPE_STRING:
+    case RDB_TYPE_HASH_ZIPMAP:
+    case RDB_TYPE_LIST_ZIPLIST:
+    case RDB_TYPE_SET_INTSET:
+    case RDB_TYPE_ZSET_ZIPLIST:
+    case RDB_TYPE_HASH_ZIPLIST:
+    case RDB_TYPE_HASH_LISTPACK:
+    case RDB_TYPE_ZSET_LISTPACK:
+        return rdbCopyString(rdb,dst);
+    case RDB_TYPE_LIST:
+    case RDB_TYPE_SET:
+    case RDB_TYPE_LIST_QUICKLIST:
+    case RDB_TYPE_LIST_QUICKLIST_2:
+    case RDB_TYPE_HASH:
+    case RDB_TYPE_ZSET:
+    case RDB_TYPE_ZSET_2:
+        if (rdbCopyLen(rdb,dst,&isencoded,&len) == -1) return -1;
+        for (j = 0; j < len; j++) {
+            if (rdbtype == RDB_TYPE_LIST_QUICKLIST_2) {
+                uint64_t container;
+
+                if (rdbCopyLen(rdb,dst,&isencoded,&container) == -1)
+                    return -1;
+            }
+            if (rdbCopyString(rdb,dst) == -1) return -1;
+            if (rdbtype == RDB_TYPE_HASH) {
+                if (rdbCopyString(rdb,dst) == -1) return -1;
+            } else if (rdbtype == RDB_TYPE_ZSET) {
+                if (rdbCopyDouble(rdb,dst) == -1) return -1;
+            } else if (rdbtype == RDB_TYPE_ZSET_2) {
+                if (rdbCopyBytes(rdb,dst,sizeof(double)) == -1) return -1;
+            }
+        }
+        return 0;
+    default:
+        rdbExitReportCorruptRDB("Unknown RDB encoding type %d",rdbtype);
+        return -1; /* Never reached. */
+    }
+}
+
+/* Decode all the values of a batch. Called by the loading threads, or by
+ * the main thread itself while it is waiting for a batch to complete. */
+static void rdbLoadDecodeBatch(rdbLoadBatch *b) {
+    int j;
+
+    for (j = 0; j < b->numjobs; j++) {
+        rdbLoadJob *job = b->jobs+j;
+        rio payload;
+
+        rioInitWithBuffer(&payload,job->payload);
+        job->val = rdbLoadObject(job->type,&payload);
+        sdsfree(job->payload);
+        job->payload = NULL;
+    }
+}
+
+static void *rdbLoadThreadMain(void *arg) {
+    rdbLoader *l = arg;
+
+    pthread_mutex_lock(&l->mutex);
+    while(1) {
+        listNode *ln;
+        rdbLoadBatch *b;
+
+        while (listLength(l->todo) == 0 && !l->stop)
+            pthread_cond_wait(&l->todo_cond,&l->mutex);
+        if (listLength(l->todo) == 0) break; /* Stop requested. */
+        ln = listFirst(l->todo);
+        b = ln->value;
+        listDelNode(l->todo,ln);
+        pthread_mutex_unlock(&l->mutex);
+
+        rdbLoadDecodeBatch(b);
+
+        pthread_mutex_lock(&l->mutex);
+        b->done = 1;
+        pthread_cond_broadcast(&l->done_cond);
+    }
+    pthread_mutex_unlock(&l->mutex);
+    return NULL;
+}
+
+/* Create a loader with 'numthreads' decoding threads. If the threads can't
+ * be created NULL is returned, and the caller should load sequentially. */
+static rdbLoader *rdbLoaderCreate(int numthreads) {
+    rdbLoader *l = zcalloc(sizeof(*l));
+    int j;
+
+    l->threads = zmalloc(sizeof(pthread_t)*numthreads);
+    l->todo = listCreate();
+    l->inflight = listCreate();
+    pthread_mutex_init(&l->mutex,NULL);
+    pthread_cond_init(&l->todo_cond,NULL);
+    pthread_cond_init(&l->done_cond,NULL);
+    for (j = 0; j < numthreads; j++) {
+        if (pthread_create(&l->threads[j],NULL,rdbLoadThreadMain,l) != 0)
+            break;
+        l->numthreads++;
+    }
+    if (l->numthreads == 0) {
+        serverLog(LL_WARNING,"Can't create the RDB loading threads: "
+                             "loading sequentially.");
+        listRelease(l->todo);
+        listRelease(l->inflight);
+        zfree(l->threads);
+        zfree(l);
+        return NULL;
+    }
+    return l;
+}
+
+/* Add the values of a decoded batch to the keyspace, exactly like the
+ * sequential code path does in rdbLoadRio(). Returns C_ERR if some value
+ * could not be decoded. */
+static int rdbLoadAddBatch(rdbLoadBatch *b, long long now) {
+    int j, retval = C_OK;
+
+    for (j = 0; j < b->numjobs; j++) {
+        rdbLoadJob *job = b->jobs+j;
+
+        if (job->val == NULL) {
+            retval = C_ERR;
+        } else if (server.masterhost == NULL && job->expiretime != -1 &&
+                   job->expiretime < now)
+        {
+            decrRefCount(job->val);
+        } else {
+            dbAdd(job->db,job->key,job->val);
+            if (job->expiretime != -1)
+                setExpire(NULL,job->db,job->key,job->expiretime);
+        }
+        decrRefCount(job->key);
+    }
+    zfree(b);
+    return retval;
+}
+
+/* Add to the keyspace all the batches at the head of the in flight list,
+ * in order. If 'maxinflight' is non zero, stop as soon as there are less
+ * than 'maxinflight' batches in flight and the next one is not decoded yet,
+ * otherwise wait for all the batches. While waiting the main thread
+ * decodes the batches no thread picked yet. */
+static int rdbLoaderDrain(rdbLoader *l, unsigned long maxinflight,
+                          long long now)
+{
+    int retval = C_OK;
+
+    pthread_mutex_lock(&l->mutex);
+    while (listLength(l->inflight)) {
+        listNode *ln = listFirst(l->inflight);
+        rdbLoadBatch *b = ln->value;
+
+        if (!b->done) {
+            if (maxinflight && listLength(l->inflight) < maxinflight) break;
+            if (listLength(l->todo)) {
+                listNode *tn = listFirst(l->todo);
+                rdbLoadBatch *tb = tn->value;
+
+                listDelNode(l->todo,tn);
+                pthread_mutex_unlock(&l->mutex);
+                rdbLoadDecodeBatch(tb);
+                pthread_mutex_lock(&l->mutex);
+                tb->done = 1;
+            } else {
+                pthread_cond_wait(&l->done_cond,&l->mutex);
+            }
+            continue;
+        }
+        listDelNode(l->inflight,ln);
+        pthread_mutex_unlock(&l->mutex);
+        if (rdbLoadAddBatch(b,now) == C_ERR) retval = C_ERR;
+        pthread_mutex_lock(&l->mutex);
+    }
+    pthread_mutex_unlock(&l->mutex);
+    return retval;
+}
+
+/* Queue the batch being filled, if any, to the loading threads. */
+static void rdbLoaderSubmit(rdbLoader *l) {
+    if (l->current == NULL) return;
+    pthread_mutex_lock(&l->mutex);
+    listAddNodeTail(l->todo,l->current);
+    listAddNodeTail(l->inflight,l->current);
+    pthread_cond_signal(&l->todo_cond);
+    pthread_mutex_unlock(&l->mutex);
+    l->current = NULL;
+}
+
+/* Read the value of type 'rdbtype' for 'key' from the stream and queue it
+ * for decoding. The reference to 'key' is owned by the loader. */
+static int rdbLoaderQueue(rdbLoader *l, rio *rdb, redisDb *db, robj *key,
+                          int rdbtype, long long expiretime, long long now)
+{
+    rdbLoadJob *job;
+    sds payload = sdsempty();
+
+    if (rdbCopyObject(rdbtype,rdb,&payload) == -1) {
+        sdsfree(payload);
+        decrRefCount(key);
+        return C_ERR;
+    }
+
+    if (l->current == NULL) l->current = zcalloc(sizeof(rdbLoadBatch));
+    job = l->current->jobs+l->current->numjobs++;
+    job->db = db;
+    job->key = key;
+    job->expiretime = expiretime;
+    job->type = rdbtype;
+    job->payload = payload;
+    job->val = NULL;
+    l->current->bytes += sdslen(payload);
+
+    if (l->current->numjobs == RDB_LOAD_BATCH_KEYS ||
+        l->current->bytes >= RDB_LOAD_BATCH_BYTES)
+    {
+        rdbLoaderSubmit(l);
+        return rdbLoaderDrain(l,
+            (unsigned long)l->numthreads*RDB_LOAD_BATCHES_PER_THREAD,now);
+    }
+    return C_OK;
+}
+
+/* Add everything still pending to the keyspace. */
+static int rdbLoaderFlush(rdbLoader *l, long long now) {
+    rdbLoaderSubmit(l);
+    return rdbLoaderDrain(l,0,now);
+}
+
+/* Stop the threads and free the loader. Must be called after
+ * rdbLoaderFlush(). */
+static void rdbLoaderRelease(rdbLoader *l) {
+    int j;
+
+    pthread_mutex_lock(&l->mutex);
+    l->stop = 1;
+    pthread_cond_broadcast(&l->todo_cond);
+    pthread_mutex_unlock(&l->mutex);
+    for (j = 0; j < l->numthreads; j++) pthread_join(l->threads[j],NULL);
+    pthread_mutex_destroy(&l->mutex);
+    pthread_cond_destroy(&l->todo_cond);
+    pthread_cond_destroy(&l->done_cond);
+    listRelease(l->todo);
+    listRelease(l->inflight);
+    zfree(l->threads);
+    zfree(l);
+}
+
 /* Load an RDB file from the rio stream 'rdb'. On success C_OK is returned,
  * otherwise C_ERR is returned and 'errno' is set accordingly. */
 int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
+    return rdbLoadRioWithDbs(rdb,rsi,server.db);
+}
+
+/* Like rdbLoadRio() but the keys are added to the 'dbarray' DBs instead of
+ * the ones of the server. A short read of the stream is not fatal if the
+ * backend reported a read error, as it happens when the stream is a socket:
+ * in that case C_ERR is returned, and the caller should discard the keys
+ * loaded so far. */
+int rdbLoadRioWithDbs(rio *rdb, rdbSaveInfo *rsi, redisDb *dbarray) {
     uint64_t dbid;
     int type, rdbver;
-    redisDb *db = server.db+0;
+    redisDb *db = dbarray+0;
     char buf[1024];
     long long expiretime, now = mstime();
+    rdbLoader *loader = NULL;
 
     rdb->update_cksum = rdbLoadProgressCallback;
     rdb->max_processing_chunk = server.loading_process_events_interval_bytes;
@@ -1513,6 +1998,9 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
         return C_ERR;
     }
 
+    if (server.rdb_load_threads > 0)
+        loader = rdbLoaderCreate(server.rdb_load_threads);
+
     while(1) {
         robj *key, *val;
         expiretime = -1;
@@ -1551,7 +2039,7 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
                     "databases. Exiting\n", server.dbnum);
                 exit(1);
             }
-            db = server.db+dbid;
+            db = dbarray+dbid;
             continue; /* Read type again. */
         } else if (type == RDB_OPCODE_RESIZEDB) {
             /* RESIZEDB: Hint about the size of the keys in the currently
@@ -1562,7 +2050,6 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
             if ((expires_size = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
                 goto eoferr;
             dictExpand(db->dict,db_size);
-            dictExpand(db->expires,expires_size);
             continue; /* Read type again. */
         } else if (type == RDB_OPCODE_AUX) {
             /* AUX: generic string-string fields. Use to add state to RDB
@@ -1604,6 +2091,19 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
 
         /* Read key */
         if ((key = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+
+        /* With parallel loading, the value is decoded and added to the
+         * keyspace later, unless it is a module value: in that case we add
+         * what is pending and load it here, so that the keys are still
+         * added in the order they appear in the file. */
+        if (loader) {
+            if (type != RDB_TYPE_MODULE && type != RDB_TYPE_MODULE_2) {
+                if (rdbLoaderQueue(loader,rdb,db,key,type,expiretime,now)
+                    == C_ERR) goto eoferr;
+                continue;
+            }
+            if (rdbLoaderFlush(loader,now) == C_ERR) goto eoferr;
+        }
         /* Read value */
         if ((val = rdbLoadObject(type,rdb)) == NULL) goto eoferr;
         /* Check if the key already expired. This function is used when loading
@@ -1624,6 +2124,11 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
 
         decrRefCount(key);
     }
+    if (loader) {
+        if (rdbLoaderFlush(loader,now) == C_ERR) goto eoferr;
+        rdbLoaderRelease(loader);
+        loader = NULL;
+    }
     /* Verify the checksum if RDB version is >= 5 */
     if (rdbver >= 5 && server.rdb_checksum) {
         uint64_t cksum, expected = rdb->cksum;
@@ -1640,6 +2145,14 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi) {
     return C_OK;
 
 eoferr: /* unexpected end of file is handled here with a fatal exit */
+    if (rioGetReadError(rdb)) {
+        serverLog(LL_WARNING,"Short read loading DB: %s",strerror(errno));
+        if (loader) {
+            rdbLoaderFlush(loader,now);
+            rdbLoaderRelease(loader);
+        }
+        return C_ERR;
+    }
     serverLog(LL_WARNING,"Short read or OOM loading DB. Unrecoverable error, aborting now.");
     rdbExitReportCorruptRDB("Unexpected EOF reading RDB file");
     return C_ERR; /* Just to avoid warning */
@@ -1701,11 +2214,66 @@ void backgroundSaveDoneHandlerDisk(int exitcode, int bysignal) {
     updateSlavesWaitingBgsave((!bysignal && exitcode == 0) ? C_OK : C_ERR, RDB_CHILD_TYPE_DISK);
 }
 
+/* Read the reports the diskless replication child sends via pipe for
+ * every slave, as soon as the slave received the whole RDB payload or
+ * failed. Every report is composed of four uint64_t integers:
+ *
+ * <slave id> <error> <bytes sent> <microseconds elapsed>
+ *
+ * The 'error' is 0 if the transfer succeeded or the errno otherwise. A
+ * slave that received the payload is put online immediately, without
+ * waiting for the transfer to the other slaves to complete, while the
+ * slaves in error are closed. */
+static void rdbReadSlavesReports(void) {
+    uint64_t report[4];
+    listNode *ln;
+    listIter li;
+
+    while(read(server.rdb_pipe_read_result_from_child,report,sizeof(report))
+          == sizeof(report))
+    {
+        listRewind(server.slaves,&li);
+        while((ln = listNext(&li))) {
+            client *slave = ln->value;
+
+            if (slave->id != report[0] ||
+                slave->replstate != SLAVE_STATE_WAIT_BGSAVE_END) continue;
+            if (report[1] != 0) {
+                serverLog(LL_WARNING,
+                "Closing slave %s: child->slave RDB transfer failed: %s",
+                    replicationGetSlaveName(slave),
+                    strerror((int)report[1]));
+                freeClient(slave);
+            } else {
+                double secs = (double)report[3]/1000000;
+
+                serverLog(LL_WARNING,
+                "Slave %s correctly received the streamed RDB file "
+                "(%llu bytes in %.2f seconds, %.2f MB/sec).",
+                    replicationGetSlaveName(slave),
+                    (unsigned long long)report[2], secs,
+                    secs ? (double)report[2]/(1024*1024)/secs : 0);
+                replicationSlaveStreamedRdb(slave);
+            }
+            break;
+        }
+    }
+}
+
+static void rdbPipeReadHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    UNUSED(el);
+    UNUSED(fd);
+    UNUSED(privdata);
+    UNUSED(mask);
+    rdbReadSlavesReports();
+}
+
 /* A background saving child (BGSAVE) terminated its work. Handle this.
  * This function covers the case of RDB -> Salves socket transfers for
  * diskless replication. */
 void backgroundSaveDoneHandlerSocket(int exitcode, int bysignal) {
-    uint64_t *ok_slaves;
+    listNode *ln;
+    listIter li;
 
     if (!bysignal && exitcode == 0) {
         serverLog(LL_NOTICE,
@@ -1720,78 +2288,28 @@ void backgroundSaveDoneHandlerSocket(int exitcode, int bysignal) {
     server.rdb_child_type = RDB_CHILD_TYPE_NONE;
     server.rdb_save_time_start = -1;
 
-    /* If the child returns an OK exit code, read the set of slave client
-     * IDs and the associated status code. We'll terminate all the slaves
-     * in error state.
-     *
-     * If the process returned an error, consider the list of slaves that
-     * can continue to be emtpy, so that it's just a special case of the
-     * normal code path. */
-    ok_slaves = zmalloc(sizeof(uint64_t)); /* Make space for the count. */
-    ok_slaves[0] = 0;
-    if (!bysignal && exitcode == 0) {
-        int readlen = sizeof(uint64_t);
-
-        if (read(server.rdb_pipe_read_result_from_child, ok_slaves, readlen) ==
-                 readlen)
-        {
-            readlen = ok_slaves[0]*sizeof(uint64_t)*2;
-
-            /* Make space for enough elements as specified by the first
-             * uint64_t element in the array. */
-            ok_slaves = zrealloc(ok_slaves,sizeof(uint64_t)+readlen);
-            if (readlen &&
-                read(server.rdb_pipe_read_result_from_child, ok_slaves+1,
-                     readlen) != readlen)
-            {
-                ok_slaves[0] = 0;
-            }
-        }
-    }
-
+    /* Process the reports not yet read: most slaves were already put
+     * online or closed while the child was still running. */
+    rdbReadSlavesReports();
+    aeDeleteFileEvent(server.el,server.rdb_pipe_read_result_from_child,
+                      AE_READABLE);
     close(server.rdb_pipe_read_result_from_child);
     close(server.rdb_pipe_write_result_to_parent);
 
-    /* We can continue the replication process with all the slaves that
-     * correctly received the full payload. Others are terminated. */
-    listNode *ln;
-    listIter li;
-
+    /* The slaves the child did not report about did not receive the
+     * full payload, and are terminated. */
     listRewind(server.slaves,&li);
     while((ln = listNext(&li))) {
         client *slave = ln->value;
 
         if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_END) {
-            uint64_t j;
-            int errorcode = 0;
-
-            /* Search for the slave ID in the reply. In order for a slave to
-             * continue the replication process, we need to find it in the list,
-             * and it must have an error code set to 0 (which means success). */
-            for (j = 0; j < ok_slaves[0]; j++) {
-                if (slave->id == ok_slaves[2*j+1]) {
-                    errorcode = ok_slaves[2*j+2];
-                    break; /* Found in slaves list. */
-                }
-            }
-            if (j == ok_slaves[0] || errorcode != 0) {
-                serverLog(LL_WARNING,
+            serverLog(LL_WARNING,
                 "Closing slave %s: child->slave RDB transfer failed: %s",
-                    replicationGetSlaveName(slave),
-                    (errorcode == 0) ? "RDB transfer child aborted"
-                                     : strerror(errorcode));
-                freeClient(slave);
-            } else {
-                serverLog(LL_WARNING,
-                "Slave %s correctly received the streamed RDB file.",
-                    replicationGetSlaveName(slave));
-                /* Restore the socket as non-blocking. */
-                anetNonBlock(NULL,slave->fd);
-                anetSendTimeout(NULL,slave->fd,0);
-            }
+                replicationGetSlaveName(slave),
+                "RDB transfer child aborted");
+            freeClient(slave);
         }
     }
-    zfree(ok_slaves);
 
     updateSlavesWaitingBgsave((!bysignal && exitcode == 0) ? C_OK : C_ERR, RDB_CHILD_TYPE_SOCKET);
 }
@@ -1811,10 +2329,32 @@ void backgroundSaveDoneHandler(int exitcode, int bysignal) {
     }
 }
 
+/* Client IDs of the slaves served by the diskless replication child, and
+ * the time the transfer started. Only used in the child. */
+static uint64_t *rdbSlavesClientIds;
+static long long rdbSlavesStart;
+
+/* Called in the diskless replication child when the slave 'j' received the
+ * whole payload or failed: send the report to the parent via pipe, see
+ * rdbReadSlavesReports() for the format. */
+static void rdbSlaveSocketDone(rio *r, int j) {
+    uint64_t report[4];
+
+    report[0] = rdbSlavesClientIds[j];
+    report[1] = r->io.fdset.state[j];
+    report[2] = r->io.fdset.sent[j];
+    report[3] = ustime()-rdbSlavesStart;
+    if (write(server.rdb_pipe_write_result_to_parent,report,sizeof(report))
+        != sizeof(report))
+    {
+        /* Nothing to do, the parent will close the slave. */
+    }
+}
+
 /* Spawn an RDB child that writes the RDB to the sockets of the slaves
  * that are currently in SLAVE_STATE_WAIT_BGSAVE_START state. */
 int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
-    int *fds;
+    int *fds, *compressed;
     uint64_t *clientids;
     int numfds;
     listNode *ln;
@@ -1823,7 +2363,8 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
     long long start;
     int pipefds[2];
 
-    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
+    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1 ||
+        server.rdb_forkless_in_progress) return C_ERR;
 
     /* Before to fork, create a pipe that will be used in order to
      * send back to the parent the IDs of the slaves that successfully
@@ -1831,6 +2372,7 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
     if (pipe(pipefds) == -1) return C_ERR;
     server.rdb_pipe_read_result_from_child = pipefds[0];
     server.rdb_pipe_write_result_to_parent = pipefds[1];
+    anetNonBlock(NULL,pipefds[0]);
 
     /* Collect the file descriptors of the slaves we want to transfer
      * the RDB to, which are i WAIT_BGSAVE_START state. */
@@ -1839,6 +2381,7 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
      * be useful for the child process in order to build the report
      * (sent via unix pipe) that will be sent to the parent. */
     clientids = zmalloc(sizeof(uint64_t)*listLength(server.slaves));
+    compressed = zmalloc(sizeof(int)*listLength(server.slaves));
     numfds = 0;
 
     listRewind(server.slaves,&li);
@@ -1847,13 +2390,9 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
 
         if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) {
             clientids[numfds] = slave->id;
-            fds[numfds++] = slave->fd;
+            fds[numfds] = slave->fd;
             replicationSetupSlaveForFullResync(slave,getPsyncInitialOffset());
-            /* Put the socket in blocking mode to simplify RDB transfer.
-             * We'll restore it when the children returns (since duped socket
-             * will share the O_NONBLOCK attribute with the parent). */
-            anetBlock(NULL,slave->fd);
-            anetSendTimeout(NULL,slave->fd,server.repl_timeout*1000);
+            compressed[numfds++] = slave->repl_comp != NULL;
         }
     }
 
@@ -1865,8 +2404,20 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
         int retval;
         rio slave_sockets;
 
-        rioInitWithFdset(&slave_sockets,fds,numfds);
+        /* The sockets are non blocking and written independently, so
+         * that a slow slave does not slow down the others: the child only
+         * waits when the slowest slave lags more than its output buffer
+         * hard limit. */
+        rioInitWithFdset(&slave_sockets,fds,numfds,
+            server.client_obuf_limits[CLIENT_TYPE_SLAVE].hard_limit_bytes,
+            (long long)server.repl_timeout*1000);
+        slave_sockets.io.fdset.fd_done = rdbSlaveSocketDone;
+        for (int j = 0; j < numfds; j++)
+            if (compressed[j]) rioFdsetEnableCompression(&slave_sockets,j);
+        rdbSlavesClientIds = clientids;
+        rdbSlavesStart = ustime();
         zfree(fds);
+        zfree(compressed);
 
         closeListeningSockets(0);
         redisSetProcTitle("redis-rdb-to-slaves");
@@ -1886,45 +2437,6 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
 
             server.child_info_data.cow_size = private_dirty;
             sendChildInfo(CHILD_INFO_TYPE_RDB);
-
-            /* If we are returning OK, at least one slave was served
-             * with the RDB file as expected, so we need to send a report
-             * to the parent via the pipe. The format of the message is:
-             *
-             * <len> <slave[0].id> <slave[0].error> ...
-             *
-             * len, slave IDs, and slave errors, are all uint64_t integers,
-             * so basically the reply is composed of 64 bits for the len field
-             * plus 2 additional 64 bit integers for each entry, for a total
-             * of 'len' entries.
-             *
-             * The 'id' represents the slave's client ID, so that the master
-             * can match the report with a specific slave, and 'error' is
-             * set to 0 if the replication process terminated with a success
-             * or the error code if an error occurred. */
-            void *msg = zmalloc(sizeof(uint64_t)*(1+2*numfds));
-            uint64_t *len = msg;
-            uint64_t *ids = len+1;
-            int j, msglen;
-
-            *len = numfds;
-            for (j = 0; j < numfds; j++) {
-                *ids++ = clientids[j];
-                *ids++ = slave_sockets.io.fdset.state[j];
-            }
-
-            /* Write the message to the parent. If we have no good slaves or
-             * we are unable to transfer the message to the parent, we exit
-             * with an error so that the parent will abort the replication
-             * process with all the childre that were waiting. */
-            msglen = sizeof(uint64_t)*(1+2*numfds);
-            if (*len == 0 ||
-                write(server.rdb_pipe_write_result_to_parent,msg,msglen)
-                != msglen)
-            {
-                retval = C_ERR;
-            }
-            zfree(msg);
         }
         zfree(clientids);
         rioFreeFdset(&slave_sockets);
@@ -1964,16 +2476,19 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
             server.rdb_child_pid = childpid;
             server.rdb_child_type = RDB_CHILD_TYPE_SOCKET;
             updateDictResizePolicy();
+            aeCreateFileEvent(server.el,server.rdb_pipe_read_result_from_child,
+                AE_READABLE,rdbPipeReadHandler,NULL);
         }
         zfree(clientids);
         zfree(fds);
+        zfree(compressed);
         return (childpid == -1) ? C_ERR : C_OK;
     }
     return C_OK; /* Unreached. */
 }
 
 void saveCommand(client *c) {
-    if (server.rdb_child_pid != -1) {
+    if (server.rdb_child_pid != -1 || server.rdb_forkless_in_progress) {
         addReplyError(c,"Background save already in progress");
         return;
     }
@@ -1999,7 +2514,7 @@ void bgsaveCommand(client *c) {
         }
     }
 
-    if (server.rdb_child_pid != -1) {
+    if (server.rdb_child_pid != -1 || server.rdb_forkless_in_progress) {
         addReplyError(c,"Background save already in progress");
     } else if (server.aof_child_pid != -1) {
         if (schedule) {
@@ -39,15 +39,20 @@
 #include <sys/time.h>
 #include <signal.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <sds.h> /* Use hiredis sds. */
 #include "ae.h"
 #include "hiredis.h"
 #include "adlist.h"
 #include "zmalloc.h"
+#include "atomicvar.h"
 
 #define UNUSED(V) ((void) V)
 #define RANDPTR_INITIAL_SIZE 8
+#define MAX_THREADS 500
+
+struct benchmarkThread;
 
 static struct config {
     aeEventLoop *el;
@@ -79,8 +84,21 @@ static struct config {
     sds dbnumstr;
     char *tests;
     char *auth;
+    int patterns;
+    int num_threads;
+    struct benchmarkThread **threads;
+    pthread_mutex_t clients_mutex; /* Protects 'clients' with --threads. */
 } config;
 
+/* With --threads every thread runs its own event loop serving a subset of
+ * the clients, so that the benchmark itself is not the bottleneck when
+ * testing a server using multiple I/O threads. */
+typedef struct benchmarkThread {
+    int index;
+    pthread_t thread;
+    aeEventLoop *el;
+} benchmarkThread;
+
 typedef struct _client {
     redisContext *context;
     sds obuf;
@@ -95,11 +113,20 @@ typedef struct _client {
                                such as auth and select are prefixed to the pipeline of
                                benchmark commands and discarded after the first send. */
     int prefixlen;          /* Size in bytes of the pending prefix commands */
+    int thread_id;          /* Benchmark thread serving the client, or -1. */
 } *client;
 
+/* Event loop serving the client: the one of its thread when --threads is
+ * used, otherwise the global one. */
+#define CLIENT_GET_EVENTLOOP(c) \
+    (c->thread_id >= 0 ? config.threads[c->thread_id]->el : config.el)
+
 /* Prototypes */
 static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 static void createMissingClients(client c);
+static client createClient(char *cmd, size_t len, client from, int thread_id);
+int showThroughput(struct aeEventLoop *eventLoop, long long id,
+                   void *clientData);
 
 /* Implementation */
 static long long ustime(void) {
@@ -123,17 +150,20 @@ static long long mstime(void) {
 }
 
 static void freeClient(client c) {
+    aeEventLoop *el = CLIENT_GET_EVENTLOOP(c);
     listNode *ln;
-    aeDeleteFileEvent(config.el,c->context->fd,AE_WRITABLE);
-    aeDeleteFileEvent(config.el,c->context->fd,AE_READABLE);
+    aeDeleteFileEvent(el,c->context->fd,AE_WRITABLE);
+    aeDeleteFileEvent(el,c->context->fd,AE_READABLE);
     redisFree(c->context);
     sdsfree(c->obuf);
     zfree(c->randptr);
     zfree(c);
+    if (config.num_threads) pthread_mutex_lock(&config.clients_mutex);
     config.liveclients--;
     ln = listSearchKey(config.clients,c);
     assert(ln != NULL);
     listDelNode(config.clients,ln);
+    if (config.num_threads) pthread_mutex_unlock(&config.clients_mutex);
 }
 
 static void freeAllClients(void) {
@@ -147,9 +177,10 @@ static void freeAllClients(void) {
 }
 
 static void resetClient(client c) {
-    aeDeleteFileEvent(config.el,c->context->fd,AE_WRITABLE);
-    aeDeleteFileEvent(config.el,c->context->fd,AE_READABLE);
-    aeCreateFileEvent(config.el,c->context->fd,AE_WRITABLE,writeHandler,c);
+    aeEventLoop *el = CLIENT_GET_EVENTLOOP(c);
+    aeDeleteFileEvent(el,c->context->fd,AE_WRITABLE);
+    aeDeleteFileEvent(el,c->context->fd,AE_READABLE);
+    aeCreateFileEvent(el,c->context->fd,AE_WRITABLE,writeHandler,c);
     c->written = 0;
     c->pending = config.pipeline;
 }
@@ -171,17 +202,20 @@ static void randomizeClientKey(client c) {
 }
 
 static void clientDone(client c) {
-    if (config.requests_finished == config.requests) {
+    int requests_finished;
+
+    atomicGet(config.requests_finished,requests_finished);
+    if (requests_finished >= config.requests) {
         freeClient(c);
-        aeStop(config.el);
+        /* With threads every event loop is stopped by showThroughput(). */
+        if (!config.num_threads) aeStop(config.el);
         return;
     }
     if (config.keepalive) {
         resetClient(c);
     } else {
-        config.liveclients--;
-        createMissingClients(c);
-        config.liveclients++;
+        /* Replace the client with a new one served by the same thread. */
+        createClient(NULL,0,c,c->thread_id);
         freeClient(c);
     }
 }
@@ -241,8 +275,10 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
                     continue;
                 }
 
-                if (config.requests_finished < config.requests)
-                    config.latency[config.requests_finished++] = c->latency;
+                int requests_finished;
+                atomicGetIncr(config.requests_finished,requests_finished,1);
+                if (requests_finished < config.requests)
+                    config.latency[requests_finished] = c->latency;
                 c->pending--;
                 if (c->pending == 0) {
                     clientDone(c);
@@ -257,14 +293,15 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
 
 static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     client c = privdata;
-    UNUSED(el);
     UNUSED(fd);
     UNUSED(mask);
 
     /* Initialize request when nothing was written. */
     if (c->written == 0) {
         /* Enforce upper bound to number of requests. */
-        if (config.requests_issued++ >= config.requests) {
+        int requests_issued;
+        atomicGetIncr(config.requests_issued,requests_issued,1);
+        if (requests_issued >= config.requests) {
             freeClient(c);
             return;
         }
@@ -286,8 +323,8 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
         }
         c->written += nwritten;
         if (sdslen(c->obuf) == c->written) {
-            aeDeleteFileEvent(config.el,c->context->fd,AE_WRITABLE);
-            aeCreateFileEvent(config.el,c->context->fd,AE_READABLE,readHandler,c);
+            aeDeleteFileEvent(el,c->context->fd,AE_WRITABLE);
+            aeCreateFileEvent(el,c->context->fd,AE_READABLE,readHandler,c);
         }
     }
 }
@@ -312,8 +349,11 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
  * 2) The offsets of the __rand_int__ elements inside the command line, used
  *    for arguments randomization.
  *
- * Even when cloning another client, prefix commands are applied if needed.*/
-static client createClient(char *cmd, size_t len, client from) {
+ * Even when cloning another client, prefix commands are applied if needed.
+ *
+ * The client is served by the event loop of the benchmark thread
+ * 'thread_id', or by the global event loop if 'thread_id' is -1. */
+static client createClient(char *cmd, size_t len, client from, int thread_id) {
     int j;
     client c = zmalloc(sizeof(struct _client));
 
@@ -373,6 +413,7 @@ static client createClient(char *cmd, size_t len, client from) {
     c->pending = config.pipeline+c->prefix_pending;
     c->randptr = NULL;
     c->randlen = 0;
+    c->thread_id = thread_id;
 
     /* Find substrings in the output buffer that need to be randomized. */
     if (config.randomkeys) {
@@ -404,9 +445,12 @@ static client createClient(char *cmd, size_t len, client from) {
         }
     }
     if (config.idlemode == 0)
-        aeCreateFileEvent(config.el,c->context->fd,AE_WRITABLE,writeHandler,c);
+        aeCreateFileEvent(CLIENT_GET_EVENTLOOP(c),c->context->fd,
+                          AE_WRITABLE,writeHandler,c);
+    if (config.num_threads) pthread_mutex_lock(&config.clients_mutex);
     listAddNodeTail(config.clients,c);
     config.liveclients++;
+    if (config.num_threads) pthread_mutex_unlock(&config.clients_mutex);
     return c;
 }
 
@@ -414,7 +458,12 @@ static void createMissingClients(client c) {
     int n = 0;
 
     while(config.liveclients < config.numclients) {
-        createClient(NULL,0,c);
+        int thread_id = -1;
+
+        /* Spread the clients among the threads, if any. */
+        if (config.num_threads)
+            thread_id = config.liveclients % config.num_threads;
+        createClient(NULL,0,c,thread_id);
 
         /* Listen backlog is quite limited on most systems */
         if (++n > 64) {
@@ -438,6 +487,8 @@ static void showLatencyReport(void) {
         printf("  %d requests completed in %.2f seconds\n", config.requests_finished,
             (float)config.totlatency/1000);
         printf("  %d parallel clients\n", config.numclients);
+        if (config.num_threads)
+            printf("  %d benchmark threads\n", config.num_threads);
         printf("  %d bytes payload\n", config.datasize);
         printf("  keep alive: %d\n", config.keepalive);
         printf("\n");
@@ -458,6 +509,53 @@ static void showLatencyReport(void) {
     }
 }
 
+static void *execBenchmarkThread(void *ptr) {
+    benchmarkThread *thread = (benchmarkThread *) ptr;
+    aeMain(thread->el);
+    return NULL;
+}
+
+static benchmarkThread *createBenchmarkThread(int index) {
+    benchmarkThread *thread = zmalloc(sizeof(*thread));
+    thread->index = index;
+    thread->el = aeCreateEventLoop(1024*10);
+    aeCreateTimeEvent(thread->el,1,showThroughput,thread,NULL);
+    return thread;
+}
+
+static void initBenchmarkThreads(void) {
+    int i;
+
+    config.threads = zmalloc(config.num_threads*sizeof(benchmarkThread*));
+    for (i = 0; i < config.num_threads; i++)
+        config.threads[i] = createBenchmarkThread(i);
+}
+
+static void startBenchmarkThreads(void) {
+    int i;
+
+    for (i = 0; i < config.num_threads; i++) {
+        benchmarkThread *t = config.threads[i];
+        if (pthread_create(&(t->thread), NULL, execBenchmarkThread, t)) {
+            fprintf(stderr, "FATAL: Failed to start thread %d.\n", i);
+            exit(1);
+        }
+    }
+    for (i = 0; i < config.num_threads; i++)
+        pthread_join(config.threads[i]->thread, NULL);
+}
+
+static void freeBenchmarkThreads(void) {
+    int i;
+
+    for (i = 0; i < config.num_threads; i++) {
+        aeDeleteEventLoop(config.threads[i]->el);
+        zfree(config.threads[i]);
+    }
+    zfree(config.threads);
+    config.threads = NULL;
+}
+
 static void benchmark(char *title, char *cmd, int len) {
     client c;
 
@@ -465,15 +563,55 @@ static void benchmark(char *title, char *cmd, int len) {
     config.requests_issued = 0;
     config.requests_finished = 0;
 
-    c = createClient(cmd,len,NULL);
+    if (config.num_threads) initBenchmarkThreads();
+
+    c = createClient(cmd,len,NULL,config.num_threads ? 0 : -1);
     createMissingClients(c);
 
     config.start = mstime();
-    aeMain(config.el);
+    if (!config.num_threads) aeMain(config.el);
+    else startBenchmarkThreads();
     config.totlatency = mstime()-config.start;
 
     showLatencyReport();
     freeAllClients();
+    if (config.num_threads) freeBenchmarkThreads();
+}
+
+/* Open a connection subscribed to 'count' patterns, used to benchmark
+ * PUBLISH when there are many pattern subscriptions. The patterns never
+ * match the channels used by the benchmark, so the connection will not
+ * receive any message. Returns NULL on error. */
+static redisContext *createPatternSubscriber(int count) {
+    redisContext *ctx;
+    redisReply *reply;
+    int j, k, batch;
+
+    if (config.hostsocket == NULL)
+        ctx = redisConnect(config.hostip,config.hostport);
+    else
+        ctx = redisConnectUnix(config.hostsocket);
+    if (ctx->err) goto err;
+    if (config.auth) {
+        reply = redisCommand(ctx,"AUTH %s",config.auth);
+        if (reply == NULL) goto err;
+        freeReplyObject(reply);
+    }
+    for (j = 0; j < count; j += batch) {
+        batch = count-j < 1000 ? count-j : 1000;
+        for (k = 0; k < batch; k++)
+            redisAppendCommand(ctx,"PSUBSCRIBE pattern:%d:*",j+k);
+        for (k = 0; k < batch; k++) {
+            if (redisGetReply(ctx,(void**)&reply) != REDIS_OK) goto err;
+            freeReplyObject(reply);
+        }
+    }
+    return ctx;
+
+err:
+    fprintf(stderr,"Error subscribing to patterns: %s\n",ctx->errstr);
+    redisFree(ctx);
+    return NULL;
 }
 
 /* Returns number of consumed options. */
@@ -542,6 +680,18 @@ int parseOptions(int argc, const char **argv) {
             config.tests = sdscat(config.tests,(char*)argv[++i]);
             config.tests = sdscat(config.tests,",");
             sdstolower(config.tests);
+        } else if (!strcmp(argv[i],"--threads")) {
+            if (lastarg) goto invalid;
+            config.num_threads = atoi(argv[++i]);
+            if (config.num_threads > MAX_THREADS) {
+                printf("WARNING: too many threads, limiting threads to %d.\n",
+                       MAX_THREADS);
+                config.num_threads = MAX_THREADS;
+            } else if (config.num_threads < 0) config.num_threads = 0;
+        } else if (!strcmp(argv[i],"--patterns")) {
+            if (lastarg) goto invalid;
+            config.patterns = atoi(argv[++i]);
+            if (config.patterns < 0) config.patterns = 0;
         } else if (!strcmp(argv[i],"--dbnum")) {
             if (lastarg) goto invalid;
             config.dbnum = atoi(argv[++i]);
@@ -589,7 +739,12 @@ usage:
 " -l                 Loop. Run the tests forever\n"
 " -t <tests>         Only run the comma separated list of tests. The test\n"
 "                    names are the same as the ones produced as output.\n"
-" -I                 Idle mode. Just open N idle connections and wait.\n\n"
+" -I                 Idle mode. Just open N idle connections and wait.\n"
+" --threads <num>    Enable multi-thread mode: the clients are served by\n"
+"                    <num> threads, each one running its own event loop.\n"
+"                    Use it to saturate a server running with io-threads.\n"
+" --patterns <num>   Number of patterns subscribed by an extra connection\n"
+"                    during the PUBLISH test (default 0).\n\n"
 "Examples:\n\n"
 " Run the benchmark with the default configuration against 127.0.0.1:6379:\n"
 "   $ redis-benchmark\n\n"
@@ -601,6 +756,11 @@ usage:
 "   $ redis-benchmark -t ping,set,get -n 100000 --csv\n\n"
 " Benchmark a specific command line:\n"
 "   $ redis-benchmark -r 10000 -n 10000 eval 'return redis.call(\"ping\")' 0\n\n"
+" Measure how throughput scales with the server io-threads setting, using\n"
+" enough benchmark threads and clients to keep the server busy:\n"
+"   $ redis-benchmark -t get,set -n 1000000 -c 200 --threads 8 -q\n\n"
+" Measure the cost of PUBLISH with 50000 pattern subscriptions:\n"
+"   $ redis-benchmark -t publish --patterns 50000 -r 100000\n\n"
 " Fill a list with 10000 random elements:\n"
 "   $ redis-benchmark -r 10000 -n 10000 lpush mylist __rand_int__\n\n"
 " On user specified command lines __rand_int__ is replaced with a random integer\n"
@@ -610,14 +770,22 @@ usage:
 }
 
 int showThroughput(struct aeEventLoop *eventLoop, long long id, void *clientData) {
-    UNUSED(eventLoop);
+    benchmarkThread *thread = (benchmarkThread *)clientData;
+    int liveclients, requests_finished;
     UNUSED(id);
-    UNUSED(clientData);
 
-    if (config.liveclients == 0) {
+    atomicGet(config.liveclients,liveclients);
+    atomicGet(config.requests_finished,requests_finished);
+    if (liveclients == 0 && requests_finished < config.requests) {
         fprintf(stderr,"All clients disconnected... aborting.\n");
         exit(1);
     }
+    if (config.num_threads && requests_finished >= config.requests) {
+        aeStop(eventLoop);
+        return AE_NOMORE;
+    }
+    /* Only the first thread reports the throughput. */
+    if (thread && thread->index != 0) return 250;
     if (config.csv) return 250;
     if (config.idlemode == 1) {
         printf("clients: %d\r", config.liveclients);
@@ -625,7 +793,7 @@ int showThroughput(struct aeEventLoop *eventLoop, long long id, void *clientData
 	return 250;
     }
     float dt = (float)(mstime()-config.start)/1000.0;
-    float rps = (float)config.requests_finished/dt;
+    float rps = (float)requests_finished/dt;
     printf("%s: %.2f\r", config.title, rps);
     fflush(stdout);
     return 250; /* every 250ms */
@@ -679,6 +847,10 @@ int main(int argc, const char **argv) {
     config.tests = NULL;
     config.dbnum = 0;
     config.auth = NULL;
+    config.patterns = 0;
+    config.num_threads = 0;
+    config.threads = NULL;
+    pthread_mutex_init(&config.clients_mutex,NULL);
 
     i = parseOptions(argc,argv);
     argc -= i;
@@ -691,8 +863,10 @@ int main(int argc, const char **argv) {
     }
 
     if (config.idlemode) {
+        /* Idle mode only opens the connections: no need for threads. */
+        config.num_threads = 0;
         printf("Creating %d idle connections and waiting forever (Ctrl+C when done)\n", config.numclients);
-        c = createClient("",0,NULL); /* will never receive a reply */
+        c = createClient("",0,NULL,-1); /* will never receive a reply */
         createMissingClients(c);
         aeMain(config.el);
         /* and will wait for every */
@@ -839,6 +1013,22 @@ int main(int argc, const char **argv) {
             free(cmd);
         }
 
+        if (test_is_selected("publish")) {
+            redisContext *subscriber = NULL;
+            sds title;
+
+            if (config.patterns)
+                subscriber = createPatternSubscriber(config.patterns);
+            title = sdscatprintf(sdsempty(),"PUBLISH (%d patterns)",
+                subscriber ? config.patterns : 0);
+            len = redisFormatCommand(&cmd,"PUBLISH channel:__rand_int__ %s",
+                data);
+            benchmark(title,cmd,len);
+            free(cmd);
+            sdsfree(title);
+            if (subscriber) redisFree(subscriber);
+        }
+
         if (!config.csv) printf("\n");
     } while(config.loop);
 
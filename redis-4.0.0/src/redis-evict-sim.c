@@ -0,0 +1,485 @@
+/*
+ * Copyright (c) 2017, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* redis-evict-sim replays a trace of key accesses against the keyspace of
+ * this process, without any client or network involved, using the real
+ * eviction and expiration code: freeMemoryIfNeeded(), the eviction pool, the
+ * LRU clock and LFU counters, and the active expire cycle. The clocks used
+ * by those algorithms follow the time of the trace, so hours of traffic can
+ * be replayed in seconds, and the same trace can be used to compare the
+ * maxmemory policies and tune maxmemory-samples, lfu-log-factor and
+ * lfu-decay-time.
+ *
+ * The trace is a text file with a request per line:
+ *
+ *   <time> GET <key> <size> [<ttl>]
+ *   <time> SET <key> <size> [<ttl>]
+ *   <time> DEL <key>
+ *
+ * Times and TTLs are in milliseconds, sizes are value lengths in bytes.
+ * A GET is a cache read: on a miss the key is created, as the next request
+ * of a client using Redis as a cache would do. Empty lines and lines
+ * starting with '#' are skipped.
+ *
+ * Every policy is replayed in a child process, so that each one starts from
+ * an empty dataset and the same memory state. The differences with a real
+ * server are that the active expire cycle does not have a time limit, since
+ * CPU time is not simulated, and that the part of eviction continued in
+ * background once maxmemory-eviction-time-limit is reached is performed
+ * before the next request instead of by a timer. */
+
+#include "server.h"
+#include "bio.h"
+#include "atomicvar.h"
+
+#include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+void createSharedObjects(void);
+
+typedef struct evictSimRequest {
+    long long time;         /* Milliseconds. */
+    char *op;               /* GET, SET or DEL, not null terminated. */
+    size_t oplen;
+    char *key;              /* Key name, not null terminated. */
+    size_t keylen;
+    long long size;         /* Value length. */
+    long long ttl;          /* Milliseconds, -1 if none. */
+} evictSimRequest;
+
+typedef struct evictSimStats {
+    long long requests, reads, hits, rejected;
+    long long evicted, expired;
+    long long eviction_us, expire_us;
+    size_t peak_memory;
+} evictSimStats;
+
+/* The trace is mapped in memory, so that it is not accounted by zmalloc as
+ * used memory: maxmemory limits only the dataset. */
+static char *trace;
+static size_t trace_len;
+static long long trace_requests, trace_start, trace_end;
+
+/* Parse the line starting at *p, and advance *p to the next line.
+ * Return 1 if a request was parsed, 0 for empty lines and comments, -1 on
+ * syntax errors. */
+static int evictSimParseLine(char **p, char *end, evictSimRequest *req) {
+    char *line = *p, *eol, *tok[5];
+    size_t toklen[5];
+    int argc = 0;
+
+    eol = memchr(line,'\n',end-line);
+    if (eol == NULL) eol = end;
+    *p = (eol == end) ? end : eol+1;
+
+    while (line < eol) {
+        while (line < eol && isspace(*line)) line++;
+        if (line == eol) break;
+        if (argc == 0 && *line == '#') return 0;
+        if (argc == 5) return -1;
+        tok[argc] = line;
+        while (line < eol && !isspace(*line)) line++;
+        toklen[argc] = line-tok[argc];
+        argc++;
+    }
+    if (argc == 0) return 0;
+    if (argc < 3) return -1;
+
+    req->op = tok[1];
+    req->oplen = toklen[1];
+    req->key = tok[2];
+    req->keylen = toklen[2];
+    req->size = 0;
+    req->ttl = -1;
+    if (!string2ll(tok[0],toklen[0],&req->time)) return -1;
+    if (toklen[1] == 3 && !strncasecmp(tok[1],"del",3)) {
+        return (argc == 3) ? 1 : -1;
+    } else if (toklen[1] != 3 || (strncasecmp(tok[1],"get",3) &&
+                                  strncasecmp(tok[1],"set",3))) {
+        return -1;
+    }
+    if (argc < 4) return -1;
+    if (!string2ll(tok[3],toklen[3],&req->size) || req->size < 0) return -1;
+    if (argc == 5 &&
+        (!string2ll(tok[4],toklen[4],&req->ttl) || req->ttl <= 0)) return -1;
+    return 1;
+}
+
+/* Load the trace file and validate it, computing the number of requests
+ * and the time range. Exit on errors. */
+static void evictSimLoadTrace(char *filename) {
+    FILE *fp = fopen(filename,"r");
+    struct stat sb;
+    evictSimRequest req;
+    char *p, *end;
+    long long line = 0;
+
+    if (fp == NULL || fstat(fileno(fp),&sb) == -1) {
+        fprintf(stderr,"Can't open the trace file %s: %s\n",
+            filename, strerror(errno));
+        exit(1);
+    }
+    trace_len = sb.st_size;
+    if (trace_len) {
+        trace = mmap(NULL,trace_len,PROT_READ,MAP_PRIVATE,fileno(fp),0);
+        if (trace == MAP_FAILED) {
+            fprintf(stderr,"Can't map the trace file %s: %s\n",
+                filename, strerror(errno));
+            exit(1);
+        }
+    }
+    fclose(fp);
+
+    p = trace;
+    end = trace+trace_len;
+    while (p < end) {
+        int retval = evictSimParseLine(&p,end,&req);
+
+        line++;
+        if (retval == -1) {
+            fprintf(stderr,"Invalid request at line %lld of the trace\n",line);
+            exit(1);
+        }
+        if (retval == 0) continue;
+        if (trace_requests == 0) trace_start = req.time;
+        if (trace_requests && req.time < trace_end) {
+            fprintf(stderr,"Time going backward at line %lld of the trace\n",
+                line);
+            exit(1);
+        }
+        trace_end = req.time;
+        trace_requests++;
+    }
+    if (trace_requests == 0) {
+        fprintf(stderr,"The trace file %s has no requests\n", filename);
+        exit(1);
+    }
+}
+
+/* Initialize the part of the server state used by the keyspace and by the
+ * eviction and expiration code: see initServer(). */
+static void evictSimInitServer(void) {
+    int j;
+
+    server.pid = getpid();
+    server.clients = listCreate();
+    server.slaves = listCreate();
+    server.monitors = listCreate();
+    server.clients_paused = 0;
+    server.system_memory_size = zmalloc_get_memory_size();
+    createSharedObjects();
+    server.db = zmalloc(sizeof(redisDb)*server.dbnum);
+    for (j = 0; j < server.dbnum; j++) {
+        server.db[j].dict = dictCreate(&dbDictType,NULL);
+        server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
+        server.db[j].ready_keys = dictCreate(&objectKeyPointerValueDictType,NULL);
+        server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
+        server.db[j].expires_index =
+            server.active_expire_index ? raxNew() : NULL;
+        server.db[j].id = j;
+        server.db[j].avg_ttl = 0;
+        server.db[j].expired_until = LLONG_MIN;
+        server.db[j].expired_backlog = 0;
+    }
+    evictionPoolAlloc();
+    server.pubsub_channels = dictCreate(&keylistDictType,NULL);
+    server.pubsub_patterns = raxNew();
+    server.pubsub_patterns_num = 0;
+    server.rdb_child_pid = -1;
+    server.aof_child_pid = -1;
+    server.aof_state = AOF_OFF;
+    server.cluster_enabled = 0;
+    server.el = NULL; /* The eviction debt is paid by evictSimReplay(). */
+    resetServerStats();
+    bioInit();
+}
+
+/* Set the cached clocks used by the LRU and LFU algorithms to the time of
+ * the trace. */
+static void evictSimSetTime(long long ms) {
+    server.mstime = ms;
+    server.unixtime = ms/1000;
+    atomicSet(server.lruclock,(ms/LRU_CLOCK_RESOLUTION) & LRU_CLOCK_MAX);
+}
+
+/* Run the active expire cycle in all the DBs, like serverCron() does,
+ * with the time of the trace. */
+static void evictSimActiveExpire(long long now, evictSimStats *stats) {
+    long long start = ustime();
+    int j, expired;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+
+        do {
+            if (dictMarkedSize(db->dict) == 0) break;
+            expired = activeExpireCycleTryExpireSome(db,now);
+        } while (activeExpireCycleShouldRepeat(db,expired));
+    }
+    stats->expire_us += ustime()-start;
+}
+
+/* Free memory before a request, like processCommand() does. */
+static int evictSimFreeMemory(evictSimStats *stats) {
+    long long start;
+    int retval;
+
+    if (!server.maxmemory) return C_OK;
+    start = ustime();
+    retval = freeMemoryIfNeeded();
+    stats->eviction_us += ustime()-start;
+    return retval;
+}
+
+/* Lazily expire the key if it is expired at the time of the trace, since
+ * expireIfNeeded() uses the real time. */
+static void evictSimExpireIfNeeded(redisDb *db, robj *key, long long now) {
+    long long when = getExpire(db,key);
+
+    if (when < 0 || now <= when) return;
+    server.stat_expiredkeys++;
+    if (server.lazyfree_lazy_expire)
+        dbAsyncDelete(db,key);
+    else
+        dbSyncDelete(db,key);
+}
+
+/* Write the key with a value of the specified size, unless the write is
+ * refused because of maxmemory. */
+static void evictSimWrite(redisDb *db, robj *key, evictSimRequest *req,
+                          int oom, evictSimStats *stats)
+{
+    if (oom) {
+        stats->rejected++;
+        return;
+    }
+    robj *val = createStringObject(NULL,req->size);
+    setKey(db,key,val);
+    decrRefCount(val);
+    if (req->ttl != -1) setExpire(NULL,db,key,req->time+req->ttl);
+}
+
+static void evictSimReportInterval(const char *policy, long long now,
+                                   long long reads, long long hits,
+                                   evictSimStats *stats)
+{
+    long long keys = 0;
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) keys += dictSize(server.db[j].dict);
+    printf("%-16s %12lld %10lld %7.2f%% %12zu %10lld %10lld %10lld %10lld\n",
+        policy, now-trace_start, stats->requests,
+        reads ? (double)hits*100/reads : 0, zmalloc_used_memory(), keys,
+        server.stat_evictedkeys, server.stat_expiredkeys, stats->eviction_us);
+}
+
+/* Replay the whole trace with the current configuration. A time series
+ * is printed every 'interval' milliseconds of the trace, if not zero. */
+static void evictSimReplay(long long interval, evictSimStats *stats) {
+    const char *policy = evictPolicyToString();
+    redisDb *db = server.db;
+    char *p = trace, *end = trace+trace_len;
+    long long cron_period = 1000/server.hz;
+    long long next_cron = trace_start, next_report = trace_start+interval;
+    long long reads = 0, hits = 0;
+    evictSimRequest req;
+    int oom;
+
+    while (p < end) {
+        if (evictSimParseLine(&p,end,&req) != 1) continue;
+
+        evictSimSetTime(req.time);
+        while (next_cron <= req.time) {
+            evictSimActiveExpire(next_cron,stats);
+            next_cron += cron_period;
+        }
+        while (interval && next_report <= req.time) {
+            evictSimReportInterval(policy,next_report,reads,hits,stats);
+            reads = hits = 0;
+            next_report += interval;
+        }
+
+        /* Pay the eviction debt as the time event of the server would do
+         * between two requests, then free memory like processCommand(). */
+        if (server.eviction_debt) evictSimFreeMemory(stats);
+        oom = evictSimFreeMemory(stats) == C_ERR;
+
+        robj *key = createStringObject(req.key,req.keylen);
+        evictSimExpireIfNeeded(db,key,req.time);
+        if (!strncasecmp(req.op,"get",3)) {
+            stats->reads++;
+            reads++;
+            if (lookupKey(db,key,LOOKUP_NONE)) {
+                stats->hits++;
+                hits++;
+            } else {
+                evictSimWrite(db,key,&req,oom,stats);
+            }
+        } else if (!strncasecmp(req.op,"set",3)) {
+            evictSimWrite(db,key,&req,oom,stats);
+        } else {
+            dbDelete(db,key);
+        }
+        decrRefCount(key);
+
+        stats->requests++;
+        if (zmalloc_used_memory() > stats->peak_memory)
+            stats->peak_memory = zmalloc_used_memory();
+    }
+    if (interval)
+        evictSimReportInterval(policy,trace_end,reads,hits,stats);
+    stats->evicted = server.stat_evictedkeys;
+    stats->expired = server.stat_expiredkeys;
+}
+
+static void evictSimUsage(char *progname) {
+    fprintf(stderr,
+"Usage: %s <trace-file> [options] [--<config-option> <value> ...]\n"
+"\n"
+"  --policy <name>    Replay only the specified maxmemory policy, instead\n"
+"                     of all of them. Can be used multiple times.\n"
+"  --interval <ms>    Print the state every <ms> milliseconds of the trace\n"
+"                     (default: 10 samples in the trace, 0 to disable).\n"
+"  --seed <n>         Seed of the random sampling (default: 0).\n"
+"\n"
+"The other options are configuration directives, like for redis-server:\n"
+"\n"
+"  %s trace.txt --maxmemory 100mb --maxmemory-samples 10\n",
+    progname, progname);
+    exit(1);
+}
+
+int redis_evict_sim_main(int argc, char **argv) {
+    const char *policies[32];
+    int numpolicies = 0, j;
+    long long interval = -1, seed = 0;
+    evictSimStats *results;
+    sds options = sdsempty();
+
+    if (argc < 2 || argv[1][0] == '-') evictSimUsage(argv[0]);
+    for (j = 2; j < argc; j++) {
+        int lastarg = (j == argc-1);
+
+        if (!strcmp(argv[j],"--policy") && !lastarg) {
+            if (numpolicies == 32) evictSimUsage(argv[0]);
+            policies[numpolicies++] = argv[++j];
+        } else if (!strcmp(argv[j],"--interval") && !lastarg) {
+            interval = strtoll(argv[++j],NULL,10);
+        } else if (!strcmp(argv[j],"--seed") && !lastarg) {
+            seed = strtoll(argv[++j],NULL,10);
+        } else if (argv[j][0] == '-' && argv[j][1] == '-' && !lastarg) {
+            /* A configuration directive and its arguments, up to the next
+             * option starting with "--". */
+            options = sdscatfmt(options,"\n%s",argv[j]+2);
+            while (j+1 < argc && strncmp(argv[j+1],"--",2)) {
+                options = sdscatlen(options," ",1);
+                options = sdscatrepr(options,argv[j+1],strlen(argv[j+1]));
+                j++;
+            }
+        } else {
+            evictSimUsage(argv[0]);
+        }
+    }
+    loadServerConfigFromString(options);
+    sdsfree(options);
+    if (numpolicies == 0) {
+        while (evictPolicyGetName(numpolicies) != NULL) {
+            policies[numpolicies] = evictPolicyGetName(numpolicies);
+            numpolicies++;
+        }
+    }
+
+    evictSimLoadTrace(argv[1]);
+    if (interval == -1) interval = (trace_end-trace_start+9)/10;
+    if (interval <= 0) interval = 0;
+
+    /* The results are written by the children in shared memory. */
+    results = mmap(NULL,sizeof(evictSimStats)*numpolicies,
+                   PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+    if (results == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    memset(results,0,sizeof(evictSimStats)*numpolicies);
+
+    printf("Replaying %lld requests in %lld ms of trace, maxmemory %llu\n",
+        trace_requests, trace_end-trace_start, server.maxmemory);
+    if (interval) {
+        printf("\n%-16s %12s %10s %8s %12s %10s %10s %10s %10s\n",
+            "policy", "time_ms", "requests", "hit%", "used_memory", "keys",
+            "evicted", "expired", "evict_us");
+    }
+    for (j = 0; j < numpolicies; j++) {
+        sds config = sdscatfmt(sdsempty(),"maxmemory-policy %s",policies[j]);
+        int status;
+        pid_t pid;
+
+        fflush(stdout);
+        if ((pid = fork()) == -1) {
+            perror("fork");
+            exit(1);
+        } else if (pid == 0) {
+            uint8_t hashseed[16] = {0};
+
+            /* The same seeds make the sampling reproducible. */
+            memcpy(hashseed,&seed,sizeof(seed));
+            dictSetHashFunctionSeed(hashseed);
+            srand(seed);
+            srandom(seed);
+            loadServerConfigFromString(config);
+            evictSimInitServer();
+            evictSimReplay(interval,results+j);
+            exit(0);
+        }
+        sdsfree(config);
+        if (waitpid(pid,&status,0) == -1 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0)
+        {
+            fprintf(stderr,"Replay of the %s policy failed\n", policies[j]);
+            exit(1);
+        }
+    }
+
+    printf("\n%-16s %8s %10s %10s %12s %8s %10s %12s %10s %12s\n",
+        "policy", "hit%", "reads", "evicted", "evict_us", "us/key",
+        "expired", "expire_us", "rejected", "peak_memory");
+    for (j = 0; j < numpolicies; j++) {
+        evictSimStats *s = results+j;
+
+        printf("%-16s %7.2f%% %10lld %10lld %12lld %8.2f %10lld %12lld "
+               "%10lld %12zu\n",
+            policies[j], s->reads ? (double)s->hits*100/s->reads : 0,
+            s->reads, s->evicted, s->eviction_us,
+            s->evicted ? (double)s->eviction_us/s->evicted : 0,
+            s->expired, s->expire_us, s->rejected, s->peak_memory);
+    }
+    exit(0);
+}
@@ -0,0 +1,328 @@
+/* Disk tier of the replication backlog.
+ *
+ * With repl-backlog-disk-size set, the blocks released from the head of
+ * the in memory backlog (see incrementalTrimReplicationBacklog()) are not
+ * freed, but appended to a list of segment files in the working directory.
+ * The writes are performed by a bio.c thread, that also frees the blocks.
+ * The segments are contiguous with the in memory backlog, so together they
+ * cover the replication stream from the first byte of the oldest segment to
+ * the current offset, and a slave asking for an offset that is no longer
+ * in memory can still continue with a partial resynchronization.
+ *
+ * A new segment is started when the current one reaches 1/8 of the disk
+ * size, and the oldest segments are deleted when the total is over the
+ * configured size, unless a slave is still reading them.
+ *
+ * A slave served from disk has 'repl_disk_offset' set to the next offset
+ * to send: the data is read from the segments when writing to its socket,
+ * and once the slave reaches the first byte of the in memory backlog it
+ * starts sending the shared replication buffer as usual. Meanwhile it is
+ * not fed with the new data, which only goes to the replication buffer.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2017, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "bio.h"
+#include "atomicvar.h"
+
+#include <fcntl.h>
+
+#define BACKLOG_DISK_SEGMENTS 8  /* Segment size is the disk size / this. */
+
+/* Operations of the BIO_REPL_BACKLOG_WRITE jobs. */
+#define BACKLOG_OP_WRITE 0
+#define BACKLOG_OP_CLOSE 1
+
+/* A segment file, shared with the bio thread. The main thread only reads
+ * 'err' and 'written', and once it submits the close job the structure
+ * belongs to the bio thread, that releases it. */
+typedef struct backlogFile {
+    int fd;
+    int err;            /* errno of the first failed write, or 0. */
+    size_t written;     /* Bytes written to the file so far. */
+} backlogFile;
+
+typedef struct backlogSegment {
+    backlogFile *file;
+    sds filename;
+    long long offset;   /* Replication offset of the first byte. */
+    long long size;     /* Bytes submitted to the bio thread. */
+} backlogSegment;
+
+static struct {
+    list *segments;     /* Oldest first. */
+    long long size;     /* Total bytes of the segments. */
+    long long id;       /* Incremental segment number. */
+} disk;
+
+/* Process a BIO_REPL_BACKLOG_WRITE job. Called by the bio thread. */
+void replBacklogDiskProcessJobFromBioThread(void *file, void *block, int op) {
+    backlogFile *f = file;
+
+    if (op == BACKLOG_OP_WRITE) {
+        replBufBlock *o = block;
+        size_t nwritten = 0;
+        int err;
+
+        atomicGet(f->err,err);
+        while(!err && nwritten < o->used) {
+            ssize_t n = write(f->fd,o->buf+nwritten,o->used-nwritten);
+
+            if (n == -1) {
+                if (errno == EINTR) continue;
+                err = errno;
+                atomicSet(f->err,err);
+            } else {
+                nwritten += n;
+            }
+        }
+        atomicIncr(f->written,nwritten);
+        zfree(o);
+    } else {
+        close(f->fd);
+        zfree(f);
+    }
+}
+
+/* Delete the oldest segment. */
+static void backlogDiskDropFirst(void) {
+    listNode *ln = listFirst(disk.segments);
+    backlogSegment *seg = listNodeValue(ln);
+
+    unlink(seg->filename);
+    bioCreateBackgroundJob(BIO_REPL_BACKLOG_WRITE,seg->file,NULL,
+                           (void*)(long)BACKLOG_OP_CLOSE);
+    disk.size -= seg->size;
+    sdsfree(seg->filename);
+    zfree(seg);
+    listDelNode(disk.segments,ln);
+}
+
+/* Return the replication offset following the last byte on disk. */
+static long long backlogDiskEnd(void) {
+    backlogSegment *seg = listNodeValue(listLast(disk.segments));
+    return seg->offset+seg->size;
+}
+
+/* Delete all the segments. The slaves that were reading them are closed:
+ * until they are actually freed, reading from disk fails for them, and
+ * since 'repl_disk_offset' is still set they are not fed with the new
+ * data either. */
+void replBacklogDiskReset(void) {
+    listNode *ln;
+    listIter li;
+
+    if (disk.segments == NULL || listLength(disk.segments) == 0) return;
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+
+        if (slave->repl_disk_offset) freeClientAsync(slave);
+    }
+    while(listLength(disk.segments)) backlogDiskDropFirst();
+}
+
+/* Delete the oldest segments while the disk tier is bigger than
+ * repl-backlog-disk-size, unless a slave still needs them. If the slaves
+ * reading from disk hold more than twice the configured size, the ones
+ * reading the oldest segment are closed. */
+static void backlogDiskTrim(void) {
+    while(listLength(disk.segments) > 1) {
+        backlogSegment *seg = listNodeValue(listFirst(disk.segments));
+        long long end = seg->offset+seg->size;
+        int pinned = 0;
+        listNode *ln;
+        listIter li;
+
+        if (disk.size - seg->size < server.repl_backlog_disk_size) break;
+        listRewind(server.slaves,&li);
+        while((ln = listNext(&li))) {
+            client *slave = ln->value;
+
+            if (slave->repl_disk_offset == 0 ||
+                slave->repl_disk_offset >= end ||
+                slave->flags & CLIENT_CLOSE_ASAP) continue;
+            if (disk.size <= server.repl_backlog_disk_size*2) {
+                pinned = 1;
+                break;
+            }
+            serverLog(LL_WARNING,"Closing slave %s, too slow reading the "
+                "replication backlog from disk",
+                replicationGetSlaveName(slave));
+            freeClientAsync(slave);
+        }
+        if (pinned) break;
+        backlogDiskDropFirst();
+    }
+}
+
+/* Append a block released from the head of the in memory backlog to the
+ * disk tier. The block is owned by this function from now on. */
+void replBacklogDiskAppend(replBufBlock *o) {
+    backlogSegment *seg = NULL;
+    int err = 0;
+
+    if (server.repl_backlog_disk_size == 0) {
+        zfree(o);
+        return;
+    }
+    if (disk.segments == NULL) disk.segments = listCreate();
+
+    /* The disk tier must be contiguous with the memory: restart it after
+     * a write error, or if the stream was restarted meanwhile. */
+    if (listLength(disk.segments)) {
+        seg = listNodeValue(listLast(disk.segments));
+        atomicGet(seg->file->err,err);
+        if (err) {
+            serverLog(LL_WARNING,"Error writing the replication backlog to "
+                "%s: %s", seg->filename, strerror(err));
+        }
+        if (err || backlogDiskEnd() != o->repl_offset) {
+            replBacklogDiskReset();
+            seg = NULL;
+        }
+    }
+
+    /* Start a new segment when the current one is full. */
+    if (seg == NULL || seg->size >= server.repl_backlog_disk_size /
+                                    BACKLOG_DISK_SEGMENTS)
+    {
+        sds filename = sdscatprintf(sdsempty(),"repl-backlog-%d-%lld.seg",
+            (int) getpid(), disk.id);
+        int fd = open(filename,O_RDWR|O_CREAT|O_TRUNC,0644);
+
+        if (fd == -1) {
+            serverLog(LL_WARNING,"Can't create the replication backlog "
+                "segment %s: %s", filename, strerror(errno));
+            sdsfree(filename);
+            replBacklogDiskReset();
+            zfree(o);
+            return;
+        }
+        seg = zmalloc(sizeof(*seg));
+        seg->file = zmalloc(sizeof(backlogFile));
+        seg->file->fd = fd;
+        seg->file->err = 0;
+        seg->file->written = 0;
+        seg->filename = filename;
+        seg->offset = o->repl_offset;
+        seg->size = 0;
+        listAddNodeTail(disk.segments,seg);
+        disk.id++;
+    }
+
+    seg->size += o->used;
+    disk.size += o->used;
+    bioCreateBackgroundJob(BIO_REPL_BACKLOG_WRITE,seg->file,o,
+                           (void*)(long)BACKLOG_OP_WRITE);
+    backlogDiskTrim();
+}
+
+/* Called when repl-backlog-disk-size is modified at runtime. */
+void replBacklogDiskResize(void) {
+    if (disk.segments == NULL) return;
+    if (server.repl_backlog_disk_size == 0)
+        replBacklogDiskReset();
+    else
+        backlogDiskTrim();
+}
+
+/* Return true if the byte at 'offset' of the replication stream is in the
+ * disk tier. The in memory backlog starts right after the last byte. */
+int replBacklogDiskHasOffset(long long offset) {
+    backlogSegment *seg;
+
+    if (disk.segments == NULL || listLength(disk.segments) == 0) return 0;
+    seg = listNodeValue(listFirst(disk.segments));
+    return offset >= seg->offset && offset < backlogDiskEnd();
+}
+
+/* Return the offset of the first byte on disk, or 0 if there is none. */
+long long replBacklogDiskFirstOffset(void) {
+    if (disk.segments == NULL || listLength(disk.segments) == 0) return 0;
+    return ((backlogSegment*)listNodeValue(listFirst(disk.segments)))->offset;
+}
+
+/* Return the number of bytes on disk. */
+long long replBacklogDiskHistlen(void) {
+    return disk.segments ? disk.size : 0;
+}
+
+/* Read up to 'len' bytes of the replication stream at 'offset' from the
+ * disk tier. A read never spans two segments. If the data was not written
+ * yet by the bio thread, wait for it. Returns the number of bytes read, or
+ * -1 on error, with errno set to ENOENT if the data was deleted. */
+ssize_t replBacklogDiskRead(long long offset, void *buf, size_t len) {
+    backlogSegment *seg = NULL;
+    size_t written, pos;
+    listNode *ln;
+    listIter li;
+    int err;
+
+    if (!replBacklogDiskHasOffset(offset)) {
+        errno = ENOENT;
+        return -1;
+    }
+    listRewind(disk.segments,&li);
+    while((ln = listNext(&li))) {
+        seg = listNodeValue(ln);
+        if (offset < seg->offset+seg->size) break;
+    }
+
+    pos = offset - seg->offset;
+    if (len > (size_t)seg->size - pos) len = seg->size - pos;
+    while(1) {
+        atomicGet(seg->file->err,err);
+        if (err) {
+            errno = err;
+            return -1;
+        }
+        atomicGet(seg->file->written,written);
+        if (written > pos) break;
+        bioWaitStepOfType(BIO_REPL_BACKLOG_WRITE);
+    }
+    if (len > written - pos) len = written - pos;
+    return pread(seg->file->fd,buf,len,pos);
+}
+
+/* Move the slave forward of 'len' bytes sent from disk. Once it reaches the
+ * in memory backlog, it continues from the shared replication buffer. */
+void replBacklogDiskAdvance(client *c, size_t len) {
+    replBacklog *bl = server.repl_backlog;
+
+    c->repl_disk_offset += len;
+    if (c->repl_disk_offset < bl->offset) return;
+    serverAssert(c->repl_disk_offset == bl->offset);
+    c->repl_disk_offset = 0;
+    c->ref_repl_buf_node = bl->ref_repl_buf_node;
+    c->ref_block_pos = 0;
+    ((replBufBlock*)listNodeValue(c->ref_repl_buf_node))->refcount++;
+}
@@ -0,0 +1,230 @@
+/* Compression of the replication stream.
+ *
+ * Slaves announcing the "lzf" capability (see repl-compression) receive
+ * everything the master sends after the reply to PSYNC compressed: the
+ * RDB payload of a full sync as well as the stream of commands. The data
+ * is split in frames of at most REPL_COMP_FRAME_LEN bytes, compressed with
+ * LZF using as dictionary the last REPL_COMP_WINDOW bytes of the previous
+ * frames, so that small commands repeating the same key prefixes and values
+ * compress well even if every write to the socket is small.
+ *
+ * Every frame has a header of REPL_COMP_HDR_LEN bytes:
+ *
+ * <flags> <uncompressed length, 2 bytes> <payload length, 2 bytes>
+ *
+ * The lengths are big endian. If REPL_COMP_FLAG_LZF is set the payload
+ * is LZF compressed, otherwise it is the data itself, used when the data
+ * does not compress. REPL_COMP_FLAG_RESET tells the receiver to forget the
+ * dictionary: it is set in the first frame produced by every compressor,
+ * since different compressors (the diskless sync child, then the master
+ * itself) may serve the same connection.
+ *
+ * Offsets in the replication stream always refer to the uncompressed data,
+ * so PSYNC works as usual.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2017, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "lzf.h"
+
+#define REPL_COMP_WINDOW (1024*8)     /* LZF can't reference older data. */
+#define REPL_COMP_FRAME_LEN (1024*16) /* Max uncompressed bytes per frame. */
+#define REPL_COMP_MIN_LEN 16          /* Smaller frames are not compressed. */
+#define REPL_COMP_HDR_LEN 5
+
+#define REPL_COMP_FLAG_LZF (1<<0)
+#define REPL_COMP_FLAG_RESET (1<<1)
+
+/* The dictionary (the last bytes of the previous frames) is followed by the
+ * data of the current frame, both when compressing and decompressing. */
+struct replCompressor {
+    int reset;          /* Set REPL_COMP_FLAG_RESET in the next frame. */
+    size_t dictlen;
+    unsigned char buf[REPL_COMP_WINDOW+REPL_COMP_FRAME_LEN];
+};
+
+struct replDecompressor {
+    sds in;             /* Received data, not yet a complete frame. */
+    sds out;            /* Decompressed data not yet consumed... */
+    size_t outpos;      /* ... starting at this offset. */
+    size_t dictlen;
+    unsigned char buf[REPL_COMP_WINDOW+REPL_COMP_FRAME_LEN];
+};
+
+/* Keep the last REPL_COMP_WINDOW bytes of the dictionary followed by a
+ * frame of 'len' bytes as the dictionary of the next frame. */
+static size_t replCompSlideDict(unsigned char *buf, size_t dictlen,
+                                size_t len)
+{
+    size_t total = dictlen+len;
+
+    if (total <= REPL_COMP_WINDOW) return total;
+    memmove(buf,buf+total-REPL_COMP_WINDOW,REPL_COMP_WINDOW);
+    return REPL_COMP_WINDOW;
+}
+
+replCompressor *replCompressorCreate(void) {
+    replCompressor *c = zmalloc(sizeof(*c));
+
+    c->reset = 1;
+    c->dictlen = 0;
+    return c;
+}
+
+void replCompressorRelease(replCompressor *c) {
+    zfree(c);
+}
+
+/* Compress 'len' bytes at 'p', appending the frames to 'dst'. The new
+ * sds string is returned. */
+sds replCompress(replCompressor *c, sds dst, const void *p, size_t len) {
+    const unsigned char *s = p;
+
+    server.stat_repl_comp_input_bytes += len;
+    while(len) {
+        size_t flen = len > REPL_COMP_FRAME_LEN ? REPL_COMP_FRAME_LEN : len;
+        size_t dstlen = sdslen(dst);
+        unsigned char *hdr;
+        unsigned int clen = 0;
+
+        dst = sdsMakeRoomFor(dst,REPL_COMP_HDR_LEN+flen);
+        hdr = (unsigned char*)dst+dstlen;
+        memcpy(c->buf+c->dictlen,s,flen);
+        if (flen >= REPL_COMP_MIN_LEN)
+            clen = lzf_compress_dict(c->buf,c->dictlen,flen,
+                                     hdr+REPL_COMP_HDR_LEN,flen-1);
+        hdr[0] = c->reset ? REPL_COMP_FLAG_RESET : 0;
+        if (clen) {
+            hdr[0] |= REPL_COMP_FLAG_LZF;
+        } else {
+            memcpy(hdr+REPL_COMP_HDR_LEN,s,flen);
+            clen = flen;
+        }
+        hdr[1] = flen >> 8;
+        hdr[2] = flen & 0xff;
+        hdr[3] = clen >> 8;
+        hdr[4] = clen & 0xff;
+        sdsIncrLen(dst,REPL_COMP_HDR_LEN+clen);
+        server.stat_repl_comp_output_bytes += REPL_COMP_HDR_LEN+clen;
+
+        c->reset = 0;
+        c->dictlen = replCompSlideDict(c->buf,c->dictlen,flen);
+        s += flen;
+        len -= flen;
+    }
+    return dst;
+}
+
+replDecompressor *replDecompressorCreate(void) {
+    replDecompressor *d = zmalloc(sizeof(*d));
+
+    d->in = sdsempty();
+    d->out = sdsempty();
+    d->outpos = 0;
+    d->dictlen = 0;
+    return d;
+}
+
+void replDecompressorRelease(replDecompressor *d) {
+    if (d == NULL) return;
+    sdsfree(d->in);
+    sdsfree(d->out);
+    zfree(d);
+}
+
+/* Decompress the complete frames received so far. Returns C_ERR if the
+ * data is corrupted. */
+static int replDecompressFrames(replDecompressor *d) {
+    unsigned char *p = (unsigned char*)d->in;
+    size_t left = sdslen(d->in);
+
+    while(left >= REPL_COMP_HDR_LEN) {
+        size_t flen = (p[1] << 8) | p[2], clen = (p[3] << 8) | p[4];
+        int flags = p[0];
+
+        if (left < REPL_COMP_HDR_LEN+clen) break;
+        if (flen == 0 || flen > REPL_COMP_FRAME_LEN) return C_ERR;
+        if (flags & REPL_COMP_FLAG_RESET) d->dictlen = 0;
+        if (flags & REPL_COMP_FLAG_LZF) {
+            if (lzf_decompress_dict(p+REPL_COMP_HDR_LEN,clen,d->buf,
+                                    d->dictlen,flen) != flen) return C_ERR;
+        } else {
+            if (clen != flen) return C_ERR;
+            memcpy(d->buf+d->dictlen,p+REPL_COMP_HDR_LEN,flen);
+        }
+        d->out = sdscatlen(d->out,d->buf+d->dictlen,flen);
+        d->dictlen = replCompSlideDict(d->buf,d->dictlen,flen);
+        p += REPL_COMP_HDR_LEN+clen;
+        left -= REPL_COMP_HDR_LEN+clen;
+    }
+    sdsrange(d->in,sdslen(d->in)-left,-1);
+    return C_OK;
+}
+
+/* Make sure some decompressed data is available, reading from 'fd' if
+ * needed. Returns the number of bytes available, or what read(2) returned
+ * if it failed or the connection was closed. A corrupted stream is
+ * reported as a failure with errno set to EPROTO. */
+ssize_t replDecompressorFill(replDecompressor *d, int fd) {
+    char buf[PROTO_IOBUF_LEN];
+
+    while(sdslen(d->out) == d->outpos) {
+        ssize_t nread = read(fd,buf,sizeof(buf));
+
+        if (nread <= 0) return nread;
+        sdsclear(d->out);
+        d->outpos = 0;
+        d->in = sdscatlen(d->in,buf,nread);
+        if (replDecompressFrames(d) == C_ERR) {
+            errno = EPROTO;
+            return -1;
+        }
+    }
+    return sdslen(d->out)-d->outpos;
+}
+
+/* Like read(2) on the socket 'fd', but returns the decompressed data. */
+ssize_t replDecompressorRead(replDecompressor *d, int fd, void *buf,
+                             size_t len)
+{
+    ssize_t avail = replDecompressorFill(d,fd);
+
+    if (avail <= 0) return avail;
+    if (len > (size_t)avail) len = avail;
+    memcpy(buf,d->out+d->outpos,len);
+    d->outpos += len;
+    return len;
+}
+
+/* Return the number of decompressed bytes not yet consumed. */
+size_t replDecompressorPending(replDecompressor *d) {
+    return sdslen(d->out)-d->outpos;
+}
@@ -74,83 +74,198 @@ char *replicationGetSlaveName(client *c) {
 
 /* ---------------------------------- MASTER -------------------------------- */
 
+/* ------------------------- Replication buffer -----------------------------
+ * The replication stream is appended once to server.repl_buffer_blocks, a
+ * list of replBufBlock structures shared by the backlog and by all the
+ * slaves. The backlog references its first block, and every slave references
+ * the block it is currently sending, together with the position inside it:
+ * so serving N slaves costs the same memory as serving one, and the output
+ * buffer of a slave is just the part of the buffer it did not send yet.
+ *
+ * The blocks are released from the head when the backlog is trimmed to the
+ * configured size, and the backlog is never trimmed past the first block
+ * referenced by a slave: the memory the slowest slave holds is accounted in
+ * its output buffer, and limited by client-output-buffer-limit as usual.
+ * With repl-backlog-disk-size the released blocks are kept on disk instead,
+ * see replbacklog.c.
+ * -------------------------------------------------------------------------- */
+
+/* Max number of blocks released from the head of the replication buffer
+ * at every call of incrementalTrimReplicationBacklog(), to avoid latency
+ * spikes when a lot of memory is released at once. */
+#define REPL_BACKLOG_TRIM_BLOCKS_PER_CALL 64
+
 void createReplicationBacklog(void) {
     serverAssert(server.repl_backlog == NULL);
-    server.repl_backlog = zmalloc(server.repl_backlog_size);
-    server.repl_backlog_histlen = 0;
-    server.repl_backlog_idx = 0;
+    server.repl_backlog = zmalloc(sizeof(replBacklog));
+    server.repl_backlog->ref_repl_buf_node = NULL;
+    server.repl_backlog->histlen = 0;
 
     /* We don't have any data inside our buffer, but virtually the first
      * byte we have is the next byte that will be generated for the
      * replication stream. */
-    server.repl_backlog_off = server.master_repl_offset+1;
+    server.repl_backlog->offset = server.master_repl_offset+1;
+}
+
+/* Release blocks from the head of the replication buffer, up to 'max_blocks'
+ * blocks, while the backlog is bigger than repl-backlog-size. Only blocks
+ * referenced by the backlog alone can be released. */
+static void incrementalTrimReplicationBacklog(int max_blocks) {
+    replBacklog *bl = server.repl_backlog;
+    int trimmed = 0;
+
+    while(bl->histlen > server.repl_backlog_size && trimmed < max_blocks) {
+        listNode *first = listFirst(server.repl_buffer_blocks);
+        listNode *next;
+        replBufBlock *o;
+
+        /* We never trim the backlog to less than one block. */
+        if (listLength(server.repl_buffer_blocks) <= 1) break;
+
+        /* The backlog always starts at the head of the buffer. Stop if a
+         * slave still needs the first block, or if without it the backlog
+         * would be smaller than the configured size. */
+        serverAssert(first == bl->ref_repl_buf_node);
+        o = listNodeValue(first);
+        if (o->refcount != 1) break;
+        if (bl->histlen - (long long)o->used < server.repl_backlog_size) break;
+
+        next = listNextNode(first);
+        ((replBufBlock*)listNodeValue(next))->refcount++;
+        bl->ref_repl_buf_node = next;
+        bl->histlen -= o->used;
+        server.repl_buffer_mem -= zmalloc_size(o)+sizeof(listNode);
+        listNodeValue(first) = NULL; /* The disk tier now owns the block. */
+        listDelNode(server.repl_buffer_blocks,first);
+        replBacklogDiskAppend(o);
+        trimmed++;
+    }
+
+    /* Set the offset of the first byte we have in the backlog. */
+    bl->offset = server.master_repl_offset - bl->histlen + 1;
 }
 
 /* This function is called when the user modifies the replication backlog
- * size at runtime. It is up to the function to both update the
- * server.repl_backlog_size and to resize the buffer and setup it so that
- * it contains the same data as the previous one (possibly less data, but
- * the most recent bytes, or the same data and more free space in case the
- * buffer is enlarged). */
+ * size at runtime. The backlog keeps its data: if it is now too big, the
+ * oldest blocks are released incrementally, as new data is appended. */
 void resizeReplicationBacklog(long long newsize) {
     if (newsize < CONFIG_REPL_BACKLOG_MIN_SIZE)
         newsize = CONFIG_REPL_BACKLOG_MIN_SIZE;
     if (server.repl_backlog_size == newsize) return;
 
     server.repl_backlog_size = newsize;
-    if (server.repl_backlog != NULL) {
-        /* What we actually do is to flush the old buffer and realloc a new
-         * empty one. It will refill with new data incrementally.
-         * The reason is that copying a few gigabytes adds latency and even
-         * worse often we need to alloc additional space before freeing the
-         * old buffer. */
-        zfree(server.repl_backlog);
-        server.repl_backlog = zmalloc(server.repl_backlog_size);
-        server.repl_backlog_histlen = 0;
-        server.repl_backlog_idx = 0;
-        /* Next byte we have is... the next since the buffer is empty. */
-        server.repl_backlog_off = server.master_repl_offset+1;
-    }
+    if (server.repl_backlog != NULL)
+        incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
 }
 
 void freeReplicationBacklog(void) {
     serverAssert(listLength(server.slaves) == 0);
+    if (server.repl_backlog == NULL) return;
+
+    /* Without slaves the backlog is the only reference to the replication
+     * buffer, that can be released as a whole. */
+    listEmpty(server.repl_buffer_blocks);
+    server.repl_buffer_mem = 0;
+    replBacklogDiskReset();
     zfree(server.repl_backlog);
     server.repl_backlog = NULL;
 }
 
-/* Add data to the replication backlog.
- * This function also increments the global replication offset stored at
- * server.master_repl_offset, because there is no case where we want to feed
- * the backlog without incrementing the offset. */
-void feedReplicationBacklog(void *ptr, size_t len) {
-    unsigned char *p = ptr;
+/* Return true if the slave will receive the replication stream we are
+ * going to append to the replication buffer. Slaves that are still waiting
+ * for BGSAVE to start don't need it, and slaves reading the backlog from
+ * disk will reach the new data from the backlog. */
+static int canFeedSlaveReplBuffer(client *slave) {
+    return slave->replstate != SLAVE_STATE_WAIT_BGSAVE_START &&
+           slave->repl_disk_offset == 0;
+}
+
+/* Append data to the replication buffer, for the backlog and for all the
+ * slaves that can receive it. This function also increments the global
+ * replication offset stored at server.master_repl_offset, because there is
+ * no case where we want to feed the backlog without incrementing the offset.
+ *
+ * The caller should call prepareClientToWrite() for the slaves before
+ * feeding the buffer, since after this call they already have pending data
+ * and prepareClientToWrite() would not install the write handler. */
+void feedReplicationBuffer(char *s, size_t len) {
+    static long long repl_block_id = 0;
+    listNode *ln, *start_node = NULL;
+    listIter li;
+    replBufBlock *tail;
+    size_t start_pos = 0;
+    int new_block = 0;
+
+    if (server.repl_backlog == NULL) return;
 
     server.master_repl_offset += len;
+    server.repl_backlog->histlen += len;
+
+    /* Append to the tail block as much as we can. */
+    ln = listLast(server.repl_buffer_blocks);
+    tail = ln ? listNodeValue(ln) : NULL;
+    if (tail && tail->size > tail->used) {
+        size_t copy = tail->size - tail->used;
+
+        if (copy > len) copy = len;
+        start_node = ln;
+        start_pos = tail->used;
+        memcpy(tail->buf+tail->used,s,copy);
+        tail->used += copy;
+        s += copy;
+        len -= copy;
+    }
+
+    /* Store the rest into a new block. Small blocks are sized so that the
+     * whole allocation is PROTO_REPLY_CHUNK_BYTES. */
+    if (len) {
+        size_t size = PROTO_REPLY_CHUNK_BYTES-sizeof(replBufBlock);
+
+        if (len > size) size = len;
+        tail = zmalloc(sizeof(replBufBlock)+size);
+        tail->size = size;
+        tail->used = len;
+        tail->refcount = 0;
+        tail->id = repl_block_id++;
+        tail->repl_offset = server.master_repl_offset-len+1;
+        memcpy(tail->buf,s,len);
+        listAddNodeTail(server.repl_buffer_blocks,tail);
+        server.repl_buffer_mem += zmalloc_size(tail)+sizeof(listNode);
+        new_block = 1;
+        if (start_node == NULL) {
+            start_node = listLast(server.repl_buffer_blocks);
+            start_pos = 0;
+        }
+    }
 
-    /* This is a circular buffer, so write as much data we can at every
-     * iteration and rewind the "idx" index if we reach the limit. */
-    while(len) {
-        size_t thislen = server.repl_backlog_size - server.repl_backlog_idx;
-        if (thislen > len) thislen = len;
-        memcpy(server.repl_backlog+server.repl_backlog_idx,p,thislen);
-        server.repl_backlog_idx += thislen;
-        if (server.repl_backlog_idx == server.repl_backlog_size)
-            server.repl_backlog_idx = 0;
-        len -= thislen;
-        p += thislen;
-        server.repl_backlog_histlen += thislen;
-    }
-    if (server.repl_backlog_histlen > server.repl_backlog_size)
-        server.repl_backlog_histlen = server.repl_backlog_size;
-    /* Set the offset of the first byte we have in the backlog. */
-    server.repl_backlog_off = server.master_repl_offset -
-                              server.repl_backlog_histlen + 1;
+    /* Slaves that had nothing left to send start from the new data. The
+     * output buffer limits only need to be checked when the buffer grows
+     * by a block. */
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+
+        if (!canFeedSlaveReplBuffer(slave)) continue;
+        if (slave->ref_repl_buf_node == NULL) {
+            slave->ref_repl_buf_node = start_node;
+            slave->ref_block_pos = start_pos;
+            ((replBufBlock*)listNodeValue(start_node))->refcount++;
+        }
+        if (new_block) asyncCloseClientOnOutputBufferLimitReached(slave);
+    }
+
+    /* The first data we get is the start of the backlog. */
+    if (server.repl_backlog->ref_repl_buf_node == NULL) {
+        serverAssert(start_node == listFirst(server.repl_buffer_blocks));
+        server.repl_backlog->ref_repl_buf_node = start_node;
+        ((replBufBlock*)listNodeValue(start_node))->refcount++;
+    }
+    incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
 }
 
-/* Wrapper for feedReplicationBacklog() that takes Redis string objects
+/* Wrapper for feedReplicationBuffer() that takes Redis string objects
  * as input. */
-void feedReplicationBacklogWithObject(robj *o) {
+void feedReplicationBufferWithObject(robj *o) {
     char llstr[LONG_STR_SIZE];
     void *p;
     size_t len;
@@ -162,7 +277,102 @@ void feedReplicationBacklogWithObject(robj *o) {
         len = sdslen(o->ptr);
         p = o->ptr;
     }
-    feedReplicationBacklog(p,len);
+    feedReplicationBuffer(p,len);
+}
+
+/* Return true if the slave has still some of the replication buffer to
+ * send to its socket. */
+int slaveHasPendingReplBuffer(client *c) {
+    listNode *last;
+
+    if (c->ref_repl_buf_node == NULL) return 0;
+    last = listLast(server.repl_buffer_blocks);
+    return c->ref_repl_buf_node != last ||
+           c->ref_block_pos < ((replBufBlock*)listNodeValue(last))->used;
+}
+
+/* Return the number of bytes of the replication stream the slave has still
+ * to send to its socket. */
+long long getSlaveReplBufferLag(client *c) {
+    replBufBlock *o;
+
+    if (c->repl_disk_offset)
+        return server.master_repl_offset+1 - c->repl_disk_offset;
+    if (c->ref_repl_buf_node == NULL) return 0;
+    o = listNodeValue(c->ref_repl_buf_node);
+    return server.master_repl_offset+1 - (o->repl_offset+c->ref_block_pos);
+}
+
+/* Return the memory of the replication buffer held by the slave: the
+ * blocks from the one it is sending to the end of the buffer. This is the
+ * memory that the slave output buffer limits apply to. */
+size_t getSlaveReplBufferMemoryUsage(client *c) {
+    replBufBlock *cur, *last;
+
+    if (c->ref_repl_buf_node == NULL) return 0;
+    cur = listNodeValue(c->ref_repl_buf_node);
+    last = listNodeValue(listLast(server.repl_buffer_blocks));
+    return (last->repl_offset+last->size - cur->repl_offset) +
+           (last->id-cur->id+1) * (sizeof(replBufBlock)+sizeof(listNode));
+}
+
+/* Move the cursor of the slave to the next blocks if it sent the whole
+ * block it references, releasing the blocks no longer needed. This is
+ * called after data is written to the slave socket, and only from the main
+ * thread, since the refcount of the blocks is shared by all the slaves. */
+void advanceSlaveReplBufferCursor(client *c) {
+    listNode *ln = c->ref_repl_buf_node, *next;
+    int moved = 0;
+
+    if (ln == NULL) return;
+    while((next = listNextNode(ln)) != NULL) {
+        replBufBlock *o = listNodeValue(ln);
+
+        if (c->ref_block_pos < o->used) break;
+        c->ref_block_pos -= o->used;
+        o->refcount--;
+        ((replBufBlock*)listNodeValue(next))->refcount++;
+        ln = next;
+        moved = 1;
+    }
+    c->ref_repl_buf_node = ln;
+    if (moved)
+        incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+}
+
+/* Make the slave 'dst' send the replication buffer from where 'src' is,
+ * used when a slave attaches to the BGSAVE in progress of another one. */
+void copySlaveReplBufferCursor(client *dst, client *src) {
+    releaseSlaveReplBufferCursor(dst);
+    if (src->ref_repl_buf_node == NULL) return;
+    dst->ref_repl_buf_node = src->ref_repl_buf_node;
+    dst->ref_block_pos = src->ref_block_pos;
+    ((replBufBlock*)listNodeValue(dst->ref_repl_buf_node))->refcount++;
+}
+
+/* Release the reference of the slave to the replication buffer, when the
+ * slave is freed. */
+void releaseSlaveReplBufferCursor(client *c) {
+    if (c->ref_repl_buf_node == NULL) return;
+    ((replBufBlock*)listNodeValue(c->ref_repl_buf_node))->refcount--;
+    c->ref_repl_buf_node = NULL;
+    c->ref_block_pos = 0;
+    incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+}
+
+/* Call prepareClientToWrite() for all the slaves that are going to receive
+ * the data we are about to append to the replication buffer. */
+static void prepareSlavesToWrite(list *slaves) {
+    listNode *ln;
+    listIter li;
+
+    listRewind(slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+
+        if (!canFeedSlaveReplBuffer(slave)) continue;
+        prepareClientToWrite(slave);
+    }
 }
 
 /* Propagate write commands to slaves, and populate the replication backlog
@@ -171,10 +381,9 @@ void feedReplicationBacklogWithObject(robj *o) {
  * stream. Instead if the instance is a slave and has sub-slaves attached,
  * we use replicationFeedSlavesFromMaster() */
 void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
-    listNode *ln;
-    listIter li;
     int j, len;
     char llstr[LONG_STR_SIZE];
+    char aux[LONG_STR_SIZE+3];
 
     /* If the instance is not a top level master, return ASAP: we'll just proxy
      * the stream of data we receive from our master instead, in order to
@@ -190,6 +399,12 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
     /* We can't have slaves attached and no backlog. */
     serverAssert(!(listLength(slaves) != 0 && server.repl_backlog == NULL));
 
+    /* Install the write handler of the slaves before feeding the stream,
+     * that is shared with the backlog and appended only once. Slaves that
+     * are waiting for the initial SYNC accumulate the stream until the
+     * initial SYNC completes. */
+    prepareSlavesToWrite(slaves);
+
     /* Send SELECT command to every slave if needed. */
     if (server.slaveseldb != dictid) {
         robj *selectcmd;
@@ -207,68 +422,34 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
                 dictid_len, llstr));
         }
 
-        /* Add the SELECT command into the backlog. */
-        if (server.repl_backlog) feedReplicationBacklogWithObject(selectcmd);
-
-        /* Send it to slaves. */
-        listRewind(slaves,&li);
-        while((ln = listNext(&li))) {
-            client *slave = ln->value;
-            if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
-            addReply(slave,selectcmd);
-        }
+        /* Add the SELECT command into the replication buffer. */
+        feedReplicationBufferWithObject(selectcmd);
 
         if (dictid < 0 || dictid >= PROTO_SHARED_SELECT_CMDS)
             decrRefCount(selectcmd);
     }
     server.slaveseldb = dictid;
 
-    /* Write the command to the replication backlog if any. */
-    if (server.repl_backlog) {
-        char aux[LONG_STR_SIZE+3];
+    /* Write the command to the replication buffer. */
+    aux[0] = '*';
+    len = ll2string(aux+1,sizeof(aux)-1,argc);
+    aux[len+1] = '\r';
+    aux[len+2] = '\n';
+    feedReplicationBuffer(aux,len+3);
+
+    for (j = 0; j < argc; j++) {
+        long objlen = stringObjectLen(argv[j]);
 
-        /* Add the multi bulk reply length. */
-        aux[0] = '*';
-        len = ll2string(aux+1,sizeof(aux)-1,argc);
+        /* We need to feed the buffer with the object as a bulk reply
+         * not just as a plain string, so create the $..CRLF payload len
+         * and add the final CRLF */
+        aux[0] = '$';
+        len = ll2string(aux+1,sizeof(aux)-1,objlen);
         aux[len+1] = '\r';
         aux[len+2] = '\n';
-        feedReplicationBacklog(aux,len+3);
-
-        for (j = 0; j < argc; j++) {
-            long objlen = stringObjectLen(argv[j]);
-
-            /* We need to feed the buffer with the object as a bulk reply
-             * not just as a plain string, so create the $..CRLF payload len
-             * and add the final CRLF */
-            aux[0] = '$';
-            len = ll2string(aux+1,sizeof(aux)-1,objlen);
-            aux[len+1] = '\r';
-            aux[len+2] = '\n';
-            feedReplicationBacklog(aux,len+3);
-            feedReplicationBacklogWithObject(argv[j]);
-            feedReplicationBacklog(aux+len+1,2);
-        }
-    }
-
-    /* Write the command to every slave. */
-    listRewind(slaves,&li);
-    while((ln = listNext(&li))) {
-        client *slave = ln->value;
-
-        /* Don't feed slaves that are still waiting for BGSAVE to start */
-        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
-
-        /* Feed slaves that are waiting for the initial SYNC (so these commands
-         * are queued in the output buffer until the initial SYNC completes),
-         * or are already in sync with the master. */
-
-        /* Add the multi bulk length. */
-        addReplyMultiBulkLen(slave,argc);
-
-        /* Finally any additional argument that was not stored inside the
-         * static buffer if any (from j to argc). */
-        for (j = 0; j < argc; j++)
-            addReplyBulk(slave,argv[j]);
+        feedReplicationBuffer(aux,len+3);
+        feedReplicationBufferWithObject(argv[j]);
+        feedReplicationBuffer(aux+len+1,2);
     }
 }
 
@@ -276,9 +457,6 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
  * to our sub-slaves. */
 #include <ctype.h>
 void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t buflen) {
-    listNode *ln;
-    listIter li;
-
     /* Debugging: this is handy to see the stream sent from master
      * to slaves. Disabled with if(0). */
     if (0) {
@@ -289,15 +467,11 @@ void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t bufle
         printf("\n");
     }
 
-    if (server.repl_backlog) feedReplicationBacklog(buf,buflen);
-    listRewind(slaves,&li);
-    while((ln = listNext(&li))) {
-        client *slave = ln->value;
+    /* We can't have slaves attached and no backlog. */
+    serverAssert(!(listLength(slaves) != 0 && server.repl_backlog == NULL));
 
-        /* Don't feed slaves that are still waiting for BGSAVE to start */
-        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
-        addReplyString(slave,buf,buflen);
-    }
+    prepareSlavesToWrite(slaves);
+    feedReplicationBuffer(buf,buflen);
 }
 
 void replicationFeedMonitors(client *c, list *monitors, int dictid, robj **argv, int argc) {
@@ -340,55 +514,61 @@ void replicationFeedMonitors(client *c, list *monitors, int dictid, robj **argv,
 }
 
 /* Feed the slave 'c' with the replication backlog starting from the
- * specified 'offset' up to the end of the backlog. */
+ * specified 'offset' up to the end of the backlog. The data is not copied:
+ * the slave just starts sending the shared replication buffer from the
+ * block containing 'offset', or reading the disk tier of the backlog if
+ * 'offset' is no longer in memory. */
 long long addReplyReplicationBacklog(client *c, long long offset) {
-    long long j, skip, len;
+    replBacklog *bl = server.repl_backlog;
+    listNode *ln;
+    replBufBlock *o;
+    long long skip;
 
     serverLog(LL_DEBUG, "[PSYNC] Slave request offset: %lld", offset);
 
-    if (server.repl_backlog_histlen == 0) {
+    if (bl->histlen == 0) {
         serverLog(LL_DEBUG, "[PSYNC] Backlog history len is zero");
         return 0;
     }
 
     serverLog(LL_DEBUG, "[PSYNC] Backlog size: %lld",
              server.repl_backlog_size);
-    serverLog(LL_DEBUG, "[PSYNC] First byte: %lld",
-             server.repl_backlog_off);
-    serverLog(LL_DEBUG, "[PSYNC] History len: %lld",
-             server.repl_backlog_histlen);
-    serverLog(LL_DEBUG, "[PSYNC] Current index: %lld",
-             server.repl_backlog_idx);
+    serverLog(LL_DEBUG, "[PSYNC] First byte: %lld", bl->offset);
+    serverLog(LL_DEBUG, "[PSYNC] History len: %lld", bl->histlen);
+
+    /* Data older than the in memory backlog is read from disk, and the
+     * slave continues with the replication buffer once it reaches it. */
+    if (offset < bl->offset) {
+        prepareClientToWrite(c);
+        releaseSlaveReplBufferCursor(c);
+        c->repl_disk_offset = offset;
+        serverLog(LL_DEBUG, "[PSYNC] Reading from the disk backlog");
+        return server.master_repl_offset+1 - offset;
+    }
 
     /* Compute the amount of bytes we need to discard. */
-    skip = offset - server.repl_backlog_off;
+    skip = offset - bl->offset;
     serverLog(LL_DEBUG, "[PSYNC] Skipping: %lld", skip);
 
-    /* Point j to the oldest byte, that is actually our
-     * server.repl_backlog_off byte. */
-    j = (server.repl_backlog_idx +
-        (server.repl_backlog_size-server.repl_backlog_histlen)) %
-        server.repl_backlog_size;
-    serverLog(LL_DEBUG, "[PSYNC] Index of first byte: %lld", j);
-
-    /* Discard the amount of data to seek to the specified 'offset'. */
-    j = (j + skip) % server.repl_backlog_size;
-
-    /* Feed slave with data. Since it is a circular buffer we have to
-     * split the reply in two parts if we are cross-boundary. */
-    len = server.repl_backlog_histlen - skip;
-    serverLog(LL_DEBUG, "[PSYNC] Reply total length: %lld", len);
-    while(len) {
-        long long thislen =
-            ((server.repl_backlog_size - j) < len) ?
-            (server.repl_backlog_size - j) : len;
-
-        serverLog(LL_DEBUG, "[PSYNC] addReply() length: %lld", thislen);
-        addReplySds(c,sdsnewlen(server.repl_backlog + j, thislen));
-        len -= thislen;
-        j = 0;
-    }
-    return server.repl_backlog_histlen - skip;
+    /* Seek the block containing 'offset'. If the slave already has all
+     * our data, it starts from the end of the last block. */
+    ln = bl->ref_repl_buf_node;
+    while(1) {
+        o = listNodeValue(ln);
+        if (o->repl_offset+(long long)o->used >= offset) break;
+        ln = listNextNode(ln);
+        serverAssert(ln != NULL);
+    }
+
+    /* Install the write handler, then point the slave to the data. */
+    prepareClientToWrite(c);
+    releaseSlaveReplBufferCursor(c);
+    c->ref_repl_buf_node = ln;
+    c->ref_block_pos = offset - o->repl_offset;
+    o->refcount++;
+    serverLog(LL_DEBUG, "[PSYNC] Reply total length: %lld",
+        bl->histlen - skip);
+    return bl->histlen - skip;
 }
 
 /* Return the offset to provide as reply to the PSYNC command received
@@ -399,6 +579,36 @@ long long getPsyncInitialOffset(void) {
     return server.master_repl_offset;
 }
 
+/* Compress everything sent to the slave from now on, called after the
+ * reply to PSYNC of slaves with the SLAVE_CAPA_LZF capability, that is
+ * marked with a final " lzf" argument. See replcompress.c. */
+void replicationEnableCompression(client *slave) {
+    slave->repl_comp = replCompressorCreate();
+    slave->repl_comp_buf = sdsempty();
+}
+
+/* Write to a slave with a compressed link the compressed data pending in
+ * its buffer, when the slave is not served by the write handler of the
+ * replication stream. Returns C_ERR if the slave was freed because of a
+ * write error. */
+static int writePendingCompressedData(client *slave) {
+    ssize_t nwritten;
+
+    if (sdslen(slave->repl_comp_buf) == 0) return C_OK;
+    nwritten = write(slave->fd,slave->repl_comp_buf,
+                     sdslen(slave->repl_comp_buf));
+    if (nwritten == -1) {
+        if (errno == EAGAIN) return C_OK;
+        serverLog(LL_VERBOSE,"Write error sending data to slave: %s",
+            strerror(errno));
+        freeClient(slave);
+        return C_ERR;
+    }
+    server.stat_net_output_bytes += nwritten;
+    sdsrange(slave->repl_comp_buf,nwritten,-1);
+    return C_OK;
+}
+
 /* Send a FULLRESYNC reply in the specific case of a full resynchronization,
  * as a side effect setup the slave for a full sync in different ways:
  *
@@ -429,12 +639,15 @@ int replicationSetupSlaveForFullResync(client *slave, long long offset) {
     /* Don't send this reply to slaves that approached us with
      * the old SYNC command. */
     if (!(slave->flags & CLIENT_PRE_PSYNC)) {
-        buflen = snprintf(buf,sizeof(buf),"+FULLRESYNC %s %lld\r\n",
-                          server.replid,offset);
+        buflen = snprintf(buf,sizeof(buf),"+FULLRESYNC %s %lld%s\r\n",
+                          server.replid,offset,
+                          (slave->slave_capa & SLAVE_CAPA_LZF) ? " lzf" : "");
         if (write(slave->fd,buf,buflen) != buflen) {
             freeClientAsync(slave);
             return C_ERR;
         }
+        if (slave->slave_capa & SLAVE_CAPA_LZF)
+            replicationEnableCompression(slave);
     }
     return C_OK;
 }
@@ -487,10 +700,13 @@ int masterTryPartialResynchronization(client *c) {
         goto need_full_resync;
     }
 
-    /* We still have the data our slave is asking for? */
+    /* We still have the data our slave is asking for? Data older than the
+     * in memory backlog may still be in its disk tier. */
     if (!server.repl_backlog ||
-        psync_offset < server.repl_backlog_off ||
-        psync_offset > (server.repl_backlog_off + server.repl_backlog_histlen))
+        (psync_offset < server.repl_backlog->offset &&
+         !replBacklogDiskHasOffset(psync_offset)) ||
+        psync_offset > (server.repl_backlog->offset +
+                        server.repl_backlog->histlen))
     {
         serverLog(LL_NOTICE,
             "Unable to partial resync with slave %s for lack of backlog (Slave request was: %lld).", replicationGetSlaveName(c), psync_offset);
@@ -514,14 +730,17 @@ int masterTryPartialResynchronization(client *c) {
      * new commands at this stage. But we are sure the socket send buffer is
      * empty so this write will never fail actually. */
     if (c->slave_capa & SLAVE_CAPA_PSYNC2) {
-        buflen = snprintf(buf,sizeof(buf),"+CONTINUE %s\r\n", server.replid);
+        buflen = snprintf(buf,sizeof(buf),"+CONTINUE %s%s\r\n",
+            server.replid, (c->slave_capa & SLAVE_CAPA_LZF) ? " lzf" : "");
     } else {
-        buflen = snprintf(buf,sizeof(buf),"+CONTINUE\r\n");
+        buflen = snprintf(buf,sizeof(buf),"+CONTINUE%s\r\n",
+            (c->slave_capa & SLAVE_CAPA_LZF) ? " lzf" : "");
     }
     if (write(c->fd,buf,buflen) != buflen) {
         freeClientAsync(c);
         return C_OK;
     }
+    if (c->slave_capa & SLAVE_CAPA_LZF) replicationEnableCompression(c);
     psync_len = addReplyReplicationBacklog(c,psync_offset);
     serverLog(LL_NOTICE,
         "Partial resynchronization request from %s accepted. Sending %lld bytes of backlog starting from offset %lld.",
@@ -698,7 +917,7 @@ void syncCommand(client *c) {
     }
 
     /* CASE 1: BGSAVE is in progress, with disk target. */
-    if (server.rdb_child_pid != -1 &&
+    if ((server.rdb_child_pid != -1 || server.rdb_forkless_in_progress) &&
         server.rdb_child_type == RDB_CHILD_TYPE_DISK)
     {
         /* Ok a background save is in progress. Let's check if it is a good
@@ -806,6 +1025,8 @@ void replconfCommand(client *c) {
                 c->slave_capa |= SLAVE_CAPA_EOF;
             else if (!strcasecmp(c->argv[j+1]->ptr,"psync2"))
                 c->slave_capa |= SLAVE_CAPA_PSYNC2;
+            else if (!strcasecmp(c->argv[j+1]->ptr,"lzf"))
+                c->slave_capa |= SLAVE_CAPA_LZF;
         } else if (!strcasecmp(c->argv[j]->ptr,"ack")) {
             /* REPLCONF ACK is used by slave to inform the master the amount
              * of replication stream that it processed so far. It is an
@@ -873,6 +1094,42 @@ void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
     char buf[PROTO_IOBUF_LEN];
     ssize_t nwritten, buflen;
 
+    /* With a compressed link the preamble and the file are compressed a
+     * chunk at a time, when the previous chunk was written. */
+    if (slave->repl_comp) {
+        if (writePendingCompressedData(slave) == C_ERR) return;
+        if (sdslen(slave->repl_comp_buf)) return;
+        if (slave->replpreamble) {
+            slave->repl_comp_buf = replCompress(slave->repl_comp,
+                slave->repl_comp_buf,slave->replpreamble,
+                sdslen(slave->replpreamble));
+            sdsfree(slave->replpreamble);
+            slave->replpreamble = NULL;
+        } else if (slave->repldboff < slave->repldbsize) {
+            lseek(slave->repldbfd,slave->repldboff,SEEK_SET);
+            buflen = read(slave->repldbfd,buf,PROTO_IOBUF_LEN);
+            if (buflen <= 0) {
+                serverLog(LL_WARNING,"Read error sending DB to slave: %s",
+                    (buflen == 0) ? "premature EOF" : strerror(errno));
+                freeClient(slave);
+                return;
+            }
+            slave->repl_comp_buf = replCompress(slave->repl_comp,
+                slave->repl_comp_buf,buf,buflen);
+            slave->repldboff += buflen;
+        }
+        if (writePendingCompressedData(slave) == C_ERR) return;
+        if (slave->repldboff == slave->repldbsize &&
+            sdslen(slave->repl_comp_buf) == 0)
+        {
+            close(slave->repldbfd);
+            slave->repldbfd = -1;
+            aeDeleteFileEvent(server.el,slave->fd,AE_WRITABLE);
+            putSlaveOnline(slave);
+        }
+        return;
+    }
+
     /* Before sending the RDB file, we send the preamble as configured by the
      * replication process. Currently the preamble is just the bulk count of
      * the file in the form "$<length>\r\n". */
@@ -922,6 +1179,23 @@ void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 }
 
+/* Called when the diskless replication child reports that 'slave' received
+ * the whole RDB payload, even if the transfer to other slaves is still in
+ * progress. */
+void replicationSlaveStreamedRdb(client *slave) {
+    serverLog(LL_NOTICE,
+        "Streamed RDB transfer with slave %s succeeded (socket). Waiting for REPLCONF ACK from slave to enable streaming",
+            replicationGetSlaveName(slave));
+    /* Note: we wait for a REPLCONF ACK message from slave in
+     * order to really put it online (install the write handler
+     * so that the accumulated data can be transfered). However
+     * we change the replication state ASAP, since our slave
+     * is technically online now. */
+    slave->replstate = SLAVE_STATE_ONLINE;
+    slave->repl_put_online_on_ack = 1;
+    slave->repl_ack_time = server.unixtime; /* Timeout otherwise. */
+}
+
 /* This function is called at the end of every background saving,
  * or when the replication RDB transfer strategy is modified from
  * disk to socket or the other way around.
@@ -959,17 +1233,7 @@ void updateSlavesWaitingBgsave(int bgsaveerr, int type) {
              * diskless replication, our work is trivial, we can just put
              * the slave online. */
             if (type == RDB_CHILD_TYPE_SOCKET) {
-                serverLog(LL_NOTICE,
-                    "Streamed RDB transfer with slave %s succeeded (socket). Waiting for REPLCONF ACK from slave to enable streaming",
-                        replicationGetSlaveName(slave));
-                /* Note: we wait for a REPLCONF ACK message from slave in
-                 * order to really put it online (install the write handler
-                 * so that the accumulated data can be transfered). However
-                 * we change the replication state ASAP, since our slave
-                 * is technically online now. */
-                slave->replstate = SLAVE_STATE_ONLINE;
-                slave->repl_put_online_on_ack = 1;
-                slave->repl_ack_time = server.unixtime; /* Timeout otherwise. */
+                replicationSlaveStreamedRdb(slave);
             } else {
                 if (bgsaveerr != C_OK) {
                     freeClient(slave);
@@ -1100,15 +1364,311 @@ void restartAOF() {
     }
 }
 
+/* Final setup of the connected slave <- master link, once the dataset of
+ * the master was loaded. */
+static void replicationFinishSync(rdbSaveInfo *rsi, int aof_is_enabled) {
+    replicationCreateMasterClient(server.repl_transfer_s,rsi->repl_stream_db);
+    server.repl_state = REPL_STATE_CONNECTED;
+    /* After a full resynchroniziation we use the replication ID and
+     * offset of the master. The secondary ID / offset are cleared since
+     * we are starting a new history. */
+    memcpy(server.replid,server.master->replid,sizeof(server.replid));
+    server.master_repl_offset = server.master->reploff;
+    clearReplicationId2();
+    /* Let's create the replication backlog if needed. Slaves need to
+     * accumulate the backlog regardless of the fact they have sub-slaves
+     * or not, in order to behave correctly if they are promoted to
+     * masters after a failover. */
+    if (server.repl_backlog == NULL) createReplicationBacklog();
+
+    serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
+    /* Restart the AOF subsystem now that we finished the sync. This
+     * will trigger an AOF rewrite, and when done will start appending
+     * to the new file. */
+    if (aof_is_enabled) restartAOF();
+
+    /* The start of the replication stream may have been decompressed
+     * together with the end of the payload: no readable event would tell
+     * us about it. */
+    if (server.repl_master_decomp &&
+        replDecompressorPending(server.repl_master_decomp))
+    {
+        readQueryFromClient(server.el,server.master->fd,server.master,
+                            AE_READABLE);
+    }
+}
+
+/* ---------------------------- Diskless load -------------------------------
+ * With repl-diskless-load enabled the RDB payload is parsed straight from
+ * the socket of the master, instead of being saved to a temp file that is
+ * loaded once the transfer is complete. In "swapdb" mode the keys are added
+ * to a set of temporary DBs while the old dataset is still served to the
+ * read only commands, and the two are swapped only if the load succeeds.
+ * -------------------------------------------------------------------------- */
+
+/* Returns the repl-diskless-load mode to use for the next sync. The old
+ * dataset can't be kept aside in cluster mode, since the keys of all the
+ * DBs are tracked by slot in a single map. */
+static int replicationDisklessLoadMode(void) {
+    if (server.repl_diskless_load == REPL_DISKLESS_LOAD_SWAPDB &&
+        server.cluster_enabled) return REPL_DISKLESS_LOAD_FLUSH;
+    return server.repl_diskless_load;
+}
+
+/* Create the DBs the dataset of the master is loaded into in "swapdb"
+ * mode. */
+static redisDb *disklessLoadCreateDbs(void) {
+    redisDb *dbs = zmalloc(sizeof(redisDb)*server.dbnum);
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        dbs[j].dict = dictCreate(&dbDictType,NULL);
+        dbs[j].blocking_keys = dictCreate(&keylistDictType,NULL);
+        dbs[j].ready_keys = dictCreate(&objectKeyPointerValueDictType,NULL);
+        dbs[j].watched_keys = dictCreate(&keylistDictType,NULL);
+        dbs[j].expires_index = server.active_expire_index ? raxNew() : NULL;
+        dbs[j].id = j;
+        dbs[j].avg_ttl = 0;
+        dbs[j].expired_until = LLONG_MIN;
+        dbs[j].expired_backlog = 0;
+    }
+    return dbs;
+}
+
+/* Release the DBs created by disklessLoadCreateDbs() and the keys they
+ * hold, in background if 'async' is true. */
+static void disklessLoadReleaseDbs(redisDb *dbs, int async) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        if (async) {
+            emptyDbAsync(dbs+j);
+        } else {
+            dictEmpty(dbs[j].dict,replicationEmptyDbCallback);
+        }
+        dictRelease(dbs[j].dict);
+        if (dbs[j].expires_index) {
+            if (async) {
+                expireIndexFreeAsync(dbs[j].expires_index);
+            } else {
+                raxFree(dbs[j].expires_index);
+            }
+        }
+        dictRelease(dbs[j].blocking_keys);
+        dictRelease(dbs[j].ready_keys);
+        dictRelease(dbs[j].watched_keys);
+    }
+    zfree(dbs);
+}
+
+/* Make the keys loaded in 'dbs' the dataset of the server, and the old
+ * dataset the content of 'dbs'. */
+static void disklessLoadSwapDbs(redisDb *dbs) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb aux = server.db[j];
+
+        server.db[j].dict = dbs[j].dict;
+        server.db[j].expires_index = dbs[j].expires_index;
+        server.db[j].expired_until = dbs[j].expired_until;
+        server.db[j].expired_backlog = dbs[j].expired_backlog;
+        server.db[j].avg_ttl = dbs[j].avg_ttl;
+        dbs[j].dict = aux.dict;
+        dbs[j].expires_index = aux.expires_index;
+        dbs[j].expired_until = aux.expired_until;
+        dbs[j].expired_backlog = aux.expired_backlog;
+        dbs[j].avg_ttl = aux.avg_ttl;
+    }
+}
+
+/* Consume what follows the RDB payload once it was loaded from the socket:
+ * the checksum if it was not verified (rdbchecksum set to no), and the EOF
+ * mark of the diskless transfers. Returns C_ERR if the stream does not end
+ * as expected. */
+static int disklessLoadReadTrailer(rio *rdb, int usemark, char *eofmark) {
+    char lastbytes[CONFIG_RUN_ID_SIZE];
+    size_t left;
+    char c;
+
+    rdb->update_cksum = NULL;
+    if (!usemark) {
+        left = server.repl_transfer_size-rdb->processed_bytes;
+        while(left--) if (rioRead(rdb,&c,1) == 0) return C_ERR;
+        return C_OK;
+    }
+
+    memset(lastbytes,0,CONFIG_RUN_ID_SIZE);
+    for (left = CONFIG_RUN_ID_SIZE+8; left > 0; left--) {
+        if (rioRead(rdb,&c,1) == 0) return C_ERR;
+        memmove(lastbytes,lastbytes+1,CONFIG_RUN_ID_SIZE-1);
+        lastbytes[CONFIG_RUN_ID_SIZE-1] = c;
+        if (memcmp(lastbytes,eofmark,CONFIG_RUN_ID_SIZE) == 0) return C_OK;
+    }
+    return C_ERR;
+}
+
+/* Called while waiting for more of the RDB payload from the master: serve
+ * the clients meanwhile, and give up once no data arrived for the
+ * replication timeout. */
+static int disklessLoadWait(rio *rdb) {
+    updateCachedTime();
+    if (rdb->io.fd.read_so_far != (size_t)server.repl_transfer_read) {
+        server.repl_transfer_read = rdb->io.fd.read_so_far;
+        server.repl_transfer_lastio = server.unixtime;
+    }
+    if (server.unixtime-server.repl_transfer_lastio > server.repl_timeout) {
+        serverLog(LL_WARNING,"Timeout receiving the RDB payload from MASTER");
+        return 0;
+    }
+    replicationSendNewlineToMaster();
+    processEventsWhileBlocked();
+    return 1;
+}
+
+/* Load the RDB payload of a full sync from the socket 'fd' of the master.
+ * Called as soon as the payload starts to arrive: the load is synchronous,
+ * like the one of the RDB file received from the master, and events are
+ * processed from time to time while loading. */
+static void readSyncBulkPayloadDiskless(int fd, int usemark, char *eofmark) {
+    int aof_is_enabled = server.aof_state != AOF_OFF;
+    int swapdb = replicationDisklessLoadMode() == REPL_DISKLESS_LOAD_SWAPDB;
+    int async = server.repl_slave_lazy_flush;
+    long long start = ustime();
+    rdbSaveInfo rsi = RDB_SAVE_INFO_INIT;
+    redisDb *dbs = NULL;
+    rio rdb;
+    int retval;
+
+    /* We need to stop any AOFRW fork before parsing the RDB, otherwise
+     * we'll create a copy-on-write disaster. */
+    if (aof_is_enabled) stopAppendOnly();
+    /* Delete the readable handler, otherwise it will get called recursively
+     * since the loading code processes events from time to time. */
+    aeDeleteFileEvent(server.el,fd,AE_READABLE);
+    if (swapdb) {
+        /* A BGSAVE without fork must complete the scan of the old dataset
+         * before the DBs are swapped. */
+        snapshotCompleteScan(-1);
+        dbs = disklessLoadCreateDbs();
+        server.repl_swapdb_loading = 1;
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Loading DB in memory "
+                             "from the socket, serving the old data");
+    } else {
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Flushing old data");
+        signalFlushedDb(-1);
+        emptyDb(-1,async ? EMPTYDB_ASYNC : EMPTYDB_NO_FLAGS,
+            replicationEmptyDbCallback);
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Loading DB in memory "
+                             "from the socket");
+        startLoadingSize(usemark ? 0 : server.repl_transfer_size);
+    }
+
+    rioInitWithFd(&rdb,fd,usemark ? 0 : server.repl_transfer_size);
+    rdb.io.fd.wait = disklessLoadWait;
+    rdb.io.fd.fdread = replicationReadMaster;
+    server.repl_transfer_lastio = server.unixtime;
+    retval = rdbLoadRioWithDbs(&rdb,&rsi,swapdb ? dbs : server.db);
+    if (retval == C_OK && disklessLoadReadTrailer(&rdb,usemark,eofmark)
+        == C_ERR)
+    {
+        serverLog(LL_WARNING,"Unexpected end of the RDB payload received "
+                             "from the MASTER");
+        retval = C_ERR;
+    }
+    server.stat_net_input_bytes += rdb.io.fd.read_so_far;
+    rioFreeFd(&rdb,NULL);
+    if (swapdb) {
+        server.repl_swapdb_loading = 0;
+    } else {
+        stopLoading();
+    }
+
+    if (retval != C_OK) {
+        serverLog(LL_WARNING,"Failed trying to load the MASTER "
+                             "synchronization DB from socket");
+        /* Discard the keys loaded so far: in "swapdb" mode the old dataset
+         * is still in place. */
+        if (swapdb) {
+            disklessLoadReleaseDbs(dbs,async);
+        } else {
+            emptyDb(-1,async ? EMPTYDB_ASYNC : EMPTYDB_NO_FLAGS,
+                replicationEmptyDbCallback);
+        }
+        cancelReplicationHandshake();
+        /* Re-enable the AOF if we disabled it earlier, in order to restore
+         * the original configuration. */
+        if (aof_is_enabled) restartAOF();
+        return;
+    }
+
+    if (swapdb) {
+        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Discarding old data");
+        signalFlushedDb(-1);
+        disklessLoadSwapDbs(dbs);
+        disklessLoadReleaseDbs(dbs,async);
+        flushSlaveKeysWithExpireList();
+    }
+    serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: %zu bytes loaded from the "
+                         "socket in %.3f seconds",
+        rdb.processed_bytes, (float)(ustime()-start)/1000000);
+    replicationFinishSync(&rsi,aof_is_enabled);
+}
+
+/* Read from the socket of the master like read(2), decompressing the data
+ * if the master compresses the replication stream. */
+ssize_t replicationReadMaster(int fd, void *buf, size_t len) {
+    if (server.repl_master_decomp == NULL) return read(fd,buf,len);
+    return replDecompressorRead(server.repl_master_decomp,fd,buf,len);
+}
+
+/* Like syncReadLine() for the socket of the master, decompressing the
+ * data if the master compresses the replication stream. */
+static ssize_t replicationSyncReadLine(int fd, char *ptr, ssize_t size,
+                                       long long timeout)
+{
+    long long start = mstime();
+    ssize_t nread = 0;
+
+    if (server.repl_master_decomp == NULL)
+        return syncReadLine(fd,ptr,size,timeout);
+
+    size--;
+    while(size) {
+        char c;
+        ssize_t retval = replicationReadMaster(fd,&c,1);
+
+        if (retval == 0) return -1;
+        if (retval == -1) {
+            long long remaining = timeout-(mstime()-start);
+
+            if (errno != EAGAIN) return -1;
+            if (remaining <= 0) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            aeWait(fd,AE_READABLE,remaining);
+            continue;
+        }
+        if (c == '\n') {
+            *ptr = '\0';
+            if (nread && *(ptr-1) == '\r') *(ptr-1) = '\0';
+            return nread;
+        }
+        *ptr++ = c;
+        *ptr = '\0';
+        nread++;
+        size--;
+    }
+    return nread;
+}
+
 /* Asynchronously read the SYNC payload we receive from a master */
 #define REPL_MAX_WRITTEN_BEFORE_FSYNC (1024*1024*8) /* 8 MB */
-void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
+static void readSyncBulkPayloadData(int fd) {
     char buf[4096];
     ssize_t nread, readlen;
     off_t left;
-    UNUSED(el);
-    UNUSED(privdata);
-    UNUSED(mask);
 
     /* Static vars used to hold the EOF mark, and the last bytes received
      * form the server: when they match, we reached the end of the transfer. */
@@ -1119,7 +1679,9 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
     /* If repl_transfer_size == -1 we still have to read the bulk length
      * from the master reply. */
     if (server.repl_transfer_size == -1) {
-        if (syncReadLine(fd,buf,1024,server.repl_syncio_timeout*1000) == -1) {
+        if (replicationSyncReadLine(fd,buf,1024,
+                server.repl_syncio_timeout*1000) == -1)
+        {
             serverLog(LL_WARNING,
                 "I/O error reading bulk count from MASTER: %s",
                 strerror(errno));
@@ -1171,6 +1733,13 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
         return;
     }
 
+    /* Without a temp file the payload is loaded straight from the socket,
+     * see repl-diskless-load. */
+    if (server.repl_transfer_fd == -1) {
+        readSyncBulkPayloadDiskless(fd,usemark,eofmark);
+        return;
+    }
+
     /* Read bulk data */
     if (usemark) {
         readlen = sizeof(buf);
@@ -1179,7 +1748,8 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
         readlen = (left < (signed)sizeof(buf)) ? left : (signed)sizeof(buf);
     }
 
-    nread = read(fd,buf,readlen);
+    nread = replicationReadMaster(fd,buf,readlen);
+    if (nread == -1 && errno == EAGAIN) return;
     if (nread <= 0) {
         serverLog(LL_WARNING,"I/O error trying to sync with MASTER: %s",
             (nread == -1) ? strerror(errno) : "connection lost");
@@ -1275,25 +1845,7 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
         /* Final setup of the connected slave <- master link */
         zfree(server.repl_transfer_tmpfile);
         close(server.repl_transfer_fd);
-        replicationCreateMasterClient(server.repl_transfer_s,rsi.repl_stream_db);
-        server.repl_state = REPL_STATE_CONNECTED;
-        /* After a full resynchroniziation we use the replication ID and
-         * offset of the master. The secondary ID / offset are cleared since
-         * we are starting a new history. */
-        memcpy(server.replid,server.master->replid,sizeof(server.replid));
-        server.master_repl_offset = server.master->reploff;
-        clearReplicationId2();
-        /* Let's create the replication backlog if needed. Slaves need to
-         * accumulate the backlog regardless of the fact they have sub-slaves
-         * or not, in order to behave correctly if they are promoted to
-         * masters after a failover. */
-        if (server.repl_backlog == NULL) createReplicationBacklog();
-
-        serverLog(LL_NOTICE, "MASTER <-> SLAVE sync: Finished with success");
-        /* Restart the AOF subsystem now that we finished the sync. This
-         * will trigger an AOF rewrite, and when done will start appending
-         * to the new file. */
-        if (aof_is_enabled) restartAOF();
+        replicationFinishSync(&rsi,aof_is_enabled);
     }
     return;
 
@@ -1302,6 +1854,20 @@ error:
     return;
 }
 
+void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
+    UNUSED(el);
+    UNUSED(privdata);
+    UNUSED(mask);
+
+    /* With a compressed link, data already decompressed must be consumed
+     * without waiting for the socket to be readable again. */
+    do {
+        readSyncBulkPayloadData(fd);
+    } while(server.repl_state == REPL_STATE_TRANSFER &&
+            server.repl_master_decomp &&
+            replDecompressorPending(server.repl_master_decomp));
+}
+
 /* Send a synchronous command to the master. Used to send AUTH and
  * REPLCONF commands before starting the replication with SYNC.
  *
@@ -1458,6 +2024,16 @@ int slaveTryPartialResynchronization(int fd, int read_reply) {
 
     aeDeleteFileEvent(server.el,fd,AE_READABLE);
 
+    /* A final " lzf" argument means the master compresses all it sends
+     * after this reply, see replcompress.c. */
+    replDecompressorRelease(server.repl_master_decomp);
+    server.repl_master_decomp = NULL;
+    if ((!strncmp(reply,"+FULLRESYNC",11) || !strncmp(reply,"+CONTINUE",9)) &&
+        sdslen(reply) > 4 && !strcmp(reply+sdslen(reply)-4," lzf"))
+    {
+        server.repl_master_decomp = replDecompressorCreate();
+    }
+
     if (!strncmp(reply,"+FULLRESYNC",11)) {
         char *replid = NULL, *offset = NULL;
 
@@ -1503,7 +2079,9 @@ int slaveTryPartialResynchronization(int fd, int read_reply) {
          * disconnection. */
         char *start = reply+10;
         char *end = reply+9;
-        while(end[0] != '\r' && end[0] != '\n' && end[0] != '\0') end++;
+        if (end[0] == ' ') end++;
+        while(end[0] != '\r' && end[0] != '\n' && end[0] != ' ' &&
+              end[0] != '\0') end++;
         if (end-start == CONFIG_RUN_ID_SIZE) {
             char new[CONFIG_RUN_ID_SIZE+1];
             memcpy(new,start,CONFIG_RUN_ID_SIZE);
@@ -1717,11 +2295,13 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
      *
      * EOF: supports EOF-style RDB transfer for diskless replication.
      * PSYNC2: supports PSYNC v2, so understands +CONTINUE <new repl ID>.
+     * LZF: asks for a compressed replication stream, see repl-compression.
      *
      * The master will ignore capabilities it does not understand. */
     if (server.repl_state == REPL_STATE_SEND_CAPA) {
         err = sendSynchronousCommand(SYNC_CMD_WRITE,fd,"REPLCONF",
-                "capa","eof","capa","psync2",NULL);
+                "capa","eof","capa","psync2",
+                server.repl_compression ? "capa" : NULL,"lzf",NULL);
         if (err) goto write_error;
         sdsfree(err);
         server.repl_state = REPL_STATE_RECEIVE_CAPA;
@@ -1799,17 +2379,20 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
         }
     }
 
-    /* Prepare a suitable temp file for bulk transfer */
-    while(maxtries--) {
-        snprintf(tmpfile,256,
-            "temp-%d.%ld.rdb",(int)server.unixtime,(long int)getpid());
-        dfd = open(tmpfile,O_CREAT|O_WRONLY|O_EXCL,0644);
-        if (dfd != -1) break;
-        sleep(1);
-    }
-    if (dfd == -1) {
-        serverLog(LL_WARNING,"Opening the temp file needed for MASTER <-> SLAVE synchronization: %s",strerror(errno));
-        goto error;
+    /* Prepare a suitable temp file for bulk transfer, unless the payload
+     * is loaded straight from the socket. */
+    if (replicationDisklessLoadMode() == REPL_DISKLESS_LOAD_DISABLED) {
+        while(maxtries--) {
+            snprintf(tmpfile,256,
+                "temp-%d.%ld.rdb",(int)server.unixtime,(long int)getpid());
+            dfd = open(tmpfile,O_CREAT|O_WRONLY|O_EXCL,0644);
+            if (dfd != -1) break;
+            sleep(1);
+        }
+        if (dfd == -1) {
+            serverLog(LL_WARNING,"Opening the temp file needed for MASTER <-> SLAVE synchronization: %s",strerror(errno));
+            goto error;
+        }
     }
 
     /* Setup the non blocking download of the bulk file. */
@@ -1828,7 +2411,7 @@ void syncWithMaster(aeEventLoop *el, int fd, void *privdata, int mask) {
     server.repl_transfer_last_fsync_off = 0;
     server.repl_transfer_fd = dfd;
     server.repl_transfer_lastio = server.unixtime;
-    server.repl_transfer_tmpfile = zstrdup(tmpfile);
+    server.repl_transfer_tmpfile = (dfd != -1) ? zstrdup(tmpfile) : NULL;
     return;
 
 error:
@@ -1888,9 +2471,12 @@ void undoConnectWithMaster(void) {
 void replicationAbortSyncTransfer(void) {
     serverAssert(server.repl_state == REPL_STATE_TRANSFER);
     undoConnectWithMaster();
-    close(server.repl_transfer_fd);
-    unlink(server.repl_transfer_tmpfile);
-    zfree(server.repl_transfer_tmpfile);
+    if (server.repl_transfer_fd != -1) {
+        close(server.repl_transfer_fd);
+        unlink(server.repl_transfer_tmpfile);
+        zfree(server.repl_transfer_tmpfile);
+        server.repl_transfer_fd = -1;
+    }
 }
 
 /* This function aborts a non blocking replication attempt if there is one
@@ -1952,6 +2538,8 @@ void replicationUnsetMaster(void) {
     if (server.master) freeClient(server.master);
     replicationDiscardCachedMaster();
     cancelReplicationHandshake();
+    replDecompressorRelease(server.repl_master_decomp);
+    server.repl_master_decomp = NULL;
     /* Disconnecting all the slaves is required: we need to inform slaves
      * of the replication ID change (see shiftReplicationId() call). However
      * the slaves will be able to partially resync with us, so it will be
@@ -2124,6 +2712,7 @@ void replicationCacheMaster(client *c) {
      * offsets, including pending transactions, already populated arguments,
      * pending outputs to the master. */
     sdsclear(server.master->querybuf);
+    server.master->qb_pos = 0;
     sdsclear(server.master->pending_querybuf);
     server.master->read_reploff = server.master->reploff;
     if (c->flags & CLIENT_MULTI) discardTransaction(c);
@@ -2568,7 +3157,11 @@ void replicationCron(void) {
             (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_END &&
              server.rdb_child_type != RDB_CHILD_TYPE_SOCKET));
 
-        if (is_presync) {
+        if (is_presync && slave->repl_comp) {
+            slave->repl_comp_buf = replCompress(slave->repl_comp,
+                slave->repl_comp_buf,"\n",1);
+            writePendingCompressedData(slave);
+        } else if (is_presync) {
             if (write(slave->fd, "\n", 1) == -1) {
                 /* Don't worry about socket errors, it's just a ping. */
             }
@@ -2631,7 +3224,9 @@ void replicationCron(void) {
      * In case of diskless replication, we make sure to wait the specified
      * number of seconds (according to configuration) so that other slaves
      * have the time to arrive before we start streaming. */
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
+    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
+        !server.rdb_forkless_in_progress)
+    {
         time_t idle, max_idle = 0;
         int slaves_waiting = 0;
         int mincapa = -1;
@@ -49,6 +49,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/uio.h>
 #include "rio.h"
 #include "util.h"
 #include "crc64.h"
@@ -94,6 +97,7 @@ static const rio rioBufferIO = {
     0,              /* current checksum */
     0,              /* bytes read or written */
     0,              /* read/write chunk size */
+    0,              /* flags */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
@@ -147,6 +151,7 @@ static const rio rioFileIO = {
     0,              /* current checksum */
     0,              /* bytes read or written */
     0,              /* read/write chunk size */
+    0,              /* flags */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
@@ -159,75 +164,202 @@ void rioInitWithFile(rio *r, FILE *fp) {
 
 /* ------------------- File descriptors set implementation ------------------- */
 
+/* The fds of the set are non blocking and are written independently: the
+ * data is appended to a list of chunks shared by all the fds, and every fd
+ * has its own offset in the stream, so a slow fd does not stop the others
+ * as long as the data it did not receive yet fits in 'max_buffer'. */
+
+/* Move the pending buffer to the list of chunks to send. */
+static void rioFdsetPushBuffer(rio *r) {
+    if (sdslen(r->io.fdset.buf) == 0) return;
+    listAddNodeTail(r->io.fdset.chunks,r->io.fdset.buf);
+    r->io.fdset.pos += sdslen(r->io.fdset.buf);
+    r->io.fdset.buf = sdsempty();
+}
+
+/* Return non zero if the fd 'j' of the set has data still to write. */
+static int rioFdsetHasPending(rio *r, int j) {
+    return r->io.fdset.sent[j] != r->io.fdset.pos ||
+           (r->io.fdset.out[j] && sdslen(r->io.fdset.out[j]));
+}
+
+/* Like rioFdsetWriteFd() for an fd with a compressed stream: the rest of
+ * the chunk not yet sent is compressed, then the compressed data is
+ * written. 'sent' counts the bytes of the plain stream compressed. */
+static void rioFdsetWriteCompressedFd(rio *r, int j) {
+    sds out = r->io.fdset.out[j];
+    ssize_t nwritten;
+
+    if (sdslen(out) == 0) {
+        off_t off = r->io.fdset.chunks_off, sent = r->io.fdset.sent[j];
+        listIter li;
+        listNode *ln;
+
+        listRewind(r->io.fdset.chunks,&li);
+        while((ln = listNext(&li)) != NULL) {
+            sds chunk = listNodeValue(ln);
+            off_t len = sdslen(chunk);
+
+            if (off+len > sent) {
+                out = replCompress(r->io.fdset.comp[j],out,
+                                   chunk+(sent-off),len-(sent-off));
+                r->io.fdset.sent[j] = off+len;
+                break;
+            }
+            off += len;
+        }
+        r->io.fdset.out[j] = out;
+        if (sdslen(out) == 0) return;
+    }
+
+    nwritten = write(r->io.fdset.fds[j],out,sdslen(out));
+    if (nwritten > 0) {
+        sdsrange(out,nwritten,-1);
+        r->io.fdset.lastio[j] = mstime();
+    } else if (nwritten == -1 && errno != EAGAIN) {
+        r->io.fdset.state[j] = errno ? errno : EIO;
+    }
+}
+
+/* Write the data not yet sent to the fd 'j' of the set, as much as the
+ * socket accepts without blocking. */
+static void rioFdsetWriteFd(rio *r, int j) {
+    struct iovec iov[16];
+    off_t off = r->io.fdset.chunks_off, sent = r->io.fdset.sent[j];
+    int iovcnt = 0;
+    ssize_t nwritten;
+    listIter li;
+    listNode *ln;
+
+    if (r->io.fdset.comp[j]) {
+        rioFdsetWriteCompressedFd(r,j);
+        return;
+    }
+
+    listRewind(r->io.fdset.chunks,&li);
+    while(iovcnt < 16 && (ln = listNext(&li)) != NULL) {
+        sds chunk = listNodeValue(ln);
+        off_t len = sdslen(chunk);
+
+        if (off+len > sent) {
+            iov[iovcnt].iov_base = chunk+(sent-off);
+            iov[iovcnt].iov_len = len-(sent-off);
+            iovcnt++;
+            sent = off+len;
+        }
+        off += len;
+    }
+    if (iovcnt == 0) return;
+
+    nwritten = writev(r->io.fdset.fds[j],iov,iovcnt);
+    if (nwritten > 0) {
+        r->io.fdset.sent[j] += nwritten;
+        r->io.fdset.lastio[j] = mstime();
+    } else if (nwritten == -1 && errno != EAGAIN) {
+        r->io.fdset.state[j] = errno ? errno : EIO;
+    }
+}
+
+/* Write to all the fds without blocking, and release the chunks every fd
+ * received. Fds not making progress for 'timeout' milliseconds are set in
+ * error. The 'fd_done' callback is called for the fds in error, and if
+ * 'final' is true (no more data will be written) for the fds that received
+ * the whole stream. Returns the number of fds with data still to send. */
+static int rioFdsetPump(rio *r, int final) {
+    off_t min_sent = r->io.fdset.pos;
+    long long now = mstime();
+    int j, pending = 0;
+
+    for (j = 0; j < r->io.fdset.numfds; j++) {
+        if (r->io.fdset.state[j] != 0) continue;
+        if (!rioFdsetHasPending(r,j)) {
+            r->io.fdset.lastio[j] = now; /* Idle, nothing to send. */
+            continue;
+        }
+        rioFdsetWriteFd(r,j);
+        if (r->io.fdset.state[j] == 0 &&
+            rioFdsetHasPending(r,j) &&
+            now - r->io.fdset.lastio[j] > r->io.fdset.timeout)
+        {
+            r->io.fdset.state[j] = ETIMEDOUT;
+        }
+        if (r->io.fdset.state[j] != 0) continue;
+        if (r->io.fdset.sent[j] < min_sent) min_sent = r->io.fdset.sent[j];
+        if (rioFdsetHasPending(r,j)) pending++;
+    }
+
+    for (j = 0; j < r->io.fdset.numfds; j++) {
+        if (r->io.fdset.done[j]) continue;
+        if (r->io.fdset.state[j] == 0 &&
+            (!final || rioFdsetHasPending(r,j))) continue;
+        r->io.fdset.done[j] = 1;
+        if (r->io.fdset.fd_done) r->io.fdset.fd_done(r,j);
+    }
+
+    while(listLength(r->io.fdset.chunks)) {
+        listNode *ln = listFirst(r->io.fdset.chunks);
+        off_t len = sdslen(listNodeValue(ln));
+
+        if (r->io.fdset.chunks_off+len > min_sent) break;
+        r->io.fdset.chunks_off += len;
+        sdsfree(listNodeValue(ln));
+        listDelNode(r->io.fdset.chunks,ln);
+    }
+    return pending;
+}
+
+/* Wait up to 100 milliseconds for one of the fds with data to send to
+ * become writable. */
+static void rioFdsetWait(rio *r) {
+    struct pollfd *pfd = zmalloc(sizeof(*pfd)*r->io.fdset.numfds);
+    int j, n = 0;
+
+    for (j = 0; j < r->io.fdset.numfds; j++) {
+        if (r->io.fdset.state[j] != 0 || !rioFdsetHasPending(r,j)) continue;
+        pfd[n].fd = r->io.fdset.fds[j];
+        pfd[n].events = POLLOUT;
+        n++;
+    }
+    if (n) poll(pfd,n,100);
+    zfree(pfd);
+}
+
 /* Returns 1 or 0 for success/failure.
  * The function returns success as long as we are able to correctly write
  * to at least one file descriptor.
  *
- * When buf is NULL and len is 0, the function performs a flush operation
- * if there is some pending buffer, so this function is also used in order
- * to implement rioFdsetFlush(). */
+ * When buf is NULL and len is 0, the function performs a flush operation,
+ * waiting for all the fds to receive the whole stream, so this function is
+ * also used in order to implement rioFdsetFlush(). */
 static size_t rioFdsetWrite(rio *r, const void *buf, size_t len) {
-    ssize_t retval;
-    int j;
-    unsigned char *p = (unsigned char*) buf;
-    int doflush = (buf == NULL && len == 0);
+    int j, doflush = (buf == NULL && len == 0);
 
     /* To start we always append to our buffer. If it gets larger than
      * a given size, we actually write to the sockets. */
     if (len) {
         r->io.fdset.buf = sdscatlen(r->io.fdset.buf,buf,len);
-        len = 0; /* Prevent entering the while below if we don't flush. */
-        if (sdslen(r->io.fdset.buf) > PROTO_IOBUF_LEN) doflush = 1;
+        if (sdslen(r->io.fdset.buf) <= PROTO_IOBUF_LEN) return 1;
     }
+    rioFdsetPushBuffer(r);
 
     if (doflush) {
-        p = (unsigned char*) r->io.fdset.buf;
-        len = sdslen(r->io.fdset.buf);
-    }
-
-    /* Write in little chunchs so that when there are big writes we
-     * parallelize while the kernel is sending data in background to
-     * the TCP socket. */
-    while(len) {
-        size_t count = len < 1024 ? len : 1024;
-        int broken = 0;
-        for (j = 0; j < r->io.fdset.numfds; j++) {
-            if (r->io.fdset.state[j] != 0) {
-                /* Skip FDs alraedy in error. */
-                broken++;
-                continue;
-            }
-
-            /* Make sure to write 'count' bytes to the socket regardless
-             * of short writes. */
-            size_t nwritten = 0;
-            while(nwritten != count) {
-                retval = write(r->io.fdset.fds[j],p+nwritten,count-nwritten);
-                if (retval <= 0) {
-                    /* With blocking sockets, which is the sole user of this
-                     * rio target, EWOULDBLOCK is returned only because of
-                     * the SO_SNDTIMEO socket option, so we translate the error
-                     * into one more recognizable by the user. */
-                    if (retval == -1 && errno == EWOULDBLOCK) errno = ETIMEDOUT;
-                    break;
-                }
-                nwritten += retval;
-            }
-
-            if (nwritten != count) {
-                /* Mark this FD as broken. */
-                r->io.fdset.state[j] = errno;
-                if (r->io.fdset.state[j] == 0) r->io.fdset.state[j] = EIO;
-            }
+        /* Wait for every fd to get the whole stream. */
+        while(rioFdsetPump(r,1)) rioFdsetWait(r);
+    } else {
+        /* Wait for the slowest fd only if it lags too much. */
+        rioFdsetPump(r,0);
+        while(r->io.fdset.max_buffer &&
+              r->io.fdset.pos - r->io.fdset.chunks_off >
+              (off_t)r->io.fdset.max_buffer)
+        {
+            rioFdsetWait(r);
+            if (rioFdsetPump(r,0) == 0) break;
         }
-        if (broken == r->io.fdset.numfds) return 0; /* All the FDs in error. */
-        p += count;
-        len -= count;
-        r->io.fdset.pos += count;
     }
 
-    if (doflush) sdsclear(r->io.fdset.buf);
-    return 1;
+    for (j = 0; j < r->io.fdset.numfds; j++)
+        if (r->io.fdset.state[j] == 0) return 1;
+    return 0; /* All the FDs in error. */
 }
 
 /* Returns 1 or 0 for success/failure. */
@@ -260,29 +392,195 @@ static const rio rioFdsetIO = {
     0,              /* current checksum */
     0,              /* bytes read or written */
     0,              /* read/write chunk size */
+    0,              /* flags */
     { { NULL, 0 } } /* union for io-specific vars */
 };
 
-void rioInitWithFdset(rio *r, int *fds, int numfds) {
+/* Create a target writing to the 'numfds' non blocking sockets 'fds'. The
+ * writer is blocked only if some fd did not receive more than 'max_buffer'
+ * bytes of the stream (0 means no limit). An fd not accepting data for
+ * 'timeout' milliseconds is set in error with ETIMEDOUT. */
+void rioInitWithFdset(rio *r, int *fds, int numfds, size_t max_buffer,
+                      long long timeout)
+{
     int j;
 
     *r = rioFdsetIO;
     r->io.fdset.fds = zmalloc(sizeof(int)*numfds);
     r->io.fdset.state = zmalloc(sizeof(int)*numfds);
+    r->io.fdset.sent = zmalloc(sizeof(off_t)*numfds);
+    r->io.fdset.lastio = zmalloc(sizeof(long long)*numfds);
+    r->io.fdset.done = zmalloc(sizeof(int)*numfds);
+    r->io.fdset.comp = zmalloc(sizeof(replCompressor*)*numfds);
+    r->io.fdset.out = zmalloc(sizeof(sds)*numfds);
     memcpy(r->io.fdset.fds,fds,sizeof(int)*numfds);
-    for (j = 0; j < numfds; j++) r->io.fdset.state[j] = 0;
+    for (j = 0; j < numfds; j++) {
+        r->io.fdset.state[j] = 0;
+        r->io.fdset.sent[j] = 0;
+        r->io.fdset.lastio[j] = mstime();
+        r->io.fdset.done[j] = 0;
+        r->io.fdset.comp[j] = NULL;
+        r->io.fdset.out[j] = NULL;
+    }
     r->io.fdset.numfds = numfds;
     r->io.fdset.pos = 0;
     r->io.fdset.buf = sdsempty();
+    r->io.fdset.chunks = listCreate();
+    r->io.fdset.chunks_off = 0;
+    r->io.fdset.fd_done = NULL;
+    r->io.fdset.max_buffer = max_buffer;
+    r->io.fdset.timeout = timeout;
 }
 
 /* release the rio stream. */
 void rioFreeFdset(rio *r) {
+    listNode *ln;
+    int j;
+
+    while((ln = listFirst(r->io.fdset.chunks)) != NULL) {
+        sdsfree(listNodeValue(ln));
+        listDelNode(r->io.fdset.chunks,ln);
+    }
+    listRelease(r->io.fdset.chunks);
     zfree(r->io.fdset.fds);
     zfree(r->io.fdset.state);
+    zfree(r->io.fdset.sent);
+    zfree(r->io.fdset.lastio);
+    zfree(r->io.fdset.done);
+    for (j = 0; j < r->io.fdset.numfds; j++) {
+        replCompressorRelease(r->io.fdset.comp[j]);
+        sdsfree(r->io.fdset.out[j]);
+    }
+    zfree(r->io.fdset.comp);
+    zfree(r->io.fdset.out);
     sdsfree(r->io.fdset.buf);
 }
 
+/* Compress the stream written to the fd 'j' of the set. Must be called
+ * before anything is written. */
+void rioFdsetEnableCompression(rio *r, int j) {
+    r->io.fdset.comp[j] = replCompressorCreate();
+    r->io.fdset.out[j] = sdsempty();
+}
+
+/* ------------------- File descriptor implementation ------------------- */
+
+/* Returns 1 or 0 for success/failure. */
+static size_t rioFdWrite(rio *r, const void *buf, size_t len) {
+    UNUSED(r);
+    UNUSED(buf);
+    UNUSED(len);
+    return 0; /* Error, this target does not support writing. */
+}
+
+/* Returns 1 or 0 for success/failure. The fd is non blocking: while
+ * waiting for data the 'wait' callback is called from time to time. Since
+ * the RDB loading code does a lot of small reads, data is read ahead in a
+ * buffer, but never more than 'read_limit' bytes in total, so that what
+ * follows in the stream is left in the fd. */
+static size_t rioFdRead(rio *r, void *buf, size_t len) {
+    size_t avail = sdslen(r->io.fd.buf)-r->io.fd.pos;
+
+    if (avail < len) {
+        size_t toread = len-avail;
+
+        if (r->io.fd.read_limit) {
+            size_t left = r->io.fd.read_limit-r->io.fd.read_so_far;
+            if (left < toread) {
+                r->flags |= RIO_FLAG_READ_ERROR;
+                errno = EOVERFLOW;
+                return 0;
+            }
+            if (toread < PROTO_IOBUF_LEN) toread = PROTO_IOBUF_LEN;
+            if (toread > left) toread = left;
+        } else {
+            if (toread < PROTO_IOBUF_LEN) toread = PROTO_IOBUF_LEN;
+        }
+
+        /* Drop the data already consumed, and make room for the new one. */
+        sdsrange(r->io.fd.buf,r->io.fd.pos,-1);
+        r->io.fd.pos = 0;
+        r->io.fd.buf = sdsMakeRoomFor(r->io.fd.buf,toread);
+        while (sdslen(r->io.fd.buf) < len) {
+            size_t buflen = sdslen(r->io.fd.buf);
+            ssize_t retval = r->io.fd.fdread ?
+                r->io.fd.fdread(r->io.fd.fd,r->io.fd.buf+buflen,
+                                avail+toread-buflen) :
+                read(r->io.fd.fd,r->io.fd.buf+buflen,avail+toread-buflen);
+            if (retval == -1 && errno == EINTR) continue;
+            if (retval == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                int mask = aeWait(r->io.fd.fd,AE_READABLE,RIO_FD_WAIT_MS);
+
+                if (mask > 0 || (mask == -1 && errno == EINTR)) continue;
+                if (mask == 0 && (r->io.fd.wait == NULL || r->io.fd.wait(r)))
+                    continue;
+                if (mask == 0) errno = ETIMEDOUT;
+            }
+            if (retval <= 0) {
+                if (retval == 0) errno = ECONNRESET;
+                r->flags |= RIO_FLAG_READ_ERROR;
+                return 0;
+            }
+            sdsIncrLen(r->io.fd.buf,retval);
+            r->io.fd.read_so_far += retval;
+        }
+    }
+    memcpy(buf,r->io.fd.buf+r->io.fd.pos,len);
+    r->io.fd.pos += len;
+    return 1;
+}
+
+/* Returns the number of bytes read from the fd. */
+static off_t rioFdTell(rio *r) {
+    return r->io.fd.read_so_far;
+}
+
+/* Nothing to flush for a read only target. */
+static int rioFdFlush(rio *r) {
+    UNUSED(r);
+    return 1;
+}
+
+static const rio rioFdIO = {
+    rioFdRead,
+    rioFdWrite,
+    rioFdTell,
+    rioFdFlush,
+    NULL,           /* update_checksum */
+    0,              /* current checksum */
+    0,              /* bytes read or written */
+    0,              /* read/write chunk size */
+    0,              /* flags */
+    { { NULL, 0 } } /* union for io-specific vars */
+};
+
+/* Create a rio reading from 'fd'. If 'read_limit' is not zero, no more
+ * than 'read_limit' bytes are read from the fd. */
+void rioInitWithFd(rio *r, int fd, size_t read_limit) {
+    *r = rioFdIO;
+    r->io.fd.fd = fd;
+    r->io.fd.pos = 0;
+    r->io.fd.buf = sdsempty();
+    r->io.fd.read_limit = read_limit;
+    r->io.fd.read_so_far = 0;
+    r->io.fd.wait = NULL;
+    r->io.fd.fdread = NULL;
+}
+
+/* Release the rio stream. If 'remaining' is not NULL, it is set to the
+ * data read ahead from the fd but not consumed, or to NULL if there is
+ * none: the caller owns the returned sds. */
+void rioFreeFd(rio *r, sds *remaining) {
+    if (remaining && (size_t)r->io.fd.pos < sdslen(r->io.fd.buf)) {
+        sdsrange(r->io.fd.buf,r->io.fd.pos,-1);
+        *remaining = r->io.fd.buf;
+    } else {
+        sdsfree(r->io.fd.buf);
+        if (remaining) *remaining = NULL;
+    }
+    r->io.fd.buf = NULL;
+}
+
 /* ---------------------------- Generic functions ---------------------------- */
 
 /* This function can be installed both in memory and file streams when checksum
@@ -60,6 +60,9 @@ struct _rio {
     /* maximum single read or write chunk size */
     size_t max_processing_chunk;
 
+    /* RIO_FLAG_* flags. */
+    int flags;
+
     /* Backend-specific vars. */
     union {
         /* In-memory buffer target. */
@@ -73,19 +76,52 @@ struct _rio {
             off_t buffered; /* Bytes written since last fsync. */
             off_t autosync; /* fsync after 'autosync' bytes written. */
         } file;
-        /* Multiple FDs target (used to write to N sockets). */
+        /* Multiple FDs target (used to write to N sockets). Every fd is
+         * written independently with non blocking writes: the data some
+         * fd did not receive yet is kept in 'chunks'. */
         struct {
             int *fds;       /* File descriptors. */
             int *state;     /* Error state of each fd. 0 (if ok) or errno. */
             int numfds;
-            off_t pos;
+            off_t pos;      /* Bytes moved from 'buf' to 'chunks'. */
             sds buf;
+            struct list *chunks; /* sds chunks not yet sent to every fd. */
+            off_t chunks_off;    /* Stream offset of the first chunk. */
+            off_t *sent;         /* Bytes written to each fd. */
+            long long *lastio;   /* Last write to each fd, milliseconds. */
+            int *done;           /* 1 if the fd got the stream or failed. */
+            void (*fd_done)(struct _rio *r, int j); /* Called once per fd
+                                    when 'done' is set, may be NULL. */
+            size_t max_buffer;   /* Block the writer when the slowest fd lags
+                                    more than this, 0 = no limit. */
+            long long timeout;   /* Milliseconds without progress after which
+                                    an fd is considered in error. */
+            struct replCompressor **comp; /* Compressor of each fd, or NULL
+                                    if the fd gets the plain stream. */
+            sds *out;            /* Compressed data not yet written. */
         } fdset;
+        /* File descriptor target (used to read from a socket). */
+        struct {
+            int fd;             /* File descriptor. */
+            off_t pos;          /* Bytes of 'buf' already consumed. */
+            sds buf;            /* Data read ahead from the fd. */
+            size_t read_limit;  /* Don't read more than this, 0 = no limit. */
+            size_t read_so_far; /* Bytes read from the fd so far. */
+            /* Called when no data arrived for RIO_FD_WAIT_MS milliseconds,
+             * returns 0 to give up. If NULL the target waits forever. */
+            int (*wait)(struct _rio *);
+            /* Used instead of read(2) when not NULL. */
+            ssize_t (*fdread)(int fd, void *buf, size_t len);
+        } fd;
     } io;
 };
 
 typedef struct _rio rio;
 
+#define RIO_FLAG_READ_ERROR (1<<0) /* The fd target failed to read. */
+
+#define RIO_FD_WAIT_MS 100 /* Period of the fd target wait callback. */
+
 /* The following functions are our interface with the stream. They'll call the
  * actual implementation of read / write / tell, and will update the checksum
  * if needed. */
@@ -124,11 +160,21 @@ static inline int rioFlush(rio *r) {
     return r->flush(r);
 }
 
+/* Returns non zero if a read of the fd target failed, to tell a short read
+ * because of an I/O error (for instance a closed socket) from a truncated
+ * or corrupted stream. */
+static inline int rioGetReadError(rio *r) {
+    return (r->flags & RIO_FLAG_READ_ERROR) != 0;
+}
+
 void rioInitWithFile(rio *r, FILE *fp);
 void rioInitWithBuffer(rio *r, sds s);
-void rioInitWithFdset(rio *r, int *fds, int numfds);
+void rioInitWithFdset(rio *r, int *fds, int numfds, size_t max_buffer, long long timeout);
+void rioInitWithFd(rio *r, int fd, size_t read_limit);
 
+void rioFdsetEnableCompression(rio *r, int j);
 void rioFreeFdset(rio *r);
+void rioFreeFd(rio *r, sds *remaining);
 
 size_t rioWriteBulkCount(rio *r, char prefix, int count);
 size_t rioWriteBulkString(rio *r, const char *buf, size_t len);
@@ -434,6 +434,7 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
 
     /* Setup our fake client for command execution */
     c->argv = argv;
+    c->argv_len = argc;
     c->argc = argc;
 
     /* Log the command if debugging is active. */
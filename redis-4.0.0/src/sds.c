@@ -55,6 +55,12 @@ static inline int sdsHdrSize(char type) {
     return 0;
 }
 
+/* Size of the auxiliary data stored before the header, see sdsnewlenaux(). */
+static inline int sdsAuxSize(char flags) {
+    return ((flags&SDS_TYPE_MASK) != SDS_TYPE_5 && (flags&SDS_AUX)) ?
+           SDS_AUX_SIZE : 0;
+}
+
 static inline char sdsReqType(size_t string_size) {
     if (string_size < 1<<5)
         return SDS_TYPE_5;
@@ -81,21 +87,24 @@ static inline char sdsReqType(size_t string_size) {
  * You can print the string with printf() as there is an implicit \0 at the
  * end of the string. However the string is binary safe and can contain
  * \0 characters in the middle, as the length is stored in the sds header. */
-sds sdsnewlen(const void *init, size_t initlen) {
+static sds _sdsnewlen(const void *init, size_t initlen, int auxlen) {
     void *sh;
     sds s;
     char type = sdsReqType(initlen);
     /* Empty strings are usually created in order to append. Use type 8
-     * since type 5 is not good at this. */
-    if (type == SDS_TYPE_5 && initlen == 0) type = SDS_TYPE_8;
+     * since type 5 is not good at this. Type 5 can't flag the presence of
+     * auxiliary data either. */
+    if (type == SDS_TYPE_5 && (initlen == 0 || auxlen)) type = SDS_TYPE_8;
     int hdrlen = sdsHdrSize(type);
     unsigned char *fp; /* flags pointer. */
 
-    sh = s_malloc(hdrlen+initlen+1);
-    if (!init)
-        memset(sh, 0, hdrlen+initlen+1);
+    sh = s_malloc(auxlen+hdrlen+initlen+1);
     if (sh == NULL) return NULL;
-    s = (char*)sh+hdrlen;
+    if (!init)
+        memset(sh, 0, auxlen+hdrlen+initlen+1);
+    else if (auxlen)
+        memset(sh, 0, auxlen);
+    s = (char*)sh+auxlen+hdrlen;
     fp = ((unsigned char*)s)-1;
     switch(type) {
         case SDS_TYPE_5: {
@@ -131,12 +140,35 @@ sds sdsnewlen(const void *init, size_t initlen) {
             break;
         }
     }
+    if (auxlen) *fp |= SDS_AUX;
     if (initlen && init)
         memcpy(s, init, initlen);
     s[initlen] = '\0';
     return s;
 }
 
+sds sdsnewlen(const void *init, size_t initlen) {
+    return _sdsnewlen(init, initlen, 0);
+}
+
+/* Like sdsnewlen(), but SDS_AUX_SIZE bytes of auxiliary data, initialized
+ * to zero, are stored before the header in the same allocation. The caller
+ * can use them for its own purposes, accessing them with sdsaux(). The
+ * auxiliary data is preserved by the functions that reallocate the string,
+ * but not copied by sdsdup(). */
+sds sdsnewlenaux(const void *init, size_t initlen) {
+    return _sdsnewlen(init, initlen, SDS_AUX_SIZE);
+}
+
+/* Return a pointer to the auxiliary data of a string created with
+ * sdsnewlenaux(), or NULL if the string has no auxiliary data. */
+void *sdsaux(const sds s) {
+    unsigned char flags = s[-1];
+    int auxlen = sdsAuxSize(flags);
+
+    return auxlen ? s-sdsHdrSize(flags)-auxlen : NULL;
+}
+
 /* Create an empty (zero length) sds string. Even in this case the string
  * always has an implicit null term. */
 sds sdsempty(void) {
@@ -157,7 +189,7 @@ sds sdsdup(const sds s) {
 /* Free an sds string. No operation is performed if 's' is NULL. */
 void sdsfree(sds s) {
     if (s == NULL) return;
-    s_free((char*)s-sdsHdrSize(s[-1]));
+    s_free((char*)s-sdsHdrSize(s[-1])-sdsAuxSize(s[-1]));
 }
 
 /* Set the sds string length to the length as obtained with strlen(), so
@@ -199,13 +231,13 @@ sds sdsMakeRoomFor(sds s, size_t addlen) {
     size_t avail = sdsavail(s);
     size_t len, newlen;
     char type, oldtype = s[-1] & SDS_TYPE_MASK;
-    int hdrlen;
+    int hdrlen, auxlen = sdsAuxSize(s[-1]);
 
     /* Return ASAP if there is enough space left. */
     if (avail >= addlen) return s;
 
     len = sdslen(s);
-    sh = (char*)s-sdsHdrSize(oldtype);
+    sh = (char*)s-sdsHdrSize(oldtype)-auxlen;
     newlen = (len+addlen);
     if (newlen < SDS_MAX_PREALLOC)
         newlen *= 2;
@@ -221,18 +253,19 @@ sds sdsMakeRoomFor(sds s, size_t addlen) {
 
     hdrlen = sdsHdrSize(type);
     if (oldtype==type) {
-        newsh = s_realloc(sh, hdrlen+newlen+1);
+        newsh = s_realloc(sh, auxlen+hdrlen+newlen+1);
         if (newsh == NULL) return NULL;
-        s = (char*)newsh+hdrlen;
+        s = (char*)newsh+auxlen+hdrlen;
     } else {
         /* Since the header size changes, need to move the string forward,
          * and can't use realloc */
-        newsh = s_malloc(hdrlen+newlen+1);
+        newsh = s_malloc(auxlen+hdrlen+newlen+1);
         if (newsh == NULL) return NULL;
-        memcpy((char*)newsh+hdrlen, s, len+1);
+        memcpy(newsh, sh, auxlen);
+        memcpy((char*)newsh+auxlen+hdrlen, s, len+1);
         s_free(sh);
-        s = (char*)newsh+hdrlen;
-        s[-1] = type;
+        s = (char*)newsh+auxlen+hdrlen;
+        s[-1] = type | (auxlen ? SDS_AUX : 0);
         sdssetlen(s, len);
     }
     sdssetalloc(s, newlen);
@@ -248,23 +281,25 @@ sds sdsMakeRoomFor(sds s, size_t addlen) {
 sds sdsRemoveFreeSpace(sds s) {
     void *sh, *newsh;
     char type, oldtype = s[-1] & SDS_TYPE_MASK;
-    int hdrlen;
+    int hdrlen, auxlen = sdsAuxSize(s[-1]);
     size_t len = sdslen(s);
-    sh = (char*)s-sdsHdrSize(oldtype);
+    sh = (char*)s-sdsHdrSize(oldtype)-auxlen;
 
     type = sdsReqType(len);
+    if (type == SDS_TYPE_5 && auxlen) type = SDS_TYPE_8;
     hdrlen = sdsHdrSize(type);
     if (oldtype==type) {
-        newsh = s_realloc(sh, hdrlen+len+1);
+        newsh = s_realloc(sh, auxlen+hdrlen+len+1);
         if (newsh == NULL) return NULL;
-        s = (char*)newsh+hdrlen;
+        s = (char*)newsh+auxlen+hdrlen;
     } else {
-        newsh = s_malloc(hdrlen+len+1);
+        newsh = s_malloc(auxlen+hdrlen+len+1);
         if (newsh == NULL) return NULL;
-        memcpy((char*)newsh+hdrlen, s, len+1);
+        memcpy(newsh, sh, auxlen);
+        memcpy((char*)newsh+auxlen+hdrlen, s, len+1);
         s_free(sh);
-        s = (char*)newsh+hdrlen;
-        s[-1] = type;
+        s = (char*)newsh+auxlen+hdrlen;
+        s[-1] = type | (auxlen ? SDS_AUX : 0);
         sdssetlen(s, len);
     }
     sdssetalloc(s, len);
@@ -273,20 +308,20 @@ sds sdsRemoveFreeSpace(sds s) {
 
 /* Return the total size of the allocation of the specifed sds string,
  * including:
- * 1) The sds header before the pointer.
+ * 1) The sds header (and auxiliary data, if any) before the pointer.
  * 2) The string.
  * 3) The free buffer at the end if any.
  * 4) The implicit null term.
  */
 size_t sdsAllocSize(sds s) {
     size_t alloc = sdsalloc(s);
-    return sdsHdrSize(s[-1])+alloc+1;
+    return sdsAuxSize(s[-1])+sdsHdrSize(s[-1])+alloc+1;
 }
 
 /* Return the pointer of the actual SDS allocation (normally SDS strings
  * are referenced by the start of the string buffer). */
 void *sdsAllocPtr(sds s) {
-    return (void*) (s-sdsHdrSize(s[-1]));
+    return (void*) (s-sdsHdrSize(s[-1])-sdsAuxSize(s[-1]));
 }
 
 /* Increment the sds length and decrements the left free space at the
@@ -50,25 +50,25 @@ struct __attribute__ ((__packed__)) sdshdr5 {
 struct __attribute__ ((__packed__)) sdshdr8 {
     uint8_t len; /* used */
     uint8_t alloc; /* excluding the header and null terminator */
-    unsigned char flags; /* 3 lsb of type, 5 unused bits */
+    unsigned char flags; /* 3 lsb of type, SDS_AUX, SDS_EMBEDDED, 3 unused bits */
     char buf[];
 };
 struct __attribute__ ((__packed__)) sdshdr16 {
     uint16_t len; /* used */
     uint16_t alloc; /* excluding the header and null terminator */
-    unsigned char flags; /* 3 lsb of type, 5 unused bits */
+    unsigned char flags; /* 3 lsb of type, SDS_AUX, SDS_EMBEDDED, 3 unused bits */
     char buf[];
 };
 struct __attribute__ ((__packed__)) sdshdr32 {
     uint32_t len; /* used */
     uint32_t alloc; /* excluding the header and null terminator */
-    unsigned char flags; /* 3 lsb of type, 5 unused bits */
+    unsigned char flags; /* 3 lsb of type, SDS_AUX, SDS_EMBEDDED, 3 unused bits */
     char buf[];
 };
 struct __attribute__ ((__packed__)) sdshdr64 {
     uint64_t len; /* used */
     uint64_t alloc; /* excluding the header and null terminator */
-    unsigned char flags; /* 3 lsb of type, 5 unused bits */
+    unsigned char flags; /* 3 lsb of type, SDS_AUX, SDS_EMBEDDED, 3 unused bits */
     char buf[];
 };
 
@@ -82,6 +82,9 @@ struct __attribute__ ((__packed__)) sdshdr64 {
 #define SDS_HDR_VAR(T,s) struct sdshdr##T *sh = (void*)((s)-(sizeof(struct sdshdr##T)));
 #define SDS_HDR(T,s) ((struct sdshdr##T *)((s)-(sizeof(struct sdshdr##T))))
 #define SDS_TYPE_5_LEN(f) ((f)>>SDS_TYPE_BITS)
+#define SDS_AUX (1<<SDS_TYPE_BITS) /* Flag: auxiliary data before header. */
+#define SDS_AUX_SIZE 8
+#define SDS_EMBEDDED (2<<SDS_TYPE_BITS) /* Flag: not a malloc'ed string. */
 
 static inline size_t sdslen(const sds s) {
     unsigned char flags = s[-1];
@@ -100,6 +103,15 @@ static inline size_t sdslen(const sds s) {
     return 0;
 }
 
+/* Return true if the string was built by the caller inside a bigger
+ * allocation, setting the SDS_EMBEDDED flag. Such strings can't be freed or
+ * reallocated by the sds functions, and are released by the caller with the
+ * allocation containing them. Type 5 strings can't be embedded. */
+static inline int sdsembedded(const sds s) {
+    unsigned char flags = s[-1];
+    return (flags&SDS_TYPE_MASK) != SDS_TYPE_5 && (flags&SDS_EMBEDDED);
+}
+
 static inline size_t sdsavail(const sds s) {
     unsigned char flags = s[-1];
     switch(flags&SDS_TYPE_MASK) {
@@ -215,6 +227,8 @@ static inline void sdssetalloc(sds s, size_t newlen) {
 }
 
 sds sdsnewlen(const void *init, size_t initlen);
+sds sdsnewlenaux(const void *init, size_t initlen);
+void *sdsaux(const sds s);
 sds sdsnew(const char *init);
 sds sdsempty(void);
 sds sdsdup(const sds s);
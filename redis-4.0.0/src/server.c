@@ -479,6 +479,15 @@ void dictSdsDestructor(void *privdata, void *val)
     sdsfree(val);
 }
 
+/* The keys of the keyspace embedded in their value object (see
+ * objectEmbedKey()) are released together with the value. */
+void dictDbKeyDestructor(void *privdata, void *key)
+{
+    DICT_NOTUSED(privdata);
+
+    if (!sdsembedded(key)) sdsfree(key);
+}
+
 int dictObjKeyCompare(void *privdata, const void *key1,
         const void *key2)
 {
@@ -577,8 +586,9 @@ dictType dbDictType = {
     NULL,                       /* key dup */
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
-    dictSdsDestructor,          /* key destructor */
-    dictObjectDestructor   /* val destructor */
+    dictDbKeyDestructor,        /* key destructor */
+    dictObjectDestructor,       /* val destructor */
+    1                           /* bucketed */
 };
 
 /* server.lua_scripts sha (as sds string) -> scripts (as robj) cache. */
@@ -591,16 +601,6 @@ dictType shaScriptObjectDictType = {
     dictObjectDestructor        /* val destructor */
 };
 
-/* Db->expires */
-dictType keyptrDictType = {
-    dictSdsHash,                /* hash function */
-    NULL,                       /* key dup */
-    NULL,                       /* val dup */
-    dictSdsKeyCompare,          /* key compare */
-    NULL,                       /* key destructor */
-    NULL                        /* val destructor */
-};
-
 /* Command table. sds string -> command struct pointer. */
 dictType commandTableDictType = {
     dictSdsCaseHash,            /* hash function */
@@ -702,10 +702,13 @@ int htNeedsResize(dict *dict) {
 /* If the percentage of used slots in the HT reaches HASHTABLE_MIN_FILL
  * we resize the hash table to save memory */
 void tryResizeHashTables(int dbid) {
+    mstime_t latency;
+
+    latencyStartMonitor(latency);
     if (htNeedsResize(server.db[dbid].dict))
         dictResize(server.db[dbid].dict);
-    if (htNeedsResize(server.db[dbid].expires))
-        dictResize(server.db[dbid].expires);
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("dict-resize",latency);
 }
 
 /* Our hash table implementation performs rehashing incrementally while
@@ -716,17 +719,16 @@ void tryResizeHashTables(int dbid) {
  * The function returns 1 if some rehashing was performed, otherwise 0
  * is returned. */
 int incrementallyRehash(int dbid) {
-    /* Keys dictionary */
-    if (dictIsRehashing(server.db[dbid].dict)) {
-        dictRehashMilliseconds(server.db[dbid].dict,1);
-        return 1; /* already used our millisecond for this loop... */
-    }
-    /* Expires */
-    if (dictIsRehashing(server.db[dbid].expires)) {
-        dictRehashMilliseconds(server.db[dbid].expires,1);
-        return 1; /* already used our millisecond for this loop... */
-    }
-    return 0;
+    dict *d = server.db[dbid].dict;
+    mstime_t latency;
+
+    if (!dictIsRehashing(d)) return 0;
+
+    latencyStartMonitor(latency);
+    dictRehashMilliseconds(d,1);
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("dict-rehash",latency);
+    return 1; /* already used our millisecond for this loop... */
 }
 
 /* This function is called once a background process of some kind terminates,
@@ -899,8 +901,9 @@ void databasesCron(void) {
         /* Don't test more DBs than we have. */
         if (dbs_per_call > server.dbnum) dbs_per_call = server.dbnum;
 
-        /* Resize */
-        for (j = 0; j < dbs_per_call; j++) {
+        /* Resize. Not while a BGSAVE without fork is scanning the
+         * keyspace, since it relies on the tables never being shrunk. */
+        for (j = 0; j < dbs_per_call && !server.rdb_forkless_in_progress; j++) {
             tryResizeHashTables(resize_db % server.dbnum);
             resize_db++;
         }
@@ -1006,7 +1009,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 
             size = dictSlots(server.db[j].dict);
             used = dictSize(server.db[j].dict);
-            vkeys = dictSize(server.db[j].expires);
+            vkeys = dictMarkedSize(server.db[j].dict);
             if (used || vkeys) {
                 serverLog(LL_VERBOSE,"DB %d: %lld keys (%lld volatile) in %lld slots HT.",j,used,vkeys,size);
                 /* dictPrintStats(server.dict); */
@@ -1031,10 +1034,16 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     /* Handle background operations on Redis databases. */
     databasesCron();
 
+    /* Spill cold values to disk if above tiered-storage-max-memory. */
+    tieredCron();
+
+    /* Make progress with the BGSAVE without fork in progress, if any. */
+    snapshotCron();
+
     /* Start a scheduled AOF rewrite if this was requested by the user while
      * a BGSAVE was in progress. */
     if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
-        server.aof_rewrite_scheduled)
+        !server.rdb_forkless_in_progress && server.aof_rewrite_scheduled)
     {
         rewriteAppendOnlyFileBackground();
     }
@@ -1074,7 +1083,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
             updateDictResizePolicy();
             closeChildInfoPipe();
         }
-    } else {
+    } else if (!server.rdb_forkless_in_progress) {
         /* If there is not a background saving/rewrite in progress check if
          * we have to save/rewrite now */
          for (j = 0; j < server.saveparamslen; j++) {
@@ -1160,7 +1169,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
      * make sure when refactoring this file to keep this order. This is useful
      * because we want to give priority to RDB savings for replication. */
     if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
-        server.rdb_bgsave_scheduled &&
+        !server.rdb_forkless_in_progress && server.rdb_bgsave_scheduled &&
         (server.unixtime-server.lastbgsave_try > CONFIG_BGSAVE_RETRY_DELAY ||
          server.lastbgsave_status == C_OK))
     {
@@ -1178,6 +1187,10 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 void beforeSleep(struct aeEventLoop *eventLoop) {
     UNUSED(eventLoop);
 
+    /* Read, parse and execute the commands of the clients whose reads were
+     * postponed to be handled by the I/O threads. */
+    handleClientsWithPendingReadsUsingThreads();
+
     /* Call the Redis Cluster before sleep function. Note that this function
      * may change the state of Redis Cluster (from ok to fail or vice versa),
      * so it's a good idea to call it before serving the unblocked clients
@@ -1221,7 +1234,7 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     flushAppendOnlyFile(0);
 
     /* Handle writes with pending output buffers. */
-    handleClientsWithPendingWrites();
+    handleClientsWithPendingWritesUsingThreads();
 
     /* Before we are going to sleep, let the threads access the dataset by
      * releasing the GIL. Redis main thread will not touch anything at this
@@ -1334,10 +1347,6 @@ void createSharedObjects(void) {
 void initServerConfig(void) {
     int j;
 
-    pthread_mutex_init(&server.next_client_id_mutex,NULL);
-    pthread_mutex_init(&server.lruclock_mutex,NULL);
-    pthread_mutex_init(&server.unixtime_mutex,NULL);
-
     getRandomHexChars(server.runid,CONFIG_RUN_ID_SIZE);
     server.runid[CONFIG_RUN_ID_SIZE] = '\0';
     changeReplicationId();
@@ -1359,6 +1368,7 @@ void initServerConfig(void) {
     server.maxidletime = CONFIG_DEFAULT_CLIENT_TIMEOUT;
     server.tcpkeepalive = CONFIG_DEFAULT_TCP_KEEPALIVE;
     server.active_expire_enabled = 1;
+    server.active_expire_index = CONFIG_DEFAULT_ACTIVE_EXPIRE_INDEX;
     server.active_defrag_enabled = CONFIG_DEFAULT_ACTIVE_DEFRAG;
     server.active_defrag_ignore_bytes = CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES;
     server.active_defrag_threshold_lower = CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER;
@@ -1399,6 +1409,8 @@ void initServerConfig(void) {
     server.requirepass = NULL;
     server.rdb_compression = CONFIG_DEFAULT_RDB_COMPRESSION;
     server.rdb_checksum = CONFIG_DEFAULT_RDB_CHECKSUM;
+    server.rdb_load_threads = CONFIG_DEFAULT_RDB_LOAD_THREADS;
+    server.rdb_forkless = CONFIG_DEFAULT_RDB_FORKLESS;
     server.stop_writes_on_bgsave_err = CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;
     server.activerehashing = CONFIG_DEFAULT_ACTIVE_REHASHING;
     server.active_defrag_running = 0;
@@ -1408,6 +1420,7 @@ void initServerConfig(void) {
     server.maxmemory = CONFIG_DEFAULT_MAXMEMORY;
     server.maxmemory_policy = CONFIG_DEFAULT_MAXMEMORY_POLICY;
     server.maxmemory_samples = CONFIG_DEFAULT_MAXMEMORY_SAMPLES;
+    server.maxmemory_eviction_time_limit = CONFIG_DEFAULT_MAXMEMORY_EVICTION_TIME_LIMIT;
     server.lfu_log_factor = CONFIG_DEFAULT_LFU_LOG_FACTOR;
     server.lfu_decay_time = CONFIG_DEFAULT_LFU_DECAY_TIME;
     server.hash_max_ziplist_entries = OBJ_HASH_MAX_ZIPLIST_ENTRIES;
@@ -1434,6 +1447,12 @@ void initServerConfig(void) {
     server.lazyfree_lazy_eviction = CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION;
     server.lazyfree_lazy_expire = CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE;
     server.lazyfree_lazy_server_del = CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL;
+    server.io_threads_num = CONFIG_DEFAULT_IO_THREADS_NUM;
+    server.tiered_storage = CONFIG_DEFAULT_TIERED_STORAGE;
+    server.tiered_storage_file = zstrdup(CONFIG_DEFAULT_TIERED_STORAGE_FILE);
+    server.tiered_storage_max_memory = CONFIG_DEFAULT_TIERED_STORAGE_MAX_MEMORY;
+    server.tiered_storage_io_threads = CONFIG_DEFAULT_TIERED_STORAGE_IO_THREADS;
+    server.io_threads_do_reads = CONFIG_DEFAULT_IO_THREADS_DO_READS;
     server.always_show_logo = CONFIG_DEFAULT_ALWAYS_SHOW_LOGO;
     server.lua_time_limit = LUA_SCRIPT_TIME_LIMIT;
 
@@ -1457,6 +1476,10 @@ void initServerConfig(void) {
     server.repl_serve_stale_data = CONFIG_DEFAULT_SLAVE_SERVE_STALE_DATA;
     server.repl_slave_ro = CONFIG_DEFAULT_SLAVE_READ_ONLY;
     server.repl_slave_lazy_flush = CONFIG_DEFAULT_SLAVE_LAZY_FLUSH;
+    server.repl_diskless_load = CONFIG_DEFAULT_REPL_DISKLESS_LOAD;
+    server.repl_compression = CONFIG_DEFAULT_REPL_COMPRESSION;
+    server.repl_master_decomp = NULL;
+    server.repl_swapdb_loading = 0;
     server.repl_down_since = 0; /* Never connected, repl is down since EVER. */
     server.repl_disable_tcp_nodelay = CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY;
     server.repl_diskless_sync = CONFIG_DEFAULT_REPL_DISKLESS_SYNC;
@@ -1473,9 +1496,7 @@ void initServerConfig(void) {
     /* Replication partial resync backlog */
     server.repl_backlog = NULL;
     server.repl_backlog_size = CONFIG_DEFAULT_REPL_BACKLOG_SIZE;
-    server.repl_backlog_histlen = 0;
-    server.repl_backlog_idx = 0;
-    server.repl_backlog_off = 0;
+    server.repl_backlog_disk_size = CONFIG_DEFAULT_REPL_BACKLOG_DISK_SIZE;
     server.repl_backlog_time_limit = CONFIG_DEFAULT_REPL_BACKLOG_TIME_LIMIT;
     server.repl_no_slaves_since = time(NULL);
 
@@ -1764,6 +1785,12 @@ void resetServerStats(void) {
     server.stat_active_defrag_misses = 0;
     server.stat_active_defrag_key_hits = 0;
     server.stat_active_defrag_key_misses = 0;
+    server.stat_tiered_spills = 0;
+    server.stat_tiered_loads = 0;
+    server.stat_tiered_sync_loads = 0;
+    server.stat_tiered_reads = 0;
+    server.stat_tiered_read_usec = 0;
+    server.stat_tiered_read_max_usec = 0;
     server.stat_fork_time = 0;
     server.stat_fork_rate = 0;
     server.stat_rejected_conn = 0;
@@ -1779,6 +1806,11 @@ void resetServerStats(void) {
     }
     server.stat_net_input_bytes = 0;
     server.stat_net_output_bytes = 0;
+    server.stat_net_write_calls = 0;
+    server.stat_repl_comp_input_bytes = 0;
+    server.stat_repl_comp_output_bytes = 0;
+    server.stat_io_reads_processed = 0;
+    server.stat_io_writes_processed = 0;
     server.aof_delayed_fsync = 0;
 }
 
@@ -1800,7 +1832,11 @@ void initServer(void) {
     server.clients_to_close = listCreate();
     server.slaves = listCreate();
     server.monitors = listCreate();
+    server.repl_buffer_blocks = listCreate();
+    listSetFreeMethod(server.repl_buffer_blocks,zfree);
+    server.repl_buffer_mem = 0;
     server.clients_pending_write = listCreate();
+    server.clients_pending_read = listCreate();
     server.slaveseldb = -1; /* Force to emit the first SELECT command. */
     server.unblocked_clients = listCreate();
     server.ready_keys = listCreate();
@@ -1846,20 +1882,23 @@ void initServer(void) {
     /* Create the Redis databases, and initialize other internal state. */
     for (j = 0; j < server.dbnum; j++) {
         server.db[j].dict = dictCreate(&dbDictType,NULL);
-        server.db[j].expires = dictCreate(&keyptrDictType,NULL);
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].ready_keys = dictCreate(&objectKeyPointerValueDictType,NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
+        server.db[j].expires_index =
+            server.active_expire_index ? raxNew() : NULL;
         server.db[j].id = j;
         server.db[j].avg_ttl = 0;
+        server.db[j].expired_until = LLONG_MIN;
+        server.db[j].expired_backlog = 0;
     }
     evictionPoolAlloc(); /* Initialize the LRU keys pool. */
     server.pubsub_channels = dictCreate(&keylistDictType,NULL);
-    server.pubsub_patterns = listCreate();
-    listSetFreeMethod(server.pubsub_patterns,freePubsubPattern);
-    listSetMatchMethod(server.pubsub_patterns,listMatchPubsubPattern);
+    server.pubsub_patterns = raxNew();
+    server.pubsub_patterns_num = 0;
     server.cronloops = 0;
     server.rdb_child_pid = -1;
+    server.rdb_forkless_in_progress = 0;
     server.aof_child_pid = -1;
     server.rdb_child_type = RDB_CHILD_TYPE_NONE;
     server.rdb_bgsave_scheduled = 0;
@@ -1878,12 +1917,16 @@ void initServer(void) {
     server.stat_starttime = time(NULL);
     server.stat_peak_memory = 0;
     server.stat_rdb_cow_bytes = 0;
+    server.stat_rdb_forkless_copied_keys = 0;
+    server.stat_rdb_forkless_peak_bytes = 0;
     server.stat_aof_cow_bytes = 0;
     server.resident_set_size = 0;
     server.lastbgsave_status = C_OK;
     server.aof_last_write_status = C_OK;
     server.aof_last_write_errno = 0;
     server.repl_good_slaves_count = 0;
+    server.eviction_debt = 0;
+    server.eviction_debt_start = 0;
     updateCachedTime();
 
     /* Create the timer callback, this is our way to process many background
@@ -1944,6 +1987,8 @@ void initServer(void) {
     slowlogInit();
     latencyMonitorInit();
     bioInit();
+    initThreadedIO();
+    if (server.tiered_storage && tieredInit() == C_ERR) exit(1);
     server.initial_memory_usage = zmalloc_used_memory();
 }
 
@@ -2363,7 +2408,10 @@ int processCommand(client *c) {
      *
      * First we try to free some memory if possible (if there are volatile
      * keys in the dataset). If there are not the only thing we can do
-     * is returning an error. */
+     * is returning an error. The same happens if evicting took more than
+     * maxmemory-eviction-time-limit: commands that may grow the memory
+     * usage are refused until the eviction continued in background is
+     * done. */
     if (server.maxmemory) {
         int retval = freeMemoryIfNeeded();
         /* freeMemoryIfNeeded may flush slave output buffers. This may result
@@ -2452,6 +2500,15 @@ int processCommand(client *c) {
         return C_OK;
     }
 
+    /* Loading the dataset of the master while serving the old one? Only
+     * read only commands are served, see repl-diskless-load. */
+    if (server.repl_swapdb_loading &&
+        !(c->cmd->flags & (CMD_READONLY|CMD_LOADING)))
+    {
+        addReply(c, shared.loadingerr);
+        return C_OK;
+    }
+
     /* Lua script too slow? Only allow a limited number of commands. */
     if (server.lua_timedout &&
           c->cmd->proc != authCommand &&
@@ -2468,6 +2525,11 @@ int processCommand(client *c) {
         return C_OK;
     }
 
+    /* If the command needs values spilled to tiered storage, block the
+     * client while they are read from disk: the command is executed
+     * again once the client is unblocked. */
+    if (tieredBlockClientOnSpilledKeys(c)) return C_OK;
+
     /* Exec the command */
     if (c->flags & CLIENT_MULTI &&
         c->cmd->proc != execCommand && c->cmd->proc != discardCommand &&
@@ -2486,6 +2548,22 @@ int processCommand(client *c) {
 
 /*================================== Shutdown =============================== */
 
+/* Stop monitoring the listening sockets in the event loop. Some multiplexing
+ * backends hold a reference to the files they monitor, so this must be done
+ * before closeListeningSockets() for the sockets to really go away. Don't
+ * call it from a child process: the loop state may be shared with the
+ * parent. */
+static void unregisterListeningSockets(void) {
+    int j;
+
+    for (j = 0; j < server.ipfd_count; j++)
+        aeDeleteFileEvent(server.el,server.ipfd[j],AE_READABLE);
+    if (server.sofd != -1) aeDeleteFileEvent(server.el,server.sofd,AE_READABLE);
+    if (server.cluster_enabled)
+        for (j = 0; j < server.cfd_count; j++)
+            aeDeleteFileEvent(server.el,server.cfd[j],AE_READABLE);
+}
+
 /* Close listening sockets. Also unlink the unix domain socket if
  * unlink_unix_socket is non-zero. */
 void closeListeningSockets(int unlink_unix_socket) {
@@ -2518,6 +2596,7 @@ int prepareForShutdown(int flags) {
         kill(server.rdb_child_pid,SIGUSR1);
         rdbRemoveTempFile(server.rdb_child_pid);
     }
+    snapshotAbort();
 
     if (server.aof_state != AOF_OFF) {
         /* Kill the AOF saving child as the AOF we already have may be longer
@@ -2563,7 +2642,11 @@ int prepareForShutdown(int flags) {
      * send them pending writes. */
     flushSlavesOutputBuffers();
 
+    /* The disk tier of the backlog is not loaded at restart. */
+    replBacklogDiskReset();
+
     /* Close the listening sockets. Apparently this allows faster restarts. */
+    unregisterListeningSockets();
     closeListeningSockets(1);
     serverLog(LL_WARNING,"%s is now ready to exit, bye bye...",
         server.sentinel_mode ? "Sentinel" : "Redis");
@@ -2980,6 +3063,8 @@ sds genRedisInfoString(char *section) {
             "rdb_last_bgsave_time_sec:%jd\r\n"
             "rdb_current_bgsave_time_sec:%jd\r\n"
             "rdb_last_cow_size:%zu\r\n"
+            "rdb_forkless_copied_keys:%lld\r\n"
+            "rdb_forkless_last_peak_size:%zu\r\n"
             "aof_enabled:%d\r\n"
             "aof_rewrite_in_progress:%d\r\n"
             "aof_rewrite_scheduled:%d\r\n"
@@ -2990,13 +3075,16 @@ sds genRedisInfoString(char *section) {
             "aof_last_cow_size:%zu\r\n",
             server.loading,
             server.dirty,
-            server.rdb_child_pid != -1,
+            server.rdb_child_pid != -1 || server.rdb_forkless_in_progress,
             (intmax_t)server.lastsave,
             (server.lastbgsave_status == C_OK) ? "ok" : "err",
             (intmax_t)server.rdb_save_time_last,
-            (intmax_t)((server.rdb_child_pid == -1) ?
+            (intmax_t)((server.rdb_child_pid == -1 &&
+                        !server.rdb_forkless_in_progress) ?
                 -1 : time(NULL)-server.rdb_save_time_start),
             server.stat_rdb_cow_bytes,
+            server.stat_rdb_forkless_copied_keys,
+            server.stat_rdb_forkless_peak_bytes,
             server.aof_state != AOF_OFF,
             server.aof_child_pid != -1,
             server.aof_rewrite_scheduled,
@@ -3059,6 +3147,12 @@ sds genRedisInfoString(char *section) {
 
     /* Stats */
     if (allsections || defsections || !strcasecmp(section,"stats")) {
+        unsigned long long expired_backlog = 0;
+        long long now = mstime();
+
+        for (j = 0; j < server.dbnum; j++)
+            expired_backlog += expiredKeysBacklog(server.db+j,now);
+
         if (sections++) info = sdscat(info,"\r\n");
         info = sdscatprintf(info,
             "# Stats\r\n"
@@ -3074,7 +3168,9 @@ sds genRedisInfoString(char *section) {
             "sync_partial_ok:%lld\r\n"
             "sync_partial_err:%lld\r\n"
             "expired_keys:%lld\r\n"
+            "expired_keys_backlog:%llu\r\n"
             "evicted_keys:%lld\r\n"
+            "eviction_debt:%zu\r\n"
             "keyspace_hits:%lld\r\n"
             "keyspace_misses:%lld\r\n"
             "pubsub_channels:%ld\r\n"
@@ -3085,7 +3181,12 @@ sds genRedisInfoString(char *section) {
             "active_defrag_hits:%lld\r\n"
             "active_defrag_misses:%lld\r\n"
             "active_defrag_key_hits:%lld\r\n"
-            "active_defrag_key_misses:%lld\r\n",
+            "active_defrag_key_misses:%lld\r\n"
+            "io_threads_active:%d\r\n"
+            "io_threaded_reads_processed:%lld\r\n"
+            "io_threaded_writes_processed:%lld\r\n"
+            "total_net_write_calls:%lld\r\n"
+            "net_write_calls_per_command:%.2f\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getInstantaneousMetric(STATS_METRIC_COMMAND),
@@ -3098,22 +3199,38 @@ sds genRedisInfoString(char *section) {
             server.stat_sync_partial_ok,
             server.stat_sync_partial_err,
             server.stat_expiredkeys,
+            expired_backlog,
             server.stat_evictedkeys,
+            server.eviction_debt,
             server.stat_keyspace_hits,
             server.stat_keyspace_misses,
             dictSize(server.pubsub_channels),
-            listLength(server.pubsub_patterns),
+            server.pubsub_patterns_num,
             server.stat_fork_time,
             dictSize(server.migrate_cached_sockets),
             getSlaveKeyWithExpireCount(),
             server.stat_active_defrag_hits,
             server.stat_active_defrag_misses,
             server.stat_active_defrag_key_hits,
-            server.stat_active_defrag_key_misses);
+            server.stat_active_defrag_key_misses,
+            server.io_threads_active,
+            server.stat_io_reads_processed,
+            server.stat_io_writes_processed,
+            server.stat_net_write_calls,
+            server.stat_numcommands ? (double)server.stat_net_write_calls /
+                                      server.stat_numcommands : 0);
+    }
+
+    /* Tiered storage */
+    if (allsections || defsections || !strcasecmp(section,"tiered")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = genTieredInfoString(info);
     }
 
     /* Replication */
     if (allsections || defsections || !strcasecmp(section,"replication")) {
+        long long repl_buffer_saved = 0;
+
         if (sections++) info = sdscat(info,"\r\n");
         info = sdscatprintf(info,
             "# Replication\r\n"
@@ -3134,6 +3251,7 @@ sds genRedisInfoString(char *section) {
                 "master_last_io_seconds_ago:%d\r\n"
                 "master_sync_in_progress:%d\r\n"
                 "slave_repl_offset:%lld\r\n"
+                "master_link_compressed:%d\r\n"
                 ,server.masterhost,
                 server.masterport,
                 (server.repl_state == REPL_STATE_CONNECTED) ?
@@ -3141,7 +3259,8 @@ sds genRedisInfoString(char *section) {
                 server.master ?
                 ((int)(server.unixtime-server.master->lastinteraction)) : -1,
                 server.repl_state == REPL_STATE_TRANSFER,
-                slave_repl_offset
+                slave_repl_offset,
+                server.repl_master_decomp != NULL
             );
 
             if (server.repl_state == REPL_STATE_TRANSFER) {
@@ -3184,6 +3303,16 @@ sds genRedisInfoString(char *section) {
             listNode *ln;
             listIter li;
 
+            /* Bytes of the replication stream the backlog and the slaves
+             * would hold with a private copy each, minus the bytes really
+             * buffered, that are all part of the backlog. */
+            if (server.repl_backlog) {
+                long long histlen = server.repl_backlog->histlen;
+
+                repl_buffer_saved = (histlen < server.repl_backlog_size ?
+                    histlen : server.repl_backlog_size) - histlen;
+            }
+
             listRewind(server.slaves,&li);
             while((ln = listNext(&li))) {
                 client *slave = listNodeValue(ln);
@@ -3191,6 +3320,7 @@ sds genRedisInfoString(char *section) {
                 char ip[NET_IP_STR_LEN], *slaveip = slave->slave_ip;
                 int port;
                 long lag = 0;
+                long long lag_bytes;
 
                 if (slaveip[0] == '\0') {
                     if (anetPeerToString(slave->fd,ip,sizeof(ip),&port) == -1)
@@ -3213,13 +3343,18 @@ sds genRedisInfoString(char *section) {
                 if (slave->replstate == SLAVE_STATE_ONLINE)
                     lag = time(NULL) - slave->repl_ack_time;
 
+                lag_bytes = getSlaveReplBufferLag(slave);
+                repl_buffer_saved += lag_bytes;
+
                 info = sdscatprintf(info,
                     "slave%d:ip=%s,port=%d,state=%s,"
-                    "offset=%lld,lag=%ld\r\n",
+                    "offset=%lld,lag=%ld,lag_bytes=%lld,compressed=%d\r\n",
                     slaveid,slaveip,slave->slave_listening_port,state,
-                    slave->repl_ack_off, lag);
+                    slave->repl_ack_off, lag, lag_bytes,
+                    slave->repl_comp != NULL);
                 slaveid++;
             }
+            if (repl_buffer_saved < 0) repl_buffer_saved = 0;
         }
         info = sdscatprintf(info,
             "master_replid:%s\r\n"
@@ -3229,15 +3364,29 @@ sds genRedisInfoString(char *section) {
             "repl_backlog_active:%d\r\n"
             "repl_backlog_size:%lld\r\n"
             "repl_backlog_first_byte_offset:%lld\r\n"
-            "repl_backlog_histlen:%lld\r\n",
+            "repl_backlog_histlen:%lld\r\n"
+            "repl_backlog_disk_size:%lld\r\n"
+            "repl_backlog_disk_first_byte_offset:%lld\r\n"
+            "repl_backlog_disk_histlen:%lld\r\n"
+            "repl_buffer_memory:%zu\r\n"
+            "repl_buffer_saved_bytes:%lld\r\n"
+            "repl_compression_input_bytes:%lld\r\n"
+            "repl_compression_output_bytes:%lld\r\n",
             server.replid,
             server.replid2,
             server.master_repl_offset,
             server.second_replid_offset,
             server.repl_backlog != NULL,
             server.repl_backlog_size,
-            server.repl_backlog_off,
-            server.repl_backlog_histlen);
+            server.repl_backlog ? server.repl_backlog->offset : 0,
+            server.repl_backlog ? server.repl_backlog->histlen : 0,
+            server.repl_backlog_disk_size,
+            replBacklogDiskFirstOffset(),
+            replBacklogDiskHistlen(),
+            server.repl_buffer_mem,
+            repl_buffer_saved,
+            server.stat_repl_comp_input_bytes,
+            server.stat_repl_comp_output_bytes);
     }
 
     /* CPU */
@@ -3288,7 +3437,7 @@ sds genRedisInfoString(char *section) {
             long long keys, vkeys;
 
             keys = dictSize(server.db[j].dict);
-            vkeys = dictSize(server.db[j].expires);
+            vkeys = dictMarkedSize(server.db[j].dict);
             if (keys || vkeys) {
                 info = sdscatprintf(info,
                     "db%d:keys=%lld,expires=%lld,avg_ttl=%lld\r\n",
@@ -3659,6 +3808,8 @@ int main(int argc, char **argv) {
     if (argc == 3 && !strcasecmp(argv[1], "test")) {
         if (!strcasecmp(argv[2], "ziplist")) {
             return ziplistTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "listpack")) {
+            return listpackTest(argc, argv);
         } else if (!strcasecmp(argv[2], "quicklist")) {
             quicklistTest(argc, argv);
         } else if (!strcasecmp(argv[2], "intset")) {
@@ -3675,6 +3826,8 @@ int main(int argc, char **argv) {
             return endianconvTest(argc, argv);
         } else if (!strcasecmp(argv[2], "crc64")) {
             return crc64Test(argc, argv);
+        } else if (!strcasecmp(argv[2], "ae")) {
+            return aeTest(argc, argv);
         }
 
         return -1; /* test not found */
@@ -3687,6 +3840,7 @@ int main(int argc, char **argv) {
 #endif
     setlocale(LC_COLLATE,"");
     zmalloc_set_oom_handler(redisOutOfMemoryHandler);
+    crc64_init();
     srand(time(NULL)^getpid());
     gettimeofday(&tv,NULL);
     char hashseed[16];
@@ -3718,6 +3872,8 @@ int main(int argc, char **argv) {
         redis_check_rdb_main(argc,argv,NULL);
     else if (strstr(argv[0],"redis-check-aof") != NULL)
         redis_check_aof_main(argc,argv);
+    else if (strstr(argv[0],"redis-evict-sim") != NULL)
+        redis_evict_sim_main(argc,argv);
 
     if (argc >= 2) {
         j = 1; /* First option to parse in argv[] */
@@ -58,6 +58,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "zmalloc.h" /* total memory usage aware version of malloc/free */
 #include "anet.h"    /* Networking the easy way */
 #include "ziplist.h" /* Compact list data structure */
+#include "listpack.h" /* Compact list of strings, replaces the ziplist */
 #include "intset.h"  /* Compact integer set structure */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
@@ -88,6 +89,11 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_MAX_LINE    1024
 #define CRON_DBS_PER_CALL 16
 #define NET_MAX_WRITES_PER_EVENT (1024*64)
+#ifdef IOV_MAX
+#define NET_MAX_WRITEV_IOV IOV_MAX /* Max buffers written with one writev() */
+#else
+#define NET_MAX_WRITEV_IOV 16
+#endif
 #define PROTO_SHARED_SELECT_CMDS 10
 #define OBJ_SHARED_INTEGERS 10000
 #define OBJ_SHARED_BULKHDR_LEN 32
@@ -108,6 +114,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_REPL_BACKLOG_SIZE (1024*1024)    /* 1mb */
 #define CONFIG_DEFAULT_REPL_BACKLOG_TIME_LIMIT (60*60)  /* 1 hour */
 #define CONFIG_REPL_BACKLOG_MIN_SIZE (1024*16)          /* 16k */
+#define CONFIG_DEFAULT_REPL_BACKLOG_DISK_SIZE 0         /* Disabled. */
 #define CONFIG_BGSAVE_RETRY_DELAY 5 /* Wait a few secs before trying again. */
 #define CONFIG_DEFAULT_PID_FILE "/var/run/redis.pid"
 #define CONFIG_DEFAULT_SYSLOG_IDENT "redis"
@@ -124,9 +131,14 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR 1
 #define CONFIG_DEFAULT_RDB_COMPRESSION 1
 #define CONFIG_DEFAULT_RDB_CHECKSUM 1
+#define CONFIG_DEFAULT_RDB_LOAD_THREADS 0 /* Decode values in the main thread. */
+#define CONFIG_DEFAULT_RDB_FORKLESS 0
+#define RDB_LOAD_THREADS_MAX_NUM 128
 #define CONFIG_DEFAULT_RDB_FILENAME "dump.rdb"
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC 0
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY 5
+#define CONFIG_DEFAULT_REPL_DISKLESS_LOAD REPL_DISKLESS_LOAD_DISABLED
+#define CONFIG_DEFAULT_REPL_COMPRESSION 0
 #define CONFIG_DEFAULT_SLAVE_SERVE_STALE_DATA 1
 #define CONFIG_DEFAULT_SLAVE_READ_ONLY 1
 #define CONFIG_DEFAULT_SLAVE_ANNOUNCE_IP NULL
@@ -134,6 +146,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY 0
 #define CONFIG_DEFAULT_MAXMEMORY 0
 #define CONFIG_DEFAULT_MAXMEMORY_SAMPLES 5
+#define CONFIG_DEFAULT_MAXMEMORY_EVICTION_TIME_LIMIT 0 /* Microseconds. */
 #define CONFIG_DEFAULT_LFU_LOG_FACTOR 10
 #define CONFIG_DEFAULT_LFU_DECAY_TIME 1
 #define CONFIG_DEFAULT_AOF_FILENAME "appendonly.aof"
@@ -153,6 +166,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL 0
+#define CONFIG_DEFAULT_ACTIVE_EXPIRE_INDEX 0
 #define CONFIG_DEFAULT_ALWAYS_SHOW_LOGO 0
 #define CONFIG_DEFAULT_ACTIVE_DEFRAG 0
 #define CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER 10 /* don't defrag when fragmentation is below 10% */
@@ -160,6 +174,14 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES (100<<20) /* don't defrag if frag overhead is below 100mb */
 #define CONFIG_DEFAULT_DEFRAG_CYCLE_MIN 25 /* 25% CPU min (at lower threshold) */
 #define CONFIG_DEFAULT_DEFRAG_CYCLE_MAX 75 /* 75% CPU max (at upper threshold) */
+#define CONFIG_DEFAULT_IO_THREADS_NUM 1 /* Single threaded by default */
+#define CONFIG_DEFAULT_IO_THREADS_DO_READS 0 /* Read + parse from threads? */
+#define IO_THREADS_MAX_NUM 128
+#define CONFIG_DEFAULT_TIERED_STORAGE 0
+#define CONFIG_DEFAULT_TIERED_STORAGE_FILE "tiered.dat"
+#define CONFIG_DEFAULT_TIERED_STORAGE_MAX_MEMORY 0
+#define CONFIG_DEFAULT_TIERED_STORAGE_IO_THREADS 4
+#define TIERED_IO_THREADS_MAX_NUM 64
 
 #define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 20 /* Loopkups per loop. */
 #define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000 /* Microseconds */
@@ -178,6 +200,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define PROTO_MAX_QUERYBUF_LEN  (1024*1024*1024) /* 1GB max query buffer. */
 #define PROTO_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
+#define PROTO_REPLY_MIN_REF_BYTES (16*1024) /* Bigger bulks are not copied */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
@@ -248,6 +271,16 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CLIENT_LUA_DEBUG (1<<25)  /* Run EVAL in debug mode. */
 #define CLIENT_LUA_DEBUG_SYNC (1<<26)  /* EVAL debugging without fork() */
 #define CLIENT_MODULE (1<<27) /* Non connected client used by some module. */
+#define CLIENT_PENDING_READ (1<<28) /* The client has pending reads and was put
+                                       in the list of clients we can read
+                                       from. */
+#define CLIENT_PENDING_COMMAND (1<<29) /* Used in threaded I/O to signal after
+                                          we return single threaded that the
+                                          client has already pending commands
+                                          to be executed. */
+#define CLIENT_CLOSE_AFTER_IO (1<<30) /* An I/O thread hit an error or a
+                                         close condition: free the client
+                                         once back in the main thread. */
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -255,6 +288,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define BLOCKED_LIST 1    /* BLPOP & co. */
 #define BLOCKED_WAIT 2    /* WAIT for synchronous replication. */
 #define BLOCKED_MODULE 3  /* Blocked by a loadable module. */
+#define BLOCKED_TIERED 4  /* Reading spilled values from tiered storage. */
 
 /* Client request types */
 #define PROTO_REQ_INLINE 1
@@ -304,6 +338,12 @@ typedef long long mstime_t; /* millisecond time type. */
 #define SLAVE_CAPA_NONE 0
 #define SLAVE_CAPA_EOF (1<<0)    /* Can parse the RDB EOF streaming format. */
 #define SLAVE_CAPA_PSYNC2 (1<<1) /* Supports PSYNC2 protocol. */
+#define SLAVE_CAPA_LZF (1<<2)    /* Wants the stream compressed. */
+
+/* Slave diskless load modes, see repl-diskless-load. */
+#define REPL_DISKLESS_LOAD_DISABLED 0 /* Save the RDB to disk, then load it. */
+#define REPL_DISKLESS_LOAD_FLUSH 1    /* Flush the old data, load from socket. */
+#define REPL_DISKLESS_LOAD_SWAPDB 2   /* Serve the old data while loading. */
 
 /* Synchronous read timeout - slave side */
 #define CONFIG_REPL_SYNCIO_TIMEOUT 5
@@ -377,6 +417,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define MAXMEMORY_ALLKEYS_LFU ((5<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_ALLKEYS_RANDOM ((6<<8)|MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_NO_EVICTION (7<<8)
+#define MAXMEMORY_ALLKEYS_TINYLFU ((8<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_ALLKEYS)
 
 #define CONFIG_DEFAULT_MAXMEMORY_POLICY MAXMEMORY_NO_EVICTION
 
@@ -570,11 +611,13 @@ typedef struct RedisModuleDigest {
 #define OBJ_ENCODING_HT 2      /* Encoded as hash table */
 #define OBJ_ENCODING_ZIPMAP 3  /* Encoded as zipmap */
 #define OBJ_ENCODING_LINKEDLIST 4 /* No longer used: old list encoding. */
-#define OBJ_ENCODING_ZIPLIST 5 /* Encoded as ziplist */
+#define OBJ_ENCODING_ZIPLIST 5 /* Encoded as ziplist (only to load old lists) */
 #define OBJ_ENCODING_INTSET 6  /* Encoded as intset */
 #define OBJ_ENCODING_SKIPLIST 7  /* Encoded as skiplist */
 #define OBJ_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
-#define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists */
+#define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of listpacks */
+#define OBJ_ENCODING_LISTPACK 10 /* Encoded as listpack */
+#define OBJ_ENCODING_SPILLED 11 /* Value spilled to the tiered storage file */
 
 #define LRU_BITS 24
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */
@@ -609,10 +652,12 @@ struct evictionPoolEntry; /* Defined in evict.c */
  * database. The database number is the 'id' field in the structure. */
 typedef struct redisDb {
     dict *dict;                 /* The keyspace for this DB */
-    dict *expires;              /* Timeout of keys with a timeout set */
     dict *blocking_keys;        /* Keys with clients waiting for data (BLPOP)*/
     dict *ready_keys;           /* Blocked keys that received a PUSH */
     dict *watched_keys;         /* WATCHED keys for MULTI/EXEC CAS */
+    rax *expires_index;         /* Keys with an expire by time, or NULL */
+    long long expired_until;    /* Time expired_backlog is counted up to. */
+    unsigned long long expired_backlog; /* Indexed keys expiring before it. */
     int id;                     /* Database ID */
     long long avg_ttl;          /* Average TTL, just for stats */
 } redisDb;
@@ -652,6 +697,9 @@ typedef struct blockingState {
     void *module_blocked_handle; /* RedisModuleBlockedClient structure.
                                     which is opaque for the Redis core, only
                                     handled in module.c. */
+
+    /* BLOCKED_TIERED */
+    list *tiered_jobs;      /* Reads of spilled values we are waiting for. */
 } blockingState;
 
 /* The following structure represents a node in the server.ready_keys list,
@@ -670,6 +718,30 @@ typedef struct readyList {
     robj *key;
 } readyList;
 
+/* The replication stream is stored only once, in the list of blocks at
+ * server.repl_buffer_blocks, that is shared by the replication backlog and
+ * by the output buffers of all the slaves. Both the backlog and the slaves
+ * just reference the block they start from: a block is released once the
+ * backlog is trimmed past it, and the backlog is never trimmed past a block
+ * that a slave still has to send. */
+typedef struct replBufBlock {
+    int refcount;           /* Backlog and slaves referencing this block. */
+    long long id;           /* Incremental block number. */
+    long long repl_offset;  /* Replication offset of the first byte. */
+    size_t size, used;      /* Allocated and used bytes of 'buf'. */
+    char buf[];
+} replBufBlock;
+
+/* The replication backlog: the history of the replication stream, from
+ * 'ref_repl_buf_node' to the end of the shared replication buffer. */
+typedef struct replBacklog {
+    listNode *ref_repl_buf_node; /* First block of the backlog, NULL if the
+                                    backlog is still empty. */
+    long long histlen;           /* Backlog actual data length. */
+    long long offset;            /* Replication "master offset" of first
+                                    byte in the replication backlog. */
+} replBacklog;
+
 /* With multiplexing we need to take per-client state.
  * Clients are taken in a linked list. */
 typedef struct client {
@@ -678,12 +750,14 @@ typedef struct client {
     redisDb *db;            /* Pointer to currently SELECTed DB. */
     robj *name;             /* As set by CLIENT SETNAME. */
     sds querybuf;           /* Buffer we use to accumulate client queries. */
+    size_t qb_pos;          /* The position we have read in querybuf. */
     sds pending_querybuf;   /* If this is a master, this buffer represents the
                                yet not applied replication stream that we
                                are receiving from the master. */
     size_t querybuf_peak;   /* Recent (100ms or more) peak of querybuf size. */
     int argc;               /* Num of arguments of current command. */
     robj **argv;            /* Arguments of current command. */
+    int argv_len;           /* Size of argv array (may be more than argc). */
     struct redisCommand *cmd, *lastcmd;  /* Last command executed. */
     int reqtype;            /* Request protocol type: PROTO_REQ_* */
     int multibulklen;       /* Number of multi bulk arguments left to read. */
@@ -714,6 +788,14 @@ typedef struct client {
     int slave_listening_port; /* As configured with: SLAVECONF listening-port */
     char slave_ip[NET_IP_STR_LEN]; /* Optionally given by REPLCONF ip-address */
     int slave_capa;         /* Slave capabilities: SLAVE_CAPA_* bitwise OR. */
+    listNode *ref_repl_buf_node; /* Slaves: replication buffer block we are
+                                    sending, NULL if none yet. */
+    size_t ref_block_pos;   /* Slaves: bytes of that block already sent. */
+    struct replCompressor *repl_comp; /* Slaves: compressor of the stream, or
+                                         NULL if not compressed. */
+    sds repl_comp_buf;      /* Slaves: compressed data not yet written. */
+    long long repl_disk_offset; /* Slaves: next offset to send from the disk
+                                   backlog, 0 if not reading from disk. */
     multiState mstate;      /* MULTI/EXEC state */
     int btype;              /* Type of blocking op if CLIENT_BLOCKED. */
     blockingState bpop;     /* blocking state */
@@ -914,6 +996,7 @@ struct redisServer {
     list *clients;              /* List of active clients */
     list *clients_to_close;     /* Clients to close asynchronously */
     list *clients_pending_write; /* There is to write or install handler. */
+    list *clients_pending_read;  /* Client has pending read socket buffers. */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
     client *current_client; /* Current client, only used on crash report */
     int clients_paused;         /* True if clients are currently paused */
@@ -944,6 +1027,12 @@ struct redisServer {
     long long stat_active_defrag_misses;    /* number of allocations scanned but not moved */
     long long stat_active_defrag_key_hits;  /* number of keys with moved allocations */
     long long stat_active_defrag_key_misses;/* number of keys scanned and not moved */
+    long long stat_tiered_spills;   /* Values spilled to tiered storage. */
+    long long stat_tiered_loads;    /* Spilled values loaded back. */
+    long long stat_tiered_sync_loads; /* Loads that blocked on a disk read. */
+    long long stat_tiered_reads;    /* Reads served by the I/O threads. */
+    long long stat_tiered_read_usec; /* Total time of the reads. */
+    long long stat_tiered_read_max_usec; /* Slowest read. */
     size_t stat_peak_memory;        /* Max used memory record */
     long long stat_fork_time;       /* Time needed to perform latest fork() */
     double stat_fork_rate;          /* Fork rate in GB/sec. */
@@ -958,7 +1047,14 @@ struct redisServer {
     size_t resident_set_size;       /* RSS sampled in serverCron(). */
     long long stat_net_input_bytes; /* Bytes read from network. */
     long long stat_net_output_bytes; /* Bytes written to network. */
+    long long stat_net_write_calls; /* Write syscalls to client sockets. */
+    long long stat_repl_comp_input_bytes; /* Bytes compressed for slaves. */
+    long long stat_repl_comp_output_bytes; /* Resulting compressed bytes. */
+    long long stat_io_reads_processed; /* Reads processed by I/O threads. */
+    long long stat_io_writes_processed; /* Writes processed by I/O threads. */
     size_t stat_rdb_cow_bytes;      /* Copy on write bytes during RDB saving. */
+    long long stat_rdb_forkless_copied_keys; /* Keys saved ahead of the scan. */
+    size_t stat_rdb_forkless_peak_bytes; /* Peak output buffer of forkless save. */
     size_t stat_aof_cow_bytes;      /* Copy on write bytes during AOF rewrite. */
     /* The following two are used to track instantaneous metrics, like
      * number of operations per second, network traffic. */
@@ -973,6 +1069,7 @@ struct redisServer {
     int maxidletime;                /* Client timeout in seconds */
     int tcpkeepalive;               /* Set SO_KEEPALIVE if non-zero. */
     int active_expire_enabled;      /* Can be disabled for testing purposes. */
+    int active_expire_index;        /* Reclaim expired keys in time order. */
     int active_defrag_enabled;
     size_t active_defrag_ignore_bytes; /* minimum amount of fragmentation waste to start active defrag */
     int active_defrag_threshold_lower; /* minimum percentage of fragmentation to start active defrag */
@@ -985,6 +1082,9 @@ struct redisServer {
     int supervised_mode;            /* See SUPERVISED_* */
     int daemonize;                  /* True if running as a daemon */
     clientBufferLimitsConfig client_obuf_limits[CLIENT_TYPE_OBUF_COUNT];
+    int io_threads_num;             /* Number of I/O threads to use. */
+    int io_threads_do_reads;        /* Read and parse from I/O threads? */
+    int io_threads_active;          /* Is the threaded I/O active? */
     /* AOF persistence */
     int aof_state;                  /* AOF_(ON|OFF|WAIT_REWRITE) */
     int aof_fsync;                  /* Kind of fsync() policy */
@@ -1030,6 +1130,9 @@ struct redisServer {
     char *rdb_filename;             /* Name of RDB file */
     int rdb_compression;            /* Use compression in RDB? */
     int rdb_checksum;               /* Use RDB checksum? */
+    int rdb_load_threads;           /* Threads decoding values on load. */
+    int rdb_forkless;               /* BGSAVE without fork(), see snapshot.c. */
+    int rdb_forkless_in_progress;   /* A forkless BGSAVE is in progress. */
     time_t lastsave;                /* Unix time of last successful save */
     time_t lastbgsave_try;          /* Unix time of last attempted bgsave */
     time_t rdb_save_time_last;      /* Time used by last RDB save run. */
@@ -1061,13 +1164,11 @@ struct redisServer {
     long long second_replid_offset; /* Accept offsets up to this for replid2. */
     int slaveseldb;                 /* Last SELECTed DB in replication output */
     int repl_ping_slave_period;     /* Master pings the slave every N seconds */
-    char *repl_backlog;             /* Replication backlog for partial syncs */
-    long long repl_backlog_size;    /* Backlog circular buffer size */
-    long long repl_backlog_histlen; /* Backlog actual data length */
-    long long repl_backlog_idx;     /* Backlog circular buffer current offset,
-                                       that is the next byte will'll write to.*/
-    long long repl_backlog_off;     /* Replication "master offset" of first
-                                       byte in the replication backlog buffer.*/
+    replBacklog *repl_backlog;      /* Replication backlog for partial syncs */
+    long long repl_backlog_size;    /* Backlog size */
+    list *repl_buffer_blocks;       /* Replication buffer, see replBufBlock. */
+    size_t repl_buffer_mem;         /* Memory used by the replication buffer. */
+    long long repl_backlog_disk_size; /* Disk backlog size, 0 = disabled. */
     time_t repl_backlog_time_limit; /* Time without slaves after the backlog
                                        gets released. */
     time_t repl_no_slaves_since;    /* We have no slaves since that time.
@@ -1106,6 +1207,13 @@ struct redisServer {
     char master_replid[CONFIG_RUN_ID_SIZE+1];  /* Master PSYNC runid. */
     long long master_initial_offset;           /* Master PSYNC offset. */
     int repl_slave_lazy_flush;          /* Lazy FLUSHALL before loading DB? */
+    int repl_diskless_load;             /* REPL_DISKLESS_LOAD_* mode. */
+    int repl_compression;               /* Ask the master to compress. */
+    struct replDecompressor *repl_master_decomp; /* Decompressor of the data
+                                           from the master, NULL if the link
+                                           is not compressed. */
+    int repl_swapdb_loading;            /* Loading from the master socket while
+                                           serving the old data. */
     /* Replication script cache. */
     dict *repl_scriptcache_dict;        /* SHA1 all slaves are aware of. */
     list *repl_scriptcache_fifo;        /* First in, first out LRU eviction. */
@@ -1118,8 +1226,16 @@ struct redisServer {
     unsigned long long maxmemory;   /* Max number of memory bytes to use */
     int maxmemory_policy;           /* Policy for key eviction */
     int maxmemory_samples;          /* Pricision of random sampling */
+    long long maxmemory_eviction_time_limit; /* Max us evicting per call. */
+    size_t eviction_debt;           /* Bytes still to evict in background. */
+    mstime_t eviction_debt_start;   /* When the eviction debt started. */
     unsigned int lfu_log_factor;    /* LFU logarithmic counter factor. */
     unsigned int lfu_decay_time;    /* LFU counter decay factor. */
+    /* Tiered storage */
+    int tiered_storage;             /* Spill cold values to disk? */
+    char *tiered_storage_file;      /* File holding the spilled values. */
+    unsigned long long tiered_storage_max_memory; /* Spill above this. */
+    int tiered_storage_io_threads;  /* Threads performing the disk I/O. */
     /* Blocked clients */
     unsigned int bpop_blocked_clients; /* Number of clients blocked by lists */
     list *unblocked_clients; /* list of clients to unblock before next loop */
@@ -1145,7 +1261,8 @@ struct redisServer {
     long long mstime;   /* Like 'unixtime' but with milliseconds resolution. */
     /* Pubsub */
     dict *pubsub_channels;  /* Map channels to list of subscribed clients */
-    list *pubsub_patterns;  /* A list of pubsub_patterns */
+    rax *pubsub_patterns;   /* Literal prefix -> list of pubsub_patterns */
+    unsigned long pubsub_patterns_num; /* Number of pattern subscriptions */
     int notify_keyspace_events; /* Events to propagate via Pub/Sub. This is an
                                    xor of NOTIFY_... flags. */
     /* Cluster */
@@ -1193,12 +1310,6 @@ struct redisServer {
     int watchdog_period;  /* Software watchdog period in ms. 0 = off */
     /* System hardware info */
     size_t system_memory_size;  /* Total memory in system as reported by OS */
-
-    /* Mutexes used to protect atomic variables when atomic builtins are
-     * not available. */
-    pthread_mutex_t lruclock_mutex;
-    pthread_mutex_t next_client_id_mutex;
-    pthread_mutex_t unixtime_mutex;
 };
 
 typedef struct pubsubPattern {
@@ -1288,6 +1399,7 @@ typedef struct {
 extern struct redisServer server;
 extern struct sharedObjectsStruct shared;
 extern dictType objectKeyPointerValueDictType;
+extern dictType keylistDictType;
 extern dictType setDictType;
 extern dictType zsetDictType;
 extern dictType clusterNodesDictType;
@@ -1297,7 +1409,6 @@ extern dictType shaScriptObjectDictType;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
 extern dictType replScriptCacheDictType;
-extern dictType keyptrDictType;
 extern dictType modulesDictType;
 
 /*-----------------------------------------------------------------------------
@@ -1361,6 +1472,7 @@ void copyClientOutputBuffer(client *dst, client *src);
 size_t sdsZmallocSize(sds s);
 size_t getStringObjectSdsUsedMemory(robj *o);
 void *dupClientReplyValue(void *o);
+void copyClientsReplyObjects(void);
 void getClientsMaxBuffers(unsigned long *longest_output_list,
                           unsigned long *biggest_input_buffer);
 char *getClientPeerId(client *client);
@@ -1382,7 +1494,16 @@ void pauseClients(mstime_t duration);
 int clientsArePaused(void);
 int processEventsWhileBlocked(void);
 int handleClientsWithPendingWrites(void);
+int handleClientsWithPendingWritesUsingThreads(void);
+int handleClientsWithPendingReadsUsingThreads(void);
+int stopThreadedIOIfNeeded(void);
+int postponeClientRead(client *c);
+void initThreadedIO(void);
+void clientInstallWriteHandler(client *c);
+int prepareClientToWrite(client *c);
+int processCommandAndResetClient(client *c);
 int clientHasPendingReplies(client *c);
+unsigned long getClientReplyMemoryUsage(client *c);
 void unlinkClient(client *c);
 int writeToClient(int fd, client *c, int handler_installed);
 
@@ -1440,6 +1561,7 @@ robj *createObject(int type, void *ptr);
 robj *createStringObject(const char *ptr, size_t len);
 robj *createRawStringObject(const char *ptr, size_t len);
 robj *createEmbeddedStringObject(const char *ptr, size_t len);
+robj *objectEmbedKey(robj *o, sds key, long long expire, sds *keyptr);
 robj *dupStringObject(const robj *o);
 int isSdsRepresentableAsLongLong(sds s, long long *llval);
 int isObjectRepresentableAsLongLong(robj *o, long long *llongval);
@@ -1454,7 +1576,7 @@ robj *createSetObject(void);
 robj *createIntsetObject(void);
 robj *createHashObject(void);
 robj *createZsetObject(void);
-robj *createZsetZiplistObject(void);
+robj *createZsetListpackObject(void);
 robj *createModuleObject(moduleType *mt, void *value);
 int getLongFromObjectOrReply(client *c, robj *o, long *target, const char *msg);
 int checkType(client *c, robj *o, int type);
@@ -1469,6 +1591,7 @@ int compareStringObjects(robj *a, robj *b);
 int collateStringObjects(robj *a, robj *b);
 int equalStringObjects(robj *a, robj *b);
 unsigned long long estimateObjectIdleTime(robj *o);
+size_t objectComputeSize(robj *o, size_t sample_size);
 #define sdsEncodedObject(objptr) (objptr->encoding == OBJ_ENCODING_RAW || objptr->encoding == OBJ_ENCODING_EMBSTR)
 
 /* Synchronous I/O with timeout */
@@ -1481,6 +1604,7 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc);
 void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t buflen);
 void replicationFeedMonitors(client *c, list *monitors, int dictid, robj **argv, int argc);
 void updateSlavesWaitingBgsave(int bgsaveerr, int type);
+void replicationSlaveStreamedRdb(client *slave);
 void replicationCron(void);
 void replicationHandleMasterDisconnection(void);
 void replicationCacheMaster(client *c);
@@ -1500,14 +1624,23 @@ long long replicationGetSlaveOffset(void);
 char *replicationGetSlaveName(client *c);
 long long getPsyncInitialOffset(void);
 int replicationSetupSlaveForFullResync(client *slave, long long offset);
+void replicationEnableCompression(client *slave);
+ssize_t replicationReadMaster(int fd, void *buf, size_t len);
 void changeReplicationId(void);
 void clearReplicationId2(void);
 void chopReplicationBacklog(void);
 void replicationCacheMasterUsingMyself(void);
-void feedReplicationBacklog(void *ptr, size_t len);
+void feedReplicationBuffer(char *s, size_t len);
+int slaveHasPendingReplBuffer(client *c);
+long long getSlaveReplBufferLag(client *c);
+size_t getSlaveReplBufferMemoryUsage(client *c);
+void advanceSlaveReplBufferCursor(client *c);
+void copySlaveReplBufferCursor(client *dst, client *src);
+void releaseSlaveReplBufferCursor(client *c);
 
 /* Generic persistence functions */
 void startLoading(FILE *fp);
+void startLoadingSize(off_t size);
 void loadingProgress(off_t pos);
 void stopLoading(void);
 
@@ -1577,13 +1710,13 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range);
 unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range);
 unsigned int zsetLength(const robj *zobj);
 void zsetConvert(robj *zobj, int encoding);
-void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen);
+void zsetConvertToListpackIfNeeded(robj *zobj, size_t maxelelen);
 int zsetScore(robj *zobj, sds member, double *score);
 unsigned long zslGetRank(zskiplist *zsl, double score, sds o);
 int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore);
 long zsetRank(robj *zobj, sds ele, int reverse);
 int zsetDel(robj *zobj, sds ele);
-sds ziplistGetObject(unsigned char *sptr);
+sds lpGetObject(unsigned char *sptr);
 int zslValueGteMin(double value, zrangespec *spec);
 int zslValueLteMax(double value, zrangespec *spec);
 void zslFreeLexRange(zlexrangespec *spec);
@@ -1599,6 +1732,7 @@ int zslLexValueLteMax(sds value, zlexrangespec *spec);
 
 /* Core functions */
 int freeMemoryIfNeeded(void);
+void evictionSetDebt(size_t debt);
 int processCommand(client *c);
 void setupSignalHandlers(void);
 struct redisCommand *lookupCommand(sds name);
@@ -1633,6 +1767,7 @@ void activeDefragCycle(void);
 unsigned int getLRUClock(void);
 unsigned int LRU_CLOCK(void);
 const char *evictPolicyToString(void);
+const char *evictPolicyGetName(int j);
 struct redisMemOverhead *getMemoryOverheadData(void);
 void freeMemoryOverheadData(struct redisMemOverhead *mh);
 
@@ -1669,10 +1804,10 @@ unsigned long hashTypeLength(const robj *o);
 hashTypeIterator *hashTypeInitIterator(robj *subject);
 void hashTypeReleaseIterator(hashTypeIterator *hi);
 int hashTypeNext(hashTypeIterator *hi);
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
-                                unsigned char **vstr,
-                                unsigned int *vlen,
-                                long long *vll);
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
+                                 unsigned char **vstr,
+                                 unsigned int *vlen,
+                                 long long *vll);
 sds hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what);
 void hashTypeCurrentObject(hashTypeIterator *hi, int what, unsigned char **vstr, unsigned int *vlen, long long *vll);
 sds hashTypeCurrentObjectNewSds(hashTypeIterator *hi, int what);
@@ -1694,6 +1829,7 @@ sds keyspaceEventsFlagsToString(int flags);
 
 /* Configuration */
 void loadServerConfig(char *filename, char *options);
+void loadServerConfigFromString(char *config);
 void appendServerSaveParams(time_t seconds, int changes);
 void resetServerSaveParams(void);
 struct rewriteConfigState; /* Forward declaration to export API. */
@@ -1704,6 +1840,7 @@ int rewriteConfig(char *path);
 int removeExpire(redisDb *db, robj *key);
 void propagateExpire(redisDb *db, robj *key, int lazy);
 int expireIfNeeded(redisDb *db, robj *key);
+long long keyGetExpire(sds key);
 long long getExpire(redisDb *db, robj *key);
 void setExpire(client *c, redisDb *db, robj *key, long long when);
 robj *lookupKey(redisDb *db, robj *key, int flags);
@@ -1716,9 +1853,10 @@ robj *objectCommandLookup(client *c, robj *key);
 robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply);
 #define LOOKUP_NONE 0
 #define LOOKUP_NOTOUCH (1<<0)
-void dbAdd(redisDb *db, robj *key, robj *val);
-void dbOverwrite(redisDb *db, robj *key, robj *val);
-void setKey(redisDb *db, robj *key, robj *val);
+robj *dbAdd(redisDb *db, robj *key, robj *val);
+robj *dbOverwrite(redisDb *db, robj *key, robj *val);
+robj *dbSetValue(redisDb *db, dictEntry *de, robj *val);
+robj *setKey(redisDb *db, robj *key, robj *val);
 int dbExists(redisDb *db, robj *key);
 robj *dbRandomKey(redisDb *db);
 int dbSyncDelete(redisDb *db, robj *key);
@@ -1744,6 +1882,7 @@ void slotToKeyFlush(void);
 int dbAsyncDelete(redisDb *db, robj *key);
 void emptyDbAsync(redisDb *db);
 void slotToKeyFlushAsync(void);
+void expireIndexFreeAsync(rax *index);
 size_t lazyfreeGetPendingObjectsCount(void);
 
 /* API to get key arguments from commands */
@@ -1776,6 +1915,9 @@ int redis_check_rdb(char *rdbfilename, FILE *fp);
 int redis_check_rdb_main(int argc, char **argv, FILE *fp);
 int redis_check_aof_main(int argc, char **argv);
 
+/* redis-evict-sim */
+int redis_evict_sim_main(int argc, char **argv);
+
 /* Scripting */
 void scriptingInit(int setup);
 int ldbRemoveChild(pid_t pid);
@@ -1792,7 +1934,13 @@ void disconnectAllBlockedClients(void);
 
 /* expire.c -- Handling of expired keys */
 void activeExpireCycle(int type);
+int activeExpireCycleTryExpireSome(redisDb *db, long long now);
+int activeExpireCycleShouldRepeat(redisDb *db, int expired);
 void expireSlaveKeys(void);
+void expireIndexUpdateKey(redisDb *db, sds key, long long when, int add);
+void expireIndexFlush(redisDb *db, int async);
+void expireIndexToggle(int enable);
+unsigned long long expiredKeysBacklog(redisDb *db, long long now);
 void rememberSlaveKeyWithExpire(redisDb *db, robj *key);
 void flushSlaveKeysWithExpireList(void);
 size_t getSlaveKeyWithExpireCount(void);
@@ -1802,11 +1950,62 @@ void evictionPoolAlloc(void);
 #define LFU_INIT_VAL 5
 unsigned long LFUGetTimeInMinutes(void);
 uint8_t LFULogIncr(uint8_t value);
+void tinylfuRecordAccess(sds key);
+unsigned int tinylfuEstimate(sds key);
+void tinylfuWindowAdd(int dbid, sds key);
+void tinylfuReset(void);
+unsigned long LFUDecrAndReturn(robj *o);
+
+/* tiered.c -- spilling of cold values to disk. */
+int tieredInit(void);
+void tieredCron(void);
+void tieredFreeValue(robj *o);
+robj *tieredLoadValue(robj *o);
+robj *tieredLoadKey(redisDb *db, dictEntry *de);
+void tieredLoadAll(void);
+int tieredBlockClientOnSpilledKeys(client *c);
+void tieredUnblockClient(client *c);
+int tieredObjectRdbType(robj *o);
+ssize_t tieredSaveObject(rio *rdb, robj *o);
+size_t tieredValueMemory(robj *o);
+sds genTieredInfoString(sds info);
+
+/* replcompress.c -- compression of the replication stream. */
+typedef struct replCompressor replCompressor;
+typedef struct replDecompressor replDecompressor;
+replCompressor *replCompressorCreate(void);
+void replCompressorRelease(replCompressor *c);
+sds replCompress(replCompressor *c, sds dst, const void *p, size_t len);
+replDecompressor *replDecompressorCreate(void);
+void replDecompressorRelease(replDecompressor *d);
+ssize_t replDecompressorFill(replDecompressor *d, int fd);
+ssize_t replDecompressorRead(replDecompressor *d, int fd, void *buf,
+                             size_t len);
+size_t replDecompressorPending(replDecompressor *d);
+
+/* replbacklog.c -- disk tier of the replication backlog. */
+void replBacklogDiskAppend(replBufBlock *o);
+void replBacklogDiskReset(void);
+void replBacklogDiskResize(void);
+int replBacklogDiskHasOffset(long long offset);
+long long replBacklogDiskFirstOffset(void);
+long long replBacklogDiskHistlen(void);
+ssize_t replBacklogDiskRead(long long offset, void *buf, size_t len);
+void replBacklogDiskAdvance(client *c, size_t len);
+
+/* snapshot.c -- BGSAVE without fork(). */
+int snapshotStart(char *filename, rdbSaveInfo *rsi);
+void snapshotCron(void);
+void snapshotAbort(void);
+void snapshotCompleteScan(int dbid);
+void snapshotBeforeKeyWrite(redisDb *db, robj *key);
+size_t snapshotBufferedBytes(void);
 
 /* Keys hashing / comparison functions for dict.c hash tables. */
 uint64_t dictSdsHash(const void *key);
 int dictSdsKeyCompare(void *privdata, const void *key1, const void *key2);
 void dictSdsDestructor(void *privdata, void *val);
+void dictDbKeyDestructor(void *privdata, void *key);
 
 /* Git SHA1 */
 char *redisGitSHA1(void);
@@ -0,0 +1,460 @@
+/* Forkless snapshots: BGSAVE without fork().
+ *
+ * When rdb-forkless is enabled, rdbSaveBackground() does not fork a child
+ * to save a point in time copy of the dataset. Instead snapshotStart()
+ * writes the header of the RDB file, and snapshotCron() iterates the
+ * keyspace incrementally with dictScan(), one DB after the other,
+ * serializing the keys exactly like rdbSaveRio() does. The output is
+ * accumulated in memory and handed to a bio.c thread, that writes it to a
+ * temporary file and fsyncs it at the end: the file is then renamed like
+ * in rdbSave().
+ *
+ * Since the keyspace keeps changing while it is scanned, the code about to
+ * modify or delete a key, or to add a new one, calls
+ * snapshotBeforeKeyWrite() first (see lookupKeyWrite(), dbAdd(), dbDelete()
+ * and setExpire()). If the scan did not reach the key yet, the value is
+ * saved right away, as it still is the value the key had when the snapshot
+ * started, and the key is remembered so that the scan skips it later. Keys
+ * created after the start are remembered the same way, so that they are not
+ * saved at all. Whether the scan passed a key is told comparing its bucket
+ * with the scan cursor (see dictScanCursorPassed()), which works as long as
+ * the hash tables of the keyspace are not shrunk meanwhile, so
+ * databasesCron() does not resize them while a snapshot is in progress. The
+ * keys of the DBs the scan did not reach yet are saved into a buffer of
+ * their DB, that is appended to the file when the scan gets there.
+ *
+ * This way the memory used by the snapshot is proportional to the keys
+ * changed while saving, instead of to the memory pages touched like with
+ * the copy on write of the child, and there is no fork latency. The price
+ * is the CPU time the main thread spends serializing values, limited to
+ * SNAPSHOT_CYCLE_TIME_PERC percent of the time by the cron function.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2017, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "bio.h"
+#include "atomicvar.h"
+
+#include <fcntl.h>
+#include <sys/param.h>
+
+#define SNAPSHOT_CYCLE_TIME_PERC 25  /* Max CPU % of the cron scanning. */
+#define SNAPSHOT_SCAN_STEPS 16       /* dictScan() calls between time checks. */
+#define SNAPSHOT_CHUNK_BYTES (1024*1024) /* Output handed to bio at once. */
+#define SNAPSHOT_MAX_PENDING_BYTES (64*1024*1024) /* Pause scanning above. */
+
+/* Operations of the BIO_SNAPSHOT_WRITE jobs. */
+#define SNAPSHOT_OP_WRITE 0
+#define SNAPSHOT_OP_FSYNC 1
+#define SNAPSHOT_OP_CLOSE 2
+
+/* The temporary file, shared with the bio thread. The main thread only
+ * reads 'err', 'done' and 'pending', and once it submits the close job the
+ * structure belongs to the bio thread, that releases it. */
+typedef struct snapshotFile {
+    int fd;
+    int err;            /* errno of the first failed write or fsync, or 0. */
+    int done;           /* Set when the fsync job was processed. */
+    size_t pending;     /* Bytes submitted and not yet written. */
+} snapshotFile;
+
+static struct {
+    snapshotFile *file;     /* NULL if no snapshot is in progress. */
+    char tmpfile[256];
+    sds filename;           /* Final name of the RDB file. */
+    rio rdb;                /* Output of the DB being scanned. */
+    long long now;          /* Keys expired at this time are not saved. */
+    int db;                 /* DB being scanned, server.dbnum at the end. */
+    unsigned long cursor;   /* dictScan() cursor of the DB being scanned. */
+    dict **touched;         /* Per DB, keys the scan must skip, or NULL. */
+    sds *ahead;             /* Per DB, keys saved before the scan started
+                               the DB, or NULL. */
+    size_t ahead_bytes;     /* Total length of the 'ahead' buffers. */
+    size_t peak_bytes;      /* Peak of the memory used by the output. */
+    int error;              /* A value could not be serialized. */
+} snapshot;
+
+/* ----------------------------------------------------------------------------
+ * Output, written by the bio thread.
+ * --------------------------------------------------------------------------*/
+
+/* Process a BIO_SNAPSHOT_WRITE job. Called by the bio thread. */
+void snapshotProcessJobFromBioThread(void *file, sds buf, int op) {
+    snapshotFile *f = file;
+    int err;
+
+    atomicGet(f->err,err);
+    if (op == SNAPSHOT_OP_WRITE) {
+        size_t len = sdslen(buf), nwritten = 0;
+
+        while(!err && nwritten < len) {
+            ssize_t n = write(f->fd,buf+nwritten,len-nwritten);
+
+            if (n == -1) {
+                if (errno == EINTR) continue;
+                err = errno;
+                atomicSet(f->err,err);
+            } else {
+                nwritten += n;
+            }
+        }
+        atomicDecr(f->pending,len);
+        sdsfree(buf);
+    } else if (op == SNAPSHOT_OP_FSYNC) {
+        if (!err && fsync(f->fd) == -1) atomicSet(f->err,errno);
+        atomicSet(f->done,1);
+    } else {
+        close(f->fd);
+        zfree(f);
+    }
+}
+
+/* Return the memory used by the output not yet written. */
+size_t snapshotBufferedBytes(void) {
+    size_t pending;
+
+    if (snapshot.file == NULL) return 0;
+    atomicGet(snapshot.file->pending,pending);
+    return pending+sdslen(snapshot.rdb.io.buffer.ptr)+snapshot.ahead_bytes;
+}
+
+/* Hand the output accumulated so far to the bio thread. */
+static void snapshotFlushOutput(void) {
+    sds buf = snapshot.rdb.io.buffer.ptr;
+    size_t used = snapshotBufferedBytes();
+
+    if (used > snapshot.peak_bytes) snapshot.peak_bytes = used;
+    if (sdslen(buf) == 0) return;
+    atomicIncr(snapshot.file->pending,sdslen(buf));
+    bioCreateBackgroundJob(BIO_SNAPSHOT_WRITE,snapshot.file,buf,
+                           (void*)(long)SNAPSHOT_OP_WRITE);
+    snapshot.rdb.io.buffer.ptr = sdsempty();
+    snapshot.rdb.io.buffer.pos = 0;
+}
+
+/* ----------------------------------------------------------------------------
+ * Keyspace scan.
+ * --------------------------------------------------------------------------*/
+
+/* Serialize a key of the keyspace with its value and expire. */
+static void snapshotSaveKey(rio *rdb, sds keysds, robj *val) {
+    robj key;
+
+    initStaticStringObject(key,keysds);
+    if (rdbSaveKeyValuePair(rdb,&key,val,keyGetExpire(keysds),
+                            snapshot.now) == -1)
+    {
+        snapshot.error = 1;
+    }
+}
+
+/* Move the scan to the next DB having keys, or keys saved ahead of the
+ * scan, writing its SELECTDB and RESIZEDB opcodes. */
+static void snapshotNextDb(void) {
+    while(++snapshot.db < server.dbnum) {
+        redisDb *db = server.db+snapshot.db;
+        sds ahead = snapshot.ahead[snapshot.db];
+        uint32_t db_size, expires_size;
+
+        if (dictSize(db->dict) == 0 && ahead == NULL) continue;
+
+        /* Like in rdbSaveRio() the sizes are just hints. */
+        db_size = (dictSize(db->dict) <= UINT32_MAX) ?
+                  dictSize(db->dict) : UINT32_MAX;
+        expires_size = (dictMarkedSize(db->dict) <= UINT32_MAX) ?
+                       dictMarkedSize(db->dict) : UINT32_MAX;
+        rdbSaveType(&snapshot.rdb,RDB_OPCODE_SELECTDB);
+        rdbSaveLen(&snapshot.rdb,snapshot.db);
+        rdbSaveType(&snapshot.rdb,RDB_OPCODE_RESIZEDB);
+        rdbSaveLen(&snapshot.rdb,db_size);
+        rdbSaveLen(&snapshot.rdb,expires_size);
+        if (ahead) {
+            rioWrite(&snapshot.rdb,ahead,sdslen(ahead));
+            snapshot.ahead_bytes -= sdslen(ahead);
+            sdsfree(ahead);
+            snapshot.ahead[snapshot.db] = NULL;
+        }
+        snapshot.cursor = 0;
+        return;
+    }
+}
+
+static void snapshotScanCallback(void *privdata, const dictEntry *de) {
+    redisDb *db = privdata;
+    dict *touched = snapshot.touched[db->id];
+    sds key = dictGetKey(de);
+
+    /* Skip the keys already saved, or created after the start. The scan
+     * never returns a key twice, so they can be forgotten. */
+    if (touched && dictDelete(touched,key) == DICT_OK) return;
+    snapshotSaveKey(&snapshot.rdb,key,dictGetVal(de));
+}
+
+/* Scan a few buckets of the current DB. Return 1 if there is more to scan,
+ * or 0 once all the DBs were saved. */
+static int snapshotScanStep(void) {
+    redisDb *db;
+
+    if (snapshot.db == server.dbnum) return 0;
+    db = server.db+snapshot.db;
+    snapshot.cursor = dictScan(db->dict,snapshot.cursor,snapshotScanCallback,
+                               NULL,db);
+    if (snapshot.cursor == 0) {
+        if (snapshot.touched[db->id]) {
+            dictRelease(snapshot.touched[db->id]);
+            snapshot.touched[db->id] = NULL;
+        }
+        snapshotNextDb();
+    }
+    return snapshot.db != server.dbnum;
+}
+
+/* Write the EOF opcode and the checksum, then ask the bio thread to fsync
+ * the file once everything is written. */
+static void snapshotWriteEnd(void) {
+    uint64_t cksum;
+
+    rdbSaveType(&snapshot.rdb,RDB_OPCODE_EOF);
+    cksum = snapshot.rdb.cksum;
+    memrev64ifbe(&cksum);
+    rioWrite(&snapshot.rdb,&cksum,8);
+    snapshotFlushOutput();
+    bioCreateBackgroundJob(BIO_SNAPSHOT_WRITE,snapshot.file,NULL,
+                           (void*)(long)SNAPSHOT_OP_FSYNC);
+}
+
+/* ----------------------------------------------------------------------------
+ * API.
+ * --------------------------------------------------------------------------*/
+
+/* Start saving the dataset to 'filename' without forking. Called by
+ * rdbSaveBackground() when rdb-forkless is enabled. Returns C_OK if the
+ * snapshot was started, otherwise C_ERR. */
+int snapshotStart(char *filename, rdbSaveInfo *rsi) {
+    char cwd[MAXPATHLEN]; /* Current working dir path for error messages. */
+    char magic[10];
+    int fd;
+
+    snprintf(snapshot.tmpfile,sizeof(snapshot.tmpfile),
+             "temp-snapshot-%d.rdb",(int) getpid());
+    fd = open(snapshot.tmpfile,O_WRONLY|O_CREAT|O_TRUNC,0644);
+    if (fd == -1) {
+        char *cwdp = getcwd(cwd,MAXPATHLEN);
+        serverLog(LL_WARNING,
+            "Failed opening the RDB file %s (in server root dir %s) "
+            "for saving: %s",
+            filename,
+            cwdp ? cwdp : "unknown",
+            strerror(errno));
+        server.lastbgsave_status = C_ERR;
+        return C_ERR;
+    }
+
+    snapshot.file = zcalloc(sizeof(snapshotFile));
+    snapshot.file->fd = fd;
+    snapshot.filename = sdsnew(filename);
+    snapshot.touched = zcalloc(sizeof(dict*)*server.dbnum);
+    snapshot.ahead = zcalloc(sizeof(sds)*server.dbnum);
+    snapshot.ahead_bytes = 0;
+    snapshot.peak_bytes = 0;
+    snapshot.error = 0;
+    snapshot.now = mstime();
+    server.stat_rdb_forkless_copied_keys = 0;
+
+    /* Writes to a buffer can't fail. */
+    rioInitWithBuffer(&snapshot.rdb,sdsempty());
+    if (server.rdb_checksum)
+        snapshot.rdb.update_cksum = rioGenericUpdateChecksum;
+    snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
+    rioWrite(&snapshot.rdb,magic,9);
+    rdbSaveInfoAuxFields(&snapshot.rdb,RDB_SAVE_NONE,rsi);
+    snapshot.db = -1;
+    snapshotNextDb();
+
+    serverLog(LL_NOTICE,"Background saving started without forking");
+    server.rdb_forkless_in_progress = 1;
+    server.rdb_save_time_start = time(NULL);
+    server.rdb_child_type = RDB_CHILD_TYPE_DISK;
+    return C_OK;
+}
+
+/* Release the state of the snapshot, and the temporary file if 'unlink_tmp'
+ * is true. */
+static void snapshotRelease(int unlink_tmp) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        if (snapshot.touched[j]) dictRelease(snapshot.touched[j]);
+        sdsfree(snapshot.ahead[j]);
+    }
+    zfree(snapshot.touched);
+    zfree(snapshot.ahead);
+    snapshot.touched = NULL;
+    snapshot.ahead = NULL;
+    snapshot.ahead_bytes = 0;
+    sdsfree(snapshot.rdb.io.buffer.ptr);
+    sdsfree(snapshot.filename);
+    bioCreateBackgroundJob(BIO_SNAPSHOT_WRITE,snapshot.file,NULL,
+                           (void*)(long)SNAPSHOT_OP_CLOSE);
+    snapshot.file = NULL;
+    if (unlink_tmp) unlink(snapshot.tmpfile);
+
+    server.stat_rdb_cow_bytes = 0; /* No pages are copied without a fork. */
+    server.stat_rdb_forkless_peak_bytes = snapshot.peak_bytes;
+    server.rdb_forkless_in_progress = 0;
+    server.rdb_child_type = RDB_CHILD_TYPE_NONE;
+    server.rdb_save_time_last = time(NULL)-server.rdb_save_time_start;
+    server.rdb_save_time_start = -1;
+}
+
+/* Terminate the snapshot like backgroundSaveDoneHandlerDisk() does for the
+ * saving child. */
+static void snapshotDone(int err) {
+    if (!err && rename(snapshot.tmpfile,snapshot.filename) == -1) err = errno;
+    if (!err) {
+        serverLog(LL_NOTICE,"Background saving terminated with success");
+        server.dirty = server.dirty - server.dirty_before_bgsave;
+        server.lastsave = time(NULL);
+        server.lastbgsave_status = C_OK;
+    } else {
+        serverLog(LL_WARNING,"Background saving error: %s",
+            err == -1 ? "can't serialize a value" : strerror(err));
+        server.lastbgsave_status = C_ERR;
+    }
+    snapshotRelease(err != 0);
+
+    /* Possibly there are slaves waiting for a BGSAVE in order to be served
+     * (the first stage of SYNC is a bulk transfer of dump.rdb) */
+    updateSlavesWaitingBgsave(err ? C_ERR : C_OK, RDB_CHILD_TYPE_DISK);
+}
+
+/* Stop the snapshot in progress, if any, without saving. This is the
+ * equivalent of killing the saving child. */
+void snapshotAbort(void) {
+    if (!server.rdb_forkless_in_progress) return;
+    serverLog(LL_WARNING,"Background saving without fork aborted");
+    snapshotRelease(1);
+    updateSlavesWaitingBgsave(C_ERR, RDB_CHILD_TYPE_DISK);
+}
+
+/* Called from serverCron(): scan the keyspace for a limited amount of time,
+ * or handle the end of the snapshot. */
+void snapshotCron(void) {
+    long long start, timelimit;
+    size_t pending;
+    int err, done;
+
+    if (!server.rdb_forkless_in_progress) return;
+
+    atomicGet(snapshot.file->err,err);
+    if (snapshot.error || err) {
+        snapshotDone(err ? err : -1);
+        return;
+    }
+
+    if (snapshot.db == server.dbnum) {
+        atomicGet(snapshot.file->done,done);
+        if (done) snapshotDone(0);
+        return;
+    }
+
+    /* Don't let the output grow without limits if the disk is slower than
+     * the scan. */
+    atomicGet(snapshot.file->pending,pending);
+    if (pending > SNAPSHOT_MAX_PENDING_BYTES) return;
+
+    start = ustime();
+    timelimit = 1000000*SNAPSHOT_CYCLE_TIME_PERC/server.hz/100;
+    while(1) {
+        int j, more = 1;
+
+        for (j = 0; j < SNAPSHOT_SCAN_STEPS && more; j++)
+            more = snapshotScanStep();
+        if (sdslen(snapshot.rdb.io.buffer.ptr) >= SNAPSHOT_CHUNK_BYTES)
+            snapshotFlushOutput();
+        if (!more) {
+            snapshotWriteEnd();
+            break;
+        }
+        if (ustime()-start > timelimit) break;
+    }
+    snapshotFlushOutput();
+}
+
+/* Complete the scan of the keyspace synchronously. Called before changes
+ * that don't go through snapshotBeforeKeyWrite(), like flushing or
+ * swapping DBs, if they involve DBs the scan did not complete yet
+ * ('dbid' is the DB changed, or -1 for all the DBs). The file is still
+ * written and fsynced in background. */
+void snapshotCompleteScan(int dbid) {
+    if (!server.rdb_forkless_in_progress ||
+        snapshot.db == server.dbnum ||
+        (dbid != -1 && dbid < snapshot.db)) return;
+
+    while(snapshotScanStep()) {
+        if (sdslen(snapshot.rdb.io.buffer.ptr) >= SNAPSHOT_CHUNK_BYTES)
+            snapshotFlushOutput();
+    }
+    snapshotWriteEnd();
+}
+
+/* Called before the key 'key' of 'db' is modified, deleted or created, to
+ * save its current value if the scan did not reach it yet. */
+void snapshotBeforeKeyWrite(redisDb *db, robj *key) {
+    dictEntry *de;
+    dict *touched;
+
+    if (!server.rdb_forkless_in_progress || db->id < snapshot.db) return;
+    if (db->id == snapshot.db &&
+        dictScanCursorPassed(db->dict,snapshot.cursor,key->ptr)) return;
+
+    if ((touched = snapshot.touched[db->id]) == NULL)
+        touched = snapshot.touched[db->id] = dictCreate(&setDictType,NULL);
+    if (dictFind(touched,key->ptr)) return;
+    dictAdd(touched,sdsdup(key->ptr),NULL);
+
+    /* Nothing to save for keys that didn't exist. */
+    if ((de = dictFind(db->dict,key->ptr)) == NULL) return;
+    if (db->id == snapshot.db) {
+        snapshotSaveKey(&snapshot.rdb,dictGetKey(de),dictGetVal(de));
+    } else {
+        rio rdb;
+        sds ahead = snapshot.ahead[db->id];
+
+        if (ahead == NULL) ahead = sdsempty();
+        snapshot.ahead_bytes -= sdslen(ahead);
+        rioInitWithBuffer(&rdb,ahead);
+        snapshotSaveKey(&rdb,dictGetKey(de),dictGetVal(de));
+        snapshot.ahead[db->id] = rdb.io.buffer.ptr;
+        snapshot.ahead_bytes += sdslen(rdb.io.buffer.ptr);
+    }
+    server.stat_rdb_forkless_copied_keys++;
+}
@@ -208,7 +208,7 @@ void pushGenericCommand(client *c, int where) {
             lobj = createQuicklistObject();
             quicklistSetOptions(lobj->ptr, server.list_max_ziplist_size,
                                 server.list_compress_depth);
-            dbAdd(c->db,c->argv[1],lobj);
+            lobj = dbAdd(c->db,c->argv[1],lobj);
         }
         listTypePush(lobj,c->argv[j],where);
         pushed++;
@@ -553,7 +553,7 @@ void rpoplpushHandlePush(client *c, robj *dstkey, robj *dstobj, robj *value) {
         dstobj = createQuicklistObject();
         quicklistSetOptions(dstobj->ptr, server.list_max_ziplist_size,
                             server.list_compress_depth);
-        dbAdd(c->db,dstkey,dstobj);
+        dstobj = dbAdd(c->db,dstkey,dstobj);
     }
     signalModifiedKey(c->db,dstkey);
     listTypePush(dstobj,value,LIST_HEAD);
@@ -268,7 +268,7 @@ void saddCommand(client *c) {
     set = lookupKeyWrite(c->db,c->argv[1]);
     if (set == NULL) {
         set = setTypeCreate(c->argv[2]->ptr);
-        dbAdd(c->db,c->argv[1],set);
+        set = dbAdd(c->db,c->argv[1],set);
     } else {
         if (set->type != OBJ_SET) {
             addReply(c,shared.wrongtypeerr);
@@ -355,7 +355,7 @@ void smoveCommand(client *c) {
     /* Create the destination set when it doesn't exist */
     if (!dstset) {
         dstset = setTypeCreate(ele->ptr);
-        dbAdd(c->db,c->argv[2],dstset);
+        dstset = dbAdd(c->db,c->argv[2],dstset);
     }
 
     signalModifiedKey(c->db,c->argv[1]);
@@ -893,7 +893,7 @@ void sinterGenericCommand(client *c, robj **setkeys,
          * is not an empty set. */
         int deleted = dbDelete(c->db,dstkey);
         if (setTypeSize(dstset) > 0) {
-            dbAdd(c->db,dstkey,dstset);
+            dstset = dbAdd(c->db,dstkey,dstset);
             addReplyLongLong(c,setTypeSize(dstset));
             notifyKeyspaceEvent(NOTIFY_SET,"sinterstore",
                 dstkey,c->db->id);
@@ -1066,7 +1066,7 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
          * create this key with the result set inside */
         int deleted = dbDelete(c->db,dstkey);
         if (setTypeSize(dstset) > 0) {
-            dbAdd(c->db,dstkey,dstset);
+            dstset = dbAdd(c->db,dstkey,dstset);
             addReplyLongLong(c,setTypeSize(dstset));
             notifyKeyspaceEvent(NOTIFY_SET,
                 op == SET_OP_UNION ? "sunionstore" : "sdiffstore",
@@ -0,0 +1,773 @@
+/* Tiered storage: spill cold values to a file on local disk.
+ *
+ * When the memory used goes above tiered-storage-max-memory, the cron
+ * function samples the keyspace and serializes the coldest values, using
+ * the same LRU / LFU information of the maxmemory policies, into a file
+ * that is written by a pool of I/O threads. In the keyspace the value is
+ * replaced by a stub: an object of the same type with the encoding
+ * OBJ_ENCODING_SPILLED, whose 'ptr' is a tieredValue structure telling
+ * where the serialized value is in the file.
+ *
+ * Before a command is executed, processCommand() calls
+ * tieredBlockClientOnSpilledKeys(): if some of the keys of the command are
+ * spilled, the reads are submitted to the I/O threads and the client is
+ * blocked (BLOCKED_TIERED) like clients blocked in list operations, so
+ * the server keeps serving the other clients meanwhile. Once all the reads
+ * are completed, the client is unblocked and executes the same command
+ * again, this time finding the serialized values in memory: lookupKey()
+ * deserializes them, putting the original value back in the keyspace.
+ * Values accessed in other ways (Lua scripts, modules, ...) are read
+ * synchronously.
+ *
+ * The file is split in pages of TIERED_PAGE_SIZE bytes, tracked with a
+ * bitmap. Every value uses contiguous pages, allocated first-fit.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2017, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "atomicvar.h"
+
+#include <fcntl.h>
+#include <signal.h>
+
+#define TIERED_PAGE_SIZE 64         /* Allocation unit in the file. */
+#define TIERED_MIN_VALUE_SIZE 128   /* Don't spill smaller values. */
+#define TIERED_SAMPLES 16           /* Keys sampled per spilled value. */
+#define TIERED_CYCLE_TIME_PERC 10   /* Max CPU % of the cron spilling. */
+#define TIERED_MAX_PENDING_WRITES 1024
+#define TIERED_SCAN_PAGES (64*1024) /* Max pages scanned to reuse space. */
+#define TIERED_NO_PAGE UINT64_MAX
+
+#define TIERED_JOB_WRITE 0
+#define TIERED_JOB_READ 1
+
+typedef struct tieredJob tieredJob;
+
+/* The 'ptr' of a stub object. The main thread owns the structure, but it
+ * may be released by the lazy free thread: 'job' and the pages are only
+ * accessed with tiered.lock held. */
+typedef struct tieredValue {
+    unsigned char rdbtype;  /* RDB type of the value, payload[0]. */
+    uint64_t page;          /* First page in the file, or TIERED_NO_PAGE. */
+    size_t len;             /* Length of the serialized value. */
+    sds payload;            /* Serialized value, NULL if only on disk. */
+    tieredJob *job;         /* Write or read in progress, or NULL. */
+} tieredValue;
+
+/* An I/O request for the threads. The threads only access 'page', 'len',
+ * 'buf' and 'err'. */
+struct tieredJob {
+    int type;               /* TIERED_JOB_WRITE or TIERED_JOB_READ. */
+    tieredValue *tv;        /* NULL if the value was released meanwhile. */
+    uint64_t page;
+    size_t len;
+    sds buf;                /* Data to write, or buffer to read into. */
+    int err;                /* errno of a failed I/O, or 0. */
+    long long start;        /* ustime() when the job was submitted. */
+    list *clients;          /* Clients waiting for a read. */
+};
+
+static struct {
+    int fd;                 /* The file, -1 if not initialized. */
+    pthread_mutex_t lock;   /* Pages and links between values and jobs. */
+    uint64_t *bitmap;       /* A set bit for every used page. */
+    uint64_t pages;         /* Pages in the file. */
+    uint64_t used_pages;
+    uint64_t next_page;     /* Where the search of free pages starts. */
+    pthread_mutex_t jobs_mutex; /* Protects 'jobs' and 'done'. */
+    pthread_cond_t jobs_cond;
+    list *jobs;             /* Jobs waiting for an I/O thread. */
+    list *done;             /* Completed jobs. */
+    int pipe[2];            /* Awakes the event loop on completed jobs. */
+    pthread_t *threads;
+    unsigned long pending_writes;
+    unsigned long pending_reads;
+    size_t pending_write_bytes; /* Payloads released on write completion. */
+    long long values;       /* Number of stubs, updated atomically. */
+    time_t write_error_time; /* Last write error, pauses spilling. */
+    int db;                 /* Next DB to sample. */
+} tiered = { .fd = -1 };
+
+/* ----------------------------------------------------------------------------
+ * Pages allocation. Called with tiered.lock held.
+ * --------------------------------------------------------------------------*/
+
+static uint64_t tieredPagesCount(size_t len) {
+    return (len+TIERED_PAGE_SIZE-1)/TIERED_PAGE_SIZE;
+}
+
+static int tieredPageIsUsed(uint64_t page) {
+    return (tiered.bitmap[page>>6] >> (page&63)) & 1;
+}
+
+static void tieredSetPages(uint64_t page, uint64_t count, int used) {
+    uint64_t j;
+
+    for (j = page; j < page+count; j++) {
+        if (used)
+            tiered.bitmap[j>>6] |= 1ULL<<(j&63);
+        else
+            tiered.bitmap[j>>6] &= ~(1ULL<<(j&63));
+    }
+    if (used) tiered.used_pages += count; else tiered.used_pages -= count;
+}
+
+/* Return the first of 'count' contiguous free pages. Free pages are
+ * searched from tiered.next_page, the lowest page freed so far, for a
+ * bounded number of pages: when no space is found the file grows. */
+static uint64_t tieredAllocPages(uint64_t count) {
+    uint64_t j = tiered.next_page, start = 0, run = 0;
+    uint64_t limit = tiered.next_page+TIERED_SCAN_PAGES;
+
+    if (limit > tiered.pages) limit = tiered.pages;
+    while (j < limit) {
+        if (run == 0 && (j&63) == 0 && tiered.bitmap[j>>6] == UINT64_MAX) {
+            j += 64; /* Skip full words. */
+            continue;
+        }
+        if (tieredPageIsUsed(j)) {
+            run = 0;
+        } else {
+            if (run++ == 0) start = j;
+            if (run == count) break;
+        }
+        j++;
+    }
+
+    if (run != count) {
+        /* Append at the end of the file, reusing the free pages there. */
+        uint64_t words;
+
+        start = tiered.pages;
+        while (start > 0 && !tieredPageIsUsed(start-1)) start--;
+        if (start+count > tiered.pages) {
+            words = (start+count+63)/64;
+            if (words > (tiered.pages+63)/64) {
+                tiered.bitmap = zrealloc(tiered.bitmap,words*sizeof(uint64_t));
+                memset(tiered.bitmap+(tiered.pages+63)/64,0,
+                    (words-(tiered.pages+63)/64)*sizeof(uint64_t));
+            }
+            tiered.pages = start+count;
+        }
+    }
+    tieredSetPages(start,count,1);
+    if (tiered.next_page == start) tiered.next_page = start+count;
+    return start;
+}
+
+static void tieredFreePages(uint64_t page, size_t len) {
+    tieredSetPages(page,tieredPagesCount(len),0);
+    if (page < tiered.next_page) tiered.next_page = page;
+}
+
+/* ----------------------------------------------------------------------------
+ * I/O threads.
+ * --------------------------------------------------------------------------*/
+
+/* Read or write 'len' bytes at 'offset' of the file. Returns 0 on success,
+ * otherwise the errno value. */
+static int tieredFileIO(int type, char *buf, size_t len, off_t offset) {
+    while (len) {
+        ssize_t n = (type == TIERED_JOB_WRITE) ?
+                    pwrite(tiered.fd,buf,len,offset) :
+                    pread(tiered.fd,buf,len,offset);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        if (n == 0) return EIO; /* Short read. */
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static void *tieredIOThreadMain(void *arg) {
+    sigset_t sigset;
+    UNUSED(arg);
+
+    /* Block SIGALRM so we are sure that only the main thread will
+     * receive the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
+        serverLog(LL_WARNING,
+            "Warning: can't mask SIGALRM in tiered storage thread: %s",
+            strerror(errno));
+
+    pthread_mutex_lock(&tiered.jobs_mutex);
+    while(1) {
+        listNode *ln;
+        tieredJob *job;
+
+        if (listLength(tiered.jobs) == 0) {
+            pthread_cond_wait(&tiered.jobs_cond,&tiered.jobs_mutex);
+            continue;
+        }
+        ln = listFirst(tiered.jobs);
+        job = ln->value;
+        listDelNode(tiered.jobs,ln);
+        pthread_mutex_unlock(&tiered.jobs_mutex);
+
+        job->err = tieredFileIO(job->type,job->buf,job->len,
+                                (off_t)job->page*TIERED_PAGE_SIZE);
+
+        pthread_mutex_lock(&tiered.jobs_mutex);
+        listAddNodeTail(tiered.done,job);
+        if (write(tiered.pipe[1],"A",1) != 1) {
+            /* Ignore the error, the pipe is already full. */
+        }
+    }
+    return NULL;
+}
+
+static tieredJob *tieredCreateJob(int type, tieredValue *tv) {
+    tieredJob *job = zmalloc(sizeof(*job));
+
+    job->type = type;
+    job->tv = tv;
+    job->page = tv->page;
+    job->len = tv->len;
+    job->buf = (type == TIERED_JOB_WRITE) ? tv->payload :
+                                            sdsnewlen(NULL,tv->len);
+    job->err = 0;
+    job->start = ustime();
+    job->clients = listCreate();
+    tv->job = job;
+    return job;
+}
+
+static void tieredSubmitJob(tieredJob *job) {
+    pthread_mutex_lock(&tiered.jobs_mutex);
+    listAddNodeTail(tiered.jobs,job);
+    pthread_cond_signal(&tiered.jobs_cond);
+    pthread_mutex_unlock(&tiered.jobs_mutex);
+}
+
+/* Write the payload of 'tv' to new pages of the file. The payload is
+ * released once the write completes. */
+static void tieredWrite(tieredValue *tv) {
+    tieredJob *job;
+
+    pthread_mutex_lock(&tiered.lock);
+    tv->page = tieredAllocPages(tieredPagesCount(tv->len));
+    job = tieredCreateJob(TIERED_JOB_WRITE,tv);
+    pthread_mutex_unlock(&tiered.lock);
+    tiered.pending_writes++;
+    tiered.pending_write_bytes += sdsAllocSize(tv->payload);
+    tieredSubmitJob(job);
+}
+
+static tieredJob *tieredRead(tieredValue *tv) {
+    tieredJob *job;
+
+    pthread_mutex_lock(&tiered.lock);
+    job = tieredCreateJob(TIERED_JOB_READ,tv);
+    pthread_mutex_unlock(&tiered.lock);
+    tiered.pending_reads++;
+    tieredSubmitJob(job);
+    return job;
+}
+
+/* Handle a job completed by the I/O threads, unblocking the clients
+ * waiting for it. */
+static void tieredCompleteJob(tieredJob *job) {
+    tieredValue *tv;
+    long long elapsed = ustime()-job->start;
+
+    pthread_mutex_lock(&tiered.lock);
+    tv = job->tv;
+    if (tv) tv->job = NULL;
+    if (job->type == TIERED_JOB_WRITE) {
+        tiered.pending_writes--;
+        tiered.pending_write_bytes -= sdsAllocSize(job->buf);
+        if (job->err || tv == NULL) tieredFreePages(job->page,job->len);
+        if (tv == NULL) {
+            sdsfree(job->buf);
+        } else if (job->err) {
+            tv->page = TIERED_NO_PAGE; /* Retried by tieredCron(). */
+        } else {
+            sdsfree(tv->payload);
+            tv->payload = NULL;
+        }
+    } else {
+        tiered.pending_reads--;
+        if (tv && !job->err) {
+            tv->payload = job->buf;
+        } else {
+            sdsfree(job->buf);
+        }
+    }
+    pthread_mutex_unlock(&tiered.lock);
+
+    if (job->type == TIERED_JOB_WRITE && job->err) {
+        if (server.unixtime != tiered.write_error_time)
+            serverLog(LL_WARNING,"Error writing to the tiered storage file "
+                "%s: %s. Spilling paused.",
+                server.tiered_storage_file, strerror(job->err));
+        tiered.write_error_time = server.unixtime;
+    } else if (job->type == TIERED_JOB_READ) {
+        if (tv && job->err) {
+            serverLog(LL_WARNING,"Error reading from the tiered storage "
+                "file %s: %s", server.tiered_storage_file, strerror(job->err));
+            serverPanic("Unrecoverable tiered storage read error");
+        }
+        server.stat_tiered_reads++;
+        server.stat_tiered_read_usec += elapsed;
+        if (elapsed > server.stat_tiered_read_max_usec)
+            server.stat_tiered_read_max_usec = elapsed;
+        latencyAddSampleIfNeeded("tiered-read",elapsed/1000);
+    }
+
+    while (listLength(job->clients)) {
+        listNode *ln = listFirst(job->clients);
+        client *c = listNodeValue(ln);
+
+        listDelNode(job->clients,ln);
+        ln = listSearchKey(c->bpop.tiered_jobs,job);
+        serverAssert(ln != NULL);
+        listDelNode(c->bpop.tiered_jobs,ln);
+        if (listLength(c->bpop.tiered_jobs) == 0) unblockClient(c);
+    }
+    listRelease(job->clients);
+    zfree(job);
+}
+
+/* Called when the I/O threads write to the pipe. The unblocked clients
+ * are served in beforeSleep(), like the clients unblocked by BLPOP. */
+static void tieredPipeReadable(aeEventLoop *el, int fd, void *privdata, int mask) {
+    char buf[64];
+    list *done;
+    listNode *ln;
+    UNUSED(el);
+    UNUSED(privdata);
+    UNUSED(mask);
+
+    while (read(fd,buf,sizeof(buf)) > 0);
+    pthread_mutex_lock(&tiered.jobs_mutex);
+    done = tiered.done;
+    tiered.done = listCreate();
+    pthread_mutex_unlock(&tiered.jobs_mutex);
+
+    while ((ln = listFirst(done)) != NULL) {
+        tieredJob *job = listNodeValue(ln);
+        listDelNode(done,ln);
+        tieredCompleteJob(job);
+    }
+    listRelease(done);
+}
+
+/* Open the file and start the I/O threads. Once initialized the file and
+ * the threads are kept even if tiered storage is disabled. */
+int tieredInit(void) {
+    int j;
+
+    if (tiered.fd != -1) return C_OK;
+    tiered.fd = open(server.tiered_storage_file,O_RDWR|O_CREAT|O_TRUNC,0600);
+    if (tiered.fd == -1) {
+        serverLog(LL_WARNING,"Can't open the tiered storage file %s: %s",
+            server.tiered_storage_file, strerror(errno));
+        return C_ERR;
+    }
+    if (pipe(tiered.pipe) == -1) {
+        serverLog(LL_WARNING,"Can't create the tiered storage pipe: %s",
+            strerror(errno));
+        close(tiered.fd);
+        tiered.fd = -1;
+        return C_ERR;
+    }
+    anetNonBlock(NULL,tiered.pipe[0]);
+    anetNonBlock(NULL,tiered.pipe[1]);
+    if (aeCreateFileEvent(server.el,tiered.pipe[0],AE_READABLE,
+        tieredPipeReadable,NULL) == AE_ERR)
+    {
+        serverPanic("Error registering the tiered storage pipe event.");
+    }
+
+    pthread_mutex_init(&tiered.lock,NULL);
+    pthread_mutex_init(&tiered.jobs_mutex,NULL);
+    pthread_cond_init(&tiered.jobs_cond,NULL);
+    tiered.jobs = listCreate();
+    tiered.done = listCreate();
+    tiered.threads = zmalloc(sizeof(pthread_t)*server.tiered_storage_io_threads);
+    for (j = 0; j < server.tiered_storage_io_threads; j++) {
+        if (pthread_create(&tiered.threads[j],NULL,tieredIOThreadMain,NULL)) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize tiered storage "
+                                 "I/O threads.");
+            exit(1);
+        }
+    }
+    serverLog(LL_NOTICE,"Tiered storage enabled, spilling to %s",
+        server.tiered_storage_file);
+    return C_OK;
+}
+
+/* ----------------------------------------------------------------------------
+ * Stubs.
+ * --------------------------------------------------------------------------*/
+
+/* Release the stub 'o'. This may be called by the lazy free thread. */
+void tieredFreeValue(robj *o) {
+    tieredValue *tv = o->ptr;
+
+    pthread_mutex_lock(&tiered.lock);
+    if (tv->job) {
+        tv->job->tv = NULL;
+        if (tv->job->type == TIERED_JOB_WRITE) {
+            /* The job now owns the payload and the pages. */
+            tv->payload = NULL;
+            tv->page = TIERED_NO_PAGE;
+        }
+    }
+    if (tv->page != TIERED_NO_PAGE) tieredFreePages(tv->page,tv->len);
+    pthread_mutex_unlock(&tiered.lock);
+    sdsfree(tv->payload);
+    zfree(tv);
+    atomicDecr(tiered.values,1);
+}
+
+/* Read the serialized value of 'tv' synchronously. Also used in the
+ * children saving the dataset, where the payloads of the values being
+ * written are still in memory, while the pages of the other values are
+ * not reused since no value is spilled while a child is active. */
+static sds tieredReadPayload(tieredValue *tv) {
+    sds buf = sdsnewlen(NULL,tv->len);
+    int err;
+
+    if ((err = tieredFileIO(TIERED_JOB_READ,buf,tv->len,
+                            (off_t)tv->page*TIERED_PAGE_SIZE)) != 0)
+    {
+        serverLog(LL_WARNING,"Error reading from the tiered storage file "
+            "%s: %s", server.tiered_storage_file, strerror(err));
+        serverPanic("Unrecoverable tiered storage read error");
+    }
+    return buf;
+}
+
+/* Return a new object with the value of the stub 'o', that is not
+ * modified. */
+robj *tieredLoadValue(robj *o) {
+    tieredValue *tv = o->ptr;
+    sds buf = tv->payload ? tv->payload : tieredReadPayload(tv);
+    robj *val;
+    rio rdb;
+    int type;
+
+    rioInitWithBuffer(&rdb,buf);
+    if ((type = rdbLoadObjectType(&rdb)) == -1 ||
+        (val = rdbLoadObject(type,&rdb)) == NULL)
+    {
+        serverPanic("Corrupted value in tiered storage");
+    }
+    if (buf != tv->payload) sdsfree(buf);
+    val->lru = o->lru;
+    return val;
+}
+
+/* Replace the stub at 'de' with its value, that is returned. */
+robj *tieredLoadKey(redisDb *db, dictEntry *de) {
+    robj *o = dictGetVal(de);
+    tieredValue *tv = o->ptr;
+
+    if (tv->payload == NULL) server.stat_tiered_sync_loads++;
+    server.stat_tiered_loads++;
+    return dbSetValue(db,de,tieredLoadValue(o));
+}
+
+/* Load back all the spilled values, when tiered storage is disabled. */
+void tieredLoadAll(void) {
+    long long values;
+    int j;
+
+    atomicGet(tiered.values,values);
+    if (values == 0) return;
+    for (j = 0; j < server.dbnum; j++) {
+        dictIterator *di = dictGetSafeIterator(server.db[j].dict);
+        dictEntry *de;
+
+        while((de = dictNext(di)) != NULL) {
+            robj *o = dictGetVal(de);
+            if (o->encoding == OBJ_ENCODING_SPILLED)
+                tieredLoadKey(server.db+j,de);
+        }
+        dictReleaseIterator(di);
+    }
+}
+
+int tieredObjectRdbType(robj *o) {
+    return ((tieredValue*)o->ptr)->rdbtype;
+}
+
+/* Save the spilled value 'o' with rdbSaveObject(), that is, the payload
+ * without the type. As rdbSaveObject() if 'rdb' is NULL only the length
+ * is returned. */
+ssize_t tieredSaveObject(rio *rdb, robj *o) {
+    tieredValue *tv = o->ptr;
+    sds buf;
+    size_t n;
+
+    if (rdb == NULL) return tv->len-1;
+    buf = tv->payload ? tv->payload : tieredReadPayload(tv);
+    n = rioWrite(rdb,buf+1,tv->len-1);
+    if (buf != tv->payload) sdsfree(buf);
+    return n ? (ssize_t)tv->len-1 : -1;
+}
+
+/* Memory used by the stub 'o', not counting the object itself. */
+size_t tieredValueMemory(robj *o) {
+    tieredValue *tv = o->ptr;
+    return sizeof(*tv)+(tv->payload ? sdsAllocSize(tv->payload) : 0);
+}
+
+/* Replace the value at 'de' with a stub, and write it to the file. */
+static void tieredSpill(redisDb *db, dictEntry *de) {
+    robj *o = dictGetVal(de), *stub;
+    tieredValue *tv = zmalloc(sizeof(*tv));
+    rio payload;
+
+    rioInitWithBuffer(&payload,sdsempty());
+    rdbSaveObjectType(&payload,o);
+    rdbSaveObject(&payload,o);
+    tv->payload = sdsRemoveFreeSpace(payload.io.buffer.ptr);
+    tv->rdbtype = tv->payload[0];
+    tv->len = sdslen(tv->payload);
+    tv->page = TIERED_NO_PAGE;
+    tv->job = NULL;
+
+    stub = createObject(o->type,tv);
+    stub->encoding = OBJ_ENCODING_SPILLED;
+    stub->lru = o->lru;
+    atomicIncr(tiered.values,1);
+    dbSetValue(db,de,stub);
+    server.stat_tiered_spills++;
+    tieredWrite(tv);
+}
+
+/* Return true if the value 'o' can be spilled. */
+static int tieredCanSpill(robj *o) {
+    if (o->refcount != 1 || o->type == OBJ_MODULE) return 0;
+    if (o->type == OBJ_STRING && o->encoding != OBJ_ENCODING_RAW) return 0;
+    return objectComputeSize(o,5) >= TIERED_MIN_VALUE_SIZE;
+}
+
+/* Called by serverCron(): while the memory used is above
+ * tiered-storage-max-memory spill the coldest value among a few sampled.
+ * Stubs found while sampling have their payload released if they were
+ * read but not loaded, or their write retried after an error.
+ *
+ * Nothing is written while a child is saving the dataset, so that the
+ * pages it may read are not reused. */
+void tieredCron(void) {
+    long long start, timelimit;
+    int iterations = 0, misses = 0;
+
+    if (!server.tiered_storage || !server.tiered_storage_max_memory ||
+        tiered.fd == -1 || server.loading ||
+        server.rdb_child_pid != -1 || server.aof_child_pid != -1 ||
+        server.unixtime - tiered.write_error_time < 1) return;
+
+    start = ustime();
+    timelimit = 1000000*TIERED_CYCLE_TIME_PERC/server.hz/100;
+    while (zmalloc_used_memory()-tiered.pending_write_bytes >
+           server.tiered_storage_max_memory &&
+           tiered.pending_writes < TIERED_MAX_PENDING_WRITES)
+    {
+        dictEntry *samples[TIERED_SAMPLES], *best = NULL;
+        unsigned long long coldest = 0;
+        redisDb *db = NULL;
+        int j, count;
+
+        for (j = 0; j < server.dbnum; j++) {
+            db = server.db+tiered.db;
+            tiered.db = (tiered.db+1) % server.dbnum;
+            if (dictSize(db->dict)) break;
+        }
+        if (j == server.dbnum) break; /* No keys at all. */
+
+        count = dictGetSomeKeys(db->dict,samples,TIERED_SAMPLES);
+        for (j = 0; j < count; j++) {
+            robj *o = dictGetVal(samples[j]);
+            unsigned long long cold;
+
+            if (o->encoding == OBJ_ENCODING_SPILLED) {
+                tieredValue *tv = o->ptr;
+                if (tv->payload == NULL || tv->job) continue;
+                if (tv->page != TIERED_NO_PAGE) {
+                    sdsfree(tv->payload);
+                    tv->payload = NULL;
+                } else {
+                    tieredWrite(tv);
+                }
+                continue;
+            }
+            if (!tieredCanSpill(o)) continue;
+            if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU)
+                cold = 255-LFUDecrAndReturn(o);
+            else
+                cold = estimateObjectIdleTime(o);
+            if (best == NULL || cold > coldest) {
+                best = samples[j];
+                coldest = cold;
+            }
+        }
+        if (best) {
+            tieredSpill(db,best);
+            misses = 0;
+        } else if (++misses == TIERED_SAMPLES) {
+            break; /* Nothing to spill. */
+        }
+
+        if ((++iterations & 15) == 0 && ustime()-start > timelimit) break;
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * Blocking clients on spilled keys.
+ * --------------------------------------------------------------------------*/
+
+/* Start the reads of the spilled values of the keys of the command, adding
+ * them to the jobs the client waits for. */
+static void tieredReadCommandKeys(client *c, struct redisCommand *cmd,
+                                  robj **argv, int argc)
+{
+    int j, numkeys, *keys;
+
+    /* Removing keys doesn't need their values. */
+    if (cmd->proc == delCommand || cmd->proc == unlinkCommand) return;
+
+    keys = getKeysFromCommand(cmd,argv,argc,&numkeys);
+    for (j = 0; j < numkeys; j++) {
+        robj *key = argv[keys[j]], *o;
+        dictEntry *de;
+        tieredValue *tv;
+        tieredJob *job;
+
+        if (!sdsEncodedObject(key)) continue;
+        if ((de = dictFind(c->db->dict,key->ptr)) == NULL) continue;
+        o = dictGetVal(de);
+        if (o->encoding != OBJ_ENCODING_SPILLED) continue;
+        tv = o->ptr;
+        if (tv->payload) continue; /* No need to wait. */
+        job = tv->job ? tv->job : tieredRead(tv);
+        if (listSearchKey(job->clients,c)) continue;
+        listAddNodeTail(job->clients,c);
+        listAddNodeTail(c->bpop.tiered_jobs,job);
+    }
+    getKeysFreeResult(keys);
+}
+
+/* Called by processCommand() before executing the command of 'c'. If
+ * some of its keys are spilled, the client is blocked until they are read
+ * from disk, and 1 is returned. Otherwise 0 is returned. In MULTI the
+ * keys of all the queued commands are read before EXEC.
+ *
+ * The master is never blocked, not to delay the replication stream, and
+ * its commands read the values synchronously. */
+int tieredBlockClientOnSpilledKeys(client *c) {
+    long long values;
+
+    atomicGet(tiered.values,values);
+    if (values == 0 || c->flags & CLIENT_MASTER) return 0;
+
+    if (c->flags & CLIENT_MULTI) {
+        int j;
+
+        if (c->cmd->proc != execCommand) return 0;
+        for (j = 0; j < c->mstate.count; j++) {
+            multiCmd *mc = c->mstate.commands+j;
+            tieredReadCommandKeys(c,mc->cmd,mc->argv,mc->argc);
+        }
+    } else {
+        tieredReadCommandKeys(c,c->cmd,c->argv,c->argc);
+    }
+    if (listLength(c->bpop.tiered_jobs) == 0) return 0;
+
+    /* Execute the command again once unblocked. */
+    c->bpop.timeout = 0;
+    c->flags |= CLIENT_PENDING_COMMAND;
+    blockClient(c,BLOCKED_TIERED);
+    return 1;
+}
+
+/* Called by unblockClient(): stop waiting for the reads. */
+void tieredUnblockClient(client *c) {
+    listNode *ln;
+
+    while ((ln = listFirst(c->bpop.tiered_jobs)) != NULL) {
+        tieredJob *job = listNodeValue(ln);
+        listNode *cln = listSearchKey(job->clients,c);
+
+        if (cln) listDelNode(job->clients,cln);
+        listDelNode(c->bpop.tiered_jobs,ln);
+    }
+}
+
+/* Append the "tiered" section of INFO. */
+sds genTieredInfoString(sds info) {
+    uint64_t pages = 0, used_pages = 0;
+    long long values;
+
+    if (tiered.fd != -1) {
+        pthread_mutex_lock(&tiered.lock);
+        pages = tiered.pages;
+        used_pages = tiered.used_pages;
+        pthread_mutex_unlock(&tiered.lock);
+    }
+    atomicGet(tiered.values,values);
+    return sdscatprintf(info,
+        "# Tiered\r\n"
+        "tiered_storage:%d\r\n"
+        "tiered_spilled_keys:%lld\r\n"
+        "tiered_file_size:%llu\r\n"
+        "tiered_used_bytes:%llu\r\n"
+        "tiered_pending_writes:%lu\r\n"
+        "tiered_pending_reads:%lu\r\n"
+        "tiered_spills:%lld\r\n"
+        "tiered_loads:%lld\r\n"
+        "tiered_sync_loads:%lld\r\n"
+        "tiered_reads:%lld\r\n"
+        "tiered_read_usec_per_read:%.2f\r\n"
+        "tiered_read_max_usec:%lld\r\n",
+        server.tiered_storage,
+        values,
+        (unsigned long long)pages*TIERED_PAGE_SIZE,
+        (unsigned long long)used_pages*TIERED_PAGE_SIZE,
+        tiered.pending_writes,
+        tiered.pending_reads,
+        server.stat_tiered_spills,
+        server.stat_tiered_loads,
+        server.stat_tiered_sync_loads,
+        server.stat_tiered_reads,
+        server.stat_tiered_reads ?
+            (double)server.stat_tiered_read_usec/server.stat_tiered_reads : 0,
+        server.stat_tiered_read_max_usec);
+}
@@ -0,0 +1,81 @@
+proc write_trace {lines} {
+    set path [tmpfile trace]
+    set fp [open $path w]
+    puts $fp [join $lines "\n"]
+    close $fp
+    return $path
+}
+
+# Return the summary row of the specified policy as a dictionary.
+proc evict_sim_summary {output policy} {
+    set fields {policy hit reads evicted evict_us us_key expired expire_us rejected peak_memory}
+    foreach line [lreverse [split $output "\n"]] {
+        if {[lindex $line 0] eq $policy} {
+            set row {}
+            foreach field $fields value $line {
+                dict set row $field [string trimright $value %]
+            }
+            return $row
+        }
+    }
+    error "no summary for $policy in: $output"
+}
+
+tags {"evict-sim"} {
+    test "Eviction simulator replays the trace with every policy" {
+        set lines {}
+        for {set j 0} {$j < 5000} {incr j} {
+            lappend lines "$j GET key:[expr {$j%1000}] 100"
+        }
+        set trace [write_trace $lines]
+        set output [exec src/redis-evict-sim $trace --maxmemory 4mb --interval 0]
+        foreach policy {volatile-lru volatile-lfu volatile-random volatile-ttl
+                        allkeys-lru allkeys-lfu allkeys-random allkeys-tinylfu
+                        noeviction} {
+            set row [evict_sim_summary $output $policy]
+            assert_equal 5000 [dict get $row reads]
+        }
+        # All the keys fit in memory: only the first access is a miss.
+        assert_equal 80.00 [dict get [evict_sim_summary $output allkeys-lru] hit]
+        assert_equal 0 [dict get [evict_sim_summary $output allkeys-lru] evicted]
+    }
+
+    test "Eviction simulator honours maxmemory" {
+        set lines {}
+        for {set j 0} {$j < 20000} {incr j} {
+            lappend lines "$j SET key:$j 1000"
+        }
+        set trace [write_trace $lines]
+        set output [exec src/redis-evict-sim $trace --maxmemory 2mb \
+            --policy allkeys-lru --policy noeviction --interval 0]
+        set row [evict_sim_summary $output allkeys-lru]
+        assert {[dict get $row evicted] > 10000}
+        assert {[dict get $row peak_memory] < 2200000}
+        set row [evict_sim_summary $output noeviction]
+        assert_equal 0 [dict get $row evicted]
+        assert {[dict get $row rejected] > 10000}
+    }
+
+    test "Eviction simulator expires keys following the time of the trace" {
+        set trace [write_trace {
+            "# Expires after one second."
+            "0 SET a 10 1000"
+            "500 GET a 10"
+            "2000 GET a 10"
+            "2001 SET b 10 100000000"
+            "3000 SET c 10 100"
+            "100000 GET b 10"
+        }]
+        set output [exec src/redis-evict-sim $trace --policy noeviction]
+        set row [evict_sim_summary $output noeviction]
+        # 'a' is expired lazily when accessed, 'c' by the active expire cycle.
+        assert_equal 66.67 [dict get $row hit]
+        assert_equal 2 [dict get $row expired]
+    }
+
+    test "Eviction simulator refuses invalid traces" {
+        set trace [write_trace {"0 GET a 10" "1 PUT a 10"}]
+        catch {exec src/redis-evict-sim $trace} output
+        assert_match "*Invalid request at line 2*" $output
+    }
+}
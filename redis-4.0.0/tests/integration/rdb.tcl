@@ -96,3 +96,171 @@ start_server_and_kill_it [list "dir" $server_path] {
         }
     }
 }
+
+# A hash listpack with an odd number of entries: "a", "b", "c".
+set server_path [tmpdir "server.rdb-odd-listpack-test"]
+set fd [open [file join $server_path dump.rdb] w]
+fconfigure $fd -translation binary
+puts -nonewline $fd "REDIS0010\xfe\x00\x10\x01k\x10"
+puts -nonewline $fd "\x10\x00\x00\x00\x03\x00\x81a\x02\x81b\x02\x81c\x02\xff"
+puts -nonewline $fd "\xff\x00\x00\x00\x00\x00\x00\x00\x00"; # No checksum.
+close $fd
+
+start_server_and_kill_it [list "dir" $server_path] {
+    test {Server should not start if a hash listpack has an odd length} {
+        wait_for_condition 50 100 {
+            [string match {*odd number of entries*} \
+                [exec tail -10 < [dict get $srv stdout]]]
+        } else {
+            fail "Server started even if the listpack was corrupted!"
+        }
+    }
+}
+
+set server_path [tmpdir "server.rdb-load-threads-test"]
+exec cp tests/assets/encodings.rdb $server_path
+
+start_server [list overrides [list "dir" $server_path "dbfilename" "encodings.rdb" "rdb-load-threads" 4]] {
+    test {RDB encoding loading test with rdb-load-threads} {
+        r select 0
+        set dump [csvdump r]
+        r config set rdb-load-threads 0
+        r debug reload
+        assert_equal $dump [csvdump r]
+    }
+
+    test {Parallel loading of a complex dataset preserves the digest} {
+        r config set rdb-load-threads 3
+        r flushall
+        createComplexDataset r 10000
+        # Values large enough to fill a batch on their own.
+        r set bigstring [string repeat "abcd" 500000]
+        r rpush biglist [string repeat x 100000] [string repeat y 100000]
+        r select 9
+        r set otherdb foo
+        r select 0
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        r select 9
+        set value [r get otherdb]
+        r select 0
+        set value
+    } {foo}
+
+    test {Parallel loading keeps the expire times} {
+        r flushall
+        for {set j 0} {$j < 1000} {incr j} {
+            r set key:$j $j ex 1000
+        }
+        r set expired 1 px 1
+        after 10
+        r debug reload
+        set ttl [r ttl key:500]
+        assert {$ttl > 900 && $ttl <= 1000}
+        list [r dbsize] [r exists expired]
+    } {1000 0}
+}
+
+set server_path [tmpdir "server.rdb-forkless-test"]
+
+start_server [list overrides [list "dir" $server_path "rdb-forkless" "yes"]] {
+    test {Forkless BGSAVE saves a point in time snapshot} {
+        # No save on shutdown: the file must be the one of the BGSAVE.
+        r config set save ""
+        r select 11
+        r debug populate 50000 other 100
+        r select 9
+        r debug populate 200000 key 100
+        createComplexDataset r 1000
+        for {set j 0} {$j < 1000} {incr j} {
+            r expire key:$j 1000
+        }
+        set digest [r debug digest]
+        r bgsave
+        # Change every kind of key while the keyspace is scanned: none of
+        # the changes must end in the file.
+        set j 1000
+        while {[s rdb_bgsave_in_progress]} {
+            r append key:$j changed
+            r del key:[expr {$j+100000}]
+            r expire key:[expr {$j+50000}] 100
+            r persist key:[expr {$j-1000}]
+            r set new:$j value
+            r select 11
+            r del other:$j
+            r set new:$j value
+            r select 9
+            incr j
+        }
+        assert {$j > 1100}
+        assert_equal ok [s rdb_last_bgsave_status]
+        assert {[s rdb_forkless_copied_keys] > 0}
+        assert {[s rdb_forkless_last_peak_size] > 0}
+        assert_equal 0 [s rdb_last_cow_size]
+    }
+}
+
+start_server [list overrides [list "dir" $server_path]] {
+    test {Forkless BGSAVE snapshot is loaded back} {
+        assert_equal $digest [r debug digest]
+    }
+}
+
+start_server [list overrides [list "dir" $server_path "rdb-forkless" "yes"]] {
+    test {FLUSHALL stops a forkless BGSAVE} {
+        r config set save ""
+        r debug populate 200000
+        r bgsave
+        r flushall
+        assert_equal 0 [s rdb_bgsave_in_progress]
+        glob -nocomplain -directory $server_path temp-snapshot-*.rdb
+    } {}
+
+    test {FLUSHDB and SWAPDB don't change a forkless BGSAVE in progress} {
+        r select 10
+        r debug populate 1000 other
+        r select 9
+        r debug populate 100000
+        set digest [r debug digest]
+        r bgsave
+        r swapdb 9 10
+        r flushdb
+        waitForBgsave r
+        assert_equal ok [s rdb_last_bgsave_status]
+    }
+}
+
+start_server [list overrides [list "dir" $server_path]] {
+    test {Forkless BGSAVE snapshot is loaded back after FLUSHDB and SWAPDB} {
+        assert_equal $digest [r debug digest]
+    }
+}
+
+start_server [list overrides [list "rdb-forkless" "yes"]] {
+    set master [srv 0 client]
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    start_server {} {
+        test {Slave is synchronized by a forkless BGSAVE} {
+            $master debug populate 100000
+            r slaveof $master_host $master_port
+            # Writes while the master saves the RDB reach the slave with
+            # the replication stream.
+            for {set j 0} {$j < 1000} {incr j} {
+                $master append key:$j x
+                $master set new:$j $j
+            }
+            wait_for_condition 100 100 {
+                [s master_link_status] eq {up}
+            } else {
+                fail "Slave not synchronized"
+            }
+            wait_for_condition 50 100 {
+                [$master debug digest] eq [r debug digest]
+            } else {
+                fail "Master and slave have different datasets"
+            }
+        }
+    }
+}
@@ -153,3 +153,177 @@ start_server {tags {"repl"}} {
         }
     }
 }
+
+start_server {tags {"repl"}} {
+    start_server {} {
+        start_server {} {
+            set master [srv -2 client]
+            set master_host [srv -2 host]
+            set master_port [srv -2 port]
+            set slave1 [srv -1 client]
+            set slave2 [srv 0 client]
+
+            proc slave_lag_bytes {id} {
+                regexp {lag_bytes=([0-9]+)} [s -2 slave$id] - lag
+                return $lag
+            }
+
+            test {Slaves share the replication buffer with the backlog} {
+                $master config set repl-backlog-size 1mb
+                $slave1 slaveof $master_host $master_port
+                $slave2 slaveof $master_host $master_port
+                wait_for_condition 50 100 {
+                    [s -1 master_link_status] eq {up} &&
+                    [s 0 master_link_status] eq {up}
+                } else {
+                    fail "Replication not started."
+                }
+
+                # Block both slaves, so that the 10MB of stream we write
+                # can't all fit in the socket buffers.
+                set rd1 [redis_deferring_client -1]
+                set rd2 [redis_deferring_client 0]
+                $rd1 debug sleep 5
+                $rd2 debug sleep 5
+                set val [string repeat x 200000]
+                for {set j 0} {$j < 50} {incr j} {
+                    $master set key:$j $val
+                }
+
+                # The stream is buffered once for both the slaves.
+                set lag1 [slave_lag_bytes 0]
+                set lag2 [slave_lag_bytes 1]
+                assert {$lag1 > 0 && $lag2 > 0}
+                assert {[s -2 repl_buffer_memory] < $lag1+$lag2}
+                assert {[s -2 repl_buffer_saved_bytes] > 0}
+                $rd1 read
+                $rd2 read
+                $rd1 close
+                $rd2 close
+
+                # Once the slaves are in sync, only the backlog is left.
+                wait_for_condition 50 100 {
+                    [slave_lag_bytes 0] == 0 && [slave_lag_bytes 1] == 0
+                } else {
+                    fail "Slaves didn't catch up with the master"
+                }
+                assert {[s -2 repl_buffer_memory] < 2*1024*1024}
+                assert {[s -2 repl_backlog_histlen] >= 1024*1024}
+                wait_for_condition 50 100 {
+                    [$master debug digest] eq [$slave1 debug digest] &&
+                    [$master debug digest] eq [$slave2 debug digest]
+                } else {
+                    fail "Master - Slaves inconsistency"
+                }
+            }
+
+            test {PSYNC is served from the shared replication buffer} {
+                set partial [s -2 sync_partial_ok]
+                $slave1 client kill type master
+                for {set j 0} {$j < 100} {incr j} {
+                    $master incr counter
+                }
+                wait_for_condition 50 100 {
+                    [s -2 sync_partial_ok] == $partial+1 &&
+                    [$master debug digest] eq [$slave1 debug digest]
+                } else {
+                    fail "Partial resync from the backlog failed"
+                }
+                assert_equal 100 [$slave2 get counter]
+            }
+        }
+    }
+}
+
+start_server {tags {"repl"} overrides {repl-backlog-size 16kb
+                                      repl-backlog-disk-size 10mb}} {
+    start_server {} {
+        set master [srv -1 client]
+        set master_host [srv -1 host]
+        set master_port [srv -1 port]
+        set slave [srv 0 client]
+
+        test {PSYNC is served from the disk backlog after a long outage} {
+            $slave slaveof $master_host $master_port
+            wait_for_condition 50 100 {
+                [s 0 master_link_status] eq {up}
+            } else {
+                fail "Replication not started."
+            }
+
+            # Keep the slave away while the master writes much more than
+            # the in memory backlog can hold: AUTH fails without a password
+            # configured in the master.
+            set full [s -1 sync_full]
+            set partial [s -1 sync_partial_ok]
+            $slave config set masterauth wrongpass
+            $slave client kill type master
+            set val [string repeat x 10000]
+            for {set j 0} {$j < 200} {incr j} {
+                $master set key:$j $val
+            }
+            assert {[s -1 repl_backlog_histlen] < 1024*1024}
+            assert {[s -1 repl_backlog_disk_histlen] > 1024*1024}
+
+            $slave config set masterauth ""
+            wait_for_condition 50 100 {
+                [s -1 sync_partial_ok] == $partial+1 &&
+                [$master debug digest] eq [$slave debug digest]
+            } else {
+                fail "Partial resync from the disk backlog failed"
+            }
+            assert_equal $full [s -1 sync_full]
+        }
+    }
+}
+
+foreach dl {no yes} {
+    start_server {tags {"repl"}} {
+        start_server {overrides {repl-compression yes}} {
+            set master [srv -1 client]
+            set master_host [srv -1 host]
+            set master_port [srv -1 port]
+            set slave [srv 0 client]
+
+            test "Compressed replication stream, diskless=$dl" {
+                $master config set repl-diskless-sync $dl
+                $master config set repl-diskless-sync-delay 0
+                $master debug populate 10000 key 1000
+                $slave slaveof $master_host $master_port
+                wait_for_condition 50 100 {
+                    [s 0 master_link_status] eq {up}
+                } else {
+                    fail "Replication not started."
+                }
+                assert_equal 1 [s 0 master_link_compressed]
+                assert_match {*compressed=1*} [s -1 slave0]
+
+                for {set j 0} {$j < 1000} {incr j} {
+                    $master rpush list [string repeat "item:$j " 20]
+                }
+                wait_for_condition 50 100 {
+                    [$master debug digest] eq [$slave debug digest]
+                } else {
+                    fail "Master - Slave inconsistency"
+                }
+                assert {[s -1 repl_compression_output_bytes] <
+                        [s -1 repl_compression_input_bytes]/2}
+            }
+
+            test "PSYNC over a compressed replication stream, diskless=$dl" {
+                set partial [s -1 sync_partial_ok]
+                $slave client kill type master
+                for {set j 0} {$j < 100} {incr j} {
+                    $master incr counter
+                }
+                wait_for_condition 50 100 {
+                    [s -1 sync_partial_ok] == $partial+1 &&
+                    [$master debug digest] eq [$slave debug digest]
+                } else {
+                    fail "Partial resync over a compressed link failed"
+                }
+                assert_equal 1 [s 0 master_link_compressed]
+            }
+        }
+    }
+}
@@ -184,6 +184,7 @@ start_server {tags {"repl"}} {
 }
 
 foreach dl {no yes} {
+  foreach sdl {disabled swapdb} {
     start_server {tags {"repl"}} {
         set master [srv 0 client]
         $master config set repl-diskless-sync $dl
@@ -195,13 +196,13 @@ foreach dl {no yes} {
         set load_handle2 [start_write_load $master_host $master_port 20]
         set load_handle3 [start_write_load $master_host $master_port 8]
         set load_handle4 [start_write_load $master_host $master_port 4]
-        start_server {} {
+        start_server [list overrides [list repl-diskless-load $sdl]] {
             lappend slaves [srv 0 client]
-            start_server {} {
+            start_server [list overrides [list repl-diskless-load $sdl]] {
                 lappend slaves [srv 0 client]
-                start_server {} {
+                start_server [list overrides [list repl-diskless-load $sdl]] {
                     lappend slaves [srv 0 client]
-                    test "Connect multiple slaves at the same time (issue #141), diskless=$dl" {
+                    test "Connect multiple slaves at the same time (issue #141), diskless=$dl, diskless-load=$sdl" {
                         # Send SLAVEOF commands to slaves
                         [lindex $slaves 0] slaveof $master_host $master_port
                         [lindex $slaves 1] slaveof $master_host $master_port
@@ -265,4 +266,148 @@ foreach dl {no yes} {
             }
         }
     }
+  }
+}
+
+# Act as a master that sends only the first half of the RDB payload to the
+# slave, then drops the link: the slave must return to its old dataset, or
+# to an empty one if it was flushed before loading.
+start_server {tags {"repl"}} {
+    r debug populate 100000 key 100
+    r save
+    set fp [open [file join [lindex [r config get dir] 1] dump.rdb] r]
+    fconfigure $fp -translation binary
+    set payload [read $fp]
+    close $fp
+    r flushall
+
+    proc fake_master_accept {fd addr port} {
+        set ::fake_master_fd $fd
+    }
+
+    # Number of loads from the master socket the slave started so far.
+    proc loads_from_socket {} {
+        set log [srv 0 stdout]
+        catch {exec grep -c "Loading DB in memory from the socket" $log} count
+        return $count
+    }
+
+    foreach sdl {swapdb flush} {
+        test "Slave keeps serving its data while loading from socket, diskless-load=$sdl" {
+            r config set repl-diskless-load $sdl
+            r debug populate 1000 old
+            set listener [socket -server fake_master_accept 0]
+            set port [lindex [fconfigure $listener -sockname] 2]
+            set ::fake_master_fd {}
+            set timer [after 5000 {set ::fake_master_fd timeout}]
+            r slaveof 127.0.0.1 $port
+            vwait ::fake_master_fd
+            after cancel $timer
+            assert {$::fake_master_fd ne {timeout}}
+            set fd $::fake_master_fd
+            fconfigure $fd -translation binary -blocking 1
+
+            # Handshake: PING, REPLCONF listening-port, REPLCONF capa, PSYNC.
+            foreach reply [list +PONG +OK +OK \
+                           "+FULLRESYNC [string repeat a 40] 0"] {
+                gets $fd
+                puts -nonewline $fd "$reply\r\n"
+                flush $fd
+            }
+            set loads [loads_from_socket]
+            puts -nonewline $fd "\$EOF:[string repeat b 40]\r\n"
+            puts -nonewline $fd [string range $payload 0 \
+                [expr {[string length $payload]/2}]]
+            flush $fd
+            wait_for_condition 50 100 {
+                [loads_from_socket] > $loads
+            } else {
+                fail "Slave is not loading"
+            }
+
+            if {$sdl eq {swapdb}} {
+                assert_equal 0 [s loading]
+                assert_equal 1000 [r dbsize]
+                assert_equal value:1 [r get old:1]
+                r config set slave-read-only no
+                catch {r set foo bar} err
+                r config set slave-read-only yes
+                assert_match {LOADING*} $err
+            } else {
+                assert_equal 1 [s loading]
+                catch {r get old:1} err
+                assert_match {LOADING*} $err
+            }
+
+            # The load fails once the master drops the link.
+            close $fd
+            wait_for_condition 50 100 {
+                [s loading] == 0 && [s master_link_status] eq {down} &&
+                ![catch {r dbsize}]
+            } else {
+                fail "Slave is still loading"
+            }
+            if {$sdl eq {swapdb}} {
+                assert_equal 1000 [r dbsize]
+                assert_equal value:1 [r get old:1]
+            } else {
+                assert_equal 0 [r dbsize]
+            }
+            r slaveof no one
+            close $listener
+            r flushall
+        }
+    }
+}
+
+start_server {tags {"repl"}} {
+    set master [srv 0 client]
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    set master_log [srv 0 stdout]
+    $master config set repl-diskless-sync yes
+    $master config set repl-diskless-sync-delay 2
+    $master config set rdbcompression no
+    $master debug populate 30000 key 1000
+
+    start_server {} {
+        test {A slow slave does not stall the diskless sync of the others} {
+            # A fake slave that never reads the payload.
+            set fd [socket $master_host $master_port]
+            fconfigure $fd -translation binary
+            puts -nonewline $fd "REPLCONF capa eof\r\n"
+            flush $fd
+            assert_equal +OK [string trim [gets $fd]]
+            puts -nonewline $fd "PSYNC ? -1\r\n"
+            flush $fd
+            r slaveof $master_host $master_port
+
+            # The real slave is put online while the transfer to the fake
+            # slave is still in progress.
+            wait_for_condition 100 100 {
+                [s master_link_status] eq {up}
+            } else {
+                fail "Slave stalled by the fake slave"
+            }
+            assert_equal 1 [status $master rdb_bgsave_in_progress]
+            assert_equal 30000 [r dbsize]
+            assert_match {*correctly received*bytes in*MB/sec*} \
+                [exec tail -20 < $master_log]
+
+            # The fake slave fails once its link is closed.
+            close $fd
+            wait_for_condition 50 100 {
+                [status $master rdb_bgsave_in_progress] == 0 &&
+                [status $master connected_slaves] == 1
+            } else {
+                fail "The diskless sync child did not terminate"
+            }
+            $master set foo bar
+            wait_for_condition 50 100 {
+                [r get foo] eq {bar}
+            } else {
+                fail "Replication stream not received"
+            }
+        }
+    }
 }
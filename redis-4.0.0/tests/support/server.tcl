@@ -278,7 +278,8 @@ proc start_server {options {code undefined}} {
 
         while 1 {
             # check that the server actually started and is ready for connections
-            if {[exec grep -i "Ready to accept" | wc -l < $stdout] > 0} {
+            # (grep fails while the message is missing, e.g. still loading)
+            if {![catch {exec grep -qi "Ready to accept" $stdout}]} {
                 break
             }
             after 10
@@ -16,6 +16,7 @@ set ::all_tests {
     unit/dump
     unit/auth
     unit/protocol
+    unit/threaded-io
     unit/keyspace
     unit/scan
     unit/type/string
@@ -41,6 +42,7 @@ set ::all_tests {
     integration/rdb
     integration/convert-zipmap-hash-on-load
     integration/logging
+    integration/evict-sim
     integration/psync2
     integration/psync2-reg
     unit/pubsub
@@ -57,6 +59,7 @@ set ::all_tests {
     unit/memefficiency
     unit/hyperloglog
     unit/lazyfree
+    unit/tiered
     unit/wait
 }
 # Index to the next test to run in the ::all_tests list.
@@ -218,5 +218,109 @@ start_server {tags {"expire"}} {
         r debug loadaof
         set ttl [r ttl foo]
         assert {$ttl <= 98 && $ttl > 90}
+        r config set appendonly no
     }
+
+    test {Expires are counted and survive PERSIST, RENAME and reload} {
+        r flushdb
+        r debug populate 1000
+        for {set j 0} {$j < 100} {incr j} {
+            r expire key:$j 100
+        }
+        r persist key:0
+        r rename key:1 renamed
+        r set key:2 newvalue
+        assert_match {*expires=98,*} [r info keyspace]
+        r debug reload
+        assert_match {*expires=98,*} [r info keyspace]
+        list [r ttl key:0] [expr {[r ttl renamed] > 90}] [r ttl key:2]
+    } {-1 1 -1}
+
+    test {Active expire finds a few volatile keys in a big keyspace} {
+        r flushdb
+        r debug populate 20000
+        for {set j 0} {$j < 20} {incr j} {
+            r pexpire key:[expr {$j*1000}] 100
+        }
+        wait_for_condition 50 100 {
+            [r dbsize] == 19980
+        } else {
+            fail "Volatile keys were not actively expired"
+        }
+        assert_match {*expires=0,*} [r info keyspace]
+    }
+
+    test {Expired keys backlog is reported with and without the expires index} {
+        r flushdb
+        r debug set-active-expire 0
+        r debug populate 1000
+        for {set j 0} {$j < 100} {incr j} {
+            r pexpire key:$j 10
+            r expire key:[expr {$j+100}] 100
+        }
+        after 50
+        set sampled [s expired_keys_backlog]
+        r config set active-expire-index yes
+        set indexed [s expired_keys_backlog]
+        r debug set-active-expire 1
+        list [expr {$sampled > 0}] $indexed
+    } {1 100}
+
+    test {Active expire with the expires index reclaims keys in time order} {
+        wait_for_condition 50 100 {
+            [r dbsize] == 900
+        } else {
+            fail "Expired keys were not reclaimed"
+        }
+        # Keys changing or losing their expire are moved in the index.
+        r pexpire key:100 10
+        r persist key:101
+        r rename key:102 renamed
+        r pexpire renamed 10
+        r set key:103 value
+        r del key:104
+        wait_for_condition 50 100 {
+            [r dbsize] == 897
+        } else {
+            fail "Keys with a new expire were not reclaimed"
+        }
+        assert_equal {0 -1} [list [r exists renamed] [r ttl key:101]]
+        r flushdb
+        r debug populate 1000
+        r pexpire key:1 10
+        r swapdb 0 9
+        r swapdb 0 9
+        wait_for_condition 50 100 {
+            [r dbsize] == 999
+        } else {
+            fail "Expired keys were not reclaimed after FLUSHDB"
+        }
+        r config set active-expire-index no
+        list [s expired_keys_backlog] [r ttl key:2]
+    } {0 -1}
+
+    test {Expired keys backlog of the expires index is updated incrementally} {
+        r flushdb
+        r debug set-active-expire 0
+        r config set active-expire-index yes
+        r debug populate 1000
+        for {set j 0} {$j < 100} {incr j} {r pexpire key:$j 10}
+        after 50
+        set backlog [s expired_keys_backlog]
+        # Keys already counted are removed from the count.
+        for {set j 0} {$j < 10} {incr j} {r del key:$j}
+        lappend backlog [s expired_keys_backlog]
+        # Only the keys expired since the last call are added.
+        for {set j 100} {$j < 150} {incr j} {r pexpire key:$j 10}
+        after 50
+        lappend backlog [s expired_keys_backlog]
+        r swapdb 0 9
+        lappend backlog [s expired_keys_backlog]
+        r swapdb 0 9
+        r flushdb
+        lappend backlog [s expired_keys_backlog]
+        r config set active-expire-index no
+        r debug set-active-expire 1
+        set backlog
+    } {100 90 140 140 0}
 }
@@ -272,4 +272,28 @@ start_server {tags {"keyspace"}} {
         r keys *
         r keys *
     } {dlskeriewrioeuwqoirueioqwrueoqwrueqw}
+
+    test {Keys survive value replacement, RENAME and MOVE} {
+        r select 10
+        r flushdb
+        r select 9
+        r flushdb
+        r set k 10
+        r append k 1
+        r expire k 100
+        r incr k
+        r setrange k 0 9
+        r rename k k2
+        r rpush l a b c
+        r expire l 100
+        r rename l l2
+        r set s [string repeat x 100]
+        r append s y
+        r move s 10
+        r select 10
+        set len [r strlen s]
+        r select 9
+        list [r get k2] [expr {[r ttl k2] > 90}] [r lrange l2 0 -1] \
+             [expr {[r ttl l2] > 90}] $len [r dbsize]
+    } {902 1 {a b c} 1 101 2}
 }
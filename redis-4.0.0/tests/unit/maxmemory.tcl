@@ -24,7 +24,7 @@ start_server {tags {"maxmemory"}} {
     }
 
     foreach policy {
-        allkeys-random allkeys-lru allkeys-lfu volatile-lru volatile-lfu volatile-random volatile-ttl
+        allkeys-random allkeys-lru allkeys-lfu allkeys-tinylfu volatile-lru volatile-lfu volatile-random volatile-ttl
     } {
         test "maxmemory - is the memory limit honoured? (policy $policy)" {
             # make sure to start with a blank instance
@@ -141,4 +141,67 @@ start_server {tags {"maxmemory"}} {
             }
         }
     }
+
+    test "maxmemory - allkeys-tinylfu keeps frequent keys during a scan" {
+        r flushall
+        r config set maxmemory 0
+        r config set maxmemory-policy allkeys-tinylfu
+        set used [s used_memory]
+        for {set j 0} {$j < 1000} {incr j} {
+            r set hot:$j [string repeat x 100]
+        }
+        set limit [expr {$used+([s used_memory]-$used)*2}]
+        r config set maxmemory $limit
+        for {set k 0} {$k < 5} {incr k} {
+            for {set j 0} {$j < 1000} {incr j} {r get hot:$j}
+        }
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 10000} {incr j} {
+            $rd set scan:$j [string repeat x 100]
+        }
+        for {set j 0} {$j < 10000} {incr j} {$rd read}
+        $rd close
+        set hot 0
+        for {set j 0} {$j < 1000} {incr j} {incr hot [r exists hot:$j]}
+        assert {[s used_memory] < $limit+4096}
+        assert {[r dbsize] < 2000}
+        r config set maxmemory 0
+        r config set maxmemory-policy noeviction
+        # Eviction samples keys: rarely a hot key can still be picked when
+        # every sampled candidate is hot. Without the frequency filter the
+        # scan would evict nearly all of them.
+        expr {$hot >= 990}
+    } {1}
+
+    test "maxmemory - eviction over the time limit continues in background" {
+        r flushall
+        r config set maxmemory 0
+        r config set maxmemory-policy allkeys-random
+        r config set latency-monitor-threshold 1
+        r debug populate 200000
+        set limit [expr {[s used_memory]/2}]
+        r config set maxmemory-eviction-time-limit 1
+        set rd [redis_deferring_client]
+        $rd config set maxmemory $limit
+        $rd set foo bar
+        $rd dbsize
+        $rd info stats
+        assert_equal OK [$rd read]
+        catch {$rd read} err
+        assert_match {OOM*} $err
+        assert {[$rd read] > 0}
+        assert_match {*eviction_debt:[1-9]*} [$rd read]
+        $rd close
+        wait_for_condition 100 50 {
+            [s eviction_debt] == 0
+        } else {
+            fail "Eviction debt was not paid"
+        }
+        assert {[s used_memory] < $limit+4096}
+        assert_equal OK [r set foo bar]
+        assert_match {*eviction-debt*} [r latency latest]
+        r config set maxmemory-eviction-time-limit 0
+        r config set latency-monitor-threshold 0
+        r config set maxmemory 0
+    }
 }
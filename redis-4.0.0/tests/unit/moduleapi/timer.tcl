@@ -0,0 +1,15 @@
+set testmodule [file normalize src/modules/testmodule.so]
+
+start_server [list tags {"modules"} overrides [list loadmodule $testmodule]] {
+    test {Module timers fire once, and stopped timers never fire} {
+        r test.timer.start
+        wait_for_condition 50 10 {
+            [lindex [r test.timer.fired] 0] == 1
+        } else {
+            fail "Module timer not fired"
+        }
+        # Give the stopped timer the time to fire, if it was still there.
+        after 50
+        r test.timer.fired
+    } {1 0 0 0}
+}
@@ -228,6 +228,126 @@ start_server {tags {"other"}} {
         set _ $err
     } {}
 
+    test {Big keyspace using a segmented hash table} {
+        r flushdb
+        r debug populate 50000
+        set stats [r debug htstats 9]
+        assert_match {*allocated segments*} $stats
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        # Every key must be reachable by SCAN and RANDOMKEY.
+        set cursor 0
+        set keys {}
+        while 1 {
+            set res [r scan $cursor count 1000]
+            set cursor [lindex $res 0]
+            foreach k [lindex $res 1] {dict set keys $k 1}
+            if {$cursor == 0} break
+        }
+        assert_match {key:*} [r randomkey]
+        list [dict size $keys] [r dbsize]
+    } {50000 50000}
+
+    test {Segmented hash table shrinks after mass deletion} {
+        for {set j 100} {$j < 50000} {incr j} {
+            r del key:$j
+        }
+        # Let serverCron resize and rehash the table.
+        wait_for_condition 50 100 {
+            ![string match {*allocated segments*} [r debug htstats 9]]
+        } else {
+            fail "Keyspace hash table was not resized"
+        }
+        list [r dbsize] [r get key:50] [r exists key:100]
+    } {100 value:50 0}
+
+    test {Big set and hash objects using segmented hash tables} {
+        r del myset myhash
+        for {set j 0} {$j < 20000} {incr j} {
+            r sadd myset $j-x
+            r hset myhash field:$j $j
+        }
+        assert_encoding hashtable myset
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        list [r scard myset] [r sismember myset 12345-x] [r hget myhash field:19999]
+    } {20000 1 19999}
+
+    test {Bucketed keyspace with full buckets, deletions and rehashing} {
+        r flushdb
+        r config set activerehashing no
+        # 10000 keys in 4096 buckets: some buckets are full and chain an
+        # overflow bucket.
+        r debug populate 10000
+        regexp {max chain length: ([0-9]+)} [r debug htstats 9] - maxlen
+        assert {$maxlen > 6}
+        for {set j 0} {$j < 5000} {incr j} {
+            r del key:$j
+        }
+        assert_equal 5000 [r dbsize]
+        # Grow the table past 5 keys per bucket, and check the keys while
+        # the old table is only partially rehashed.
+        set extra 0
+        while {![string match {*rehashing target*} [r debug htstats 9]]} {
+            incr extra 500
+            r debug populate $extra extra
+            assert {$extra < 100000}
+        }
+        set err {}
+        for {set j 0} {$j < 10000} {incr j} {
+            set exists [r exists key:$j]
+            if {$exists != ($j >= 5000)} {
+                set err "key:$j exists=$exists"
+                break
+            }
+        }
+        r config set activerehashing yes
+        assert_equal [expr {5000+$extra}] [r dbsize]
+        set last [expr {$extra-1}]
+        assert_equal value:$last [r get extra:$last]
+        set err
+    } {}
+
+    test {SCAN cursor continuity while the bucketed keyspace is rehashing} {
+        r flushdb
+        r config set activerehashing no
+        r debug populate 10000
+        r debug populate 10500 extra
+        assert_match {*rehashing target*} [r debug htstats 9]
+        # Every SET moves the rehashing forward of one bucket: the rehashing
+        # completes in the middle of the SCAN.
+        set cursor 0
+        set keys {}
+        set rehashing 0
+        set j 0
+        while 1 {
+            set res [r scan $cursor count 50]
+            set cursor [lindex $res 0]
+            foreach k [lindex $res 1] {dict set keys $k 1}
+            if {$cursor == 0} break
+            for {set i 0} {$i < 20} {incr i} {
+                r set new:[incr j] x
+            }
+            if {[string match {*rehashing target*} [r debug htstats 9]]} {
+                incr rehashing
+            }
+        }
+        r config set activerehashing yes
+        assert {$rehashing > 0}
+        assert {![string match {*rehashing target*} [r debug htstats 9]]}
+        # All the keys existing for the whole SCAN were returned.
+        set missing 0
+        for {set j 0} {$j < 10000} {incr j} {
+            if {![dict exists $keys key:$j]} {incr missing}
+        }
+        for {set j 0} {$j < 10500} {incr j} {
+            if {![dict exists $keys extra:$j]} {incr missing}
+        }
+        set missing
+    } {0}
+
     # Leave the user with a clean DB before to exit
     test {FLUSHDB} {
         set aux {}
@@ -98,6 +98,28 @@ start_server {tags {"protocol"}} {
         } {*Protocol error*}
     }
     unset c
+
+    test "Pipelined replies spanning many reply chunks are written in order" {
+        reconnect
+        r set foo [string repeat x 1000]
+        set calls [s total_net_write_calls]
+        set fd [r channel]
+        set proto ""
+        for {set j 0} {$j < 1000} {incr j} {
+            append proto "*3\r\n\$6\r\nAPPEND\r\n\$3\r\nfoo\r\n\$1\r\ny\r\n"
+            append proto "*2\r\n\$3\r\nGET\r\n\$3\r\nfoo\r\n"
+        }
+        puts -nonewline $fd $proto
+        flush $fd
+        for {set j 0} {$j < 1000} {incr j} {
+            assert_equal [expr {1001+$j}] [r read]
+            set reply [r read]
+            assert_equal [expr {1001+$j}] [string length $reply]
+            assert_equal y [string index $reply end]
+        }
+        # About 1MB of replies: much less than a write call per reply.
+        assert {[s total_net_write_calls]-$calls < 1000}
+    }
 }
 
 start_server {tags {"regression"}} {
@@ -196,6 +196,30 @@ start_server {tags {"pubsub"}} {
         $rd1 close
     }
 
+    test "PUBLISH/PSUBSCRIBE with nested and empty pattern prefixes" {
+        set rd1 [redis_deferring_client]
+        set patterns {* a* ab* abc abc* ab?d a\\*b x[ab]* *c}
+        assert_equal {1 2 3 4 5 6 7 8 9} [psubscribe $rd1 $patterns]
+        assert_equal 9 [r pubsub numpat]
+
+        set matches {}
+        foreach channel {abc abd a*b xb1 zzc q {}} {
+            set n [r publish $channel hello]
+            set got {}
+            for {set j 0} {$j < $n} {incr j} {
+                lappend got [lindex [$rd1 read] 1]
+            }
+            lappend matches $channel [lsort $got]
+        }
+
+        # Unsubscribing the last pattern of a prefix should not affect the
+        # patterns with a longer or shorter prefix.
+        assert_equal {8 7} [punsubscribe $rd1 {ab* abc}]
+        assert_equal 4 [r publish abc hello]
+        $rd1 close
+        set matches
+    } {abc {* *c a* ab* abc abc*} abd {* a* ab*} a*b {* a* {a\*b}} xb1 {* {x[ab]*}} zzc {* *c} q * {} *}
+
     test "NUMSUB returns numbers, not strings (#1561)" {
         r pubsub numsub abc def
     } {abc 0 def 0}
@@ -0,0 +1,58 @@
+start_server {tags {"threaded-io"} overrides {io-threads 2 io-threads-do-reads yes}} {
+    test {Threaded I/O: pipelined commands from many clients are served} {
+        r flushall
+        set clients {}
+        for {set j 0} {$j < 20} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+        # Send everything before reading anything, so that many clients
+        # have pending writes in the same event loop iteration and the
+        # I/O threads get activated.
+        for {set j 0} {$j < 20} {incr j} {
+            set rd [lindex $clients $j]
+            for {set i 0} {$i < 50} {incr i} {
+                $rd set key:$j:$i $j:$i
+                $rd incr counter
+            }
+            $rd flush
+        }
+        for {set j 0} {$j < 20} {incr j} {
+            set rd [lindex $clients $j]
+            for {set i 0} {$i < 50} {incr i} {
+                assert_equal OK [$rd read]
+                $rd read
+            }
+        }
+        foreach rd $clients {$rd close}
+        list [r dbsize] [r get counter] [r get key:7:42]
+    } {1001 1000 7:42}
+
+    test {Threaded I/O: INFO reports the threaded reads and writes} {
+        assert {[s io_threaded_writes_processed] > 0}
+        assert {[s io_threaded_reads_processed] > 0}
+    }
+
+    test {Threaded I/O: protocol errors are reported and close the client} {
+        set clients {}
+        for {set j 0} {$j < 10} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+        foreach rd $clients {
+            $rd write "*3\r\n\$3\r\nSET\r\n\$1\r\nx\r\nfooz\r\n"
+            $rd flush
+        }
+        foreach rd $clients {
+            assert_error "*expected '$', got 'f'*" {$rd read}
+            $rd close
+        }
+        r ping
+    } {PONG}
+
+    test {Threaded I/O: io-threads-do-reads can be changed at runtime} {
+        r config set io-threads-do-reads no
+        assert_equal {io-threads-do-reads no} [r config get io-threads-do-reads]
+        r config set io-threads-do-reads yes
+        assert_equal {io-threads 2} [r config get io-threads]
+        r ping
+    } {PONG}
+}
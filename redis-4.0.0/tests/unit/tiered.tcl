@@ -0,0 +1,106 @@
+start_server {tags {"tiered"} overrides {tiered-storage yes}} {
+    proc tiered_value {j} {
+        return "value:$j:[string repeat x 500]"
+    }
+
+    proc tiered_populate {} {
+        for {set j 0} {$j < 2000} {incr j} {
+            r set key:$j [tiered_value $j]
+        }
+        for {set j 0} {$j < 20} {incr j} {
+            for {set i 0} {$i < 100} {incr i} {
+                r rpush list:$j [tiered_value $i]
+                r hset hash:$j field:$i [tiered_value $i]
+            }
+        }
+    }
+
+    # Spill until less than half of the dataset is in memory.
+    proc tiered_spill {} {
+        set used [s used_memory]
+        r config set tiered-storage-max-memory [expr {$used/2}]
+        wait_for_condition 100 100 {
+            [s tiered_pending_writes] == 0 &&
+            [s used_memory] < $used*0.6
+        } else {
+            fail "Values were not spilled"
+        }
+        r config set tiered-storage-max-memory 0
+    }
+
+    test {Cold values are spilled to tiered storage} {
+        tiered_populate
+        set used [s used_memory]
+        tiered_spill
+        assert {[s tiered_spilled_keys] > 1000}
+        assert {[s tiered_used_bytes] > 0}
+        set spilled 0
+        for {set j 0} {$j < 2000} {incr j} {
+            if {[string match {* encoding:spilled *} [r debug object key:$j]]} {
+                incr spilled
+            }
+        }
+        assert {$spilled > 0}
+        assert_equal 2040 [r dbsize]
+    }
+
+    test {Spilled values are read back by commands} {
+        for {set j 0} {$j < 2000} {incr j} {
+            assert_equal [tiered_value $j] [r get key:$j]
+        }
+        for {set j 0} {$j < 20} {incr j} {
+            assert_equal 100 [r llen list:$j]
+            assert_equal [tiered_value 42] [r hget hash:$j field:42]
+        }
+        assert {[s tiered_reads] > 0}
+        assert {[s tiered_loads] > 0}
+    }
+
+    test {Spilled values are read back in MULTI/EXEC} {
+        tiered_spill
+        r multi
+        r append key:1 y
+        r get key:2
+        set res [r exec]
+        assert_equal [list [expr {[string length [tiered_value 1]]+1}] \
+                           [tiered_value 2]] $res
+    }
+
+    test {Spilled values are saved and reloaded} {
+        tiered_spill
+        set digest [r debug digest]
+        assert {[s tiered_spilled_keys] > 0}
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_equal 0 [s tiered_spilled_keys]
+    }
+
+    test {Spilled values are rewritten in the AOF} {
+        tiered_spill
+        set digest [r debug digest]
+        r bgrewriteaof
+        waitForBgrewriteaof r
+        r debug loadaof
+        assert_equal $digest [r debug digest]
+    }
+
+    test {Deleting spilled keys releases their space in the file} {
+        tiered_spill
+        for {set j 0} {$j < 2000} {incr j} {
+            r del key:$j
+        }
+        r flushall
+        assert_equal 0 [s tiered_spilled_keys]
+        assert_equal 0 [s tiered_used_bytes]
+    }
+
+    test {Disabling tiered storage loads back all the values} {
+        tiered_populate
+        tiered_spill
+        set digest [r debug digest]
+        r config set tiered-storage no
+        assert_equal 0 [s tiered_spilled_keys]
+        assert_equal $digest [r debug digest]
+        assert_encoding raw key:0
+    }
+}
@@ -419,4 +419,23 @@ start_server {tags {"string"}} {
         r set foo bar
         r getrange foo 0 4294967297
     } {bar}
+
+    test {Big GET replies are not affected by later writes to the key} {
+        # All the replies of a transaction are written after EXEC, so the
+        # first GET reply is still pending while the value is modified.
+        r set foo [string repeat a 100000]
+        r multi
+        r get foo
+        r setrange foo 0 y
+        r append foo z
+        r get foo
+        r flushall async
+        set res [r exec]
+        list [string length [lindex $res 0]] \
+             [string index [lindex $res 0] 0] \
+             [string index [lindex $res 0] end] \
+             [string length [lindex $res 3]] \
+             [string index [lindex $res 3] 0] \
+             [string index [lindex $res 3] end]
+    } {100000 a a 100001 y z}
 }
@@ -0,0 +1,128 @@
+# Replay a synthetic trace of requests against a Redis instance used as a
+# cache, in order to compare the hit ratio of the maxmemory policies.
+#
+# Every request is a GET, followed by a SET of the key if it was a miss.
+# The trace alternates requests of popular keys, following a Zipf
+# distribution, with scans of keys requested just once, that is the access
+# pattern where the admission of allkeys-tinylfu matters.
+#
+# Usage:
+#
+#   tclsh utils/lru/trace-replay.tcl [host] [port] [requests]
+#
+# The instance is flushed and its configuration changed: don't run it
+# against a server holding useful data.
+
+source [file join [file dirname [info script]] ../../tests/support/redis.tcl]
+
+set host [expr {[llength $argv] > 0 ? [lindex $argv 0] : "127.0.0.1"}]
+set port [expr {[llength $argv] > 1 ? [lindex $argv 1] : 6379}]
+set requests [expr {[llength $argv] > 2 ? [lindex $argv 2] : 300000}]
+
+set popular_keys 100000     ;# Keys requested following a Zipf distribution.
+set zipf_exponent 0.9
+set cache_keys 10000        ;# Keys fitting in maxmemory.
+set block 10000             ;# Requests per block...
+set scan_len 2000           ;# ...the last ones of the block are a scan.
+set pipeline 100
+set value [string repeat x 100]
+set policies {allkeys-lru allkeys-lfu allkeys-tinylfu}
+
+# Cumulative distribution of the popular keys, searched with bisection.
+proc zipf_setup {n s} {
+    global zipf_cdf
+    set sum 0.0
+    for {set j 1} {$j <= $n} {incr j} {set sum [expr {$sum+1.0/pow($j,$s)}]}
+    set acc 0.0
+    set zipf_cdf {}
+    for {set j 1} {$j <= $n} {incr j} {
+        set acc [expr {$acc+1.0/pow($j,$s)/$sum}]
+        lappend zipf_cdf $acc
+    }
+}
+
+proc zipf_next {} {
+    global zipf_cdf
+    set r [expr {rand()}]
+    set lo 0
+    set hi [expr {[llength $zipf_cdf]-1}]
+    while {$lo < $hi} {
+        set mid [expr {($lo+$hi)/2}]
+        if {[lindex $zipf_cdf $mid] < $r} {set lo [expr {$mid+1}]} else {set hi $mid}
+    }
+    return "key:$lo"
+}
+
+# The same trace is replayed for every policy.
+proc build_trace {} {
+    global requests block scan_len
+    expr {srand(1)}
+    set trace {}
+    set scanned 0
+    for {set j 0} {$j < $requests} {incr j} {
+        if {$j % $block >= $block-$scan_len} {
+            lappend trace "scan:[incr scanned]"
+        } else {
+            lappend trace [zipf_next]
+        }
+    }
+    return $trace
+}
+
+# Set maxmemory so that about 'cache_keys' keys fit.
+proc setup_maxmemory {r} {
+    global cache_keys value
+    $r config set maxmemory 0
+    $r flushall
+    set base [get_used_memory $r]
+    for {set j 0} {$j < 10000} {incr j} {$r set "key:$j" $value}
+    set perkey [expr {([get_used_memory $r]-$base)/10000.0}]
+    $r flushall
+    $r config set maxmemory [expr {int($base+$perkey*$cache_keys)}]
+}
+
+proc get_used_memory {r} {
+    regexp {used_memory:(\d+)} [$r info memory] -> used
+    return $used
+}
+
+proc replay {r trace} {
+    global pipeline value requests
+    set hits 0
+    set counted 0
+    set warmup [expr {$requests/10}]
+    for {set j 0} {$j < [llength $trace]} {incr j $pipeline} {
+        set batch [lrange $trace $j [expr {$j+$pipeline-1}]]
+        foreach key $batch {$r get $key}
+        set missing {}
+        set i $j
+        foreach key $batch {
+            set reply [$r read]
+            if {$i >= $warmup} {
+                incr counted
+                if {$reply ne {}} {incr hits}
+            }
+            if {$reply eq {}} {lappend missing $key}
+            incr i
+        }
+        foreach key $missing {$r set $key $value}
+        foreach key $missing {$r read}
+    }
+    return [expr {double($hits)/$counted}]
+}
+
+zipf_setup $popular_keys $zipf_exponent
+set trace [build_trace]
+set r [redis $host $port]
+set rd [redis $host $port 1] ;# Deferring client used to pipeline requests.
+foreach policy $policies {
+    $r config set maxmemory-policy $policy
+    setup_maxmemory $r
+    set start [clock milliseconds]
+    set ratio [replay $rd $trace]
+    set elapsed [expr {[clock milliseconds]-$start}]
+    puts [format "%-16s hit ratio %.2f%%  (%d requests, %d ms)" \
+        $policy [expr {$ratio*100}] [llength $trace] $elapsed]
+}
+$r config set maxmemory 0
+$r flushall
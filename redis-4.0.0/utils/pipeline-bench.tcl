@@ -0,0 +1,81 @@
+#!/usr/bin/env tclsh8.5
+# Micro benchmark for the server side parsing of pipelined requests.
+#
+# A pipeline (by default a synthetic mix of SET and GET commands, or a
+# captured one in RESP format, the same used by redis-cli --pipe) is sent
+# in a single burst, then all the replies are read. The server CPU time
+# consumed, as reported by INFO, is printed: most of it is spent parsing
+# the query buffer and calling the commands.
+#
+# Usage: tclsh pipeline-bench.tcl [host] [port] [capture-file]
+#
+# Released under the BSD license like Redis itself
+
+source [file join [file dirname [info script]] ../tests/support/redis.tcl]
+
+set ::host [expr {[llength $argv] > 0 ? [lindex $argv 0] : "127.0.0.1"}]
+set ::port [expr {[llength $argv] > 1 ? [lindex $argv 1] : 6379}]
+set ::capture [expr {[llength $argv] > 2 ? [lindex $argv 2] : ""}]
+set ::commands 200000
+set ::keyspace 10000
+
+proc resp args {
+    set proto "*[llength $args]\r\n"
+    foreach a $args {
+        append proto "\$[string length $a]\r\n$a\r\n"
+    }
+    return $proto
+}
+
+proc synthetic_pipeline {} {
+    set p {}
+    for {set j 0} {$j < $::commands} {incr j} {
+        set key "key:[expr {int(rand()*$::keyspace)}]"
+        if {$j % 2} {
+            append p [resp SET $key [format "value%05d" $j]]
+        } else {
+            append p [resp GET $key]
+        }
+    }
+    return $p
+}
+
+proc server_cpu r {
+    set cpu 0
+    foreach line [split [$r info cpu] "\r\n"] {
+        if {[regexp {^used_cpu_(user|sys):([0-9.]+)} $line -> _ val]} {
+            set cpu [expr {$cpu+$val}]
+        }
+    }
+    return $cpu
+}
+
+if {$::capture ne {}} {
+    set fd [open $::capture]
+    fconfigure $fd -translation binary
+    set pipeline [read $fd]
+    close $fd
+} else {
+    set pipeline [synthetic_pipeline]
+}
+
+# Terminate the pipeline with an ECHO of a random marker, so that we know
+# when we read the last reply without parsing the requests.
+set marker [format "pipeline-bench-%08x" [expr {int(rand()*0x7fffffff)}]]
+append pipeline [resp ECHO $marker]
+
+set r [redis $::host $::port]
+set cpu [server_cpu $r]
+set start [clock milliseconds]
+set fd [$r channel]
+puts -nonewline $fd $pipeline
+flush $fd
+set replies 0
+while {[$r read] ne $marker} {incr replies}
+set elapsed [expr {[clock milliseconds]-$start}]
+set cpu [expr {[server_cpu $r]-$cpu}]
+
+puts "$replies commands, [string length $pipeline] bytes"
+puts [format "server CPU: %.2f sec (%.2f usec per command)" \
+    $cpu [expr {$cpu*1000000/$replies}]]
+puts [format "wall time: %d ms" $elapsed]